@@ -0,0 +1,74 @@
+﻿using BenchmarkDotNet.Attributes;
+using Harp.Protocol;
+using System;
+
+namespace Harp.Benchmarks;
+
+/// <summary>Parses a recorded stream delivered in fragments, the same way <see cref="HarpConnection"/> receives data from a serial port.</summary>
+public class HarpMessageParserBenchmarks
+{
+    /// <summary>The number of bytes delivered by each read, 1 is the worst case of a port with no buffering.</summary>
+    [Params(1, 7, 64, 4096)]
+    public int FragmentSize { get; set; }
+
+    private byte[] Stream = Array.Empty<byte>();
+    private readonly byte[] ReceiveBuffer = new byte[128 * 1024];
+    private readonly byte[] PayloadBuffer = new byte[ushort.MaxValue];
+
+    [GlobalSetup]
+    public void Setup()
+        => Stream = RecordedStream.Load();
+
+    /// <summary>Allocates a <see cref="HarpMessage"/> for every message, like <see cref="HarpConnection"/>'s ordinary transactions.</summary>
+    [Benchmark]
+    public int Consume()
+        => Parse(allocate: true);
+
+    /// <summary>Parses into a reused payload buffer without allocating, like the zero-allocation transaction path.</summary>
+    [Benchmark(Baseline = true)]
+    public int TryConsume()
+        => Parse(allocate: false);
+
+    private int Parse(bool allocate)
+    {
+        HarpMessageParser parser = allocate ? new() : new(PayloadBuffer);
+        int messageCount = 0;
+        int readHead = 0;
+        int writeHead = 0;
+
+        for (int offset = 0; offset < Stream.Length; offset += FragmentSize)
+        {
+            ReadOnlySpan<byte> fragment = Stream.AsSpan(offset, Math.Min(FragmentSize, Stream.Length - offset));
+
+            // Move data back to the start of the buffer if the fragment doesn't fit
+            if (writeHead + fragment.Length > ReceiveBuffer.Length)
+            {
+                ReceiveBuffer.AsSpan(readHead, writeHead - readHead).CopyTo(ReceiveBuffer);
+                writeHead -= readHead;
+                readHead = 0;
+            }
+
+            fragment.CopyTo(ReceiveBuffer.AsSpan(writeHead));
+            writeHead += fragment.Length;
+
+            while (readHead < writeHead)
+            {
+                ReadOnlySpan<byte> buffered = ReceiveBuffer.AsSpan(readHead, writeHead - readHead);
+                int bytesConsumed;
+                bool isComplete = allocate ? parser.Consume(buffered, out bytesConsumed) is not null : parser.TryConsume(buffered, out bytesConsumed);
+                readHead += bytesConsumed;
+
+                if (isComplete)
+                {
+                    messageCount++;
+                    parser.Reset();
+                }
+                // The parser makes no progress when the buffer ends partway through a multi-byte field
+                else if (bytesConsumed == 0)
+                { break; }
+            }
+        }
+
+        return messageCount;
+    }
+}
@@ -0,0 +1,12 @@
+﻿using BenchmarkDotNet.Configs;
+using BenchmarkDotNet.Diagnosers;
+using BenchmarkDotNet.Exporters.Json;
+using BenchmarkDotNet.Running;
+using Harp.Benchmarks;
+
+// Results are written to BenchmarkDotNet.Artifacts/results, the full JSON report includes every measurement so runs can be compared over time
+IConfig config = DefaultConfig.Instance
+    .AddExporter(JsonExporter.Full)
+    .AddDiagnoser(MemoryDiagnoser.Default);
+
+BenchmarkSwitcher.FromAssembly(typeof(Uf2Benchmarks).Assembly).Run(args, config);
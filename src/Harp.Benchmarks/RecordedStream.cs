@@ -0,0 +1,63 @@
+﻿using Harp.Protocol;
+using System;
+using System.Collections.Generic;
+using System.IO;
+
+namespace Harp.Benchmarks;
+
+/// <summary>Provides the bytes a host receives from a Harp device, used as the input for the parser benchmarks.</summary>
+internal static class RecordedStream
+{
+    /// <summary>When set this names a file containing bytes captured from a real device, which are used instead of the generated stream.</summary>
+    /// <remarks>This is read from the environment rather than the command line so that it reaches the processes BenchmarkDotNet runs benchmarks in.</remarks>
+    public const string EnvironmentVariable = "HARP_BENCHMARKS_STREAM";
+
+    public static byte[] Load()
+    {
+        string? filePath = Environment.GetEnvironmentVariable(EnvironmentVariable);
+        return string.IsNullOrEmpty(filePath) ? Generate() : File.ReadAllBytes(filePath);
+    }
+
+    /// <summary>Generates a stream resembling a busy device: mostly timestamped events with the occasional reply and extended-length message.</summary>
+    /// <remarks>The same arguments always produce the same stream.</remarks>
+    public static byte[] Generate(int messageCount = 10_000, int seed = 0)
+    {
+        Random random = new(seed);
+        List<byte> stream = new();
+        byte[] payload = new byte[300];
+        byte[] message = new byte[HarpMessageEncoder.GetEncodedLength(true, payload.Length)];
+        uint seconds = 0;
+        ushort microseconds = 0;
+
+        for (int i = 0; i < messageCount; i++)
+        {
+            // Events are 1ms apart, timestamps count in units of 32 microseconds
+            microseconds += 1000 / 32;
+            if (microseconds >= 1_000_000 / 32)
+            {
+                microseconds -= 1_000_000 / 32;
+                seconds++;
+            }
+            HarpTimestamp timestamp = new(seconds, microseconds);
+
+            int kind = random.Next(100);
+            (MessageType messageType, byte address, PayloadType payloadType, int payloadLength) = kind switch
+            {
+                // Analog inputs
+                < 70 => (MessageType.Event, (byte)44, PayloadType.GetType<short>(true), 3 * sizeof(short)),
+                // Digital inputs
+                < 90 => (MessageType.Event, (byte)32, PayloadType.GetType<byte>(true), sizeof(byte)),
+                // Replies to register reads
+                < 99 => (MessageType.Read, (byte)random.Next(256), PayloadType.GetType<uint>(true), 4 * sizeof(uint)),
+                // Bulk data which needs an extended length
+                _ => (MessageType.Event, (byte)200, PayloadType.GetType<byte>(true), payload.Length),
+            };
+
+            random.NextBytes(payload.AsSpan(0, payloadLength));
+            int length = HarpMessageEncoder.Encode(message, messageType, address, payloadType, timestamp, payload.AsSpan(0, payloadLength));
+            stream.AddRange(message.AsSpan(0, length));
+        }
+
+        return stream.ToArray();
+    }
+}
@@ -0,0 +1,78 @@
+﻿using Harp.Devices.Pico;
+using System;
+using System.Buffers.Binary;
+using System.IO;
+
+namespace Harp.Benchmarks;
+
+public enum Uf2Layout
+{
+    /// <summary>Blocks are in address order, which is how picotool and the Pico SDK write them.</summary>
+    Contiguous,
+    /// <summary>Blocks are in a random order, so views have to sort them.</summary>
+    Shuffled,
+    /// <summary>Only every other flash sector has data, so reads have holes to fill.</summary>
+    Sparse,
+}
+
+/// <summary>Generates UF2 files of pseudo-random data, the same arguments always produce the same file.</summary>
+internal static class SyntheticUf2
+{
+    /// <summary>The payload size used by picotool and elf2uf2.</summary>
+    public const int PayloadSize = 256;
+    private const int BlockSize = 512;
+    private const int SectorSize = 4096;
+
+    /// <param name="sramSize">The number of bytes of data to place in SRAM after the flash data, which makes the memory types of the file mixed.</param>
+    /// <returns>The path of the generated file, it is in a temporary directory and should be deleted once it's no longer needed.</returns>
+    public static string Create(Uf2FamilyId familyId, uint baseAddress, int imageSize, Uf2Layout layout, int sramSize = 0, int seed = 0)
+    {
+        if (imageSize % SectorSize != 0)
+            throw new ArgumentException($"The image size must be a multiple of {SectorSize} bytes.", nameof(imageSize));
+        if (sramSize % PayloadSize != 0)
+            throw new ArgumentException($"The SRAM size must be a multiple of {PayloadSize} bytes.", nameof(sramSize));
+
+        Random random = new(seed);
+        int blocksPerSector = SectorSize / PayloadSize;
+        int flashBlockCount = layout == Uf2Layout.Sparse ? imageSize / SectorSize / 2 * blocksPerSector : imageSize / PayloadSize;
+        int blockCount = flashBlockCount + sramSize / PayloadSize;
+
+        uint[] addresses = new uint[blockCount];
+        for (int i = 0; i < flashBlockCount; i++)
+        {
+            // Sparse images skip every other sector
+            int sector = layout == Uf2Layout.Sparse ? i / blocksPerSector * 2 : i / blocksPerSector;
+            addresses[i] = baseAddress + (uint)(sector * SectorSize + i % blocksPerSector * PayloadSize);
+        }
+
+        for (int i = flashBlockCount; i < blockCount; i++)
+            addresses[i] = PicoMemoryMap.SRAM_START + (uint)((i - flashBlockCount) * PayloadSize);
+
+        if (layout == Uf2Layout.Shuffled)
+            random.Shuffle(addresses);
+
+        string directory = Path.Combine(Path.GetTempPath(), "Harp.Benchmarks");
+        Directory.CreateDirectory(directory);
+        string filePath = Path.Combine(directory, $"{familyId}-{imageSize}-{sramSize}-{layout}-{seed}.uf2");
+
+        using FileStream stream = new(filePath, FileMode.Create, FileAccess.Write);
+        byte[] block = new byte[BlockSize];
+        for (int i = 0; i < blockCount; i++)
+        {
+            Span<byte> span = block;
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(0), Uf2Block.ExpectedMagicStart0);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(4), Uf2Block.ExpectedMagicStart1);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(8), (uint)Uf2Flags.FamilyIdPresent);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(12), addresses[i]);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(16), PayloadSize);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(20), (uint)i);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(24), (uint)blockCount);
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(28), (uint)familyId);
+            random.NextBytes(span.Slice(32, PayloadSize));
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(BlockSize - 4), Uf2Block.ExpectedMagicEnd);
+            stream.Write(block);
+        }
+
+        return filePath;
+    }
+}
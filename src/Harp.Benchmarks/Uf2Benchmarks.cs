@@ -0,0 +1,88 @@
+﻿using BenchmarkDotNet.Attributes;
+using Harp.Devices.Pico;
+using System;
+using System.IO;
+
+namespace Harp.Benchmarks;
+
+/// <summary>Opening UF2 files and building views of them.</summary>
+/// <remarks>RP2350 images are used since its flash window is large enough for the biggest image.</remarks>
+public class Uf2Benchmarks
+{
+    [Params(1, 4, 32)]
+    public int ImageSizeMiB { get; set; }
+
+    [Params(Uf2Layout.Contiguous, Uf2Layout.Shuffled)]
+    public Uf2Layout Layout { get; set; }
+
+    private const Uf2FamilyId FamilyId = Uf2FamilyId.RP2350_ARM_S;
+    private const int LookupCount = 1024;
+
+    private string FilePath = "";
+    private string MixedFilePath = "";
+    private Uf2File File = null!;
+    private Uf2File MixedFile = null!;
+    private Uf2View View = null!;
+    private Uf2View MixedView = null!;
+    private readonly uint[] LookupAddresses = new uint[LookupCount];
+
+    [GlobalSetup]
+    public void Setup()
+    {
+        int imageSize = ImageSizeMiB * 1024 * 1024;
+        FilePath = SyntheticUf2.Create(FamilyId, PicoMemoryMap.FLASH_START, imageSize, Layout);
+        MixedFilePath = SyntheticUf2.Create(FamilyId, PicoMemoryMap.FLASH_START, imageSize, Layout, sramSize: 64 * 1024);
+        File = new Uf2File(FilePath);
+        MixedFile = new Uf2File(MixedFilePath);
+        View = new Uf2View(File, FamilyId);
+        MixedView = new Uf2View(MixedFile, FamilyId);
+
+        Random random = new(0);
+        for (int i = 0; i < LookupAddresses.Length; i++)
+            LookupAddresses[i] = PicoMemoryMap.FLASH_START + (uint)random.Next(imageSize);
+    }
+
+    [GlobalCleanup]
+    public void Cleanup()
+    {
+        File.Dispose();
+        MixedFile.Dispose();
+        System.IO.File.Delete(FilePath);
+        System.IO.File.Delete(MixedFilePath);
+    }
+
+    [Benchmark]
+    public int OpenFile()
+    {
+        using Uf2File file = new(FilePath);
+        return file.FamilyIds.Count;
+    }
+
+    /// <summary>Validates and sorts the blocks of the file.</summary>
+    [Benchmark]
+    public int CreateView()
+        => new Uf2View(File, FamilyId).BlockCount;
+
+    /// <summary>Looks up the block containing each of <see cref="LookupCount"/> random addresses.</summary>
+    [Benchmark(OperationsPerInvoke = LookupCount)]
+    public uint GetBlocks()
+    {
+        uint result = 0;
+        foreach (uint address in LookupAddresses)
+        {
+            foreach (ref readonly Uf2Block block in View.GetBlocks(address, address + 1))
+                result += block.TargetAddress;
+        }
+        return result;
+    }
+
+    /// <summary>The memory types of a flash-only image can be determined from its first and last address.</summary>
+    [Benchmark]
+    public int GetMemoryTypes()
+        => View.GetMemoryTypes().Count;
+
+    /// <summary>Images with data in SRAM as well as flash require every block to be checked.</summary>
+    [Benchmark]
+    public int GetMemoryTypesMixed()
+        => MixedView.GetMemoryTypes().Count;
+}
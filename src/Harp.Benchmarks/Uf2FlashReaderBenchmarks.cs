@@ -0,0 +1,62 @@
+﻿using BenchmarkDotNet.Attributes;
+using Harp.Devices.Pico;
+using System;
+
+namespace Harp.Benchmarks;
+
+/// <summary>Reads the whole of a 4 MiB image through <see cref="Uf2FlashReader"/>.</summary>
+public class Uf2FlashReaderBenchmarks
+{
+    [Params(Uf2Layout.Contiguous, Uf2Layout.Sparse)]
+    public Uf2Layout Layout { get; set; }
+
+    /// <summary>256 bytes is a flash page, 4 KiB is a flash sector.</summary>
+    [Params(256, 4096)]
+    public int ReadSize { get; set; }
+
+    private const int ImageSize = 4 * 1024 * 1024;
+
+    private string FilePath = "";
+    private Uf2File File = null!;
+    private Uf2FlashReader Reader = null!;
+    private byte[] Buffer = Array.Empty<byte>();
+
+    [GlobalSetup]
+    public void Setup()
+    {
+        FilePath = SyntheticUf2.Create(Uf2FamilyId.RP2040, PicoMemoryMap.FLASH_START, ImageSize, Layout);
+        File = new Uf2File(FilePath);
+        Reader = new Uf2FlashReader(new Uf2View(File, Uf2FamilyId.RP2040));
+        Buffer = new byte[ReadSize];
+
+        // The sparse image is built on first use, which isn't what's being measured here
+        Reader.Read(PicoMemoryMap.FLASH_START, Buffer);
+    }
+
+    [GlobalCleanup]
+    public void Cleanup()
+    {
+        File.Dispose();
+        System.IO.File.Delete(FilePath);
+    }
+
+    [Benchmark(Baseline = true)]
+    public byte ReadAligned()
+        => ReadImage(0);
+
+    /// <summary>Every read straddles a page boundary and has to be assembled from two pages.</summary>
+    [Benchmark]
+    public byte ReadUnaligned()
+        => ReadImage(3);
+
+    private byte ReadImage(uint offset)
+    {
+        byte result = 0;
+        for (uint address = PicoMemoryMap.FLASH_START + offset; address + ReadSize <= PicoMemoryMap.FLASH_START + ImageSize; address += (uint)ReadSize)
+        {
+            Reader.Read(address, Buffer);
+            result ^= Buffer[0];
+        }
+        return result;
+    }
+}
@@ -1,4 +1,6 @@
-﻿using Xunit;
+﻿using System.Collections.Immutable;
+using System.Linq;
+using Xunit;
 
 namespace Harp.Devices.Tests;
 
@@ -80,4 +82,23 @@ public sealed class DeviceTests
         device = device.WithMetadataFromUsbDescription(usbDescription);
         Assert.Equal(expectedDescription, device.DeviceDescription);
     }
+
+    [Theory]
+    [InlineData("WhoAmI=1234", new[] { 0, 2 })]
+    [InlineData("whoami=1234", new[] { 0, 2 })]
+    [InlineData("WhoAmI=1401", new[] { 1 })]
+    [InlineData("WhoAmI=42", new int[0])]
+    [InlineData("beef", new[] { 2 })]
+    public void FilterByWhoAmIOrSerialNumber(string targetFilter, int[] expectedIndices)
+    {
+        ImmutableArray<Device> devices =
+        [
+            new() { Source = "Test", WhoAmI = 1234, SerialNumber = 0x1111 },
+            new() { Source = "Test", WhoAmI = 1401, SerialNumber = 0x2222 },
+            new() { Source = "Test", WhoAmI = 1234, SerialNumber = 0xbeef },
+        ];
+
+        ImmutableArray<Device> filtered = devices.Filter(targetFilter);
+        Assert.Equal(expectedIndices.Select(i => devices[i]), filtered);
+    }
 }
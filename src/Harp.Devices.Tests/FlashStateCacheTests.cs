@@ -0,0 +1,130 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using Xunit;
+using static Harp.Devices.Pico.FlashStateCache;
+using static Harp.Devices.Tests.TestUf2;
+
+namespace Harp.Devices.Tests;
+
+public sealed class FlashStateCacheTests : IDisposable
+{
+    private const string Key = "rp2040-0123456789abcdef";
+    private readonly string CacheDirectory = Path.Combine(Path.GetTempPath(), $"Harp.Devices.Tests-{Guid.NewGuid()}");
+    private readonly FlashStateCache Cache;
+
+    public FlashStateCacheTests()
+        => Cache = new FlashStateCache(CacheDirectory);
+
+    public void Dispose()
+    {
+        if (Directory.Exists(CacheDirectory))
+            Directory.Delete(CacheDirectory, recursive: true);
+    }
+
+    private static AddressRange GetSectors(int first, int count)
+        => new(FlashStart + (uint)(first * SectorSize), FlashStart + (uint)((first + count) * SectorSize));
+
+    private static FlashState CreateState(AddressRange range, byte[] data)
+        => new() { Model = model_t.rp2040, Regions = [CreateRegion(range, data)] };
+
+    [Fact]
+    public void OnlyChangedSectorsAreSelected()
+    {
+        AddressRange range = GetSectors(0, 6);
+        byte[] oldData = Pattern(range.Start, (int)range.Size);
+        FlashState confirmedState = CreateState(range, oldData);
+
+        // Sectors 1, 2, and 4 change, the two runs must stay separate so that sector 3 isn't erased
+        byte[] newData = (byte[])oldData.Clone();
+        newData[1 * SectorSize + 7] ^= 0xFF;
+        newData[3 * SectorSize - 1] ^= 0xFF;
+        newData[4 * SectorSize] ^= 0xFF;
+
+        List<AddressRange> changedRanges = GetChangedRanges(confirmedState, range, newData, out Region newRegion);
+        Assert.Equal([GetSectors(1, 2), GetSectors(4, 1)], changedRanges);
+        Assert.Equal(range, newRegion.Range);
+        Assert.Equal(Picoboot.Crc32(newData), newRegion.Crc32);
+
+        Assert.Empty(GetChangedRanges(confirmedState, range, oldData, out _));
+    }
+
+    [Fact]
+    public void SectorsOutsideOfConfirmedStateAreSelected()
+    {
+        byte[] data = Pattern(FlashStart, 4 * SectorSize);
+        FlashState confirmedState = CreateState(GetSectors(0, 2), data.AsSpan(0, 2 * SectorSize).ToArray());
+
+        // The firmware grew by two sectors, nothing is known about what the device contains there
+        List<AddressRange> changedRanges = GetChangedRanges(confirmedState, GetSectors(0, 4), data, out _);
+        Assert.Equal([GetSectors(2, 2)], changedRanges);
+    }
+
+    [Fact]
+    public void EverythingIsSelectedWithoutConfirmedState()
+    {
+        AddressRange range = GetSectors(2, 3);
+        Assert.Equal([range], GetChangedRanges(null, range, Pattern(range.Start, (int)range.Size), out _));
+    }
+
+    [Fact]
+    public void SaveLoadRoundTrip()
+    {
+        Assert.Null(Cache.Load(Key));
+
+        AddressRange first = GetSectors(0, 2);
+        AddressRange second = GetSectors(16, 1);
+        FlashState state = new()
+        {
+            Model = model_t.rp2040,
+            Regions =
+            [
+                CreateRegion(first, Pattern(first.Start, (int)first.Size)),
+                CreateRegion(second, Pattern(second.Start, (int)second.Size)),
+            ],
+        };
+        Cache.Save(Key, state);
+
+        FlashState? loaded = new FlashStateCache(CacheDirectory).Load(Key);
+        Assert.NotNull(loaded);
+        Assert.Equal(state.Model, loaded.Model);
+        Assert.Equal(state.Regions.Count, loaded.Regions.Count);
+        for (int i = 0; i < state.Regions.Count; i++)
+        {
+            Assert.Equal(state.Regions[i].Range, loaded.Regions[i].Range);
+            Assert.Equal(state.Regions[i].Crc32, loaded.Regions[i].Crc32);
+            Assert.Equal(state.Regions[i].SectorHashes, loaded.Regions[i].SectorHashes);
+        }
+
+        Assert.Equal(state.GetSectorHash(second.Start), loaded.GetSectorHash(second.Start));
+        Assert.Null(loaded.GetSectorHash(GetSectors(2, 1).Start));
+    }
+
+    [Fact]
+    public void InvalidatedStateIsForgotten()
+    {
+        // This is what happens when verification fails after writing, the next upload must write everything again
+        AddressRange range = GetSectors(0, 2);
+        byte[] data = Pattern(range.Start, (int)range.Size);
+        Cache.Save(Key, CreateState(range, data));
+        Assert.NotNull(Cache.Load(Key));
+
+        Cache.Invalidate(Key);
+        FlashState? confirmedState = Cache.Load(Key);
+        Assert.Null(confirmedState);
+        Assert.Equal([range], GetChangedRanges(confirmedState, range, data, out _));
+
+        // Invalidating an entry which doesn't exist is harmless
+        Cache.Invalidate(Key);
+    }
+
+    [Fact]
+    public void CorruptEntryIsIgnored()
+    {
+        Directory.CreateDirectory(CacheDirectory);
+        File.WriteAllText(Path.Combine(CacheDirectory, $"{Key}.json"), "{ \"Model\": ");
+        Assert.Null(Cache.Load(Key));
+    }
+}
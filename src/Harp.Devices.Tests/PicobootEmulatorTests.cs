@@ -0,0 +1,87 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Threading;
+using Xunit;
+using static Harp.Devices.Tests.TestUf2;
+
+namespace Harp.Devices.Tests;
+
+public sealed class PicobootEmulatorTests
+{
+    private static picoboot_emulator_config GetFastConfig(model_t model, uint seed)
+    {
+        // Realistic transfer timing so that the pipelined writes of each device overlap, but no multi-second sector erases
+        picoboot_emulator_config config = PicobootEmulator.GetDefaultConfig(model);
+        config.sector_erase_us = 500;
+        config.page_program_us = 20;
+        config.unique_id += seed;
+        config.seed = seed;
+        return config;
+    }
+
+    /// <summary>Uploads to several emulated devices at once like a fleet upload does, each device must end up with exactly its own firmware.</summary>
+    [Theory]
+    [InlineData(model_t.rp2040)]
+    [InlineData(model_t.rp2350)]
+    public void ConcurrentUploads(model_t model)
+    {
+        const int deviceCount = 4;
+        const int flashSize = 16 * SectorSize;
+        const int sramSize = 8 * 1024;
+
+        PicobootEmulator[] emulators = new PicobootEmulator[deviceCount];
+        byte[][] flashData = new byte[deviceCount][];
+        byte[][] sramData = new byte[deviceCount][];
+        Exception?[] failures = new Exception?[deviceCount];
+        Thread[] threads = new Thread[deviceCount];
+        using Barrier start = new(deviceCount);
+
+        try
+        {
+            for (int i = 0; i < deviceCount; i++)
+            {
+                emulators[i] = new PicobootEmulator(GetFastConfig(model, (uint)i));
+                flashData[i] = Pattern(FlashStart, flashSize, salt: (byte)(i + 1));
+                sramData[i] = Pattern(SramStart, sramSize, salt: (byte)(0x80 + i));
+
+                int index = i;
+                threads[i] = new Thread(() =>
+                {
+                    try
+                    {
+                        using PicobootDevice device = emulators[index].Open();
+                        start.SignalAndWait();
+                        device.ProgramRegion(FlashStart, flashData[index]);
+                        device.ProgramRegion(SramStart, sramData[index]);
+                    }
+                    catch (Exception ex)
+                    { failures[index] = ex; }
+                });
+            }
+
+            foreach (Thread thread in threads)
+                thread.Start();
+            foreach (Thread thread in threads)
+                thread.Join();
+
+            for (int i = 0; i < deviceCount; i++)
+            {
+                Assert.Null(failures[i]);
+
+                byte[] actual = new byte[flashSize];
+                emulators[i].ReadMemory(FlashStart, actual);
+                Assert.Equal(flashData[i], actual);
+
+                actual = new byte[sramSize];
+                emulators[i].ReadMemory(SramStart, actual);
+                Assert.Equal(sramData[i], actual);
+            }
+        }
+        finally
+        {
+            foreach (PicobootEmulator? emulator in emulators)
+                emulator?.Dispose();
+        }
+    }
+}
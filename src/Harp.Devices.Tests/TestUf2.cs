@@ -0,0 +1,63 @@
+﻿using Harp.Devices.Pico;
+using System;
+using System.Buffers.Binary;
+using System.IO;
+
+namespace Harp.Devices.Tests;
+
+/// <summary>A UF2 file written to a temporary location for the duration of a test.</summary>
+internal sealed class TestUf2 : IDisposable
+{
+    public const uint FlashStart = 0x10000000;
+    public const uint SramStart = 0x20000000;
+    public const int SectorSize = 4096;
+
+    private readonly string FilePath;
+    public Uf2File File { get; }
+    public Uf2View View { get; }
+
+    /// <param name="blocks">The address and payload of each block, in file order.</param>
+    public TestUf2(Uf2FamilyId familyId, params (uint Address, byte[] Data)[] blocks)
+    {
+        FilePath = Path.Combine(Path.GetTempPath(), $"Harp.Devices.Tests-{Guid.NewGuid()}.uf2");
+
+        byte[] block = new byte[512];
+        using (FileStream stream = new(FilePath, FileMode.CreateNew, FileAccess.Write))
+        {
+            for (int i = 0; i < blocks.Length; i++)
+            {
+                Span<byte> span = block;
+                span.Clear();
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(0), Uf2Block.ExpectedMagicStart0);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(4), Uf2Block.ExpectedMagicStart1);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(8), (uint)Uf2Flags.FamilyIdPresent);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(12), blocks[i].Address);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(16), (uint)blocks[i].Data.Length);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(20), (uint)i);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(24), (uint)blocks.Length);
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(28), (uint)familyId);
+                blocks[i].Data.CopyTo(span.Slice(32));
+                BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(512 - 4), Uf2Block.ExpectedMagicEnd);
+                stream.Write(block);
+            }
+        }
+
+        File = new Uf2File(FilePath);
+        View = new Uf2View(File, familyId);
+    }
+
+    /// <summary>Creates a payload whose bytes are derived from their address, so misplaced data is easy to spot.</summary>
+    public static byte[] Pattern(uint address, int length, byte salt = 0)
+    {
+        byte[] result = new byte[length];
+        for (int i = 0; i < length; i++)
+            result[i] = (byte)(((address + (uint)i) * 31 >> 3) ^ salt);
+        return result;
+    }
+
+    public void Dispose()
+    {
+        File.Dispose();
+        System.IO.File.Delete(FilePath);
+    }
+}
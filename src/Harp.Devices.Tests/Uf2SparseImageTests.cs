@@ -0,0 +1,167 @@
+﻿using Harp.Devices.Pico;
+using System;
+using System.Collections.Generic;
+using Xunit;
+using static Harp.Devices.Tests.TestUf2;
+
+namespace Harp.Devices.Tests;
+
+public sealed class Uf2SparseImageTests
+{
+    private const int PageSize = Uf2SparseImage.PageSize;
+
+    /// <summary>Builds what a read of <paramref name="range"/> should return the naive way, one byte at a time with holes left as zero.</summary>
+    private static byte[] GetExpected(AddressRange range, params (uint Address, byte[] Data)[] blocks)
+    {
+        byte[] result = new byte[range.Size];
+        foreach ((uint address, byte[] data) in blocks)
+        {
+            for (int i = 0; i < data.Length; i++)
+            {
+                if (range.Contains(address + (uint)i))
+                    result[address + (uint)i - range.Start] = data[i];
+            }
+        }
+        return result;
+    }
+
+    [Fact]
+    public void PageCoveredByOneBlockIsFull()
+    {
+        (uint, byte[])[] blocks = [(FlashStart, Pattern(FlashStart, PageSize))];
+        using TestUf2 uf2 = new(Uf2FamilyId.RP2040, blocks);
+        Uf2SparseImage image = uf2.View.Image;
+
+        Assert.Equal(1, image.PageCount);
+        Assert.True(image.ContainsPage(FlashStart + PageSize - 1));
+        Assert.False(image.ContainsPage(FlashStart + PageSize));
+
+        Assert.True(image.TryGetFullPage(FlashStart + 10, out ReadOnlySpan<byte> page));
+        Assert.Equal(GetExpected(new AddressRange(FlashStart, FlashStart + PageSize), blocks), page);
+        Assert.False(image.TryGetFullPage(FlashStart + PageSize, out _));
+    }
+
+    [Fact]
+    public void PageComposedFromSeveralBlocksIsFull()
+    {
+        // Blocks are deliberately out of order in the file
+        (uint, byte[])[] blocks =
+        [
+            (FlashStart + 100, Pattern(FlashStart + 100, PageSize - 100)),
+            (FlashStart, Pattern(FlashStart, 100)),
+        ];
+        using TestUf2 uf2 = new(Uf2FamilyId.RP2040, blocks);
+        Uf2SparseImage image = uf2.View.Image;
+
+        Assert.Equal(1, image.PageCount);
+        Assert.True(image.TryGetFullPage(FlashStart, out ReadOnlySpan<byte> page));
+        Assert.Equal(GetExpected(new AddressRange(FlashStart, FlashStart + PageSize), blocks), page);
+    }
+
+    [Fact]
+    public void PageWithHoleIsNotFull()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (FlashStart, Pattern(FlashStart, 100)),
+            (FlashStart + 101, Pattern(FlashStart + 101, PageSize - 101))
+        );
+        Uf2SparseImage image = uf2.View.Image;
+
+        Assert.True(image.ContainsPage(FlashStart));
+        Assert.False(image.TryGetFullPage(FlashStart, out _));
+        Assert.Equal([new AddressRange(FlashStart + 100, FlashStart + 101)], image.GetHoles(new AddressRange(FlashStart, FlashStart + PageSize)));
+    }
+
+    [Fact]
+    public void BlockSpanningPagesIsSplit()
+    {
+        // Payloads larger than a page (up to 476 bytes) are allowed, and they needn't be page-aligned
+        (uint, byte[])[] blocks = [(FlashStart + 200, Pattern(FlashStart + 200, 476))];
+        using TestUf2 uf2 = new(Uf2FamilyId.RP2040, blocks);
+        Uf2SparseImage image = uf2.View.Image;
+
+        Assert.Equal(3, image.PageCount);
+        Assert.False(image.TryGetFullPage(FlashStart, out _));
+        Assert.True(image.TryGetFullPage(FlashStart + PageSize, out ReadOnlySpan<byte> page));
+        Assert.Equal(GetExpected(new AddressRange(FlashStart + PageSize, FlashStart + 2 * PageSize), blocks), page);
+        Assert.False(image.TryGetFullPage(FlashStart + 2 * PageSize, out _));
+    }
+
+    [Theory]
+    [InlineData(0, 0x1100)]
+    [InlineData(0x100, 0x80)]
+    [InlineData(0x17F, 0x42)]
+    [InlineData(0x1000, 0x100)]
+    [InlineData(0x2000, 0x10)] // Nothing but hole
+    public void HolesAreFilledWithZero(int offset, int length)
+    {
+        (uint, byte[])[] blocks =
+        [
+            (FlashStart, Pattern(FlashStart, PageSize)),
+            (FlashStart + 0x180, Pattern(FlashStart + 0x180, 64)),
+            (FlashStart + 0x1000 + 10, Pattern(FlashStart + 0x1000 + 10, 20)),
+            (FlashStart + 0x1000 + 40, Pattern(FlashStart + 0x1000 + 40, 300)),
+        ];
+        using TestUf2 uf2 = new(Uf2FamilyId.RP2040, blocks);
+        AddressRange range = new(FlashStart + (uint)offset, FlashStart + (uint)(offset + length));
+        byte[] expected = GetExpected(range, blocks);
+
+        byte[] actual = new byte[length];
+        uf2.View.Image.Read(range.Start, actual, fillHolesWithZero: true);
+        Assert.Equal(expected, actual);
+
+        // The flash reader used to inspect firmware must see exactly the same thing
+        Uf2FlashReader reader = new(uf2.View);
+        Array.Fill(actual, (byte)0xCC);
+        reader.Read(range.Start, actual);
+        Assert.Equal(expected, actual);
+    }
+
+    [Fact]
+    public void ReadingHoleThrowsUnlessFilled()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (FlashStart, Pattern(FlashStart, PageSize)),
+            (FlashStart + PageSize + 16, Pattern(FlashStart + PageSize + 16, 16))
+        );
+        Uf2FlashReader reader = new(uf2.View);
+        byte[] buffer = new byte[PageSize];
+
+        // Fully covered reads are fine either way
+        reader.Read(FlashStart, buffer, fillHolesWithZero: false);
+        reader.Read(FlashStart + PageSize + 16, buffer.AsSpan(0, 16), fillHolesWithZero: false);
+
+        // Missing pages and holes within composed pages are both rejected
+        Assert.Throws<InvalidOperationException>(() => reader.Read(FlashStart + 2 * PageSize, buffer, fillHolesWithZero: false));
+        Assert.Throws<InvalidOperationException>(() => reader.Read(FlashStart + PageSize, buffer.AsSpan(0, 32), fillHolesWithZero: false));
+        Assert.Throws<InvalidOperationException>(() => reader.Read(FlashStart + PageSize - 4, buffer.AsSpan(0, 8), fillHolesWithZero: false));
+    }
+
+    [Fact]
+    public void GetHolesFindsEveryHole()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (FlashStart + 0x10, Pattern(FlashStart + 0x10, 0x20)),
+            (FlashStart + PageSize, Pattern(FlashStart + PageSize, PageSize)),
+            (FlashStart + 4 * PageSize, Pattern(FlashStart + 4 * PageSize, 0x40))
+        );
+
+        List<AddressRange> holes = uf2.View.Image.GetHoles(new AddressRange(FlashStart, FlashStart + 5 * PageSize));
+        Assert.Equal
+        (
+            [
+                new AddressRange(FlashStart, FlashStart + 0x10),
+                new AddressRange(FlashStart + 0x30, FlashStart + PageSize),
+                new AddressRange(FlashStart + 2 * PageSize, FlashStart + 4 * PageSize),
+                new AddressRange(FlashStart + 4 * PageSize + 0x40, FlashStart + 5 * PageSize),
+            ],
+            holes
+        );
+    }
+}
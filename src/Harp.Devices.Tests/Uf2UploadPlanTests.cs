@@ -0,0 +1,101 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using Xunit;
+using static Harp.Devices.Tests.TestUf2;
+
+namespace Harp.Devices.Tests;
+
+public sealed class Uf2UploadPlanTests
+{
+    [Fact]
+    public void SparseRangesInOneSectorProduceOneRegion()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (FlashStart + 0x100, Pattern(FlashStart + 0x100, 0x100)),
+            (FlashStart + 0x800, Pattern(FlashStart + 0x800, 0x100))
+        );
+        Uf2UploadPlan plan = Uf2UploadPlan.Compile(uf2.View, model_t.rp2040);
+
+        Uf2UploadPlan.Region region = Assert.Single(plan.Regions);
+        Assert.Equal(memory_type.flash, region.MemoryType);
+        Assert.Equal(new AddressRange(FlashStart, FlashStart + SectorSize), region.Range);
+        Assert.Equal((ulong)SectorSize, plan.TotalSize);
+
+        // Everything outside of the UF2's data is padded with zeros
+        byte[] expected = new byte[SectorSize];
+        Pattern(FlashStart + 0x100, 0x100).CopyTo(expected, 0x100);
+        Pattern(FlashStart + 0x800, 0x100).CopyTo(expected, 0x800);
+        Assert.Equal(expected, region.ToArray());
+    }
+
+    [Fact]
+    public void AdjacentSectorsAreMerged()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (FlashStart + SectorSize - 0x100, Pattern(FlashStart + SectorSize - 0x100, 0x100)),
+            (FlashStart + SectorSize + 0x200, Pattern(FlashStart + SectorSize + 0x200, 0x100)),
+            (FlashStart + 2 * SectorSize, Pattern(FlashStart + 2 * SectorSize, 0x100)),
+            // Separated from the others by an empty sector, which must be left alone
+            (FlashStart + 4 * SectorSize, Pattern(FlashStart + 4 * SectorSize, 0x100))
+        );
+        Uf2UploadPlan plan = Uf2UploadPlan.Compile(uf2.View, model_t.rp2040);
+
+        Assert.Collection
+        (
+            plan.Regions,
+            r => Assert.Equal(new AddressRange(FlashStart, FlashStart + 3 * SectorSize), r.Range),
+            r => Assert.Equal(new AddressRange(FlashStart + 4 * SectorSize, FlashStart + 5 * SectorSize), r.Range)
+        );
+        Assert.All(plan.Regions, r => Assert.Equal(memory_type.flash, r.MemoryType));
+        Assert.Equal((ulong)(4 * SectorSize), plan.TotalSize);
+    }
+
+    [Fact]
+    public void FlashRegionsComeBeforeSram()
+    {
+        using TestUf2 uf2 = new
+        (
+            Uf2FamilyId.RP2040,
+            (SramStart, Pattern(SramStart, 0x100)),
+            (FlashStart, Pattern(FlashStart, 0x100)),
+            (SramStart + 0x1000, Pattern(SramStart + 0x1000, 0x80)),
+            (FlashStart + 8 * SectorSize, Pattern(FlashStart + 8 * SectorSize, 0x100))
+        );
+        Uf2UploadPlan plan = Uf2UploadPlan.Compile(uf2.View, model_t.rp2040);
+
+        Assert.Collection
+        (
+            plan.Regions,
+            r => Assert.Equal(new AddressRange(FlashStart, FlashStart + SectorSize), r.Range),
+            r => Assert.Equal(new AddressRange(FlashStart + 8 * SectorSize, FlashStart + 9 * SectorSize), r.Range),
+            // SRAM is written exactly as it appears in the UF2, without any alignment
+            r => Assert.Equal(new AddressRange(SramStart, SramStart + 0x100), r.Range),
+            r => Assert.Equal(new AddressRange(SramStart + 0x1000, SramStart + 0x1080), r.Range)
+        );
+        Assert.Equal(memory_type.flash, plan.Regions[1].MemoryType);
+        Assert.Equal(memory_type.sram, plan.Regions[2].MemoryType);
+        Assert.Equal(Pattern(SramStart + 0x1000, 0x80), plan.Regions[3].ToArray());
+    }
+
+    [Theory]
+    [InlineData(0x0000, 0x1000, 0x0000, 0x1000)]
+    [InlineData(0x1000, 0x3000, 0x1000, 0x3000)]
+    [InlineData(0x0100, 0x1000, 0x0000, 0x1000)] // Aligned end, unaligned start
+    [InlineData(0x1000, 0x1001, 0x1000, 0x2000)]
+    [InlineData(0x0FFF, 0x1001, 0x0000, 0x2000)]
+    public void GetAligned(uint start, uint end, uint expectedStart, uint expectedEnd)
+        => Assert.Equal
+        (
+            new AddressRange(FlashStart + expectedStart, FlashStart + expectedEnd),
+            new AddressRange(FlashStart + start, FlashStart + end).GetAligned(SectorSize)
+        );
+
+    [Fact]
+    public void GetAlignedRejectsNonPowerOfTwo()
+        => Assert.Throws<ArgumentException>(() => new AddressRange(FlashStart, FlashStart + 1).GetAligned(3000));
+}
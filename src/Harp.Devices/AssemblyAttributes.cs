@@ -1,3 +1,5 @@
 ﻿using System.Runtime.CompilerServices;
 
 [assembly: DisableRuntimeMarshalling]
+[assembly: InternalsVisibleTo("Harp.Benchmarks")]
+[assembly: InternalsVisibleTo("Harp.Simulator")]
\ No newline at end of file
@@ -6,8 +6,11 @@ using System.Collections.Immutable;
 using System.Diagnostics;
 using System.IO;
 using System.IO.Ports;
+using System.Runtime.ExceptionServices;
+using System.Runtime.InteropServices;
 using System.Text;
 using System.Text.Json.Serialization;
+using System.Threading;
 
 namespace Harp.Devices;
 
@@ -140,7 +143,7 @@ public sealed partial record Device
         Debug.Assert(State is DeviceState.Online or DeviceState.Unknown); // We don't expect other states to reach this method
 
         // Used to improve exception messages
-        CommonRegister? currentlyReading = null;
+        string? currentlyReading = null;
 
         bool ownsConnection = false;
         try
@@ -155,42 +158,84 @@ public sealed partial record Device
                 );
             }
 
-            HarpMessage<T>? ReadRegisterOrNull<T>(CommonRegister register, int minimumLength = 1)
+            HarpMessage<T>? ValidateResponse<T>(CommonRegister register, HarpMessage? response, int minimumLength = 1)
                 where T : unmanaged
             {
-                currentlyReading = register;
-                HarpMessage<T> response = harp.Read<T>(register);
-                currentlyReading = null;
-                if (!response.IsValid)
+                if (response is null)
+                    Trace.WriteLine($"Got no response when trying to read {register} from {PortName}");
+                else if (!response.IsValid)
                     Trace.WriteLine($"Got an invalid repsonse when trying to read {register} from {PortName}");
                 else if (response.MessageType != MessageType.Read)
                     Trace.WriteLine($"Got {response.MessageType} response when trying to read {register} from {PortName}");
-                else if (response.Payload.Length < minimumLength)
-                    Trace.WriteLine($"Got response with less than {minimumLength} element(s) when reading {register} from {PortName}");
-                else if (response.PayloadType.Type != typeof(T))
+                else if (response is not HarpMessage<T> typedResponse)
                     Trace.WriteLine($"Expected {PayloadType.GetType<T>()} but got {response.PayloadType} when reading {register} from {PortName}");
+                else if (typedResponse.Payload.Length < minimumLength)
+                    Trace.WriteLine($"Got response with less than {minimumLength} element(s) when reading {register} from {PortName}");
                 else
-                    return response;
+                    return typedResponse;
                 return null;
             }
 
-            T? ReadRegisterValueOrNull<T>(CommonRegister register)
+            ushort? whoAmI = WhoAmI;
+            if (whoAmI is null)
+            {
+                currentlyReading = CommonRegister.R_WHO_AM_I.ToString();
+                whoAmI = ValidateResponse<ushort>(CommonRegister.R_WHO_AM_I, harp.Read<ushort>(CommonRegister.R_WHO_AM_I))?.Payload[0];
+                currentlyReading = null;
+            }
+
+            // Every Harp device implements R_WHO_AM_I, if it didn't answer there's no point waiting on the remaining registers
+            // (It's read on its own so that devices which aren't Harp devices only ever receive a single request)
+            if (whoAmI is null)
+            {
+                Trace.WriteLine($"{PortName} did not provide a valid {CommonRegister.R_WHO_AM_I}, assuming it is not a Harp device.");
+                return this;
+            }
+
+            // The remaining registers are read as a single batch so that they cost one round trip rather than one each
+            List<(byte Register, PayloadType PayloadType)> batch = new(4);
+            void Request<T>(CommonRegister register)
                 where T : unmanaged
-                => ReadRegisterOrNull<T>(register)?.Payload[0];
+                => batch.Add(((byte)register, PayloadType.GetType<T>()));
 
-            ushort? whoAmI = WhoAmI ?? ReadRegisterValueOrNull<ushort>(CommonRegister.R_WHO_AM_I);
+            if (FirmwareVersion is null)
+            {
+                Request<byte>(CommonRegister.R_FW_VERSION_H);
+                Request<byte>(CommonRegister.R_FW_VERSION_L);
+            }
+
+            if (DeviceDescription is null)
+                Request<byte>(CommonRegister.R_DEVICE_NAME);
+
+            if (SerialNumber is null)
+                Request<ushort>(CommonRegister.R_SERIAL_NUMBER);
+
+            currentlyReading = "device metadata";
+            HarpMessage?[] responses = harp.ReadMany(CollectionsMarshal.AsSpan(batch));
+            currentlyReading = null;
+
+            HarpMessage<T>? GetResponse<T>(CommonRegister register, int minimumLength = 1)
+                where T : unmanaged
+            {
+                int index = batch.FindIndex(request => request.Register == (byte)register);
+                return index < 0 ? null : ValidateResponse<T>(register, responses[index], minimumLength);
+            }
+
+            T? GetResponseValue<T>(CommonRegister register)
+                where T : unmanaged
+                => GetResponse<T>(register)?.Payload[0];
 
             HarpVersion? firmwareVersion = FirmwareVersion;
             if (firmwareVersion is null
-                && ReadRegisterValueOrNull<byte>(CommonRegister.R_FW_VERSION_H) is byte versionMajor
-                && ReadRegisterValueOrNull<byte>(CommonRegister.R_FW_VERSION_L) is byte versionMinor)
+                && GetResponseValue<byte>(CommonRegister.R_FW_VERSION_H) is byte versionMajor
+                && GetResponseValue<byte>(CommonRegister.R_FW_VERSION_L) is byte versionMinor)
             {
                 firmwareVersion = new HarpVersion(versionMajor, versionMinor, 0);
             }
 
             string? deviceDescription = DeviceDescription;
             {
-                if (deviceDescription is null && ReadRegisterOrNull<byte>(CommonRegister.R_DEVICE_NAME, minimumLength: 0) is HarpMessage<byte> response)
+                if (deviceDescription is null && GetResponse<byte>(CommonRegister.R_DEVICE_NAME, minimumLength: 0) is HarpMessage<byte> response)
                 {
                     ReadOnlySpan<byte> deviceName = response.Payload.SliceNullTerminated(0);
                     if (deviceName.Length > 0)
@@ -199,7 +244,7 @@ public sealed partial record Device
             }
 
             ulong? serialNumber = SerialNumber;
-            if (serialNumber is null && ReadRegisterValueOrNull<ushort>(CommonRegister.R_SERIAL_NUMBER) is ushort harpSerialNumber)
+            if (serialNumber is null && GetResponseValue<ushort>(CommonRegister.R_SERIAL_NUMBER) is ushort harpSerialNumber)
             {
                 switch (harpSerialNumber)
                 {
@@ -231,7 +276,7 @@ public sealed partial record Device
         }
         catch (TimeoutException)
         {
-            Trace.WriteLine($"Timed out while trying to read {currentlyReading?.ToString() ?? "???"} from {PortName}");
+            Trace.WriteLine($"Timed out while trying to read {currentlyReading ?? "???"} from {PortName}");
             return this;
         }
         catch (Exception ex) when (ex is IOException or UnauthorizedAccessException)
@@ -281,17 +326,25 @@ public sealed partial record Device
         return result;
     }
 
+    /// <summary>The default number of devices <see cref="EnumerateDevices"/> will connect to at once.</summary>
+    public const int DefaultMaxParallelConnections = 8;
+
     /// <summary>Enumerates devices connected to the system</summary>
     /// <param name="allowConnection">If specified, devices at the specified confidence level or above have missing metadata populated using the Harp protocol.</param>
-    public static ImmutableArray<Device> EnumerateDevices(DeviceConfidence? allowConnection)
+    /// <param name="maxParallelConnections">The maximum number of devices to connect to at once when <paramref name="allowConnection"/> is specified.</param>
+    /// <param name="metadataCache">
+    /// Optional cache used to avoid re-querying devices which were seen by a previous enumeration, see <see cref="DeviceMetadataCache"/>.
+    /// BOOTSEL devices resolved from the cache are not opened, so they won't have a <see cref="PicobootDevice"/>.
+    /// </param>
+    public static ImmutableArray<Device> EnumerateDevices(DeviceConfidence? allowConnection, int maxParallelConnections = DefaultMaxParallelConnections, DeviceMetadataCache? metadataCache = null)
     {
         ImmutableArray<Device>.Builder builder = ImmutableArray.CreateBuilder<Device>();
 
         // Enumerate Harp devices directly if possible
         if (OperatingSystem.IsWindows())
-            WindowsDeviceEnumerator.EnumerateDevices(builder);
+            WindowsDeviceEnumerator.EnumerateDevices(builder, metadataCache);
         else if (OperatingSystem.IsLinux())
-            LinuxDeviceEnumerator.EnumerateDevices(builder);
+            LinuxDeviceEnumerator.EnumerateDevices(builder, metadataCache);
         else
             Trace.WriteLine("Warning: Support for enumerating Harp devices via USB descriptors is not implemneted on this platform.");
 
@@ -308,21 +361,80 @@ public sealed partial record Device
 
         // Connect to online Harp devices to fill in missing information (if applicable)
         if (allowConnection is DeviceConfidence connectionFilter)
+            PopulateMetadataFromHarpProtocol(builder, d => d.Confidence >= connectionFilter, maxParallelConnections);
+
+        return builder.ToImmutable();
+    }
+
+    /// <summary>Connects to the selected devices to fill in missing information via the Harp protocol.</summary>
+    /// <param name="devices">The devices to update, each device is replaced in place so their order is preserved.</param>
+    /// <param name="shouldConnect">Selects which devices to connect to, devices without a serial port are always skipped.</param>
+    /// <param name="maxParallelConnections">The maximum number of devices to communicate with at once.</param>
+    /// <returns>The number of devices which were updated.</returns>
+    /// <remarks>
+    /// Silent ports take the entire timeout to give up on, so connecting to them one at a time means the time to enumerate grows with every port on the system.
+    /// Each device is probed on its own thread rather than the thread pool since the serial port APIs block and we'd otherwise be at the mercy of thread injection.
+    /// </remarks>
+    public static int PopulateMetadataFromHarpProtocol(ImmutableArray<Device>.Builder devices, Predicate<Device> shouldConnect, int maxParallelConnections = DefaultMaxParallelConnections)
+    {
+        ArgumentOutOfRangeException.ThrowIfNegativeOrZero(maxParallelConnections);
+
+        List<int> indices = new();
+        for (int i = 0; i < devices.Count; i++)
         {
-            for (int i = 0; i < builder.Count; i++)
-            {
-                Device device = builder[i];
-                if (device.PortName is null)
-                    continue;
+            if (devices[i].PortName is not null && shouldConnect(devices[i]))
+                indices.Add(i);
+        }
 
-                if (device.Confidence < connectionFilter)
-                    continue;
+        if (indices.Count == 0)
+            return 0;
 
+        Device[] results = new Device[indices.Count];
+        int nextWorkItem = -1;
+        ExceptionDispatchInfo? firstException = null;
+        void ProbeWorker()
+        {
+            int workItem;
+            while ((workItem = Interlocked.Increment(ref nextWorkItem)) < indices.Count)
+            {
+                Device device = devices[indices[workItem]];
                 Trace.WriteLine($"Populating {device.PortName}'s metadata via Harp registers.");
-                builder[i] = device.WithMetadataFromHarpProtocol();
+                try
+                { results[workItem] = device.WithMetadataFromHarpProtocol(); }
+                catch (Exception ex)
+                {
+                    // Unexpected exceptions are rethrown on the calling thread once all workers finish
+                    Interlocked.CompareExchange(ref firstException, ExceptionDispatchInfo.Capture(ex), null);
+                    results[workItem] = device;
+                }
             }
         }
 
-        return builder.ToImmutable();
+        int threadCount = Math.Min(maxParallelConnections, indices.Count);
+        Thread[] threads = new Thread[threadCount - 1];
+        for (int i = 0; i < threads.Length; i++)
+        {
+            threads[i] = new Thread(ProbeWorker) { IsBackground = true, Name = $"Harp metadata probe #{i}" };
+            threads[i].Start();
+        }
+
+        // The calling thread does its share of the work rather than sitting idle
+        ProbeWorker();
+        foreach (Thread thread in threads)
+            thread.Join();
+
+        firstException?.Throw();
+
+        int updatedCount = 0;
+        for (int i = 0; i < indices.Count; i++)
+        {
+            if (results[i] == devices[indices[i]])
+                continue;
+
+            devices[indices[i]] = results[i];
+            updatedCount++;
+        }
+
+        return updatedCount;
     }
 }
@@ -33,6 +33,10 @@ public static class DeviceFilterExtensions
         if (targetFilter.Equals("PICOBOOT", StringComparison.OrdinalIgnoreCase))
             return devices.Filter(d => d.State == DeviceState.Bootloader);
 
+        const string whoAmIPrefix = "WhoAmI=";
+        if (targetFilter.StartsWith(whoAmIPrefix, StringComparison.OrdinalIgnoreCase) && ushort.TryParse(targetFilter.AsSpan(whoAmIPrefix.Length), out ushort whoAmI))
+            return devices.Filter(d => d.WhoAmI == whoAmI);
+
         return devices.Filter
         (
             (device) =>
@@ -0,0 +1,156 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Diagnostics.CodeAnalysis;
+
+namespace Harp.Devices;
+
+/// <summary>Remembers metadata which is expensive to gather so that long-running processes can re-enumerate devices cheaply.</summary>
+/// <remarks>
+/// Currently this only covers Picoboot devices, where getting the unique ID and firmware info requires executing code on the device and reading its flash.
+/// Entries are keyed by the VID, PID, and serial number from the USB descriptor, which the OS reports without the device being opened.
+/// When an entry exists the device is not opened at all, so enumerating doesn't interfere with other processes using it.
+/// Devices without a serial number cannot be cached and are never opened.
+///
+/// Opening a device which wasn't cached can be deferred using <see cref="OpenDelay"/>. Another process which just rebooted a device into BOOTSEL mode
+/// (IE: to upload to it) will have opened it by the time the delay elapses, in which case our attempt fails harmlessly and is retried later.
+///
+/// Entries are removed once a device stops appearing in enumerations, so firmware uploaded while the device was away is noticed when it returns.
+///
+/// This type is thread-safe.
+/// </remarks>
+public sealed class DeviceMetadataCache
+{
+    private readonly Dictionary<string, Device> Entries = new();
+    // Devices which aren't cached yet, and the timestamp after which they may be opened
+    private readonly Dictionary<string, long> Deferred = new();
+    private readonly HashSet<string> UsedKeys = new();
+    private readonly object Lock = new();
+
+    /// <summary>How long a device must have been present before it is opened to populate its metadata.</summary>
+    public TimeSpan OpenDelay { get; init; } = TimeSpan.Zero;
+
+    public int Count
+    {
+        get
+        {
+            lock (Lock)
+                return Entries.Count;
+        }
+    }
+
+    /// <summary>True if a device which was deferred due to <see cref="OpenDelay"/> may now be opened, IE: the caller should enumerate again.</summary>
+    public bool HasDeferredDevicesReady
+    {
+        get
+        {
+            long now = Stopwatch.GetTimestamp();
+            lock (Lock)
+            {
+                foreach (long notBefore in Deferred.Values)
+                {
+                    if (now >= notBefore)
+                        return true;
+                }
+                return false;
+            }
+        }
+    }
+
+    /// <summary>Resolves the metadata of a device in BOOTSEL mode without opening it.</summary>
+    /// <param name="key">The key from <see cref="GetKey"/>, or null if the device doesn't have one.</param>
+    /// <param name="resolved">The cached device (with the <see cref="Device.Source"/> of <paramref name="device"/>), or <paramref name="device"/> as-is if the device must not be opened.</param>
+    /// <returns>False if the caller should open the device to populate its metadata and then call <see cref="Add"/>.</returns>
+    internal bool TryResolve(string? key, Device device, out Device resolved)
+    {
+        resolved = device;
+        if (key is null)
+        {
+            Trace.WriteLine($"'{device.Source}' has no serial number, so its details can't be cached and it will not be opened.");
+            return true;
+        }
+
+        lock (Lock)
+        {
+            UsedKeys.Add(key);
+            if (Entries.TryGetValue(key, out Device? cached))
+            {
+                Trace.WriteLine($"Using cached details for '{device.Source}'.");
+                resolved = cached with { Source = device.Source };
+                return true;
+            }
+
+            long now = Stopwatch.GetTimestamp();
+            long delay = (long)(OpenDelay.TotalSeconds * Stopwatch.Frequency);
+            if (!Deferred.TryGetValue(key, out long notBefore))
+            {
+                notBefore = now + delay;
+                Deferred.Add(key, notBefore);
+            }
+
+            if (now < notBefore)
+            {
+                Trace.WriteLine($"Deferring opening '{device.Source}' in case another process is using it.");
+                return true;
+            }
+
+            // If opening the device fails (IE: because another process has it open) the next attempt is deferred again
+            Deferred[key] = now + delay;
+            return false;
+        }
+    }
+
+    internal void Add(string key, Device device)
+    {
+        lock (Lock)
+        {
+            Entries[key] = device with { PicobootDevice = null };
+            Deferred.Remove(key);
+            UsedKeys.Add(key);
+        }
+    }
+
+    /// <summary>Gets the cache key for a USB device.</summary>
+    /// <returns>The key, or null if the device has no serial number.</returns>
+    internal static string? GetKey(ushort vendorId, ushort productId, string? serialNumber)
+        => String.IsNullOrEmpty(serialNumber) ? null : $"{vendorId:X4}:{productId:X4}:{serialNumber.ToUpperInvariant()}";
+
+    /// <summary>Removes entries which weren't used since the previous call, IE: devices which have since been disconnected.</summary>
+    /// <remarks>Call this after each enumeration.</remarks>
+    public void Prune()
+    {
+        lock (Lock)
+        {
+            List<string> staleKeys = new();
+            foreach (string key in Entries.Keys)
+            {
+                if (!UsedKeys.Contains(key))
+                    staleKeys.Add(key);
+            }
+
+            foreach (string key in Deferred.Keys)
+            {
+                if (!UsedKeys.Contains(key))
+                    staleKeys.Add(key);
+            }
+
+            foreach (string key in staleKeys)
+            {
+                Entries.Remove(key);
+                Deferred.Remove(key);
+            }
+
+            UsedKeys.Clear();
+        }
+    }
+
+    public void Clear()
+    {
+        lock (Lock)
+        {
+            Entries.Clear();
+            Deferred.Clear();
+            UsedKeys.Clear();
+        }
+    }
+}
@@ -1,27 +1,246 @@
-﻿using System.Collections.Immutable;
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using PicobootConnection.LibUsb;
+using System;
+using System.Collections.Immutable;
 using System.Diagnostics;
+using System.Globalization;
+using System.IO;
 using System.Runtime.Versioning;
 
 namespace Harp.Devices;
 
+/// <remarks>
+/// Devices are identified entirely from sysfs so that enumeration never touches the serial ports themselves.
+/// (libusb is not viable here for the same reason it isn't on Windows, it'd need to talk to the device and on Linux that'd mean detaching the kernel driver.)
+/// See docs/IdentifyingHarpDevices.md for details on expected behavior.
+/// </remarks>
 [SupportedOSPlatform("linux")]
 internal static class LinuxDeviceEnumerator
 {
-    internal static void EnumerateDevices(ImmutableArray<Device>.Builder builder)
+    private const string TtyClassPath = "/sys/class/tty";
+    private const string UsbDevicesPath = "/sys/bus/usb/devices";
+
+    private const byte VendorSpecificInterfaceClass = 0xff;
+
+    private static Device? TryCreateFromTty(string ttyName)
+    {
+        // The device link is relative to the TTY's real location, so that has to be resolved first rather than following the link through /sys/class
+        // Only TTYs backed by a physical device have a device link, this skips virtual consoles and pseudo-terminals
+        string? ttyPath = TryResolveLink(Path.Combine(TtyClassPath, ttyName));
+        string? devicePath = ttyPath is null ? null : TryResolveLink(Path.Combine(ttyPath, "device"));
+        if (devicePath is null)
+            return null;
+
+        // For CDC ACM devices the link points at the USB interface directly, for USB-serial converters (IE: FTDI) it points at the usb-serial port
+        // which is a child of the interface. Either way the USB interface is the nearest ancestor with an interface class.
+        string? interfacePath = devicePath;
+        while (interfacePath is not null && !File.Exists(Path.Combine(interfacePath, "bInterfaceClass")))
+        {
+            interfacePath = Path.GetDirectoryName(interfacePath);
+            if (interfacePath == "/sys/devices")
+                interfacePath = null;
+        }
+
+        if (interfacePath is null)
+            return null;
+
+        string? usbDevicePath = Path.GetDirectoryName(interfacePath);
+        if (usbDevicePath is null || !TryReadIds(usbDevicePath, out ushort vendorId, out ushort productId))
+            return null;
+
+        string sysfsName = Path.GetFileName(interfacePath);
+        string portName = $"/dev/{ttyName}";
+        Device result;
+
+        if (vendorId == Picoboot.VENDOR_ID_RASPBERRY_PI)
+        {
+            if (productId is not (Picoboot.PRODUCT_ID_RP2040_STDIO_USB or Picoboot.PRODUCT_ID_STDIO_USB))
+            {
+                Trace.WriteLine($"USB device '{sysfsName}' ({portName}) is a Raspberry Pi Foundation device, but not one we recognize.");
+                return null;
+            }
+
+            Trace.WriteLine($"USB device '{sysfsName}' ({portName}) is an online Pico device.");
+            result = new Device()
+            {
+                Confidence = DeviceConfidence.Low,
+                Kind = DeviceKind.Pico,
+                State = DeviceState.Online,
+                PortName = portName,
+                Source = $"Pico USB Serial Port - {sysfsName}",
+            };
+
+            // The USB serial number is deliberately ignored, it's the board's 64 bit unique ID whereas Windows reports the 16 bit Harp serial number
+            // (Which is read from R_SERIAL_NUMBER when connecting is allowed, same as on Windows.)
+            result = WithIdentityFromUsbDescriptor(result);
+        }
+        else if (vendorId == FtdiVendorId)
+        {
+            Trace.WriteLine($"USB device '{sysfsName}' ({portName}) is an FTDI serial port interface.");
+            result = new Device()
+            {
+                Confidence = DeviceConfidence.Low,
+                Kind = DeviceKind.FTDI,
+                State = DeviceState.Online,
+                PortName = portName,
+                Source = $"FTDI USB Device - {sysfsName}",
+            };
+
+            // If we're able to populate a WhoAmI from the FTDI device's description we assume it's a ATxmega device
+            result = WithIdentityFromUsbDescriptor(result);
+            if (result.WhoAmI is not null)
+            {
+                Trace.WriteLine($"USB device '{sysfsName}' is had Harp metadata, assuming it's an ATxmega device.");
+                result = result with { Kind = DeviceKind.ATxmega };
+            }
+        }
+        else
+        {
+            Trace.WriteLine($"USB device '{sysfsName}' ({portName}) is a port device, but not one we recognize as a potential Harp device.");
+            return null;
+        }
+
+        return result;
+
+        Device WithIdentityFromUsbDescriptor(Device device)
+        {
+            Debug.Assert(device.Confidence < DeviceConfidence.High && device.WhoAmI is null);
+
+            // Windows reports the interface string when there is one and the product string otherwise, so we do the same
+            string? deviceDescription = TryReadAttribute(interfacePath, "interface") ?? TryReadAttribute(usbDevicePath, "product");
+            if (deviceDescription is null)
+                return device;
+
+            return device.WithMetadataFromUsbDescription(deviceDescription);
+        }
+    }
+
+    private static Device? TryCreateBootsel(ref LibUsbDeviceList? libUsbDevices, DeviceMetadataCache? metadataCache, string usbDevicePath)
+    {
+        if (!TryReadIds(usbDevicePath, out ushort vendorId, out ushort productId))
+            return null;
+
+        if (vendorId != Picoboot.VENDOR_ID_RASPBERRY_PI || productId is not (Picoboot.PRODUCT_ID_RP2040_USBBOOT or Picoboot.PRODUCT_ID_RP2350_USBBOOT))
+            return null;
+
+        // Only consider the device if it exposes the Picoboot interface, see WindowsDeviceEnumerator for details
+        string sysfsName = Path.GetFileName(usbDevicePath);
+        bool found = false;
+        foreach (string interfacePath in Directory.EnumerateDirectories(usbDevicePath, $"{sysfsName}:*"))
+        {
+            if (TryReadHexAttribute(interfacePath, "bInterfaceClass") == VendorSpecificInterfaceClass)
+            {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            Trace.WriteLine($"USB device '{sysfsName}' has a BOOTSEL VID/PID but no Picoboot interface.");
+            return null;
+        }
+
+        Trace.WriteLine($"USB device '{sysfsName}' is an Pico device in BOOTSEL mode.");
+        Device result = new()
+        {
+            Confidence = DeviceConfidence.Low,
+            Kind = DeviceKind.Pico,
+            State = DeviceState.Bootloader,
+            Source = $"Picoboot USB Device - {sysfsName}",
+        };
+
+        // The cache is keyed on the serial number from the USB descriptor since the bus address changes whenever the device re-enumerates
+        string? cacheKey = DeviceMetadataCache.GetKey(vendorId, productId, TryReadAttribute(usbDevicePath, "serial"));
+        if (metadataCache is not null && metadataCache.TryResolve(cacheKey, result, out Device resolved))
+        {
+            result = resolved;
+        }
+        else if (TryReadAttribute(usbDevicePath, "busnum") is string busString && byte.TryParse(busString, out byte busNumber)
+            && TryReadAttribute(usbDevicePath, "devnum") is string addressString && byte.TryParse(addressString, out byte deviceAddress))
+        {
+            if (PicobootDevice.TryOpen(libUsbDevices ??= new(), busNumber, deviceAddress, sysfsName) is PicobootDevice picobootDevice)
+            {
+                result = result.WithMetadataFromPicobootDevice(picobootDevice);
+                if (cacheKey is not null)
+                    metadataCache?.Add(cacheKey, result);
+            }
+        }
+        else
+        { Trace.WriteLine($"Could not determine the bus number and device address of '{sysfsName}'."); }
+
+        return result;
+    }
+
+    private const ushort FtdiVendorId = 0x0403;
+
+    private static bool TryReadIds(string usbDevicePath, out ushort vendorId, out ushort productId)
+    {
+        vendorId = productId = 0;
+        if (TryReadHexAttribute(usbDevicePath, "idVendor") is not ushort vid || TryReadHexAttribute(usbDevicePath, "idProduct") is not ushort pid)
+            return false;
+
+        vendorId = vid;
+        productId = pid;
+        return true;
+    }
+
+    private static string? TryReadAttribute(string path, string attribute)
+    {
+        try
+        {
+            string value = File.ReadAllText(Path.Combine(path, attribute)).Trim();
+            return value.Length == 0 ? null : value;
+        }
+        catch (IOException)
+        { return null; }
+        catch (UnauthorizedAccessException)
+        { return null; }
+    }
+
+    private static ushort? TryReadHexAttribute(string path, string attribute)
+        => TryReadAttribute(path, attribute) is string value && ushort.TryParse(value, NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out ushort result) ? result : null;
+
+    private static string? TryResolveLink(string path)
     {
-        //TODO: Implement me
-        // See docs/IdentifyingHarpDevices.md for details on expected behavior
-        //
-        // libusb was not vaiable on Windows due to the fact that it requires communicating with
-        // the device to get things like the USB interface description string and communicating
-        // with devices on Windows requires they be using the WinUSB driver. Even if it was easy to
-        // switch to WinUSB temporarily (it extremely isn't), the whole point of this strategy for
-        // device enumeration is to identify devices without connecting to them and swapping the
-        // driver would require kicking off anything connected to the serial port.
-        //
-        // IIRC Linux is actually similar in that libusb changes the Kernel module which controls
-        // the device so a similar approach is probably necessary. (I suspect enumeration will be a
-        // bit simpler though and all of the relevant info is exposed via sysfs.)
-        Trace.WriteLine("Warning: Support for enumerating Harp devices via USB descriptors is not implemneted on Linux.");
+        try
+        {
+            FileSystemInfo? target = new DirectoryInfo(path).ResolveLinkTarget(returnFinalTarget: true);
+            return target?.FullName;
+        }
+        catch (IOException)
+        { return null; }
+        catch (UnauthorizedAccessException)
+        { return null; }
+    }
+
+    internal static void EnumerateDevices(ImmutableArray<Device>.Builder builder, DeviceMetadataCache? metadataCache)
+    {
+        if (!Directory.Exists(TtyClassPath) || !Directory.Exists(UsbDevicesPath))
+        {
+            Trace.WriteLine("Warning: sysfs is not available, cannot enumerate Harp devices via USB descriptors.");
+            return;
+        }
+
+        foreach (string ttyPath in Directory.EnumerateFileSystemEntries(TtyClassPath))
+        {
+            if (TryCreateFromTty(Path.GetFileName(ttyPath)) is Device newDevice)
+                builder.Add(newDevice);
+        }
+
+        // BOOTSEL devices do not have a TTY, so they're found from the USB devices directly
+        // (Interfaces also appear here with names like 1-2:1.0, but they'll never have a VID/PID so they're skipped.)
+        LibUsbDeviceList? libUsbDevices = null;
+        try
+        {
+            foreach (string usbDevicePath in Directory.EnumerateFileSystemEntries(UsbDevicesPath))
+            {
+                if (TryCreateBootsel(ref libUsbDevices, metadataCache, usbDevicePath) is Device newDevice)
+                    builder.Add(newDevice);
+            }
+        }
+        finally
+        { libUsbDevices?.Dispose(); }
     }
 }
@@ -40,7 +40,7 @@ public readonly record struct AddressRange
         return new AddressRange
         (
             Start & ~(alignment - 1),
-            (End & ~(alignment - 1)) + alignment
+            checked(End + (alignment - 1)) & ~(alignment - 1)
         );
     }
 
@@ -0,0 +1,170 @@
+﻿using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Security.Cryptography;
+using System.Text.Json;
+using System.Text.Json.Serialization;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>Remembers what was last written to the flash of each device so that sectors which haven't changed don't need to be written again.</summary>
+/// <remarks>
+/// Entries are keyed by the unique ID of the device and are stored as one small JSON file per device.
+/// An entry only records what we <i>think</i> is on the device, callers must confirm it (IE: using the CRC of each region) before trusting it.
+/// </remarks>
+public sealed class FlashStateCache
+{
+    public sealed class Region
+    {
+        public required uint Start { get; init; }
+        public required uint End { get; init; }
+        /// <summary>The CRC32 of the entire region as computed by <see cref="Picoboot.Crc32"/>.</summary>
+        public required uint Crc32 { get; init; }
+        /// <summary>The hash of each sector within the region as computed by <see cref="HashSector"/>.</summary>
+        public required string[] SectorHashes { get; init; }
+
+        [JsonIgnore]
+        public AddressRange Range => new(Start, End);
+    }
+
+    public sealed class FlashState
+    {
+        public required model_t Model { get; init; }
+        public required List<Region> Regions { get; init; }
+
+        public string? GetSectorHash(uint sectorAddress)
+        {
+            foreach (Region region in Regions)
+            {
+                if (region.Range.Contains(sectorAddress))
+                    return region.SectorHashes[(sectorAddress - region.Start) / FLASH_SECTOR_ERASE_SIZE];
+            }
+
+            return null;
+        }
+    }
+
+    private static readonly JsonSerializerOptions JsonOptions = new()
+    {
+        WriteIndented = true,
+        Converters = { new JsonStringEnumConverter() },
+    };
+
+    public string Directory { get; }
+
+    public FlashStateCache(string directory)
+        => Directory = directory;
+
+    public static FlashStateCache Default { get; } = new(Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "HarpRegulator", "FlashState"));
+
+    /// <summary>Gets the key used to identify the flash of the specified device, or null if it cannot be uniquely identified.</summary>
+    public static string? GetKey(PicobootDevice device)
+        // Emulated devices are recreated from scratch every time, so there's nothing worth remembering about them
+        => device.Emulator is null && device.UniqueId is ulong uniqueId ? $"{device.Model}-{uniqueId:x16}" : null;
+
+    private string GetPath(string key)
+        => Path.Combine(Directory, $"{key}.json");
+
+    public FlashState? Load(string key)
+    {
+        string path = GetPath(key);
+        if (!File.Exists(path))
+            return null;
+
+        try
+        {
+            using FileStream stream = File.OpenRead(path);
+            return JsonSerializer.Deserialize<FlashState>(stream, JsonOptions);
+        }
+        catch (Exception ex) when (ex is IOException or UnauthorizedAccessException or JsonException)
+        {
+            Trace.WriteLine($"Ignoring unreadable flash state cache entry '{path}': {ex.Message}");
+            return null;
+        }
+    }
+
+    public void Save(string key, FlashState state)
+    {
+        string path = GetPath(key);
+        try
+        {
+            System.IO.Directory.CreateDirectory(Directory);
+
+            // Written to the side and moved into place so that an interrupted write can't leave a truncated entry behind
+            string temporaryPath = $"{path}.{Environment.ProcessId}.tmp";
+            using (FileStream stream = File.Create(temporaryPath))
+                JsonSerializer.Serialize(stream, state, JsonOptions);
+            File.Move(temporaryPath, path, overwrite: true);
+        }
+        catch (Exception ex) when (ex is IOException or UnauthorizedAccessException)
+        { Trace.WriteLine($"Failed to save flash state cache entry '{path}': {ex.Message}"); }
+    }
+
+    public void Invalidate(string key)
+    {
+        try
+        { File.Delete(GetPath(key)); }
+        catch (Exception ex) when (ex is IOException or UnauthorizedAccessException)
+        { Trace.WriteLine($"Failed to invalidate flash state cache entry '{key}': {ex.Message}"); }
+    }
+
+    /// <summary>Computes the hash used to identify the contents of a flash sector.</summary>
+    public static string HashSector(ReadOnlySpan<byte> sector)
+    {
+        Span<byte> hash = stackalloc byte[SHA256.HashSizeInBytes];
+        SHA256.HashData(sector, hash);
+        // 128 bits is plenty to tell sectors apart
+        return Convert.ToHexString(hash.Slice(0, 16));
+    }
+
+    /// <summary>Builds the cache entry for a flash region which is about to be written.</summary>
+    public static Region CreateRegion(AddressRange range, ReadOnlySpan<byte> data)
+    {
+        if (!range.IsAligned(FLASH_SECTOR_ERASE_SIZE) || range.Size != data.Length)
+            throw new ArgumentException("The range must be sector-aligned and match the size of the data.", nameof(range));
+
+        string[] sectorHashes = new string[range.Size / FLASH_SECTOR_ERASE_SIZE];
+        for (int i = 0; i < sectorHashes.Length; i++)
+            sectorHashes[i] = HashSector(data.Slice(i * (int)FLASH_SECTOR_ERASE_SIZE, (int)FLASH_SECTOR_ERASE_SIZE));
+
+        return new Region()
+        {
+            Start = range.Start,
+            End = range.End,
+            Crc32 = Picoboot.Crc32(data),
+            SectorHashes = sectorHashes,
+        };
+    }
+
+    /// <summary>Determines which parts of a flash region actually need to be written.</summary>
+    /// <param name="confirmedState">The state the device is known to contain, or null to write everything.</param>
+    /// <param name="newRegion">The cache entry describing the region once it has been written.</param>
+    /// <returns>Sector-aligned ranges covering every sector which differs from the confirmed state, in address order.</returns>
+    public static List<AddressRange> GetChangedRanges(FlashState? confirmedState, AddressRange range, ReadOnlySpan<byte> data, out Region newRegion)
+    {
+        const uint sectorSize = FLASH_SECTOR_ERASE_SIZE;
+        newRegion = CreateRegion(range, data);
+
+        if (confirmedState is null)
+            return [range];
+
+        // Consecutive changed sectors are merged so that each run is erased with a single command
+        List<AddressRange> changedRanges = new();
+        for (int i = 0; i < newRegion.SectorHashes.Length; i++)
+        {
+            uint sectorAddress = range.Start + (uint)i * sectorSize;
+            if (confirmedState.GetSectorHash(sectorAddress) == newRegion.SectorHashes[i])
+                continue;
+
+            if (changedRanges.Count > 0 && changedRanges[^1].End == sectorAddress)
+                changedRanges[^1] = new AddressRange(changedRanges[^1].Start, sectorAddress + sectorSize);
+            else
+                changedRanges.Add(new AddressRange(sectorAddress, sectorAddress + sectorSize));
+        }
+
+        return changedRanges;
+    }
+}
@@ -1,25 +1,97 @@
 ﻿using PicobootConnection;
 using System;
+using System.Collections.Generic;
+using System.Diagnostics;
 using static PicobootConnection.Picoboot;
 
 namespace Harp.Devices.Pico;
 
-/// <remarks>This is roughly requivalent to picoboot_memory_access in picotool.</remarks>
+/// <remarks>
+/// This is roughly requivalent to picoboot_memory_access in picotool.
+///
+/// Flash reads are cached for the lifetime of the reader since things like <see cref="PicoFirmwareInfo"/> tend to issue many small reads
+/// which are close together. The cache is invalidated if the device is written to.
+/// </remarks>
 internal sealed class PhysicalDeviceFlashReader : PicoFlashReaderBase
 {
     private readonly PicobootDevice Pico;
 
+    // Flash is cached in blocks of this size, so a miss always fetches at least a whole block
+    private const uint CacheBlockSize = FLASH_SECTOR_ERASE_SIZE;
+    // On a miss, this many additional blocks past the end of the read are fetched in the same command (if they aren't already cached)
+    private const int ReadAheadBlocks = 1;
+
+    private readonly Dictionary<uint, ReadOnlyMemory<byte>> Cache = new();
+    private int CacheModificationCount;
+
     public override uint BinaryStart => PicoMemoryMap.FLASH_START;
 
     public PhysicalDeviceFlashReader(PicobootDevice pico)
-        => Pico = pico;
+    {
+        Pico = pico;
+        CacheModificationCount = pico.ModificationCount;
+    }
+
+    public override void Read(uint address, Span<byte> buffer)
+    {
+        uint endAddress = address + checked((uint)buffer.Length);
+
+        if (buffer.Length == 0 || !IsFlashBlock(address) || !IsFlashBlock(endAddress - 1))
+        {
+            Pico.Read(address, buffer);
+            return;
+        }
+
+        if (CacheModificationCount != Pico.ModificationCount)
+        {
+            Cache.Clear();
+            CacheModificationCount = Pico.ModificationCount;
+        }
+
+        while (buffer.Length > 0)
+        {
+            uint blockStart = address & ~(CacheBlockSize - 1);
+            if (!Cache.TryGetValue(blockStart, out ReadOnlyMemory<byte> block))
+                block = Fill(blockStart, endAddress);
+
+            ReadOnlySpan<byte> source = block.Span.Slice((int)(address - blockStart));
+            if (source.Length > buffer.Length)
+                source = source.Slice(0, buffer.Length);
+
+            source.CopyTo(buffer);
+            buffer = buffer.Slice(source.Length);
+            address += (uint)source.Length;
+        }
+    }
 
-    public unsafe override void Read(uint address, Span<byte> buffer)
+    private bool IsFlashBlock(uint address)
     {
-        if (PBC_get_memory_type(address, Pico.Model) == memory_type.flash)
-            Pico.ExitXip();
+        uint blockStart = address & ~(CacheBlockSize - 1);
+        return PBC_get_memory_type(blockStart, Pico.Model) == memory_type.flash
+            && PBC_get_memory_type(blockStart + CacheBlockSize - 1, Pico.Model) == memory_type.flash;
+    }
+
+    /// <summary>Fetches the block at <paramref name="blockStart"/> along with any following blocks needed to satisfy the read and any read-ahead.</summary>
+    private ReadOnlyMemory<byte> Fill(uint blockStart, uint readEnd)
+    {
+        uint fetchEnd = blockStart + CacheBlockSize;
+        int readAhead = 0;
+        while (IsFlashBlock(fetchEnd) && !Cache.ContainsKey(fetchEnd))
+        {
+            if (fetchEnd >= readEnd && ++readAhead > ReadAheadBlocks)
+                break;
+
+            fetchEnd += CacheBlockSize;
+        }
+
+        byte[] data = new byte[fetchEnd - blockStart];
+        Pico.ReadAligned(blockStart, data);
+
+        for (uint offset = 0; offset < data.Length; offset += CacheBlockSize)
+            Cache[blockStart + offset] = data.AsMemory((int)offset, (int)CacheBlockSize);
 
-        Pico.Read(address, buffer);
+        Debug.Assert(Cache.ContainsKey(blockStart));
+        return Cache[blockStart];
     }
 
     public override model_t ReadModel()
@@ -0,0 +1,47 @@
+﻿using PicobootConnection;
+using System.Collections.Immutable;
+using System.Text.Json.Serialization;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>Statistics for a single kind of PICOBOOT command sent to a device, see <see cref="PicobootDevice.GetStatistics"/>.</summary>
+public sealed record PicobootCommandStatistics
+{
+    public picoboot_cmd_id Command { get; }
+    public uint Calls { get; }
+    public uint Failures { get; }
+    public uint Timeouts { get; }
+    /// <summary>The number of endpoint halts which had to be cleared after this command failed.</summary>
+    public uint Halts { get; }
+    /// <summary>The number of bytes transferred by successful commands.</summary>
+    public ulong Bytes { get; }
+    public ulong TotalMicroseconds { get; }
+    public ulong MaxMicroseconds { get; }
+    /// <summary>Latency histogram, bucket <c>i</c> counts commands which took less than <see cref="GetHistogramBucketLimitMicroseconds"/> (the last bucket counts everything else.)</summary>
+    public ImmutableArray<uint> LatencyHistogram { get; }
+
+    [JsonIgnore]
+    public double MeanMicroseconds => Calls == 0 ? 0.0 : (double)TotalMicroseconds / Calls;
+
+    internal unsafe PicobootCommandStatistics(picoboot_cmd_id command, in picoboot_cmd_stats stats)
+    {
+        Command = command;
+        Calls = stats.calls;
+        Failures = stats.failures;
+        Timeouts = stats.timeouts;
+        Halts = stats.halts;
+        Bytes = stats.bytes;
+        TotalMicroseconds = stats.total_us;
+        MaxMicroseconds = stats.max_us;
+
+        ImmutableArray<uint>.Builder histogram = ImmutableArray.CreateBuilder<uint>((int)PICOBOOT_STATS_HISTOGRAM_BUCKETS);
+        for (int i = 0; i < PICOBOOT_STATS_HISTOGRAM_BUCKETS; i++)
+            histogram.Add(stats.histogram[i]);
+        LatencyHistogram = histogram.MoveToImmutable();
+    }
+
+    /// <returns>The exclusive upper bound of the given histogram bucket, or <see cref="ulong.MaxValue"/> for the last bucket.</returns>
+    public static ulong GetHistogramBucketLimitMicroseconds(int bucket)
+        => bucket >= PICOBOOT_STATS_HISTOGRAM_BUCKETS - 1 ? ulong.MaxValue : (ulong)PICOBOOT_STATS_HISTOGRAM_BASE_US << bucket;
+}
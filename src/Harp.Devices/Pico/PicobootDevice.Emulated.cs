@@ -0,0 +1,39 @@
+﻿using PicobootConnection;
+using System.Diagnostics;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+partial class PicobootDevice
+{
+    internal static unsafe PicobootDevice? TryOpen(PicobootEmulator emulator)
+    {
+        Trace.WriteLine("==============================================================================");
+        Trace.WriteLine($"Opening emulated {emulator.Model} PICOBOOT device...");
+
+        picoboot_connection connection = default;
+        try
+        {
+            model_t model;
+            picoboot_device_result result = picoboot_open_emulated_device(emulator.Handle, &connection, &model);
+
+            if (result != picoboot_device_result.dr_vidpid_bootrom_ok)
+            {
+                // Only one connection may have an emulator open at a time
+                Trace.WriteLine($"Could not open emulated picoboot device: {result}");
+                return null;
+            }
+
+            PicobootDevice picobootDevice = new($"emulated {model} device", model, busNumber: 0, connection);
+            picobootDevice.Emulator = emulator;
+            connection = default; // PicobootDevice owns the connection now
+            return picobootDevice;
+        }
+        finally
+        {
+            if (!connection.IsNull)
+                picoboot_close_device(connection);
+            Trace.WriteLine("==============================================================================");
+        }
+    }
+}
@@ -0,0 +1,66 @@
+﻿using PicobootConnection;
+using PicobootConnection.LibUsb;
+using System.Diagnostics;
+using System.Runtime.Versioning;
+using static PicobootConnection.LibUsb.Globals;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+partial class PicobootDevice
+{
+    [SupportedOSPlatform("linux")]
+    internal static unsafe PicobootDevice? TryOpen(LibUsbDeviceList libUsbDevices, byte busNumber, byte deviceAddress, string sysfsName)
+    {
+        Trace.WriteLine("==============================================================================");
+        Trace.WriteLine($"Seaching for libusb device corresponding to '{sysfsName}'...");
+
+        // Unlike Windows the bus number and device address reported by libusb on Linux come straight from sysfs (busnum and devnum) so they can be used to correlate devices
+        libusb_device foundDevice = default;
+        foreach (libusb_device device in libUsbDevices)
+        {
+            if (libusb_get_bus_number(device) == busNumber && libusb_get_device_address(device) == deviceAddress)
+            {
+                foundDevice = device;
+                break;
+            }
+        }
+
+        if (foundDevice.IsNull)
+        {
+            Trace.WriteLine($"Could not find libusb device corresponding to '{sysfsName}'");
+            Trace.WriteLine("==============================================================================");
+            return null;
+        }
+
+        string identity = $"Picoboot interface for '{sysfsName}' as libusb device address {deviceAddress} on bus {busNumber}";
+        Trace.WriteLine($"Found '{sysfsName}' as libusb device address {deviceAddress} on bus {busNumber}.");
+
+        // Initialize the PICOBOOT device
+        picoboot_connection connection = default;
+        try
+        {
+            model_t model;
+            byte* serial = stackalloc byte[1];
+            serial[0] = 0;
+            picoboot_device_result result = picoboot_open_device(foundDevice, &connection, &model, -1, -1, serial);
+
+            if (result != picoboot_device_result.dr_vidpid_bootrom_ok)
+            {
+                // The most likely culprit here is missing udev rules granting access to the device
+                Trace.WriteLine($"Could not open picoboot device: {result}");
+                return null;
+            }
+
+            PicobootDevice picobootDevice = new(identity, model, busNumber, connection);
+            connection = default; // PicobootDevice owns the connection now
+            return picobootDevice;
+        }
+        finally
+        {
+            if (!connection.IsNull)
+                picoboot_close_device(connection);
+            Trace.WriteLine("==============================================================================");
+        }
+    }
+}
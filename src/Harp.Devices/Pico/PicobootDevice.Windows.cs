@@ -39,6 +39,7 @@ partial class PicobootDevice
 
         // Find the device corresponding to the SetupAPI device
         libusb_device foundDevice = default;
+        byte foundBusNumber = 0;
         string identity = searchInstanceId;
         {
             Span<char> deviceIdStringBuffer = new char[1024];
@@ -64,6 +65,7 @@ partial class PicobootDevice
                     identity = $"Picoboot interface for '{instanceId}' as libusb device address {deviceAddress} on bus {busNumber} via '{searchInstanceId}'";
 
                     foundDevice = device;
+                    foundBusNumber = busNumber;
                     break;
                 }
             }
@@ -77,13 +79,13 @@ partial class PicobootDevice
         }
 
         // Initialize the PICOBOOT device
-        libusb_device_handle handle = default;
+        picoboot_connection connection = default;
         try
         {
             model_t model;
             byte* serial = stackalloc byte[1];
             serial[0] = 0;
-            picoboot_device_result result = picoboot_open_device(foundDevice, &handle, &model, -1, -1, serial);
+            picoboot_device_result result = picoboot_open_device(foundDevice, &connection, &model, -1, -1, serial);
 
             if (result != picoboot_device_result.dr_vidpid_bootrom_ok)
             {
@@ -91,14 +93,14 @@ partial class PicobootDevice
                 return null;
             }
 
-            PicobootDevice picobootDevice = new(identity, model, handle);
-            handle = default; // PicobootDevice owns the handle now
+            PicobootDevice picobootDevice = new(identity, model, foundBusNumber, connection);
+            connection = default; // PicobootDevice owns the connection now
             return picobootDevice;
         }
         finally
         {
-            if (!handle.IsNull)
-                libusb_close(handle);
+            if (!connection.IsNull)
+                picoboot_close_device(connection);
             Trace.WriteLine("==============================================================================");
         }
     }
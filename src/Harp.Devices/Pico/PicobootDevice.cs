@@ -2,44 +2,61 @@
 using PicobootConnection.LibUsb;
 using System;
 using System.Collections.Generic;
+using System.Collections.Immutable;
 using System.Diagnostics;
 using System.Numerics;
 using System.Runtime.CompilerServices;
+using System.Runtime.ExceptionServices;
 using System.Runtime.InteropServices;
-using static PicobootConnection.LibUsb.Globals;
+using System.Text;
 using static PicobootConnection.Picoboot;
 
 namespace Harp.Devices.Pico;
 
 public sealed partial class PicobootDevice : IDisposable
 {
-    private static HashSet<GCHandle> AllPicobootDevices = new();
+    // Devices may be opened and disposed from worker threads, so all access to this set must hold AllPicobootDevicesLock
+    private static readonly HashSet<GCHandle> AllPicobootDevices = new();
+    private static readonly object AllPicobootDevicesLock = new();
     private readonly GCHandle ThisGCHandle;
 
     private string Identity { get; }
-    public libusb_device_handle Handle { get; }
+    public picoboot_connection Connection { get; }
     public model_t Model { get; }
+    /// <summary>The libusb bus number of the device, devices sharing a bus share the bandwidth of a single root hub.</summary>
+    public byte BusNumber { get; }
 
     private readonly bool Exclusive;
 
+    /// <summary>The emulator backing this device, if it isn't a real one.</summary>
+    internal PicobootEmulator? Emulator { get; private set; }
+    // Emulated connections don't use libusb at all, so don't initialize it just for them
+    private libusb_context UsbContext => Emulator is null ? LibusbManager.Context : default;
+
+    /// <summary>Incremented whenever the contents of the device's memory may have been modified, used to invalidate cached reads.</summary>
+    internal int ModificationCount { get; private set; }
+
     private bool HaveUniqueId = false;
     private ulong? _UniqueId;
 
-    private PicobootDevice(string identity, model_t model, libusb_device_handle handle, bool exclusive = true)
+    private PicobootDevice(string identity, model_t model, byte busNumber, picoboot_connection connection, bool exclusive = true)
     {
-        AllPicobootDevices.Add(ThisGCHandle = GCHandle.Alloc(this, GCHandleType.Weak));
+        ThisGCHandle = GCHandle.Alloc(this, GCHandleType.Weak);
+        lock (AllPicobootDevicesLock)
+            AllPicobootDevices.Add(ThisGCHandle);
         Identity = identity;
         Model = model;
+        BusNumber = busNumber;
         Exclusive = exclusive;
 
         if (exclusive)
         {
-            int status = picoboot_exclusive_access(handle, picoboot_exclusive_type.EXCLUSIVE);
+            int status = picoboot_exclusive_access(connection, picoboot_exclusive_type.EXCLUSIVE);
             HandleReturnCode("Exclusive access lock command failed", status);
         }
 
         // Assigned last so we only dispose of it if ownership is fully transferred
-        Handle = handle;
+        Connection = connection;
     }
 
     /// <summary>For the RP2040, this is the flash ID. For the RP2350, this is the chip's embedded uniqued ID.</summary>
@@ -65,7 +82,7 @@ public sealed partial class PicobootDevice : IDisposable
                 {
                     ulong flashId;
                     //TODO: Make sure this fails gracefully on systems without a flash chip
-                    result = picoboot_flash_id(Handle, &flashId);
+                    result = picoboot_flash_id(Connection, &flashId);
 
                     HandleReturnCode("Get flash ID command failed", result, justWriteTraceMessage: true);
                     return flashId;
@@ -81,7 +98,7 @@ public sealed partial class PicobootDevice : IDisposable
                     fixed (uint* infoP = info)
                     {
                         int lengthBytes = info.Length * sizeof(uint);
-                        result = Rp2350.picoboot_get_info(Handle, &command, (byte*)infoP, checked((uint)lengthBytes));
+                        result = Rp2350.picoboot_get_info(Connection, &command, (byte*)infoP, checked((uint)lengthBytes));
                     }
 
                     HandleReturnCode("Get info command failed", result, justWriteTraceMessage: true);
@@ -110,7 +127,7 @@ public sealed partial class PicobootDevice : IDisposable
 
     public void ExitXip()
     {
-        int status = Picoboot.picoboot_exit_xip(Handle);
+        int status = Picoboot.picoboot_exit_xip(Connection);
         HandleReturnCode("Exit XIP", status);
     }
 
@@ -143,7 +160,7 @@ public sealed partial class PicobootDevice : IDisposable
 
         int status;
         fixed (byte* dataP = buffer)
-            status = picoboot_read(Handle, baseAddress, dataP, length);
+            status = picoboot_read(Connection, baseAddress, dataP, length);
         HandleReturnCode("Read command failed", status);
     }
 
@@ -167,6 +184,25 @@ public sealed partial class PicobootDevice : IDisposable
         }
     }
 
+    /// <summary>Whether <see cref="GetFlashCrc32"/> is supported on this device.</summary>
+    public bool CanComputeFlashCrc32 => Model == model_t.rp2040;
+
+    /// <summary>Computes the CRC32 of a range of flash on the device itself, so that only the result has to be transferred.</summary>
+    /// <returns>The CRC32 as computed by <see cref="Crc32"/>.</returns>
+    /// <remarks>This overwrites the start of SRAM on the device.</remarks>
+    public unsafe uint GetFlashCrc32(AddressRange range)
+    {
+        if (!CanComputeFlashCrc32)
+            throw new NotSupportedException($"Computing flash CRCs on-device is not supported for {Model} devices.");
+        if (PBC_get_memory_type(range.Start, Model) != memory_type.flash || PBC_get_memory_type(range.End, Model) != memory_type.flash)
+            throw new ArgumentException("The specified memory range does not lie fully within the flash.", nameof(range));
+
+        uint crc;
+        int status = picoboot_flash_crc32(Connection, range.Start, range.Size, &crc);
+        HandleReturnCode("Flash CRC32 failed", status);
+        return crc;
+    }
+
     public void FlashErase(AddressRange range)
     {
         if (PBC_get_memory_type(range.Start, Model) != memory_type.flash || PBC_get_memory_type(range.End, Model) != memory_type.flash)
@@ -174,14 +210,17 @@ public sealed partial class PicobootDevice : IDisposable
         if (range.Start % FLASH_SECTOR_ERASE_SIZE != 0 || range.End % FLASH_SECTOR_ERASE_SIZE != 0)
             throw new ArgumentException("The specified memory range is not aligned to the flash sector erase size.", nameof(range));
 
-        int status = Picoboot.picoboot_flash_erase(Handle, range.Start, range.Size);
+        ModificationCount++;
+        int status = Picoboot.picoboot_flash_erase(Connection, range.Start, range.Size);
         HandleReturnCode("Flash erase failed", status);
     }
 
-    public unsafe void Write(uint baseAddress, ReadOnlySpan<byte> data)
+    internal void PrepareForWrite(uint baseAddress, ReadOnlySpan<byte> data)
     {
-        uint length = checked((uint)data.Length);
-        uint endAddress = baseAddress + length;
+        // Everything which writes goes through here, so this is also where we note that cached reads are no longer valid
+        ModificationCount++;
+
+        uint endAddress = baseAddress + checked((uint)data.Length);
         memory_type type = PBC_get_memory_type(baseAddress, Model);
         memory_type endType = PBC_get_memory_type(endAddress, Model);
 
@@ -196,13 +235,105 @@ public sealed partial class PicobootDevice : IDisposable
             if (endAddress % PAGE_SIZE != 0)
                 throw new ArgumentException("The end of the write operation must lie on a flash page boundary.", nameof(data));
         }
+    }
+
+    public unsafe void Write(uint baseAddress, ReadOnlySpan<byte> data)
+    {
+        PrepareForWrite(baseAddress, data);
 
         int status;
         fixed (byte* dataP = data)
-            status = picoboot_write(Handle, baseAddress, dataP, length);
+            status = picoboot_write(Connection, baseAddress, dataP, (uint)data.Length);
         HandleReturnCode("Write command failed", status);
     }
 
+    /// <summary>Opens a stream which pipelines multiple writes to the device rather than waiting for each one to be acknowledged.</summary>
+    /// <param name="maxWriteSize">The largest write which will be made to the stream.</param>
+    /// <param name="depth">The number of writes which may be in flight at once.</param>
+    /// <remarks>
+    /// Only one stream may be open for a device at a time.
+    /// Issuing any other command while the stream is open will implicitly wait for all outstanding writes to complete.
+    /// </remarks>
+    public PicobootWriteStream OpenWriteStream(uint maxWriteSize = FLASH_SECTOR_ERASE_SIZE, uint depth = PicobootWriteStream.DefaultDepth)
+    {
+        int status = picoboot_write_stream_open(Connection, UsbContext, depth, maxWriteSize);
+        HandleReturnCode("Failed to open write stream", status);
+        return new PicobootWriteStream(this, maxWriteSize);
+    }
+
+    /// <summary>Erases (if applicable) and writes an entire contiguous region of memory in a single native call.</summary>
+    /// <param name="progress">Invoked periodically with the number of bytes written so far.</param>
+    /// <remarks>For flash the region must be aligned to <see cref="FLASH_SECTOR_ERASE_SIZE"/>, pad the data with whatever should fill the gaps.</remarks>
+    public unsafe void ProgramRegion(uint baseAddress, ReadOnlySpan<byte> data, Action<uint>? progress = null, PBC_program_policy? policy = null)
+    {
+        PrepareForWrite(baseAddress, data);
+
+        if (PBC_get_memory_type(baseAddress, Model) == memory_type.flash)
+        {
+            if (baseAddress % FLASH_SECTOR_ERASE_SIZE != 0 || data.Length % FLASH_SECTOR_ERASE_SIZE != 0)
+                throw new ArgumentException("Flash regions must be aligned to the flash sector erase size.", nameof(data));
+        }
+
+        PBC_program_policy policyValue = policy ?? new PBC_program_policy()
+        {
+            write_size = FLASH_SECTOR_ERASE_SIZE,
+            erase_size = 0,
+            pipeline_depth = PicobootWriteStream.DefaultDepth,
+        };
+
+        ProgramRegionProgressState state = new(progress);
+        GCHandle stateHandle = GCHandle.Alloc(state);
+        try
+        {
+            int status;
+            fixed (byte* dataP = data)
+            {
+                status = PBC_program_region
+                (
+                    Connection,
+                    UsbContext,
+                    Model,
+                    baseAddress,
+                    dataP,
+                    (uint)data.Length,
+                    &policyValue,
+                    progress is null ? null : &ProgramRegionProgressCallback,
+                    (void*)GCHandle.ToIntPtr(stateHandle)
+                );
+            }
+
+            HandleReturnCode("Failed to program region", status);
+        }
+        finally
+        {
+            stateHandle.Free();
+        }
+
+        if (state.Exception is not null)
+            ExceptionDispatchInfo.Throw(state.Exception);
+    }
+
+    private sealed class ProgramRegionProgressState(Action<uint>? progress)
+    {
+        public readonly Action<uint>? Progress = progress;
+        public Exception? Exception;
+    }
+
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
+    private static unsafe void ProgramRegionProgressCallback(uint bytesWritten, uint totalBytes, void* userData)
+    {
+        ProgramRegionProgressState state = (ProgramRegionProgressState)GCHandle.FromIntPtr((nint)userData).Target!;
+
+        // Exceptions must not propagate into native code, the first one is rethrown once the operation completes
+        if (state.Exception is not null)
+            return;
+
+        try
+        { state.Progress?.Invoke(bytesWritten); }
+        catch (Exception ex)
+        { state.Exception = ex; }
+    }
+
     /// <remarks>Based on logic in picotool's <c>load_guts</c>.</remarks>
     public unsafe void Reboot(uint binaryStart)
     {
@@ -246,7 +377,7 @@ public sealed partial class PicobootDevice : IDisposable
             { throw new ArgumentOutOfRangeException(nameof(binaryStart), $"The binary start must be 0, a flash address, an SRAM address, or an XIP SRAM address."); }
 
             command.dDelayMS = delayMs;
-            int status = Rp2350.picoboot_reboot2(Handle, &command);
+            int status = Rp2350.picoboot_reboot2(Connection, &command);
             HandleReturnCode("RP2350 reboot command failed", status);
         }
         else if (Model == model_t.rp2040)
@@ -272,7 +403,7 @@ public sealed partial class PicobootDevice : IDisposable
                     break;
             }
 
-            int status = picoboot_reboot(Handle, binaryStart, end, delayMs);
+            int status = picoboot_reboot(Connection, binaryStart, end, delayMs);
             HandleReturnCode("RP2040 reboot command failed", status);
         }
         else
@@ -338,6 +469,26 @@ public sealed partial class PicobootDevice : IDisposable
     public AddressRange TryGetFlashRange()
         => new AddressRange(PicoMemoryMap.FLASH_START, PicoMemoryMap.FLASH_START + TryGetFlashSize());
 
+    /// <summary>Gets statistics for every kind of command which has been sent to the device since it was opened or <see cref="ResetStatistics"/> was called.</summary>
+    public unsafe ImmutableArray<PicobootCommandStatistics> GetStatistics()
+    {
+        picoboot_cmd_stats* stats = stackalloc picoboot_cmd_stats[(int)PICOBOOT_STATS_COMMAND_COUNT];
+        uint count = Math.Min(PBC_get_stats(Connection, stats, PICOBOOT_STATS_COMMAND_COUNT), PICOBOOT_STATS_COMMAND_COUNT);
+
+        ImmutableArray<PicobootCommandStatistics>.Builder result = ImmutableArray.CreateBuilder<PicobootCommandStatistics>();
+        foreach (picoboot_cmd_id command in Enum.GetValues<picoboot_cmd_id>())
+        {
+            int index = (byte)command & 0x7f;
+            if (index < count && stats[index].calls > 0)
+                result.Add(new PicobootCommandStatistics(command, stats[index]));
+        }
+
+        return result.ToImmutable();
+    }
+
+    public void ResetStatistics()
+        => PBC_reset_stats(Connection);
+
     /// <remarks>Based on the logic in picotool's connection::wrap_call</remarks>
     private unsafe Exception? MakeExceptionForReturnCode(string? messagePrefix, int returnCode)
     {
@@ -347,12 +498,12 @@ public sealed partial class PicobootDevice : IDisposable
         //TODO: picoboot_connection seems to have a pattern of returning positive values for picoboot errors and negative values for libusb, we could
         // potentially take advantage of that to skip this check.
         picoboot_cmd_status status = new();
-        int statusReturnCode = picoboot_cmd_status(Handle, &status);
+        int statusReturnCode = picoboot_cmd_status(Connection, &status);
         int resetStatus = 0; // Just so it's accessible via the debugger
 
         if (statusReturnCode == 0)
         {
-            resetStatus = picoboot_reset(Handle);
+            resetStatus = picoboot_reset(Connection);
             messagePrefix ??= "Picoboot command resulted in failure";
             return new PicobootCommandFailureException(messagePrefix, status.dStatusCode == picoboot_status.PICOBOOT_OK ? picoboot_status.PICOBOOT_UNKNOWN_ERROR : status.dStatusCode);
         }
@@ -365,7 +516,7 @@ public sealed partial class PicobootDevice : IDisposable
     }
 
     /// <remarks>Based on the logic in picotool's connection::wrap_call</remarks>
-    private void HandleReturnCode(string? messagePrefix, int returnCode, bool justWriteTraceMessage = false)
+    internal void HandleReturnCode(string? messagePrefix, int returnCode, bool justWriteTraceMessage = false)
     {
         if (MakeExceptionForReturnCode(messagePrefix, returnCode) is Exception ex)
         {
@@ -389,31 +540,57 @@ public sealed partial class PicobootDevice : IDisposable
     {
         GC.SuppressFinalize(this);
 
-        if (isDisposeAll)
-        { Debug.Assert(AllPicobootDevices.Contains(ThisGCHandle)); }
-        else
+        if (!isDisposeAll)
         {
-            bool removed = AllPicobootDevices.Remove(ThisGCHandle);
-            Debug.Assert(removed);
+            lock (AllPicobootDevicesLock)
+            {
+                // Removal may fail if we raced with DisposeAll, in which case it is already disposing us
+                if (!AllPicobootDevices.Remove(ThisGCHandle))
+                    return;
+            }
         }
 
-        if (!Handle.IsNull)
+        if (!Connection.IsNull)
         {
             if (Exclusive)
             {
-                int status = picoboot_exclusive_access(Handle, picoboot_exclusive_type.NOT_EXCLUSIVE);
+                int status = picoboot_exclusive_access(Connection, picoboot_exclusive_type.NOT_EXCLUSIVE);
                 if (status != 0)
                 {
                     // Failed to restore exclusive access, just reset the device
-                    status = picoboot_reset(Handle);
+                    status = picoboot_reset(Connection);
                     HandleReturnCode("Reset command failed", status);
                 }
             }
 
-            libusb_close(Handle);
+            picoboot_close_device(Connection);
         }
     }
 
+    /// <summary>Waits for a device in BOOTSEL mode to appear, returning as soon as one arrives.</summary>
+    /// <param name="partialSerialNumber">
+    /// If specified only a BOOTSEL device matching this serial number completes the wait, whether it's already connected or arrives later.
+    /// This matters when several devices reboot into BOOTSEL mode at once.
+    /// </param>
+    /// <returns>False if no device appeared before the timeout elapsed.</returns>
+    /// <remarks>The caller should still enumerate devices afterwards, this only removes the guesswork of how long the bootloader takes to show up.</remarks>
+    public static unsafe bool WaitForBootselDevice(string? partialSerialNumber, TimeSpan timeout)
+    {
+        byte[]? serial = partialSerialNumber is null ? null : Encoding.ASCII.GetBytes(partialSerialNumber + '\0');
+        uint timeoutMilliseconds = (uint)Math.Clamp(timeout.TotalMilliseconds, 0, uint.MaxValue);
+
+        long start = Stopwatch.GetTimestamp();
+        int result;
+        fixed (byte* serialP = serial)
+            result = PBC_wait_for_bootsel_device(LibusbManager.Context, serialP, timeoutMilliseconds);
+
+        if (result < 0)
+            throw new LibUsbException("Waiting for BOOTSEL device failed", (libusb_error)result);
+
+        Trace.WriteLine(result > 0 ? $"BOOTSEL device appeared after {Stopwatch.GetElapsedTime(start).TotalMilliseconds:0} ms." : "Timed out waiting for a BOOTSEL device to appear.");
+        return result > 0;
+    }
+
     ~PicobootDevice()
         => Dispose();
 
@@ -422,12 +599,18 @@ public sealed partial class PicobootDevice : IDisposable
     // but this gets the job done.
     public static void DisposeAll()
     {
-        foreach (GCHandle handle in AllPicobootDevices)
+        GCHandle[] handles;
+        lock (AllPicobootDevicesLock)
+        {
+            handles = new GCHandle[AllPicobootDevices.Count];
+            AllPicobootDevices.CopyTo(handles);
+            AllPicobootDevices.Clear();
+        }
+
+        foreach (GCHandle handle in handles)
         {
             PicobootDevice? device = (PicobootDevice?)handle.Target;
             device?.Dispose(isDisposeAll: true);
         }
-
-        AllPicobootDevices.Clear();
     }
 }
@@ -0,0 +1,108 @@
+﻿using PicobootConnection;
+using PicobootConnection.LibUsb;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>A software emulated RP2040/RP2350 in BOOTSEL mode, for exercising the PICOBOOT stack without any hardware.</summary>
+/// <remarks>
+/// The emulator stands in for the device at the USB transfer level, so everything above that (including pipelining and statistics) runs exactly as it would
+/// against a real device. Transfers take as long as the configured timing model says they would.
+/// Only one <see cref="PicobootDevice"/> may be open for an emulator at a time, and like a real device the emulator drops off the bus after being rebooted.
+/// </remarks>
+public sealed unsafe class PicobootEmulator : IDisposable
+{
+    internal picoboot_emulator Handle { get; private set; }
+    public picoboot_emulator_config Config { get; }
+    public model_t Model => Config.model;
+
+    // Devices must be closed before the emulator backing them is destroyed
+    private readonly List<PicobootDevice> OpenedDevices = new();
+
+    public PicobootEmulator(picoboot_emulator_config config)
+    {
+        picoboot_emulator handle;
+        ((libusb_error)picoboot_emulator_create(&config, &handle)).ThrowIfError("Failed to create PICOBOOT emulator");
+        Handle = handle;
+        Config = config;
+    }
+
+    public PicobootEmulator(model_t model)
+        : this(GetDefaultConfig(model))
+    { }
+
+    /// <summary>Gets the default configuration for the given model, which is based on a Pico/Pico 2 with its stock flash chip.</summary>
+    public static picoboot_emulator_config GetDefaultConfig(model_t model)
+    {
+        picoboot_emulator_config config;
+        picoboot_emulator_default_config(model, &config);
+        return config;
+    }
+
+    /// <summary>Plugs the emulated device in (again, if it was rebooted) and opens it.</summary>
+    public PicobootDevice Open()
+    {
+        ObjectDisposedException.ThrowIf(Handle.IsNull, this);
+        PicobootDevice device = PicobootDevice.TryOpen(this) ?? throw new InvalidOperationException("The emulated device is already open.");
+        OpenedDevices.Add(device);
+        return device;
+    }
+
+    /// <summary>Reads the emulated device's memory directly, without going through PICOBOOT.</summary>
+    public void ReadMemory(uint address, Span<byte> buffer)
+    {
+        ObjectDisposedException.ThrowIf(Handle.IsNull, this);
+        int result;
+        fixed (byte* bufferP = buffer)
+            result = picoboot_emulator_read_memory(Handle, address, bufferP, checked((uint)buffer.Length));
+        ((libusb_error)result).ThrowIfError("The range is not emulated");
+    }
+
+    /// <summary>Writes the emulated device's memory directly, without going through PICOBOOT.</summary>
+    /// <remarks>Unlike programming it over PICOBOOT, flash does not need to be erased first.</remarks>
+    public void WriteMemory(uint address, ReadOnlySpan<byte> data)
+    {
+        ObjectDisposedException.ThrowIf(Handle.IsNull, this);
+        int result;
+        fixed (byte* dataP = data)
+            result = picoboot_emulator_write_memory(Handle, address, dataP, checked((uint)data.Length));
+        ((libusb_error)result).ThrowIfError("The range is not emulated");
+    }
+
+    /// <summary>Gets what the emulated device has done since it was created or <see cref="ResetStatistics"/> was called.</summary>
+    public picoboot_emulator_stats GetStatistics()
+    {
+        ObjectDisposedException.ThrowIf(Handle.IsNull, this);
+        picoboot_emulator_stats stats;
+        picoboot_emulator_get_stats(Handle, &stats);
+        return stats;
+    }
+
+    public void ResetStatistics()
+    {
+        ObjectDisposedException.ThrowIf(Handle.IsNull, this);
+        picoboot_emulator_reset_stats(Handle);
+    }
+
+    public void Dispose()
+    {
+        if (Handle.IsNull)
+            return;
+
+        foreach (PicobootDevice device in OpenedDevices)
+        {
+            // Releasing exclusive access fails once the device has rebooted, which doesn't matter since it's gone either way
+            try
+            { device.Dispose(); }
+            catch (LibUsbException ex)
+            { Trace.WriteLine($"Failed to cleanly close {device}: {ex.Message}"); }
+        }
+        OpenedDevices.Clear();
+
+        picoboot_emulator_destroy(Handle);
+        Handle = default;
+    }
+}
@@ -0,0 +1,59 @@
+﻿using System;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>Pipelines writes to a <see cref="PicobootDevice"/> so that the next write is already queued while the device is busy with the previous one.</summary>
+/// <remarks>
+/// Failures are not necessarily reported by the write which caused them, they may instead be reported by a later write or by <see cref="Flush"/>.
+/// Once a failure is reported all outstanding writes have been abandoned, so the stream should not be used further.
+/// </remarks>
+public sealed class PicobootWriteStream : IDisposable
+{
+    /// <summary>Enough to keep the next write queued while the device is programming the current one, more doesn't help much.</summary>
+    public const uint DefaultDepth = 4;
+
+    private readonly PicobootDevice Device;
+    private readonly uint MaxWriteSize;
+    private bool IsDisposed;
+
+    internal PicobootWriteStream(PicobootDevice device, uint maxWriteSize)
+    {
+        Device = device;
+        MaxWriteSize = maxWriteSize;
+    }
+
+    /// <summary>Queues a write to the device.</summary>
+    /// <remarks>The data is copied before this method returns, so the buffer may be reused immediately.</remarks>
+    public unsafe void Write(uint baseAddress, ReadOnlySpan<byte> data)
+    {
+        ObjectDisposedException.ThrowIf(IsDisposed, this);
+        Device.PrepareForWrite(baseAddress, data);
+
+        if ((uint)data.Length > MaxWriteSize)
+            throw new ArgumentException($"Writes to this stream must not exceed {MaxWriteSize} bytes.", nameof(data));
+
+        int status;
+        fixed (byte* dataP = data)
+            status = picoboot_write_stream_write(Device.Connection, baseAddress, dataP, (uint)data.Length);
+        Device.HandleReturnCode("Write command failed", status);
+    }
+
+    /// <summary>Waits for all queued writes to be acknowledged by the device.</summary>
+    public void Flush()
+    {
+        ObjectDisposedException.ThrowIf(IsDisposed, this);
+        int status = picoboot_write_stream_flush(Device.Connection);
+        Device.HandleReturnCode("Write command failed", status);
+    }
+
+    /// <remarks>Outstanding writes are cancelled rather than flushed, call <see cref="Flush"/> first if they should complete.</remarks>
+    public void Dispose()
+    {
+        if (IsDisposed)
+            return;
+
+        IsDisposed = true;
+        picoboot_write_stream_close(Device.Connection);
+    }
+}
@@ -1,115 +1,131 @@
 ﻿using System;
+using System.Collections.Generic;
 using System.Collections.Immutable;
 using System.IO;
+using System.IO.MemoryMappedFiles;
 using System.Runtime.InteropServices;
 
 namespace Harp.Devices.Pico;
 
-public sealed class Uf2File
+/// <summary>A UF2 file mapped into memory.</summary>
+/// <remarks>
+/// Only the block headers are read when the file is opened, so opening a large multi-family UF2 only costs a pass over its headers.
+/// Blocks are fully validated by <see cref="Uf2View"/> when a family is actually used.
+/// Spans returned by <see cref="Blocks"/> are only valid until the file is disposed.
+/// </remarks>
+public sealed unsafe class Uf2File : IDisposable
 {
     internal readonly string FilePath;
-    private readonly byte[] Uf2Bytes;
-    public ReadOnlySpan<Uf2Block> Blocks => MemoryMarshal.Cast<byte, Uf2Block>(Uf2Bytes);
+    private readonly MemoryMappedFile? MappedFile;
+    private readonly MemoryMappedViewAccessor? MappedView;
+    private Uf2Block* BlocksPointer;
+    private readonly int _BlockCount;
+    private bool IsDisposed;
+
+    public ReadOnlySpan<Uf2Block> Blocks
+    {
+        get
+        {
+            ObjectDisposedException.ThrowIf(IsDisposed, this);
+            return new ReadOnlySpan<Uf2Block>(BlocksPointer, _BlockCount);
+        }
+    }
+
+    public int BlockCount => _BlockCount;
 
     /// <summary>A set of all family IDs within this UF2 marked as being flashable.</summary>
     public ImmutableSortedSet<Uf2FamilyId> FamilyIds { get; }
 
-    public unsafe Uf2File(string filePath)
+    // Indices of the flashable blocks for each family, in file order
+    private readonly Dictionary<Uf2FamilyId, int[]> FamilyBlockIndices;
+
+    /// <summary>The index of the first block with invalid start magic, or -1 if there are none.</summary>
+    /// <remarks>It's impossible to say which family such a block was meant to belong to, so any view of the file is considered malformed.</remarks>
+    internal int FirstMalformedBlockIndex { get; }
+
+    public Uf2File(string filePath)
     {
         FilePath = filePath;
-        Uf2Bytes = File.ReadAllBytes(filePath);
 
-        if (Uf2Bytes.Length % sizeof(Uf2Block) != 0)
+        long fileLength = new FileInfo(filePath).Length;
+        if (fileLength % sizeof(Uf2Block) != 0)
             throw new InvalidOperationException($"'{filePath}' is not a UF2 or is malformed: The file must be a multiple of {sizeof(Uf2Block)} bytes.");
 
-        ImmutableSortedSet<Uf2FamilyId>.Builder builder = ImmutableSortedSet.CreateBuilder<Uf2FamilyId>();
-        int blockIndex = 0;
-        foreach (ref readonly Uf2Block block in Blocks)
-        {
-            if (!block.IsValid)
-                throw new InvalidOperationException($"'{filePath}' is not a UF2 or is malformed: Block {blockIndex} is invalid.");
-            blockIndex++;
-
-            if (block.Flags.HasFlag(Uf2Flags.NotMainFlash))
-                continue;
-
-            // Ignore 0-sized blocks
-            // (picotool does this so we do too)
-            if (block.PayloadSizeBytes == 0)
-                continue;
+        _BlockCount = checked((int)(fileLength / sizeof(Uf2Block)));
 
-            if (block.Flags.HasFlag(Uf2Flags.FamilyIdPresent))
-                builder.Add((Uf2FamilyId)block.ExtraInfo);
-            else
-                builder.Add(Uf2FamilyId.None);
-        }
-
-        FamilyIds = builder.ToImmutable();
-    }
-
-    /// <summary>Flattens this UF2 file into a contiguous array of bytes</summary>
-    /// <param name="familyIdFilter">The family ID to select from the file.</param>
-    /// <param name="minAddress">The index where data actually starts in the returned buffer</param>
-    /// <param name="maxAddress">The exclusive upper bound of the data within the buffer</param>
-    /// <returns>A contiguous array of bytes where byte 0 corresponds to address 0.</returns>
-    /// <remarks>
-    /// Ideally you should avoid using this as it defeats the point of sparse UF2 files, and in some cases using the regions
-    /// of 0's added where holes used to be could result data loss in the case that a UF2 was intended explicitly as a patch.
-    /// </remarks>
-    public byte[] GetFlattened(Uf2FamilyId familyIdFilter, out uint minAddress, out uint maxAddress)
-    {
-        bool ShouldSkip(in Uf2Block block)
+        // Empty files cannot be mapped
+        if (_BlockCount > 0)
         {
-            if (block.Flags.HasFlag(Uf2Flags.NotMainFlash))
-                return true;
-
-            if (familyIdFilter != Uf2FamilyId.None)
+            MappedFile = MemoryMappedFile.CreateFromFile(filePath, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+            try
             {
-                if (!block.Flags.HasFlag(Uf2Flags.FamilyIdPresent))
-                    return true;
-                else if (block.ExtraInfo == (uint)familyIdFilter)
-                    return false;
-                else
-                    return true;
+                MappedView = MappedFile.CreateViewAccessor(0, fileLength, MemoryMappedFileAccess.Read);
+                byte* pointer = null;
+                MappedView.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+                BlocksPointer = (Uf2Block*)(pointer + MappedView.PointerOffset);
             }
-            else
+            catch
             {
-                return block.Flags.HasFlag(Uf2Flags.FamilyIdPresent);
+                MappedView?.Dispose();
+                MappedFile.Dispose();
+                throw;
             }
         }
 
-        minAddress = uint.MaxValue;
-        maxAddress = 0;
-        foreach (ref readonly Uf2Block block in Blocks)
+        // Build the family index in a single pass over the block headers
+        // Only the first 32 bytes of each block are touched here, the end magic and payload are left for Uf2View to validate.
+        Dictionary<Uf2FamilyId, List<int>> familyBlocks = new();
+        List<int>? currentBlocks = null;
+        Uf2FamilyId currentFamily = default;
+        FirstMalformedBlockIndex = -1;
+        Uf2Block* block = BlocksPointer;
+        for (int i = 0; i < _BlockCount; i++, block++)
         {
-            if (!block.IsValid)
-                throw new InvalidOperationException("The UF2 file is malformed.");
+            if (block->MagicStart0 != Uf2Block.ExpectedMagicStart0 || block->MagicStart1 != Uf2Block.ExpectedMagicStart1)
+            {
+                if (FirstMalformedBlockIndex < 0)
+                    FirstMalformedBlockIndex = i;
+                continue;
+            }
 
-            if (ShouldSkip(block))
+            Uf2Flags flags = block->Flags;
+            if (flags.HasFlag(Uf2Flags.NotMainFlash))
                 continue;
 
-            if (block.TargetAddress < minAddress)
-                minAddress = block.TargetAddress;
+            // Ignore 0-sized blocks
+            // (picotool does this so we do too)
+            if (block->PayloadSizeBytes == 0)
+                continue;
 
-            uint end = block.TargetAddress + block.PayloadSizeBytes;
-            if (end > maxAddress)
-                maxAddress = end;
-        }
+            Uf2FamilyId familyId = flags.HasFlag(Uf2Flags.FamilyIdPresent) ? (Uf2FamilyId)block->ExtraInfo : Uf2FamilyId.None;
 
-        if (maxAddress == 0 && Blocks.Length > 0)
-            throw new InvalidOperationException($"UF2 does not contain flash data{(familyIdFilter == Uf2FamilyId.None ? "" : $" family 0x{familyIdFilter:x4}")}");
+            // Families are almost always stored contiguously, so avoid the dictionary lookup for runs of the same family
+            if (currentBlocks is null || familyId != currentFamily)
+            {
+                if (!familyBlocks.TryGetValue(familyId, out currentBlocks))
+                {
+                    currentBlocks = new List<int>();
+                    familyBlocks.Add(familyId, currentBlocks);
+                }
+                currentFamily = familyId;
+            }
 
-        byte[] result = new byte[maxAddress];
-        foreach (ref readonly Uf2Block block in Blocks)
-        {
-            Span<byte> targetSpan = result.AsSpan().Slice(checked((int)block.TargetAddress), checked((int)block.PayloadSizeBytes));
-            block.Data.CopyTo(targetSpan);
+            currentBlocks.Add(i);
         }
 
-        return result;
+        FamilyBlockIndices = new Dictionary<Uf2FamilyId, int[]>(familyBlocks.Count);
+        foreach ((Uf2FamilyId familyId, List<int> blockIndices) in familyBlocks)
+            FamilyBlockIndices.Add(familyId, blockIndices.ToArray());
+
+        FamilyIds = ImmutableSortedSet.CreateRange(FamilyBlockIndices.Keys);
     }
 
-    public unsafe static bool IsUf2File(string filePath)
+    /// <summary>Gets the indices of the flashable blocks belonging to the specified family, in file order.</summary>
+    /// <remarks>The blocks have not been validated beyond their start magic.</remarks>
+    internal ReadOnlySpan<int> GetBlockIndices(Uf2FamilyId familyId)
+        => FamilyBlockIndices.TryGetValue(familyId, out int[]? blockIndices) ? blockIndices : ReadOnlySpan<int>.Empty;
+
+    public static bool IsUf2File(string filePath)
     {
         using FileStream s = File.OpenRead(filePath);
         Span<Uf2Block> firstBlock = stackalloc Uf2Block[1];
@@ -120,4 +136,19 @@ public sealed class Uf2File
 
     public override string ToString()
         => $"UF2 reader for '{FilePath}'";
+
+    public void Dispose()
+    {
+        if (IsDisposed)
+            return;
+
+        IsDisposed = true;
+        BlocksPointer = null;
+        if (MappedView is not null)
+        {
+            MappedView.SafeMemoryMappedViewHandle.ReleasePointer();
+            MappedView.Dispose();
+        }
+        MappedFile?.Dispose();
+    }
 }
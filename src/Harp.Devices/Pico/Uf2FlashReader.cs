@@ -19,47 +19,7 @@ public sealed class Uf2FlashReader : PicoFlashReaderBase
         => Read(baseAddress, buffer, fillHolesWithZero: true);
 
     public void Read(uint baseAddress, Span<byte> buffer, bool fillHolesWithZero)
-    {
-        uint nextStart = baseAddress;
-        foreach (ref readonly Uf2Block block in View.GetBlocks(baseAddress, baseAddress + (uint)buffer.Length))
-        {
-            // Pad start with zeroes
-            if (nextStart < block.TargetAddress)
-            {
-                if (!fillHolesWithZero)
-                    throw new InvalidOperationException($"Region [0x{nextStart:X8}..0x{block.TargetAddress:X8}) does not contain data.");
-
-                int zeroCount = checked((int)(block.TargetAddress - nextStart));
-                buffer.Slice(0, zeroCount).Fill(0);
-                nextStart = block.TargetAddress;
-                buffer = buffer.Slice(zeroCount);
-            }
-
-            // Determine the source span within the block
-            ReadOnlySpan<byte> data = block.Data;
-
-            uint skipBytes = nextStart - block.TargetAddress;
-            if (skipBytes > 0)
-                data = data.Slice(checked((int)skipBytes));
-
-            if (data.Length > buffer.Length)
-                data = data.Slice(0, buffer.Length);
-
-            // Copy data from block to buffer
-            data.CopyTo(buffer);
-            nextStart += checked((uint)data.Length);
-            buffer = buffer.Slice(data.Length);
-        }
-
-        // Pad end with zeroes
-        if (buffer.Length > 0)
-        {
-            if (!fillHolesWithZero)
-                throw new InvalidOperationException($"Region [0x{nextStart:X8}..0x{nextStart + (uint)buffer.Length:X8}) does not contain data.");
-
-            buffer.Fill(0);
-        }
-    }
+        => View.Image.Read(baseAddress, buffer, fillHolesWithZero);
 
     public override model_t ReadModel()
         => View.FamilyId.ToPicoModel();
@@ -0,0 +1,234 @@
+﻿using System;
+using System.Collections.Generic;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>A page-indexed view of the data within a <see cref="Uf2View"/>.</summary>
+/// <remarks>
+/// Only pages which contain data are indexed, so memory use is proportional to the payload of the UF2 rather than the address space it spans.
+/// Pages covered entirely by a single block (which is the norm for UF2s produced by the Pico SDK) refer directly to the block within the file,
+/// other pages are composed into their own buffer and track which of their bytes are holes.
+/// </remarks>
+public sealed class Uf2SparseImage
+{
+    public const int PageSize = (int)PAGE_SIZE;
+    private const int PageMask = PageSize - 1;
+    private const int CoverageWordCount = PageSize / 64;
+
+    private readonly Uf2View View;
+
+    private sealed class ComposedPage
+    {
+        public readonly byte[] Data = new byte[PageSize];
+        public readonly ulong[] Coverage = new ulong[CoverageWordCount];
+
+        public bool IsFull
+        {
+            get
+            {
+                foreach (ulong word in Coverage)
+                {
+                    if (word != ulong.MaxValue)
+                        return false;
+                }
+                return true;
+            }
+        }
+
+        public void MarkCovered(int start, int length)
+        {
+            for (int i = start; i < start + length; i++)
+                Coverage[i / 64] |= 1ul << (i % 64);
+        }
+
+        public bool IsCovered(int offset)
+            => (Coverage[offset / 64] & (1ul << (offset % 64))) != 0;
+    }
+
+    /// <summary>Either a reference to a block which covers the entire page or a composed page.</summary>
+    private readonly record struct PageEntry(int BlockIndex, int BlockOffset, ComposedPage? Composed);
+
+    // Keyed by page number (IE: address / PageSize)
+    private readonly Dictionary<uint, PageEntry> Pages = new();
+
+    /// <summary>The number of pages which contain at least some data.</summary>
+    public int PageCount => Pages.Count;
+
+    /// <summary>The total number of payload bytes in the image.</summary>
+    public long PayloadSize { get; }
+
+    public Uf2FamilyId FamilyId => View.FamilyId;
+
+    internal Uf2SparseImage(Uf2View view)
+    {
+        View = view;
+        ReadOnlySpan<Uf2Block> blocks = view.File.Blocks;
+
+        foreach ((uint startAddress, uint endAddress, int blockIndex) in view.BlockMap)
+        {
+            PayloadSize += endAddress - startAddress;
+            ReadOnlySpan<byte> data = blocks[blockIndex].Data;
+
+            uint address = startAddress;
+            while (address < endAddress)
+            {
+                uint pageNumber = address / PageSize;
+                int pageOffset = (int)(address & PageMask);
+                int length = (int)Math.Min(PageSize - pageOffset, endAddress - address);
+                int blockOffset = (int)(address - startAddress);
+
+                if (length == PageSize)
+                {
+                    // Blocks within a view never overlap, so a page covered by a whole block cannot already have an entry
+                    Pages.Add(pageNumber, new PageEntry(blockIndex, blockOffset, null));
+                }
+                else
+                {
+                    if (!Pages.TryGetValue(pageNumber, out PageEntry entry))
+                    {
+                        entry = new PageEntry(-1, 0, new ComposedPage());
+                        Pages.Add(pageNumber, entry);
+                    }
+
+                    data.Slice(blockOffset, length).CopyTo(entry.Composed!.Data.AsSpan(pageOffset));
+                    entry.Composed.MarkCovered(pageOffset, length);
+                }
+
+                address += (uint)length;
+            }
+        }
+    }
+
+    /// <summary>Gets the contents of the page containing <paramref name="address"/> if it is entirely covered by data.</summary>
+    /// <remarks>The returned span refers to the underlying UF2 file where possible and is only valid until the file is disposed.</remarks>
+    public bool TryGetFullPage(uint address, out ReadOnlySpan<byte> data)
+    {
+        if (Pages.TryGetValue(address / PageSize, out PageEntry entry))
+        {
+            if (entry.Composed is null)
+            {
+                data = View.File.Blocks[entry.BlockIndex].Data.Slice(entry.BlockOffset, PageSize);
+                return true;
+            }
+            else if (entry.Composed.IsFull)
+            {
+                data = entry.Composed.Data;
+                return true;
+            }
+        }
+
+        data = default;
+        return false;
+    }
+
+    /// <summary>Determines whether the page containing <paramref name="address"/> contains any data.</summary>
+    public bool ContainsPage(uint address)
+        => Pages.ContainsKey(address / PageSize);
+
+    /// <summary>Finds the regions of <paramref name="range"/> which do not contain data.</summary>
+    public List<AddressRange> GetHoles(AddressRange range)
+    {
+        List<AddressRange> holes = new();
+        uint holeStart = range.Start;
+        bool inHole = false;
+
+        void Covered(uint address)
+        {
+            if (inHole)
+            {
+                holes.Add(new AddressRange(holeStart, address));
+                inHole = false;
+            }
+        }
+
+        void Uncovered(uint address)
+        {
+            if (!inHole)
+            {
+                holeStart = address;
+                inHole = true;
+            }
+        }
+
+        uint address = range.Start;
+        while (address < range.End)
+        {
+            int pageOffset = (int)(address & PageMask);
+            uint length = Math.Min((uint)(PageSize - pageOffset), range.End - address);
+
+            if (!Pages.TryGetValue(address / PageSize, out PageEntry entry))
+            { Uncovered(address); }
+            else if (entry.Composed is null)
+            { Covered(address); }
+            else
+            {
+                for (int i = 0; i < length; i++)
+                {
+                    if (entry.Composed.IsCovered(pageOffset + i))
+                        Covered(address + (uint)i);
+                    else
+                        Uncovered(address + (uint)i);
+                }
+            }
+
+            address += length;
+        }
+
+        if (inHole)
+            holes.Add(new AddressRange(holeStart, range.End));
+
+        return holes;
+    }
+
+    /// <summary>Reads data from the image.</summary>
+    /// <param name="fillHolesWithZero">If false, an exception is thrown when the region being read contains a hole.</param>
+    public void Read(uint address, Span<byte> buffer, bool fillHolesWithZero)
+    {
+        ReadOnlySpan<Uf2Block> blocks = View.File.Blocks;
+        uint endAddress = checked(address + (uint)buffer.Length);
+
+        while (buffer.Length > 0)
+        {
+            int pageOffset = (int)(address & PageMask);
+            int length = Math.Min(PageSize - pageOffset, buffer.Length);
+            Span<byte> destination = buffer.Slice(0, length);
+
+            if (!Pages.TryGetValue(address / PageSize, out PageEntry entry))
+            {
+                if (!fillHolesWithZero)
+                    ThrowHole(new AddressRange(address, endAddress));
+
+                destination.Clear();
+            }
+            else if (entry.Composed is null)
+            { blocks[entry.BlockIndex].Data.Slice(entry.BlockOffset + pageOffset, length).CopyTo(destination); }
+            else
+            {
+                if (!fillHolesWithZero && !entry.Composed.IsFull)
+                {
+                    for (int i = 0; i < length; i++)
+                    {
+                        if (!entry.Composed.IsCovered(pageOffset + i))
+                            ThrowHole(new AddressRange(address + (uint)i, endAddress));
+                    }
+                }
+
+                // Holes within composed pages are already zero
+                entry.Composed.Data.AsSpan(pageOffset, length).CopyTo(destination);
+            }
+
+            address += (uint)length;
+            buffer = buffer.Slice(length);
+        }
+    }
+
+    private void ThrowHole(AddressRange remainingRange)
+    {
+        AddressRange hole = GetHoles(remainingRange)[0];
+        throw new InvalidOperationException($"Region {hole} does not contain data.");
+    }
+
+    public override string ToString()
+        => $"Sparse image of {View}";
+}
@@ -0,0 +1,117 @@
+﻿using PicobootConnection;
+using System;
+using System.Collections.Immutable;
+using System.Diagnostics;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Devices.Pico;
+
+/// <summary>Describes the regions of memory which must be programmed to upload a <see cref="Uf2View"/> to a device.</summary>
+/// <remarks>
+/// Flash data is grouped by erase sector so that each sector is erased exactly once, even when several sparse ranges of the UF2 share it.
+/// Runs of consecutive sectors are merged into a single region so that they can be erased with a single command.
+/// Sectors which don't contain any data from the UF2 are never part of a region, so their contents on the device are left alone.
+/// </remarks>
+public sealed class Uf2UploadPlan
+{
+    public sealed class Region
+    {
+        private readonly Uf2SparseImage Image;
+        public memory_type MemoryType { get; }
+        /// <summary>The range to be programmed, for flash this is aligned to <see cref="FLASH_SECTOR_ERASE_SIZE"/>.</summary>
+        public AddressRange Range { get; }
+
+        internal Region(Uf2SparseImage image, memory_type memoryType, AddressRange range)
+        {
+            Image = image;
+            MemoryType = memoryType;
+            Range = range;
+        }
+
+        /// <summary>Copies the contents of this region into <paramref name="buffer"/>, filling any holes with zeros.</summary>
+        public void CopyTo(Span<byte> buffer)
+        {
+            if (buffer.Length != Range.Size)
+                throw new ArgumentException("The buffer must be exactly the size of the region.", nameof(buffer));
+
+            if (MemoryType != memory_type.flash)
+            {
+                Image.Read(Range.Start, buffer, fillHolesWithZero: true);
+                return;
+            }
+
+            // Pages are gathered straight from the UF2 where possible, which for Pico SDK output is all of them
+            for (uint address = Range.Start; address < Range.End; address += PAGE_SIZE)
+            {
+                Span<byte> page = buffer.Slice((int)(address - Range.Start), (int)PAGE_SIZE);
+                if (Image.TryGetFullPage(address, out ReadOnlySpan<byte> data))
+                    data.CopyTo(page);
+                else
+                    Image.Read(address, page, fillHolesWithZero: true);
+            }
+        }
+
+        public byte[] ToArray()
+        {
+            byte[] result = new byte[checked((int)Range.Size)];
+            CopyTo(result);
+            return result;
+        }
+
+        public override string ToString()
+            => $"{MemoryType.FriendlyName()} region {Range}";
+    }
+
+    /// <summary>The regions to program, in the order they should be programmed.</summary>
+    public ImmutableArray<Region> Regions { get; }
+
+    /// <summary>The total number of bytes which will be programmed, including padding.</summary>
+    public ulong TotalSize { get; }
+
+    private Uf2UploadPlan(ImmutableArray<Region> regions)
+    {
+        Regions = regions;
+        foreach (Region region in regions)
+            TotalSize += region.Range.Size;
+    }
+
+    public static Uf2UploadPlan Compile(Uf2View view, model_t model)
+    {
+        const uint sectorSize = FLASH_SECTOR_ERASE_SIZE;
+        Uf2SparseImage image = view.Image;
+
+        // Flash is programmed first since on-device verification of flash clobbers SRAM
+        ImmutableArray<Region>.Builder flashRegions = ImmutableArray.CreateBuilder<Region>();
+        ImmutableArray<Region>.Builder otherRegions = ImmutableArray.CreateBuilder<Region>();
+
+        // Coalesced ranges are sorted by address, so a flash range can only ever share a sector with the range immediately before it
+        AddressRange? pendingFlash = null;
+        foreach (AddressRange coalescedRange in view.CoalescedRanges)
+        {
+            memory_type memoryType = PBC_get_memory_type(coalescedRange.Start, model);
+            Debug.Assert(PBC_get_memory_type(coalescedRange.End - 1, model) == memoryType, "UF2 ranges are not expected to straddle memory types!");
+
+            if (memoryType != memory_type.flash)
+            {
+                otherRegions.Add(new Region(image, memoryType, coalescedRange));
+                continue;
+            }
+
+            AddressRange sectors = coalescedRange.GetAligned(sectorSize);
+            if (pendingFlash is AddressRange pending && sectors.Start <= pending.End)
+            { pendingFlash = new AddressRange(pending.Start, Math.Max(pending.End, sectors.End)); }
+            else
+            {
+                if (pendingFlash is AddressRange previous)
+                    flashRegions.Add(new Region(image, memory_type.flash, previous));
+                pendingFlash = sectors;
+            }
+        }
+
+        if (pendingFlash is AddressRange last)
+            flashRegions.Add(new Region(image, memory_type.flash, last));
+
+        flashRegions.AddRange(otherRegions);
+        return new Uf2UploadPlan(flashRegions.ToImmutable());
+    }
+}
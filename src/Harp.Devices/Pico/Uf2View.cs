@@ -6,11 +6,11 @@ namespace Harp.Devices.Pico;
 
 public sealed class Uf2View
 {
-    private readonly Uf2File File;
+    internal readonly Uf2File File;
     public Uf2FamilyId FamilyId { get; }
 
     // StartAddress is inclusive, EndAddress is exclusive
-    private readonly List<(uint StartAddress, uint EndAddress, int BlockIndex)> BlockMap = new();
+    internal readonly List<(uint StartAddress, uint EndAddress, int BlockIndex)> BlockMap = new();
 
     /// <summary>Inclusive lower address targeted by the blocks in this view.</summary>
     public uint MinAddress { get; }
@@ -19,6 +19,10 @@ public sealed class Uf2View
 
     public int BlockCount => BlockMap.Count;
 
+    private Uf2SparseImage? _Image;
+    /// <summary>A page-indexed image of the data within this view, built on first use.</summary>
+    public Uf2SparseImage Image => _Image ??= new Uf2SparseImage(this);
+
     public Uf2View(Uf2File file, Uf2FamilyId familyIdFilter)
     {
         File = file;
@@ -27,31 +31,22 @@ public sealed class Uf2View
         MinAddress = uint.MaxValue;
         MaxAddress = 0;
 
-        int blockIndex = -1;
-        foreach (ref readonly Uf2Block block in File.Blocks)
-        {
-            blockIndex++;
-            if (block.Flags.HasFlag(Uf2Flags.NotMainFlash))
-                continue;
+        if (File.FirstMalformedBlockIndex >= 0)
+            throw new InvalidOperationException($"'{File.FilePath}' is not a UF2 or is malformed: Block {File.FirstMalformedBlockIndex} is invalid.");
 
-            // Ignore 0-sized blocks
-            // (picotool does this so we do too)
-            if (block.PayloadSizeBytes == 0)
-                continue;
+        // Blocks are validated here rather than when the file is opened so that we only pay for the families which are actually used
+        ReadOnlySpan<Uf2Block> blocks = File.Blocks;
+        foreach (int blockIndex in File.GetBlockIndices(familyIdFilter))
+        {
+            ref readonly Uf2Block block = ref blocks[blockIndex];
+            if (!block.IsValid)
+                throw new InvalidOperationException($"'{File.FilePath}' is not a UF2 or is malformed: Block {blockIndex} is invalid.");
 
             // Fail if payload is too long
             // (We don't check this until here in case some future UF2 extension uses the field for something else
             if (block.PayloadSizeBytes > Uf2Block.MaxDataSize)
                 throw new InvalidOperationException($"UF2 data for family {FamilyId} are malformed: Block {blockIndex} payload size exceeds the maximum.");
 
-            if (block.Flags.HasFlag(Uf2Flags.FamilyIdPresent))
-            {
-                if (block.ExtraInfo != (uint)familyIdFilter)
-                    continue;
-            }
-            else if (familyIdFilter != Uf2FamilyId.None)
-            { continue; }
-
             AddressRange addressRange = block.AddressRange;
 
             if (addressRange.Start < MinAddress)
@@ -7,6 +7,7 @@ using System;
 using System.Collections.Immutable;
 using System.ComponentModel;
 using System.Diagnostics;
+using System.Globalization;
 using System.Runtime.Versioning;
 using static Harp.Devices.SetupApi.Globals;
 
@@ -15,7 +16,7 @@ namespace Harp.Devices;
 [SupportedOSPlatform("windows")]
 internal unsafe static class WindowsDeviceEnumerator
 {
-    private static Device? TryCreate(ref LibUsbDeviceList? libUsbDevices, HDEVINFO deviceList, SP_DEVINFO_DATA* deviceInfo)
+    private static Device? TryCreate(ref LibUsbDeviceList? libUsbDevices, DeviceMetadataCache? metadataCache, HDEVINFO deviceList, SP_DEVINFO_DATA* deviceInfo)
     {
         Device result;
 
@@ -83,8 +84,17 @@ internal unsafe static class WindowsDeviceEnumerator
                     Source = $"Picoboot USB Device - {instanceId}",
                 };
 
-                if (PicobootDevice.TryOpen(libUsbDevices ??= new(), deviceList, deviceInfo, instanceId) is PicobootDevice picobootDevice)
+                string? cacheKey = TryGetMetadataCacheKey(deviceList, deviceInfo);
+                if (metadataCache is not null && metadataCache.TryResolve(cacheKey, result, out Device resolved))
+                {
+                    result = resolved;
+                }
+                else if (PicobootDevice.TryOpen(libUsbDevices ??= new(), deviceList, deviceInfo, instanceId) is PicobootDevice picobootDevice)
+                {
                     result = result.WithMetadataFromPicobootDevice(picobootDevice);
+                    if (cacheKey is not null)
+                        metadataCache?.Add(cacheKey, result);
+                }
             }
             else
             {
@@ -182,7 +192,24 @@ internal unsafe static class WindowsDeviceEnumerator
         }
     }
 
-    internal static void EnumerateDevices(ImmutableArray<Device>.Builder builder)
+    /// <summary>Gets the <see cref="DeviceMetadataCache"/> key for a PICOBOOT interface from the instance ID of its parent composite device.</summary>
+    private static string? TryGetMetadataCacheKey(HDEVINFO deviceList, SP_DEVINFO_DATA* deviceInfo)
+    {
+        // Devices with a serial number have an instance ID like USB\VID_2E8A&PID_0003\<serial>
+        // Otherwise the last part is generated by Windows from the port the device is connected to, in which case it contains ampersands
+        string? parentInstanceId = TryGetDevicePropertyString(deviceList, deviceInfo, DEVPROPKEY.DEVPKEY_Device_Parent);
+        if (parentInstanceId?.Split('\\') is not [_, string ids, string serialNumber] || serialNumber.Contains('&'))
+            return null;
+
+        if (ids.Length != "VID_xxxx&PID_xxxx".Length
+            || !ushort.TryParse(ids.AsSpan(4, 4), NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out ushort vendorId)
+            || !ushort.TryParse(ids.AsSpan(13, 4), NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out ushort productId))
+            return null;
+
+        return DeviceMetadataCache.GetKey(vendorId, productId, serialNumber);
+    }
+
+    internal static void EnumerateDevices(ImmutableArray<Device>.Builder builder, DeviceMetadataCache? metadataCache)
     {
         // Note: Avoid any temptation to replace this with libusb to make it automatically cross-platform
         // libusb reads things like the USB descriptor strings by communicating with the device, which we're actively trying to avoid
@@ -214,7 +241,7 @@ internal unsafe static class WindowsDeviceEnumerator
                     return;
                 }
 
-                if (TryCreate(ref libUsbDevices, deviceList, &deviceInfo) is Device newDevice)
+                if (TryCreate(ref libUsbDevices, metadataCache, deviceList, &deviceInfo) is Device newDevice)
                     builder.Add(newDevice);
             }
         }
@@ -0,0 +1,45 @@
+﻿using System;
+using System.Numerics;
+using Xunit;
+
+namespace Harp.Protocol.Tests;
+
+public sealed class HarpChecksumTests
+{
+    private static byte ComputeScalar(ReadOnlySpan<byte> data)
+    {
+        byte result = 0;
+        foreach (byte b in data)
+            result += b;
+        return result;
+    }
+
+    [Fact]
+    public void VectorizedMatchesScalar()
+    {
+        // Mostly large bytes so that each lane wraps many times
+        byte[] data = new byte[Vector<byte>.Count * 5 + 3];
+        Random random = new(1234);
+        for (int i = 0; i < data.Length; i++)
+            data[i] = (byte)random.Next(0xC0, 0x100);
+
+        // Every length around each multiple of the vector width, including ones too short to vectorize at all
+        // Unaligned starts are included since the vectorized path reads the span as-is
+        for (int start = 0; start < 3; start++)
+        {
+            for (int length = 0; start + length <= data.Length; length++)
+            {
+                ReadOnlySpan<byte> span = data.AsSpan(start, length);
+                Assert.Equal(ComputeScalar(span), HarpChecksum.Compute(span));
+            }
+        }
+    }
+
+    [Fact]
+    public void MaximumMessageLength()
+    {
+        byte[] data = new byte[ushort.MaxValue + 4];
+        data.AsSpan().Fill(0xFF);
+        Assert.Equal(ComputeScalar(data), HarpChecksum.Compute(data));
+    }
+}
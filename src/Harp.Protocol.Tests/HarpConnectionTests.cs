@@ -0,0 +1,69 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+using Xunit;
+
+namespace Harp.Protocol.Tests;
+
+public sealed class HarpConnectionTests
+{
+    /// <summary>Replies to every request with <see cref="Reply"/>, handing it out in contiguous fragments as though it wrapped around a ring buffer.</summary>
+    private sealed class FragmentingTransport(int fragmentSize) : IHarpBufferedTransport
+    {
+        private readonly List<byte> Buffered = new();
+
+        public required byte[] Reply { get; init; }
+        public string PortName => "Fragmenting";
+        public int ReadTimeout { get; set; }
+        public int WriteTimeout { get; set; }
+
+        public ReadOnlySpan<byte> Peek(int minimumLength)
+        {
+            Assert.InRange(minimumLength, 0, IHarpBufferedTransport.MaxMinimumLength);
+            if (Buffered.Count < minimumLength)
+                throw new TimeoutException();
+
+            int length = Math.Min(Buffered.Count, Math.Max(minimumLength, fragmentSize));
+            return Buffered.GetRange(0, length).ToArray();
+        }
+
+        public void Advance(int count)
+            => Buffered.RemoveRange(0, count);
+
+        public int Read(byte[] buffer, int offset, int count)
+            => throw new InvalidOperationException("Buffered transports should be parsed in place.");
+
+        public void Write(byte[] buffer, int offset, int count)
+            => Buffered.AddRange(Reply);
+
+        public void Dispose()
+        { }
+    }
+
+    // Fragments are small enough to split the extended length and timestamp fields
+    [Theory]
+    [InlineData(1)]
+    [InlineData(2)]
+    [InlineData(5)]
+    [InlineData(4096)]
+    public void ReceivesFragmentedResponseInPlace(int fragmentSize)
+    {
+        ushort[] value = new ushort[200];
+        for (int i = 0; i < value.Length; i++)
+            value[i] = (ushort)(i * 31);
+        HarpTimestamp timestamp = new(123456, 789);
+
+        byte[] reply = new byte[HarpMessageEncoder.GetEncodedLength(hasTimestamp: true, value.Length * sizeof(ushort))];
+        HarpMessageEncoder.Encode(reply, MessageType.Write, 42, PayloadType.GetType<ushort>(hasTimestamp: true), timestamp, MemoryMarshal.AsBytes(value.AsSpan()));
+
+        FragmentingTransport transport = new(fragmentSize) { Reply = reply };
+        using HarpConnection connection = new(transport, timeoutMilliseconds: 1000);
+        HarpMessage response = connection.Write<ushort>(42, value, timestamp);
+
+        Assert.True(response.IsValid);
+        Assert.Equal(MessageType.Write, response.MessageType);
+        Assert.Equal(timestamp, response.Timestamp);
+        Assert.Equal(MemoryMarshal.AsBytes(value.AsSpan()).ToArray(), response.RawPayload.ToArray());
+        Assert.Empty(transport.Peek(0).ToArray());
+    }
+}
@@ -0,0 +1,149 @@
+﻿using System;
+using Xunit;
+
+namespace Harp.Protocol.Tests;
+
+public sealed class HarpMessageRoundTripTests
+{
+    private static readonly HarpTimestamp Timestamp = new(123456, 789);
+
+    private static byte[] CreatePayload(int length)
+    {
+        byte[] result = new byte[length];
+        new Random(length).NextBytes(result);
+        return result;
+    }
+
+    private static byte[] Encode(bool hasTimestamp, byte[] payload)
+    {
+        byte[] message = new byte[HarpMessageEncoder.GetEncodedLength(hasTimestamp, payload.Length)];
+        PayloadType payloadType = PayloadType.GetType<byte>(hasTimestamp);
+        int length = HarpMessageEncoder.Encode(message, MessageType.Write, 42, payloadType, hasTimestamp ? Timestamp : null, payload);
+        Assert.Equal(message.Length, length);
+        return message;
+    }
+
+    private static void AssertMessage(bool hasTimestamp, byte[] payload, HarpMessage? message)
+    {
+        Assert.NotNull(message);
+        Assert.True(message.IsValid);
+        Assert.Equal(MessageType.Write, message.MessageType);
+        Assert.Equal(42, message.Address);
+        Assert.Equal(0xFF, message.Port);
+        Assert.Equal(PayloadType.GetType<byte>(hasTimestamp).RawValue, message.PayloadType.RawValue);
+        Assert.Equal(hasTimestamp ? Timestamp : HarpTimestamp.Invalid, message.Timestamp);
+        Assert.Equal(payload, message.RawPayload.ToArray());
+    }
+
+    // The length field overflows into the extended length at 255, which is at a payload of 251 bytes without a timestamp or 245 bytes with one
+    [Theory]
+    [InlineData(0, false)]
+    [InlineData(0, true)]
+    [InlineData(244, true)]
+    [InlineData(245, true)]
+    [InlineData(246, true)]
+    [InlineData(250, false)]
+    [InlineData(250, true)]
+    [InlineData(251, false)]
+    [InlineData(251, true)]
+    [InlineData(252, false)]
+    [InlineData(252, true)]
+    [InlineData(ushort.MaxValue - 4, false)]
+    [InlineData(ushort.MaxValue - 10, true)]
+    public void RoundTrip(int payloadLength, bool hasTimestamp)
+    {
+        byte[] payload = CreatePayload(payloadLength);
+        byte[] encoded = Encode(hasTimestamp, payload);
+
+        int lengthField = encoded.Length - 2;
+        if (lengthField < byte.MaxValue)
+        { Assert.Equal(lengthField, encoded[1]); }
+        else
+        {
+            lengthField -= 2;
+            Assert.Equal(byte.MaxValue, encoded[1]);
+            Assert.Equal(lengthField, BitConverter.ToUInt16(encoded, 2));
+        }
+
+        HarpMessageParser parser = new();
+        HarpMessage? message = parser.Consume(encoded, out int bytesConsumed);
+        Assert.Equal(encoded.Length, bytesConsumed);
+        AssertMessage(hasTimestamp, payload, message);
+    }
+
+    [Theory]
+    [InlineData(250, false)]
+    [InlineData(251, false)]
+    [InlineData(252, false)]
+    [InlineData(251, true)]
+    [InlineData(ushort.MaxValue - 10, true)]
+    public void RoundTripIntoPayloadBuffer(int payloadLength, bool hasTimestamp)
+    {
+        byte[] payload = CreatePayload(payloadLength);
+        byte[] encoded = Encode(hasTimestamp, payload);
+
+        // Trailing bytes belong to the next message and must be left alone
+        byte[] stream = new byte[encoded.Length + 3];
+        encoded.CopyTo(stream, 0);
+
+        HarpMessageParser parser = new(new byte[ushort.MaxValue]);
+        Assert.True(parser.TryConsume(stream, out int bytesConsumed));
+        Assert.Equal(encoded.Length, bytesConsumed);
+
+        HarpMessageView<byte> view = parser.GetView<byte>();
+        Assert.True(view.IsValid);
+        Assert.Equal(hasTimestamp ? Timestamp : HarpTimestamp.Invalid, view.Timestamp);
+        Assert.Equal(payload, view.Payload.ToArray());
+    }
+
+    [Theory]
+    [InlineData(1, false)]
+    [InlineData(251, false)]
+    [InlineData(252, true)]
+    [InlineData(1000, true)]
+    public void RoundTripInFragments(int payloadLength, bool hasTimestamp)
+    {
+        byte[] payload = CreatePayload(payloadLength);
+        byte[] encoded = Encode(hasTimestamp, payload);
+
+        // Fragments are small enough to split the extended length and timestamp fields
+        for (int fragmentSize = 1; fragmentSize <= 7; fragmentSize++)
+        {
+            HarpMessageParser parser = new();
+            HarpMessage? message = null;
+            int offset = 0;
+            int available = 0;
+            while (message is null)
+            {
+                // Fields are only consumed once they're complete, so unconsumed bytes are offered again along with the next fragment
+                available = Math.Min(available + fragmentSize, encoded.Length);
+                message = parser.Consume(encoded.AsSpan(offset, available - offset), out int bytesConsumed);
+                offset += bytesConsumed;
+            }
+
+            Assert.Equal(encoded.Length, offset);
+            AssertMessage(hasTimestamp, payload, message);
+        }
+    }
+
+    [Theory]
+    [InlineData(ushort.MaxValue - 3, false)]
+    [InlineData(ushort.MaxValue - 9, true)]
+    public void OversizedPayloadIsRejected(int payloadLength, bool hasTimestamp)
+    {
+        Assert.Throws<ArgumentException>(() => HarpMessageEncoder.GetEncodedLength(hasTimestamp, payloadLength));
+        Assert.Throws<ArgumentException>(() => Encode(hasTimestamp, new byte[payloadLength]));
+    }
+
+    [Fact]
+    public void CorruptChecksumIsDetected()
+    {
+        byte[] encoded = Encode(hasTimestamp: true, CreatePayload(300));
+        encoded[^1] ^= 1;
+
+        HarpMessageParser parser = new();
+        HarpMessage? message = parser.Consume(encoded, out _);
+        Assert.NotNull(message);
+        Assert.False(message.IsValid);
+    }
+}
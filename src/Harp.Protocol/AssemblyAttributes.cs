@@ -0,0 +1,5 @@
+﻿using System.Runtime.CompilerServices;
+
+[assembly: InternalsVisibleTo("Harp.Benchmarks")]
+[assembly: InternalsVisibleTo("Harp.Simulator")]
+[assembly: InternalsVisibleTo("Harp.Protocol.Tests")]
\ No newline at end of file
@@ -0,0 +1,34 @@
+﻿using System;
+using System.Numerics;
+using System.Runtime.InteropServices;
+
+namespace Harp.Protocol;
+
+internal static class HarpChecksum
+{
+    /// <summary>Computes the sum of <paramref name="data"/> modulo 256, which is how the checksum of a Harp message is formed.</summary>
+    /// <remarks>
+    /// Addition modulo 256 is associative, so each lane of a vector can accumulate its own sum (with each lane wrapping independently)
+    /// and the lanes can be summed at the end without changing the result.
+    /// </remarks>
+    public static byte Compute(ReadOnlySpan<byte> data)
+    {
+        byte result = 0;
+
+        if (Vector.IsHardwareAccelerated && data.Length >= Vector<byte>.Count)
+        {
+            Vector<byte> sums = Vector<byte>.Zero;
+            ReadOnlySpan<Vector<byte>> vectors = MemoryMarshal.Cast<byte, Vector<byte>>(data);
+            foreach (Vector<byte> vector in vectors)
+                sums += vector;
+
+            result = Vector.Sum(sums);
+            data = data.Slice(vectors.Length * Vector<byte>.Count);
+        }
+
+        foreach (byte b in data)
+            result += b;
+
+        return result;
+    }
+}
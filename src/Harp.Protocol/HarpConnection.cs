@@ -1,77 +1,147 @@
 ﻿//#define PRINT_RECEIVED_MESSAGES
 using System;
 using System.Diagnostics;
+using System.IO;
 using System.IO.Ports;
 using System.Runtime.InteropServices;
+using System.Threading;
 
 namespace Harp.Protocol;
 
 public sealed class HarpConnection : IDisposable
 {
-    private readonly SerialPort Port;
+    private readonly IHarpTransport Transport;
+    /// <summary><see cref="Transport"/> if it can be parsed in place, in which case <see cref="ReceiveBuffer"/> goes unused.</summary>
+    private readonly IHarpBufferedTransport? BufferedTransport;
 
     private readonly byte[] ReceiveBuffer = new byte[1024];
     private int WriteHead = 0;
     private int ReadHead = 0;
 
-    public HarpConnection(string portName, int timeoutMilliseconds = SerialPort.InfiniteTimeout)
+    /// <summary>How long a transaction waits for its response, this is also the port's read timeout unless the connection is streaming.</summary>
+    private readonly int TransactionTimeout;
+    private readonly object TransactionLock = new();
+
+    /// <summary>Connects to the specified serial port using the best transport for the current platform.</summary>
+    public HarpConnection(string portName, int timeoutMilliseconds = SerialPort.InfiniteTimeout, int baudRate = HarpTransport.DefaultBaudRate)
+        : this(HarpTransport.Open(portName, baudRate), timeoutMilliseconds)
+    { }
+
+    /// <summary>Communicates over <paramref name="transport"/>, which is owned by the connection from now on.</summary>
+    public HarpConnection(IHarpTransport transport, int timeoutMilliseconds = SerialPort.InfiniteTimeout)
     {
-        Port = new SerialPort(portName, 115200)
-        {
-            ReadTimeout = timeoutMilliseconds,
-            WriteTimeout = timeoutMilliseconds,
-        };
-        Port.Open();
+        TransactionTimeout = timeoutMilliseconds;
+        Transport = transport;
+        BufferedTransport = transport as IHarpBufferedTransport;
+        Transport.ReadTimeout = timeoutMilliseconds;
+        Transport.WriteTimeout = timeoutMilliseconds;
 
 #if DEBUG
         ReceiveBuffer.AsSpan().Fill(0xCC);
 #endif
     }
 
-    private HarpMessage DoTransaction(MessageType messageType, byte address, PayloadType payloadType, ReadOnlySpan<byte> rawPayload)
+    // Large enough for any message without extended length, grown as needed for extended-length messages
+    private byte[] TransmitBuffer = new byte[byte.MaxValue + 2];
+
+    private byte[] GetTransmitBuffer(int length)
     {
-        byte[] messageData = new byte[6 + rawPayload.Length];
+        if (TransmitBuffer.Length < length)
+            TransmitBuffer = new byte[length];
+        return TransmitBuffer;
+    }
 
-        if (messageData.Length > byte.MaxValue)
-            throw new NotImplementedException("This method doesn't implement extended-length message support.");
-        if (payloadType.HasTimestamp)
-            throw new NotImplementedException("This method doesn't implement timestamp support.");
+    private HarpMessage DoTransaction(MessageType messageType, byte address, PayloadType payloadType, HarpTimestamp? timestamp, ReadOnlySpan<byte> rawPayload)
+    {
+        HarpMessageParser parser = new();
+        DoTransaction(messageType, address, payloadType, timestamp, rawPayload, ref parser);
+        return HarpMessage.Create(parser);
+    }
 
-        messageData[0] = (byte)messageType;
-        messageData[1] = checked((byte)(messageData.Length - 2));
-        messageData[2] = address;
-        messageData[3] = 0xFF;
-        messageData[4] = payloadType.RawValue;
+    /// <summary>Consumes the buffered data using <paramref name="parser"/>.</summary>
+    /// <exception cref="IOException">The buffered data is not a message the parser can handle, in which case it is discarded.</exception>
+    private bool TryConsumeBuffered(ref HarpMessageParser parser)
+    {
+        try
+        {
+            bool isComplete = parser.TryConsume(ReceiveBuffer.AsSpan().Slice(ReadHead, WriteHead - ReadHead), out int bytesConsumed);
+            ReadHead += bytesConsumed;
+            return isComplete;
+        }
+        catch (InvalidOperationException ex)
+        {
+            // There's no way to find the start of the next message, so we throw away everything received so far and start over
+            // Otherwise we'd trip over the same bytes on every subsequent attempt
+            Trace.WriteLine($"Discarding {WriteHead - ReadHead} buffered byte(s) from {Transport.PortName} after a malformed message: {ex.Message}");
+            ReadHead = 0;
+            WriteHead = 0;
+            parser.Reset();
+            throw new IOException("Received a malformed message.", ex);
+        }
+    }
 
-        rawPayload.CopyTo(messageData.AsSpan().Slice(5, rawPayload.Length));
+    /// <summary>Consumes <paramref name="buffered"/>, which was peeked from <paramref name="transport"/>, using <paramref name="parser"/>.</summary>
+    /// <param name="minimumLength">Updated to the amount of data the next peek needs for the parser to make progress.</param>
+    /// <exception cref="IOException">The buffered data is not a message the parser can handle, in which case it is discarded.</exception>
+    private bool TryConsumeInPlace(IHarpBufferedTransport transport, ReadOnlySpan<byte> buffered, ref HarpMessageParser parser, ref int minimumLength)
+    {
+        bool isComplete;
+        int bytesConsumed;
+        try
+        { isComplete = parser.TryConsume(buffered, out bytesConsumed); }
+        catch (InvalidOperationException ex)
+        {
+            Trace.WriteLine($"Discarding {buffered.Length} buffered byte(s) from {Transport.PortName} after a malformed message: {ex.Message}");
+            transport.Advance(buffered.Length);
+            minimumLength = 1;
+            parser.Reset();
+            throw new IOException("Received a malformed message.", ex);
+        }
 
-        byte checksum = 0;
-        foreach (byte data in messageData)
-            checksum += data;
-        messageData[messageData.Length - 1] = checksum;
+        transport.Advance(bytesConsumed);
+        // The parser makes no progress when the data ends partway through a multi-byte field (IE: a timestamp split across reads), so wait for more than that
+        minimumLength = bytesConsumed == 0 ? buffered.Length + 1 : 1;
+        return isComplete;
+    }
+
+    /// <summary>Receives the next message using <paramref name="parser"/>, which is reset first.</summary>
+    /// <exception cref="TimeoutException">Nothing was received within the read timeout of <paramref name="startTimestamp"/>.</exception>
+    /// <exception cref="IOException">A malformed message was received.</exception>
+    private void ReceiveMessage(ref HarpMessageParser parser, long startTimestamp)
+    {
+        parser.Reset();
+        if (BufferedTransport is IHarpBufferedTransport transport)
+        {
+            int minimumLength = 1;
+            while (true)
+            {
+                if (TransactionTimeout != SerialPort.InfiniteTimeout && Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds > TransactionTimeout)
+                    throw new TimeoutException();
 
-        Port.Write(messageData, 0, messageData.Length);
+                if (TryConsumeInPlace(transport, transport.Peek(minimumLength), ref parser, ref minimumLength))
+                    return;
+            }
+        }
 
-        // Wait for the response
-#if PRINT_RECEIVED_MESSAGES
-        Console.WriteLine($"====================== Awaiting response from {messageType} {payloadType} {(CommonRegister)address}...");
-#endif
-        long startTimestamp = Stopwatch.GetTimestamp();
-        TryAgain:
-        HarpMessageParser parser = new();
-        HarpMessage? message = null;
-        while (message is null)
+        // Data left over from the previous message (IE: an event which arrived alongside a response) is parsed before reading more
+        bool needMoreData = ReadHead == WriteHead;
+        while (true)
         {
-            // This is to handle the case where we keep trying again and again but never get a response
-            if (Port.ReadTimeout != SerialPort.InfiniteTimeout && Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds > Port.ReadTimeout)
-                throw new TimeoutException();
+            if (needMoreData)
+            {
+                // This is to handle the case where we keep trying again and again but never get a response
+                if (TransactionTimeout != SerialPort.InfiniteTimeout && Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds > TransactionTimeout)
+                    throw new TimeoutException();
 
-            WriteHead += Port.Read(ReceiveBuffer, WriteHead, ReceiveBuffer.Length - WriteHead);
+                WriteHead += Transport.Read(ReceiveBuffer, WriteHead, ReceiveBuffer.Length - WriteHead);
+            }
 
-            message = parser.Consume(ReceiveBuffer.AsSpan().Slice(ReadHead, WriteHead - ReadHead), out int bytesConsumed);
-            ReadHead += bytesConsumed;
+            int previousReadHead = ReadHead;
+            bool isComplete = TryConsumeBuffered(ref parser);
+            // The parser makes no progress when the buffer ends partway through a multi-byte field (IE: a timestamp split across reads)
+            needMoreData = ReadHead == WriteHead || ReadHead == previousReadHead;
 #if PRINT_RECEIVED_MESSAGES
-            Console.WriteLine($"Parser consumed {bytesConsumed} bytes with {WriteHead - ReadHead} remaining in the buffer. ParserState = {parser.ParserState}");
+            Console.WriteLine($"Parser has {WriteHead - ReadHead} bytes remaining in the buffer. ParserState = {parser.ParserState}");
 #endif
 
             // Move data back to the start of the buffer if we've exhausted it
@@ -86,51 +156,34 @@ public sealed class HarpConnection : IDisposable
                 ReceiveBuffer.AsSpan().Slice(WriteHead).Fill(0xCC);
 #endif
             }
+
+            if (isComplete)
+                break;
         }
 
 #if PRINT_RECEIVED_MESSAGES
         Console.WriteLine("Got response!");
-        Console.WriteLine($"MessageType: {message.MessageType}");
-        Console.WriteLine($"Address: {(CommonRegister)message.Address}");
-        Console.WriteLine($"Port: {message.Port}");
-        Console.WriteLine($"PayloadType: {message.PayloadType}");
-        Console.WriteLine($"Timestamp: {message.Timestamp}");
+        Console.WriteLine($"MessageType: {parser.MessageType}");
+        Console.WriteLine($"Address: {(CommonRegister)parser.Address}");
+        Console.WriteLine($"Port: {parser.Port}");
+        Console.WriteLine($"PayloadType: {parser.PayloadType}");
+        Console.WriteLine($"Timestamp: {parser.Timestamp}");
 
         Console.Write("RawPayload: [ ");
-        for (int i = 0; i < message.RawPayload.Length; i++)
+        for (int i = 0; i < parser.PayloadSpan.Length; i++)
         {
             if (i > 0)
                 Console.Write(", ");
-            Console.Write($"{message.RawPayload[i]:X2}");
+            Console.Write($"{parser.PayloadSpan[i]:X2}");
         }
         Console.WriteLine(" ]");
 
-        if (message is HarpMessage<ushort> { Payload.Length: 1 } ushortMessage)
-            Console.WriteLine($"Payload: {ushortMessage.Payload[0]}");
-        else if (message is HarpMessage<uint> { Payload.Length: 1 } uintMessage)
-            Console.WriteLine($"Payload: {uintMessage.Payload[0]}");
-
-        Console.WriteLine($"IsValid: {message.IsValid}");
-        Console.WriteLine($"Checksum: {message.Checksum} (Received)");
-        Console.WriteLine($"Checksum: {message.CalculatedChecksum} (Calculated)");
+        Console.WriteLine($"Checksum: {parser.Checksum} (Received)");
+        Console.WriteLine($"Checksum: {parser.CalculatedChecksum} (Calculated)");
 
         Console.WriteLine();
 #endif
 
-        // If the message was an event, then it's not actually our response. Try again.
-        if (message.MessageType == MessageType.Event)
-        {
-            Trace.WriteLine($"Got event in response to {messageType} {(CommonRegister)address} transaction, trying again...");
-            goto TryAgain;
-        }
-
-        //TODO: Not all messages will get a reply from the same address, need a more robust way to handle this.
-        if (message.Address != address)
-        {
-            Trace.WriteLine($"Got irrelevant {messageType} {(CommonRegister)message.Address} in response to {messageType} {(CommonRegister)address} transaction, trying again...");
-            goto TryAgain;
-        }
-
         // Reset read/write head if there isn't any extra data left in the buffer
         if (ReadHead == WriteHead)
         {
@@ -140,13 +193,184 @@ public sealed class HarpConnection : IDisposable
             ReceiveBuffer.AsSpan().Fill(0xCC);
 #endif
         }
+    }
+
+    /// <summary>Receives the next response, either from the port or from the stream reader if the connection is streaming.</summary>
+    /// <exception cref="TimeoutException">Nothing was received within the read timeout of <paramref name="startTimestamp"/>.</exception>
+    /// <exception cref="IOException">A malformed message was received.</exception>
+    private void ReceiveResponse(ref HarpMessageParser parser, long startTimestamp)
+    {
+        if (ResponseRing is not HarpMessageRing responses)
+        {
+            ReceiveMessage(ref parser, startTimestamp);
+            return;
+        }
+
+        while (true)
+        {
+            try
+            {
+                if (responses.TryRead(ref parser))
+                    return;
+            }
+            catch (InvalidOperationException ex)
+            { throw new IOException("Received a response which is too large for the payload buffer.", ex); }
+
+            if (StreamException is Exception streamException)
+                throw new IOException("The stream reader stopped due to an error.", streamException);
+
+            int remainingMilliseconds = SerialPort.InfiniteTimeout;
+            if (TransactionTimeout != SerialPort.InfiniteTimeout)
+            {
+                remainingMilliseconds = TransactionTimeout - (int)Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds;
+                if (remainingMilliseconds <= 0)
+                    throw new TimeoutException();
+            }
+
+            responses.Wait(remainingMilliseconds);
+        }
+    }
+
+    /// <summary>Sends a request and receives the response to it using <paramref name="parser"/>.</summary>
+    /// <remarks>The parser is reset between attempts. Nothing is allocated unless the parser allocates its payload.</remarks>
+    private void DoTransaction(MessageType messageType, byte address, PayloadType payloadType, HarpTimestamp? timestamp, ReadOnlySpan<byte> rawPayload, ref HarpMessageParser parser)
+    {
+        lock (TransactionLock)
+            DoTransactionLocked(messageType, address, payloadType, timestamp, rawPayload, ref parser);
+    }
+
+    private void DoTransactionLocked(MessageType messageType, byte address, PayloadType payloadType, HarpTimestamp? timestamp, ReadOnlySpan<byte> rawPayload, ref HarpMessageParser parser)
+    {
+        byte[] transmitBuffer = GetTransmitBuffer(HarpMessageEncoder.GetEncodedLength(payloadType.HasTimestamp, rawPayload.Length));
+        int messageLength = HarpMessageEncoder.Encode(transmitBuffer, messageType, address, payloadType, timestamp, rawPayload);
+        ResponseRing?.Clear();
+        Transport.Write(transmitBuffer, 0, messageLength);
+
+        // Wait for the response
+#if PRINT_RECEIVED_MESSAGES
+        Console.WriteLine($"====================== Awaiting response from {messageType} {payloadType} {(CommonRegister)address}...");
+#endif
+        long startTimestamp = Stopwatch.GetTimestamp();
+        while (true)
+        {
+            ReceiveResponse(ref parser, startTimestamp);
+
+            // If the message was an event, then it's not actually our response. Try again.
+            if (parser.MessageType == MessageType.Event)
+            {
+                Trace.WriteLine($"Got event in response to {messageType} {(CommonRegister)address} transaction, trying again...");
+                continue;
+            }
+
+            //TODO: Not all messages will get a reply from the same address, need a more robust way to handle this.
+            if (parser.Address != address)
+            {
+                Trace.WriteLine($"Got irrelevant {messageType} {(CommonRegister)parser.Address} in response to {messageType} {(CommonRegister)address} transaction, trying again...");
+                continue;
+            }
+
+            return;
+        }
+    }
+
+    /// <summary>Reads several registers at once, all of the requests are sent before waiting for any of the responses.</summary>
+    /// <param name="requests">The registers to read along with the payload type of each. Each register may only appear once.</param>
+    /// <returns>
+    /// The response to each request in the same order as <paramref name="requests"/>, or null for requests which weren't answered.
+    /// Responses may be <see cref="MessageType.ReadError"/>s.
+    /// </returns>
+    /// <remarks>
+    /// Responses are matched to their requests by address, so they may arrive in any order.
+    /// The read timeout applies to the batch as a whole rather than to each request, so an unresponsive device costs a single timeout.
+    /// </remarks>
+    public HarpMessage?[] ReadMany(ReadOnlySpan<(byte Register, PayloadType PayloadType)> requests)
+    {
+        lock (TransactionLock)
+            return ReadManyLocked(requests);
+    }
+
+    private HarpMessage?[] ReadManyLocked(ReadOnlySpan<(byte Register, PayloadType PayloadType)> requests)
+    {
+        HarpMessage?[] responses = new HarpMessage?[requests.Length];
+        if (requests.Length == 0)
+            return responses;
+
+        // Correlation table, maps each register to the index of its request (or -1 if it isn't being read)
+        Span<short> pendingIndex = stackalloc short[byte.MaxValue + 1];
+        pendingIndex.Fill(-1);
+
+        byte[] requestBuffer = GetTransmitBuffer(requests.Length * HarpMessageEncoder.GetEncodedLength(hasTimestamp: false, payloadLength: 0));
+        int requestsLength = 0;
+        for (int i = 0; i < requests.Length; i++)
+        {
+            (byte register, PayloadType payloadType) = requests[i];
+            if (pendingIndex[register] >= 0)
+                throw new ArgumentException($"Register {(CommonRegister)register} is requested more than once.", nameof(requests));
+
+            pendingIndex[register] = (short)i;
+            requestsLength += HarpMessageEncoder.Encode(requestBuffer.AsSpan(requestsLength), MessageType.Read, register, payloadType, null, ReadOnlySpan<byte>.Empty);
+        }
+
+        ResponseRing?.Clear();
+        Transport.Write(requestBuffer, 0, requestsLength);
+
+        HarpMessageParser parser = new();
+        long startTimestamp = Stopwatch.GetTimestamp();
+        int pendingCount = requests.Length;
+        while (pendingCount > 0)
+        {
+            try
+            { ReceiveResponse(ref parser, startTimestamp); }
+            catch (TimeoutException)
+            {
+                Trace.WriteLine($"Timed out waiting for {pendingCount} of {requests.Length} batched read(s).");
+                break;
+            }
+
+            if (parser.MessageType == MessageType.Event)
+            {
+                Trace.WriteLine($"Got event {(CommonRegister)parser.Address} while waiting for batched reads, ignoring it.");
+                continue;
+            }
+
+            int index = pendingIndex[parser.Address];
+            if (index < 0 || parser.MessageType is not (MessageType.Read or MessageType.ReadError))
+            {
+                Trace.WriteLine($"Got irrelevant {parser.MessageType} {(CommonRegister)parser.Address} while waiting for batched reads, ignoring it.");
+                continue;
+            }
+
+            responses[index] = HarpMessage.Create(parser);
+            pendingIndex[parser.Address] = -1;
+            pendingCount--;
+        }
+
+        return responses;
+    }
 
-        return message;
+    /// <summary>Reads a register without allocating, the payload of the response is written to <paramref name="payloadBuffer"/>.</summary>
+    /// <remarks>The returned view refers to <paramref name="payloadBuffer"/>.</remarks>
+    public HarpMessageView<T> Read<T>(byte register, Span<byte> payloadBuffer)
+        where T : unmanaged
+    {
+        HarpMessageParser parser = new(payloadBuffer);
+        DoTransaction(MessageType.Read, register, PayloadType.GetType<T>(), null, ReadOnlySpan<byte>.Empty, ref parser);
+        return parser.GetView<T>();
+    }
+
+    /// <summary>Writes a register without allocating, the payload of the response is written to <paramref name="payloadBuffer"/>.</summary>
+    /// <remarks>The returned view refers to <paramref name="payloadBuffer"/>.</remarks>
+    public HarpMessageView<T> Write<T>(byte register, ReadOnlySpan<T> value, Span<byte> payloadBuffer)
+        where T : unmanaged
+    {
+        HarpMessageParser parser = new(payloadBuffer);
+        DoTransaction(MessageType.Write, register, PayloadType.GetType<T>(), null, MemoryMarshal.Cast<T, byte>(value), ref parser);
+        return parser.GetView<T>();
     }
 
     public HarpMessage<T> Read<T>(byte register)
         where T : unmanaged
-        => (HarpMessage<T>)DoTransaction(MessageType.Read, register, PayloadType.GetType<T>(), ReadOnlySpan<byte>.Empty);
+        => (HarpMessage<T>)DoTransaction(MessageType.Read, register, PayloadType.GetType<T>(), null, ReadOnlySpan<byte>.Empty);
 
     public HarpMessage Write<T>(byte register, T value)
         where T : unmanaged
@@ -154,7 +378,13 @@ public sealed class HarpConnection : IDisposable
 
     public HarpMessage Write<T>(byte register, ReadOnlySpan<T> value)
         where T : unmanaged
-        => (HarpMessage<T>)DoTransaction(MessageType.Write, register, PayloadType.GetType<T>(), MemoryMarshal.Cast<T, byte>(value));
+        => (HarpMessage<T>)DoTransaction(MessageType.Write, register, PayloadType.GetType<T>(), null, MemoryMarshal.Cast<T, byte>(value));
+
+    /// <summary>Writes a register with a timestamped payload.</summary>
+    /// <remarks>Arrays of up to about 64 KiB are written as a single extended-length message.</remarks>
+    public HarpMessage Write<T>(byte register, ReadOnlySpan<T> value, HarpTimestamp timestamp)
+        where T : unmanaged
+        => (HarpMessage<T>)DoTransaction(MessageType.Write, register, PayloadType.GetType<T>(hasTimestamp: true), timestamp, MemoryMarshal.Cast<T, byte>(value));
 
     public HarpMessage<T> Read<T>(CommonRegister register)
         where T : unmanaged
@@ -168,6 +398,199 @@ public sealed class HarpConnection : IDisposable
         where T : unmanaged
         => Write<T>((byte)register, value);
 
+    public HarpMessageView<T> Read<T>(CommonRegister register, Span<byte> payloadBuffer)
+        where T : unmanaged
+        => Read<T>((byte)register, payloadBuffer);
+
+    // Streaming
+    // While streaming a dedicated thread owns all reads from the port, events are routed to subscriptions and everything else is routed to transactions
+    private const int StreamReadTimeoutMilliseconds = 50;
+    private const int ResponseRingCapacity = 8;
+    private Thread? StreamThread;
+    private volatile bool StopStreamingRequested;
+    private HarpMessageRing? ResponseRing;
+    private volatile Exception? StreamException;
+
+    // Indexed by register, replaced rather than mutated so that the stream reader never needs to lock
+    private readonly HarpEventSubscription[][] Subscriptions = CreateEmptySubscriptions();
+    private readonly object SubscriptionsLock = new();
+
+    private static HarpEventSubscription[][] CreateEmptySubscriptions()
+    {
+        HarpEventSubscription[][] result = new HarpEventSubscription[byte.MaxValue + 1][];
+        result.AsSpan().Fill(Array.Empty<HarpEventSubscription>());
+        return result;
+    }
+
+    public bool IsStreaming => StreamThread is not null;
+
+    /// <summary>Subscribes to the events raised by <paramref name="register"/>.</summary>
+    /// <param name="capacity">The number of events which can be buffered before they start being dropped, rounded up to a power of two.</param>
+    /// <remarks>Events are only received while the connection is streaming, see <see cref="StartStreaming"/>.</remarks>
+    public HarpEventSubscription Subscribe(byte register, int capacity = 1024)
+    {
+        HarpEventSubscription subscription = new(this, register, capacity);
+        lock (SubscriptionsLock)
+            Volatile.Write(ref Subscriptions[register], [.. Subscriptions[register], subscription]);
+        return subscription;
+    }
+
+    public HarpEventSubscription Subscribe(CommonRegister register, int capacity = 1024)
+        => Subscribe((byte)register, capacity);
+
+    internal void Unsubscribe(HarpEventSubscription subscription)
+    {
+        lock (SubscriptionsLock)
+            Volatile.Write(ref Subscriptions[subscription.Register], Array.FindAll(Subscriptions[subscription.Register], s => s != subscription));
+        subscription.Ring.Wake();
+    }
+
+    /// <summary>Starts receiving events in the background.</summary>
+    /// <remarks>Transactions continue to work while streaming, their responses are handed over by the stream reader.</remarks>
+    public void StartStreaming()
+    {
+        lock (TransactionLock)
+        {
+            if (StreamThread is not null)
+                return;
+
+            // Responses can be extended-length messages (IE: the reply to a large array write), so they get full-size slots
+            ResponseRing ??= new HarpMessageRing(ResponseRingCapacity, maxPayloadSize: ushort.MaxValue);
+            ResponseRing.Clear();
+            StreamException = null;
+            StopStreamingRequested = false;
+
+            // The stream reader uses a short timeout so that it notices when it's asked to stop
+            Transport.ReadTimeout = StreamReadTimeoutMilliseconds;
+            StreamThread = new Thread(StreamReader)
+            {
+                Name = $"Harp stream reader ({Transport.PortName})",
+                IsBackground = true,
+                Priority = ThreadPriority.AboveNormal,
+            };
+            StreamThread.Start();
+        }
+    }
+
+    public void StopStreaming()
+    {
+        lock (TransactionLock)
+        {
+            if (StreamThread is null)
+                return;
+
+            StopStreamingRequested = true;
+            StreamThread.Join();
+            StreamThread = null;
+            ResponseRing = null;
+
+            // Anything left in the receive buffer is the start of a message the stream reader already consumed part of
+            ReadHead = 0;
+            WriteHead = 0;
+            if (BufferedTransport is IHarpBufferedTransport transport)
+            {
+                for (ReadOnlySpan<byte> buffered = transport.Peek(0); !buffered.IsEmpty; buffered = transport.Peek(0))
+                    transport.Advance(buffered.Length);
+            }
+            Transport.ReadTimeout = TransactionTimeout;
+        }
+    }
+
+    private void StreamReader()
+    {
+        // Large enough for the payload of any message, including extended-length ones
+        Span<byte> payloadBuffer = new byte[ushort.MaxValue];
+        HarpMessageParser parser = new(payloadBuffer);
+
+        try
+        {
+            if (BufferedTransport is IHarpBufferedTransport transport)
+            {
+                int minimumLength = 1;
+                while (!StopStreamingRequested)
+                {
+                    ReadOnlySpan<byte> buffered;
+                    try
+                    { buffered = transport.Peek(minimumLength); }
+                    catch (TimeoutException)
+                    { continue; }
+
+                    bool isComplete;
+                    try
+                    { isComplete = TryConsumeInPlace(transport, buffered, ref parser, ref minimumLength); }
+                    catch (IOException)
+                    { continue; }
+
+                    if (isComplete)
+                    {
+                        DispatchStreamedMessage(parser);
+                        parser.Reset();
+                    }
+                }
+            }
+
+            while (!StopStreamingRequested)
+            {
+                // Parse every complete message in the buffer
+                while (true)
+                {
+                    bool isComplete;
+                    try
+                    { isComplete = TryConsumeBuffered(ref parser); }
+                    catch (IOException)
+                    { break; }
+
+                    if (!isComplete)
+                        break;
+
+                    DispatchStreamedMessage(parser);
+                    parser.Reset();
+                }
+
+                // The parser consumes everything it can, so anything left over is the start of a field it can't parse yet
+                ReadOnlySpan<byte> liveBuffer = ReceiveBuffer.AsSpan().Slice(ReadHead, WriteHead - ReadHead);
+                liveBuffer.CopyTo(ReceiveBuffer);
+                WriteHead = liveBuffer.Length;
+                ReadHead = 0;
+
+                try
+                { WriteHead += Transport.Read(ReceiveBuffer, WriteHead, ReceiveBuffer.Length - WriteHead); }
+                catch (TimeoutException)
+                { }
+            }
+        }
+        catch (Exception ex) when (ex is IOException or InvalidOperationException or UnauthorizedAccessException)
+        {
+            Trace.WriteLine($"Harp stream reader for {Transport.PortName} stopped due to an error: {ex}");
+            StreamException = ex;
+        }
+        finally
+        {
+            // Wake anything waiting on the stream so that it notices it has stopped
+            ResponseRing?.Wake();
+            foreach (HarpEventSubscription[] subscriptions in Subscriptions)
+            {
+                foreach (HarpEventSubscription subscription in subscriptions)
+                    subscription.Ring.Wake();
+            }
+        }
+    }
+
+    private void DispatchStreamedMessage(scoped in HarpMessageParser parser)
+    {
+        if (parser.MessageType == MessageType.Event)
+        {
+            foreach (HarpEventSubscription subscription in Volatile.Read(ref Subscriptions[parser.Address]))
+                subscription.Ring.TryWrite(parser);
+        }
+        // Responses which arrive while no transaction is waiting are stale, they're cleared at the start of the next transaction
+        else
+        { ResponseRing!.TryWrite(parser); }
+    }
+
     public void Dispose()
-        => Port.Dispose();
+    {
+        StopStreaming();
+        Transport.Dispose();
+    }
 }
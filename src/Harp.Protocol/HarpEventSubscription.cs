@@ -0,0 +1,60 @@
+﻿using System;
+
+namespace Harp.Protocol;
+
+/// <summary>Receives the events raised by a single register while a <see cref="HarpConnection"/> is streaming.</summary>
+/// <remarks>
+/// Events are buffered until they're read, if the buffer fills up new events are dropped and counted by <see cref="DroppedCount"/>.
+/// A subscription must only be read by one thread at a time.
+/// </remarks>
+public sealed class HarpEventSubscription : IDisposable
+{
+    private readonly HarpConnection Connection;
+    internal readonly HarpMessageRing Ring;
+
+    public byte Register { get; }
+
+    /// <summary>The number of events which were dropped because they weren't read quickly enough.</summary>
+    public long DroppedCount => Ring.DroppedCount;
+
+    internal HarpEventSubscription(HarpConnection connection, byte register, int capacity)
+    {
+        Connection = connection;
+        Register = register;
+        Ring = new HarpMessageRing(capacity);
+    }
+
+    /// <summary>Reads the oldest buffered event without allocating, its payload is written to <paramref name="payloadBuffer"/>.</summary>
+    /// <remarks>The returned view refers to <paramref name="payloadBuffer"/>. The event is consumed even if its payload isn't a <typeparamref name="T"/>.</remarks>
+    /// <returns>False if there are no buffered events.</returns>
+    /// <exception cref="InvalidOperationException">The event's payload doesn't fit in <paramref name="payloadBuffer"/>, the event is still consumed.</exception>
+    public bool TryRead<T>(Span<byte> payloadBuffer, out HarpMessageView<T> message)
+        where T : unmanaged
+    {
+        HarpMessageParser parser = new(payloadBuffer);
+        if (!Ring.TryRead(ref parser))
+        {
+            message = default;
+            return false;
+        }
+
+        message = parser.GetView<T>();
+        return true;
+    }
+
+    /// <summary>Reads the oldest buffered event.</summary>
+    /// <returns>The event, or null if there are no buffered events.</returns>
+    public HarpMessage? TryRead()
+    {
+        HarpMessageParser parser = new();
+        return Ring.TryRead(ref parser) ? HarpMessage.Create(parser) : null;
+    }
+
+    /// <summary>Waits for an event to be buffered.</summary>
+    /// <returns>True if there is an event to read, false if the wait timed out or the connection stopped streaming.</returns>
+    public bool WaitForEvent(int millisecondsTimeout)
+        => Ring.Wait(millisecondsTimeout);
+
+    public void Dispose()
+        => Connection.Unsubscribe(this);
+}
@@ -1,5 +1,4 @@
 ﻿using System;
-using System.Diagnostics;
 using System.Runtime.InteropServices;
 
 namespace Harp.Protocol;
@@ -23,49 +22,56 @@ public class HarpMessage
         && PayloadType.IsValid
         && Checksum == CalculatedChecksum;
 
-    internal HarpMessage(HarpMessageParser parser)
+    internal HarpMessage(in HarpMessageParser parser)
     {
         MessageType = parser.MessageType;
         Address = parser.Address;
         Port = parser.Port;
         PayloadType = parser.PayloadType;
         Timestamp = parser.Timestamp;
-        Payload = parser.Payload;
+        Payload = parser.Payload ?? parser.PayloadSpan.ToArray();
         Checksum = parser.Checksum;
         CalculatedChecksum = parser.CalculatedChecksum;
     }
 
-    internal static HarpMessage Create(HarpMessageParser parser)
+    private delegate HarpMessage Factory(in HarpMessageParser parser);
+
+    // Indexed by the raw payload type, entries are null for invalid payload types
+    private static readonly Factory?[] Factories = CreateFactories();
+
+    private static Factory?[] CreateFactories()
+    {
+        Factory?[] factories = new Factory?[byte.MaxValue + 1];
+
+        void Add<T>()
+            where T : unmanaged
+        {
+            Factory factory = (in HarpMessageParser parser) => new HarpMessage<T>(parser);
+            factories[PayloadType.GetType<T>(hasTimestamp: false).RawValue] = factory;
+            factories[PayloadType.GetType<T>(hasTimestamp: true).RawValue] = factory;
+        }
+
+        Add<Half>();
+        Add<float>();
+        Add<double>();
+        Add<sbyte>();
+        Add<short>();
+        Add<int>();
+        Add<long>();
+        Add<byte>();
+        Add<ushort>();
+        Add<uint>();
+        Add<ulong>();
+        return factories;
+    }
+
+    internal static HarpMessage Create(in HarpMessageParser parser)
     {
         if (parser.ParserState != HarpMessageParser.State.Done)
             throw new ArgumentException("Parser has not parsed a full message yet!", nameof(parser));
 
-        if (!parser.PayloadType.TryGetType(out Type? type))
-            return new HarpMessage(parser);
-        else if (type == typeof(Half))
-            return new HarpMessage<Half>(parser);
-        else if (type == typeof(float))
-            return new HarpMessage<float>(parser);
-        else if (type == typeof(double))
-            return new HarpMessage<double>(parser);
-        else if (type == typeof(sbyte))
-            return new HarpMessage<sbyte>(parser);
-        else if (type == typeof(short))
-            return new HarpMessage<short>(parser);
-        else if (type == typeof(int))
-            return new HarpMessage<int>(parser);
-        else if (type == typeof(long))
-            return new HarpMessage<long>(parser);
-        else if (type == typeof(byte))
-            return new HarpMessage<byte>(parser);
-        else if (type == typeof(ushort))
-            return new HarpMessage<ushort>(parser);
-        else if (type == typeof(uint))
-            return new HarpMessage<uint>(parser);
-        else if (type == typeof(ulong))
-            return new HarpMessage<ulong>(parser);
-        else
-            throw new UnreachableException();
+        Factory? factory = Factories[parser.PayloadType.RawValue];
+        return factory is null ? new HarpMessage(parser) : factory(parser);
     }
 }
 
@@ -74,7 +80,7 @@ public sealed class HarpMessage<T> : HarpMessage
 {
     public ReadOnlySpan<T> Payload => MemoryMarshal.Cast<byte, T>(RawPayload);
 
-    unsafe internal HarpMessage(HarpMessageParser parser)
+    unsafe internal HarpMessage(in HarpMessageParser parser)
         : base(parser)
     { }
 }
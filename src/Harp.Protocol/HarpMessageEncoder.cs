@@ -0,0 +1,71 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+
+namespace Harp.Protocol;
+
+internal static class HarpMessageEncoder
+{
+    // Address, port, payload type, and checksum
+    private const int MinimumLengthFieldValue = 4;
+    private static readonly int TimestampSize = Unsafe.SizeOf<HarpTimestamp>();
+
+    private static int GetLengthFieldValue(bool hasTimestamp, int payloadLength)
+    {
+        int length = MinimumLengthFieldValue + (hasTimestamp ? TimestampSize : 0) + payloadLength;
+        if (length > ushort.MaxValue)
+            throw new ArgumentException($"A {payloadLength} byte payload is too large to fit in a Harp message.", nameof(payloadLength));
+        return length;
+    }
+
+    /// <summary>Gets the number of bytes required to encode a message.</summary>
+    public static int GetEncodedLength(bool hasTimestamp, int payloadLength)
+    {
+        int length = GetLengthFieldValue(hasTimestamp, payloadLength);
+        // Message type, length, and the extended length if the length doesn't fit in a byte
+        return 1 + (length < byte.MaxValue ? 1 : 3) + length;
+    }
+
+    /// <summary>Encodes a message into <paramref name="destination"/>.</summary>
+    /// <param name="timestamp">The timestamp to include, this must be specified if and only if <paramref name="payloadType"/> has a timestamp.</param>
+    /// <returns>The length of the encoded message.</returns>
+    public static int Encode(Span<byte> destination, MessageType messageType, byte address, PayloadType payloadType, HarpTimestamp? timestamp, ReadOnlySpan<byte> rawPayload)
+    {
+        if (payloadType.HasTimestamp != timestamp.HasValue)
+            throw new ArgumentException("A timestamp must be specified if and only if the payload type has a timestamp.", nameof(timestamp));
+
+        int length = GetLengthFieldValue(payloadType.HasTimestamp, rawPayload.Length);
+        int messageLength = GetEncodedLength(payloadType.HasTimestamp, rawPayload.Length);
+        Span<byte> messageData = destination.Slice(0, messageLength);
+
+        int offset = 0;
+        messageData[offset++] = (byte)messageType;
+        if (length < byte.MaxValue)
+        { messageData[offset++] = (byte)length; }
+        else
+        {
+            messageData[offset++] = byte.MaxValue;
+            BinaryPrimitives.WriteUInt16LittleEndian(messageData.Slice(offset), (ushort)length);
+            offset += sizeof(ushort);
+        }
+
+        messageData[offset++] = address;
+        messageData[offset++] = 0xFF;
+        messageData[offset++] = payloadType.RawValue;
+
+        if (timestamp is HarpTimestamp messageTimestamp)
+        {
+            MemoryMarshal.Write(messageData.Slice(offset), in messageTimestamp);
+            offset += TimestampSize;
+        }
+
+        rawPayload.CopyTo(messageData.Slice(offset));
+        offset += rawPayload.Length;
+
+        messageData[offset] = HarpChecksum.Compute(messageData.Slice(0, offset));
+        Debug.Assert(offset + 1 == messageLength);
+        return messageLength;
+    }
+}
@@ -28,10 +28,26 @@ public ref struct HarpMessageParser
     internal PayloadType PayloadType;
     internal HarpTimestamp Timestamp;
     private int PayloadWriteHead;
-    internal byte[] Payload;
+    private bool PayloadInitialized;
+    /// <summary>The array backing <see cref="PayloadSpan"/>, or null if the parser was given a payload buffer.</summary>
+    internal byte[]? Payload;
+    internal Span<byte> PayloadSpan;
+    private readonly Span<byte> PayloadBuffer;
+    private readonly bool HasPayloadBuffer;
     internal byte Checksum;
     internal byte CalculatedChecksum;
 
+    public HarpMessageParser()
+    { }
+
+    /// <summary>Creates a parser which writes the payload into <paramref name="payloadBuffer"/> rather than allocating an array for it.</summary>
+    /// <remarks>Use <see cref="TryConsume"/> and <see cref="GetView{T}"/> with parsers created this way to avoid allocating at all.</remarks>
+    public HarpMessageParser(Span<byte> payloadBuffer)
+    {
+        PayloadBuffer = payloadBuffer;
+        HasPayloadBuffer = true;
+    }
+
     private unsafe T ConsumeField<T>(ref ReadOnlySpan<byte> bytes)
             where T : unmanaged
     {
@@ -66,6 +82,11 @@ public ref struct HarpMessageParser
     }
 
     public HarpMessage? Consume(ReadOnlySpan<byte> buffer, out int bytesConsumed)
+        => TryConsume(buffer, out bytesConsumed) ? HarpMessage.Create(this) : null;
+
+    /// <summary>Consumes bytes from <paramref name="buffer"/> without allocating a <see cref="HarpMessage"/> once the message is complete.</summary>
+    /// <returns>True if a full message has been parsed.</returns>
+    public bool TryConsume(ReadOnlySpan<byte> buffer, out int bytesConsumed)
     {
         if (ParserState == State.Done)
             throw new InvalidOperationException("This parser has completed.");
@@ -85,10 +106,16 @@ public ref struct HarpMessageParser
             }
             else if (buffer.Length >= 3)
             {
-                HandleField(ref buffer, State.NeedLength, ref smallLength);
+                // Both parts are consumed before advancing so that the extended length isn't counted against the remaining bytes
+                smallLength = ConsumeField<byte>(ref buffer);
                 Debug.Assert(smallLength == 255);
                 RemainingBytes = ConsumeField<ushort>(ref buffer);
+                ParserState++;
             }
+
+            // Address, port, payload type, and checksum
+            if (ParserState > State.NeedLength && RemainingBytes < 4)
+                throw new InvalidOperationException($"The length of the message ({RemainingBytes}) is too short to be valid.");
         }
 
         HandleField(ref buffer, State.NeedAddress, ref Address);
@@ -98,7 +125,12 @@ public ref struct HarpMessageParser
         if (ParserState == State.NeedTimestamp)
         {
             if (PayloadType.HasTimestamp)
-            { HandleField(ref buffer, State.NeedTimestamp, ref Timestamp); }
+            {
+                // Timestamp and checksum
+                if (RemainingBytes < Unsafe.SizeOf<HarpTimestamp>() + 1)
+                    throw new InvalidOperationException("The length of the message is too short for it to contain a timestamp.");
+                HandleField(ref buffer, State.NeedTimestamp, ref Timestamp);
+            }
             else
             {
                 Timestamp = HarpTimestamp.Invalid;
@@ -106,27 +138,33 @@ public ref struct HarpMessageParser
             }
         }
 
-        if (ParserState == State.NeedPayload && buffer.Length > 0)
+        if (ParserState == State.NeedPayload && !PayloadInitialized)
         {
-            if (Payload is null)
-            {
-                PayloadWriteHead = 0;
-                Payload = GC.AllocateUninitializedArray<byte>(RemainingBytes - 1); // -1 for checksum
-            }
+            PayloadWriteHead = 0;
+            PayloadInitialized = true;
+            int payloadLength = RemainingBytes - 1; // -1 for checksum
+            if (!HasPayloadBuffer)
+            { PayloadSpan = Payload = GC.AllocateUninitializedArray<byte>(payloadLength); }
+            else if (payloadLength <= PayloadBuffer.Length)
+            { PayloadSpan = PayloadBuffer.Slice(0, payloadLength); }
+            else
+            { throw new InvalidOperationException($"The payload buffer is too small for the {payloadLength} byte payload of the message."); }
+        }
 
-            Span<byte> payloadBuffer = Payload.AsSpan().Slice(PayloadWriteHead);
+        if (ParserState == State.NeedPayload)
+        {
+            Span<byte> payloadBuffer = PayloadSpan.Slice(PayloadWriteHead);
             int bytesToCopy = Math.Min(payloadBuffer.Length, buffer.Length);
             buffer.Slice(0, bytesToCopy).CopyTo(payloadBuffer);
             RemainingBytes -= checked((ushort)bytesToCopy);
             PayloadWriteHead += bytesToCopy;
             buffer = buffer.Slice(bytesToCopy);
 
-            if (PayloadWriteHead >= Payload.Length)
+            if (PayloadWriteHead >= PayloadSpan.Length)
             {
                 ParserState++;
 
-                foreach (byte data in Payload)
-                    CalculatedChecksum += data;
+                CalculatedChecksum += HarpChecksum.Compute(PayloadSpan);
             }
         }
 
@@ -137,13 +175,58 @@ public ref struct HarpMessageParser
         if (ParserState == State.Done)
         {
             Debug.Assert(RemainingBytes == 0);
-            HarpMessage result = HarpMessage.Create(this);
-            return result;
+            return true;
+        }
+
+        return false;
+    }
+
+    /// <summary>Gets a view of the parsed message, the payload of which refers to the parser's payload buffer.</summary>
+    public HarpMessageView<T> GetView<T>()
+        where T : unmanaged
+    {
+        if (ParserState != State.Done)
+            throw new InvalidOperationException("Parser has not parsed a full message yet!");
+
+        // The timestamp flag doesn't affect the type of the payload
+        if ((PayloadType.RawValue & ~PayloadType.HasTimestampFlag) != PayloadType.GetType<T>().RawValue)
+            throw new InvalidCastException($"Message has a payload of type {PayloadType}, not {typeof(T).Name}.");
+
+        return new HarpMessageView<T>(this, PayloadSpan);
+    }
+
+    /// <summary>Resets the parser and loads it with a message which has already been parsed elsewhere.</summary>
+    internal void Load(MessageType messageType, byte address, byte port, PayloadType payloadType, HarpTimestamp timestamp, ReadOnlySpan<byte> payload, byte checksum, byte calculatedChecksum)
+    {
+        Reset();
+        MessageType = messageType;
+        Address = address;
+        Port = port;
+        PayloadType = payloadType;
+        Timestamp = timestamp;
+
+        PayloadInitialized = true;
+        PayloadWriteHead = payload.Length;
+        if (!HasPayloadBuffer)
+        { PayloadSpan = Payload = payload.ToArray(); }
+        else if (payload.Length <= PayloadBuffer.Length)
+        {
+            PayloadSpan = PayloadBuffer.Slice(0, payload.Length);
+            payload.CopyTo(PayloadSpan);
         }
+        else
+        { throw new InvalidOperationException($"The payload buffer is too small for the {payload.Length} byte payload of the message."); }
 
-        return null;
+        Checksum = checksum;
+        CalculatedChecksum = calculatedChecksum;
+        ParserState = State.Done;
     }
 
     public void Reset()
-        => this = default;
+    {
+        if (HasPayloadBuffer)
+            this = new HarpMessageParser(PayloadBuffer);
+        else
+            this = default;
+    }
 }
@@ -0,0 +1,162 @@
+﻿using System;
+using System.Diagnostics;
+using System.Numerics;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+using System.Threading;
+
+namespace Harp.Protocol;
+
+/// <summary>A single-producer single-consumer ring buffer of parsed messages.</summary>
+/// <remarks>
+/// Messages are copied into preallocated fixed-size slots so that neither side allocates.
+/// Only one thread may write to the ring and only one thread may read from it at any given time, but they needn't be the same thread.
+/// </remarks>
+internal sealed class HarpMessageRing
+{
+    [StructLayout(LayoutKind.Sequential, Pack = 1)]
+    private struct SlotHeader
+    {
+        public MessageType MessageType;
+        public byte Address;
+        public byte Port;
+        public PayloadType PayloadType;
+        public HarpTimestamp Timestamp;
+        public byte Checksum;
+        public byte CalculatedChecksum;
+        public ushort PayloadLength;
+    }
+
+    /// <summary>The default slot payload size, which is enough for any message without extended length.</summary>
+    public const int DefaultMaxPayloadSize = byte.MaxValue;
+    private static readonly int HeaderSize = Unsafe.SizeOf<SlotHeader>();
+    private readonly int SlotSize;
+
+    private readonly byte[] Slots;
+    private readonly int Mask;
+
+    // Each index is only ever written by one side, the other side only reads it
+    private long WriteIndex;
+    private long ReadIndex;
+    private long _DroppedCount;
+
+    private readonly ManualResetEventSlim DataAvailable = new(false);
+
+    public int Capacity { get; }
+
+    /// <summary>The largest payload which fits in a slot, larger messages are dropped.</summary>
+    public int MaxPayloadSize { get; }
+
+    /// <summary>The number of messages which were discarded because the ring was full or they were too large.</summary>
+    public long DroppedCount => Volatile.Read(ref _DroppedCount);
+
+    public bool IsEmpty => Volatile.Read(ref ReadIndex) == Volatile.Read(ref WriteIndex);
+
+    public HarpMessageRing(int capacity, int maxPayloadSize = DefaultMaxPayloadSize)
+    {
+        if (capacity <= 0)
+            throw new ArgumentOutOfRangeException(nameof(capacity), "The capacity must be positive.");
+        if (maxPayloadSize is < 0 or > ushort.MaxValue)
+            throw new ArgumentOutOfRangeException(nameof(maxPayloadSize));
+
+        Capacity = checked((int)BitOperations.RoundUpToPowerOf2((uint)capacity));
+        Mask = Capacity - 1;
+        MaxPayloadSize = maxPayloadSize;
+        SlotSize = HeaderSize + maxPayloadSize;
+        Slots = new byte[checked(Capacity * SlotSize)];
+    }
+
+    private Span<byte> GetSlot(long index)
+        => Slots.AsSpan((int)(index & Mask) * SlotSize, SlotSize);
+
+    /// <summary>Copies the message parsed by <paramref name="parser"/> into the ring. Must only be called by the producer.</summary>
+    /// <returns>False if the message was dropped.</returns>
+    public bool TryWrite(scoped in HarpMessageParser parser)
+    {
+        Debug.Assert(parser.ParserState == HarpMessageParser.State.Done);
+        long writeIndex = WriteIndex;
+        if (writeIndex - Volatile.Read(ref ReadIndex) >= Capacity || parser.PayloadSpan.Length > MaxPayloadSize)
+        {
+            Volatile.Write(ref _DroppedCount, _DroppedCount + 1);
+            return false;
+        }
+
+        Span<byte> slot = GetSlot(writeIndex);
+        SlotHeader header = new()
+        {
+            MessageType = parser.MessageType,
+            Address = parser.Address,
+            Port = parser.Port,
+            PayloadType = parser.PayloadType,
+            Timestamp = parser.Timestamp,
+            Checksum = parser.Checksum,
+            CalculatedChecksum = parser.CalculatedChecksum,
+            PayloadLength = (ushort)parser.PayloadSpan.Length,
+        };
+        MemoryMarshal.Write(slot, in header);
+        parser.PayloadSpan.CopyTo(slot.Slice(HeaderSize));
+
+        // Publishing the index is what hands the slot over to the consumer
+        Volatile.Write(ref WriteIndex, writeIndex + 1);
+        DataAvailable.Set();
+        return true;
+    }
+
+    /// <summary>Loads the oldest message in the ring into <paramref name="parser"/>. Must only be called by the consumer.</summary>
+    /// <returns>False if the ring is empty.</returns>
+    public bool TryRead(ref HarpMessageParser parser)
+    {
+        long readIndex = ReadIndex;
+        if (readIndex == Volatile.Read(ref WriteIndex))
+            return false;
+
+        ReadOnlySpan<byte> slot = GetSlot(readIndex);
+        SlotHeader header = MemoryMarshal.Read<SlotHeader>(slot);
+        try
+        {
+            parser.Load
+            (
+                header.MessageType,
+                header.Address,
+                header.Port,
+                header.PayloadType,
+                header.Timestamp,
+                slot.Slice(HeaderSize, header.PayloadLength),
+                header.Checksum,
+                header.CalculatedChecksum
+            );
+        }
+        finally
+        {
+            // The slot must not be released until we're done copying out of it
+            // It's released even if the message doesn't fit in the parser's payload buffer, otherwise the ring would be stuck on it forever
+            Volatile.Write(ref ReadIndex, readIndex + 1);
+        }
+
+        return true;
+    }
+
+    /// <summary>Discards every message currently in the ring. Must only be called by the consumer.</summary>
+    public void Clear()
+        => Volatile.Write(ref ReadIndex, Volatile.Read(ref WriteIndex));
+
+    /// <summary>Waits for the ring to contain a message. Must only be called by the consumer.</summary>
+    /// <returns>True if the ring is not empty, false if the wait timed out or was interrupted by <see cref="Wake"/>.</returns>
+    public bool Wait(int millisecondsTimeout)
+    {
+        if (!IsEmpty)
+            return true;
+
+        // The event is reset before checking again so that a message published in between isn't missed
+        DataAvailable.Reset();
+        if (!IsEmpty)
+            return true;
+
+        DataAvailable.Wait(millisecondsTimeout);
+        return !IsEmpty;
+    }
+
+    /// <summary>Wakes the consumer if it's waiting for a message.</summary>
+    public void Wake()
+        => DataAvailable.Set();
+}
@@ -0,0 +1,39 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace Harp.Protocol;
+
+/// <summary>A non-allocating equivalent of <see cref="HarpMessage{T}"/>.</summary>
+/// <remarks>The payload refers to the buffer the message was parsed into, so the view is only valid for as long as that buffer is.</remarks>
+public readonly ref struct HarpMessageView<T>
+    where T : unmanaged
+{
+    public readonly MessageType MessageType;
+    public readonly byte Address;
+    public readonly byte Port;
+    public readonly PayloadType PayloadType;
+    public readonly HarpTimestamp Timestamp;
+
+    public readonly ReadOnlySpan<byte> RawPayload;
+    public ReadOnlySpan<T> Payload => MemoryMarshal.Cast<byte, T>(RawPayload);
+
+    public readonly byte Checksum;
+    public readonly byte CalculatedChecksum;
+
+    public bool IsValid
+        => MessageType.IsValid()
+        && PayloadType.IsValid
+        && Checksum == CalculatedChecksum;
+
+    internal HarpMessageView(scoped in HarpMessageParser parser, ReadOnlySpan<byte> payload)
+    {
+        MessageType = parser.MessageType;
+        Address = parser.Address;
+        Port = parser.Port;
+        PayloadType = parser.PayloadType;
+        Timestamp = parser.Timestamp;
+        RawPayload = payload;
+        Checksum = parser.Checksum;
+        CalculatedChecksum = parser.CalculatedChecksum;
+    }
+}
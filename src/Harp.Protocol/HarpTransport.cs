@@ -0,0 +1,18 @@
+﻿using System;
+
+namespace Harp.Protocol;
+
+public static class HarpTransport
+{
+    /// <summary>The baud rate used unless otherwise specified, USB CDC devices (IE: Pico-based ones) ignore it.</summary>
+    public const int DefaultBaudRate = 115200;
+
+    /// <summary>Opens the best transport for the current platform.</summary>
+    public static IHarpTransport Open(string portName, int baudRate = DefaultBaudRate)
+    {
+        if (OperatingSystem.IsLinux())
+            return new LinuxSerialTransport(portName, baudRate);
+
+        return new SerialPortTransport(portName, baudRate);
+    }
+}
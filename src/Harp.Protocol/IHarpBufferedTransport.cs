@@ -0,0 +1,22 @@
+﻿using System;
+
+namespace Harp.Protocol;
+
+/// <summary>A transport which buffers received data itself, so <see cref="HarpConnection"/> can parse it in place rather than copying it out with <see cref="IHarpTransport.Read"/>.</summary>
+public interface IHarpBufferedTransport : IHarpTransport
+{
+    /// <summary>The largest <c>minimumLength</c> which may be passed to <see cref="Peek"/>, this is larger than any single field of a Harp message.</summary>
+    const int MaxMinimumLength = 16;
+
+    /// <summary>Gets received data without consuming it, waiting up to <see cref="IHarpTransport.ReadTimeout"/> for at least <paramref name="minimumLength"/> bytes to arrive.</summary>
+    /// <param name="minimumLength">At most <see cref="MaxMinimumLength"/>, 0 returns whatever is buffered without waiting.</param>
+    /// <returns>
+    /// Contiguous data from the transport's buffer, which may be less than everything which is buffered.
+    /// It is only valid until the next call to any other member of the transport.
+    /// </returns>
+    /// <exception cref="TimeoutException">Fewer than <paramref name="minimumLength"/> bytes arrived within the read timeout.</exception>
+    ReadOnlySpan<byte> Peek(int minimumLength);
+
+    /// <summary>Consumes the first <paramref name="count"/> bytes of the data returned by <see cref="Peek"/>.</summary>
+    void Advance(int count);
+}
@@ -0,0 +1,26 @@
+﻿using System;
+
+namespace Harp.Protocol;
+
+/// <summary>The byte stream a <see cref="HarpConnection"/> talks to a device over.</summary>
+/// <remarks>
+/// Reads and writes may happen concurrently from separate threads (IE: while streaming), but there is never more than one reader or writer at a time.
+/// Timeouts are in milliseconds, -1 means infinite.
+/// </remarks>
+public interface IHarpTransport : IDisposable
+{
+    /// <summary>The name of the port, used in diagnostics.</summary>
+    string PortName { get; }
+
+    int ReadTimeout { get; set; }
+    int WriteTimeout { get; set; }
+
+    /// <summary>Reads whatever data is available, waiting up to <see cref="ReadTimeout"/> for at least one byte to arrive.</summary>
+    /// <returns>The number of bytes read, which is always at least 1.</returns>
+    /// <exception cref="TimeoutException">Nothing arrived within the read timeout.</exception>
+    int Read(byte[] buffer, int offset, int count);
+
+    /// <summary>Writes all of the specified data.</summary>
+    /// <exception cref="TimeoutException">The data could not be written within the write timeout.</exception>
+    void Write(byte[] buffer, int offset, int count);
+}
@@ -0,0 +1,120 @@
+﻿using System.Runtime.InteropServices;
+using System.Runtime.Versioning;
+
+namespace Harp.Protocol;
+
+[SupportedOSPlatform("linux")]
+internal unsafe static partial class Libc
+{
+    public const int O_RDWR = 0x2;
+    public const int O_NOCTTY = 0x100;
+    public const int O_NONBLOCK = 0x800;
+    public const int O_CLOEXEC = 0x80000;
+    public const int TCSANOW = 0;
+    public const int TCIOFLUSH = 2;
+    public const short POLLIN = 0x1;
+    public const short POLLOUT = 0x4;
+    public const int EINTR = 4;
+    public const int EAGAIN = 11;
+
+    public const nuint TIOCEXCL = 0x540C;
+    public const nuint TIOCGSERIAL = 0x541E;
+    public const nuint TIOCSSERIAL = 0x541F;
+
+    // Large enough for struct termios on every architecture glibc supports
+    public const int TermiosSize = 256;
+    // Offsets within struct termios, these are the same on every architecture .NET supports on Linux
+    public const int TermiosCFlagOffset = 8;
+    public const int TermiosCcOffset = 17;
+    public const int VTIME = 5;
+    public const int VMIN = 6;
+    public const uint CREAD = 0x80;
+    public const uint CLOCAL = 0x800;
+    public const uint CRTSCTS = 0x80000000;
+
+    // Large enough for struct serial_struct, flags follows four ints so its offset doesn't depend on the architecture
+    public const int SerialStructSize = 128;
+    public const int SerialStructFlagsOffset = 16;
+    public const int ASYNC_LOW_LATENCY = 1 << 13;
+
+    public const int EPOLL_CLOEXEC = O_CLOEXEC;
+    public const int EPOLL_CTL_ADD = 1;
+    public const uint EPOLLIN = 0x1;
+    public const uint EPOLLERR = 0x8;
+    public const uint EPOLLHUP = 0x10;
+    // struct epoll_event is packed on x64 and padded elsewhere, only the first field is ever accessed
+    public const int EpollEventSize = 16;
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct pollfd
+    {
+        public int fd;
+        public short events;
+        public short revents;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct iovec
+    {
+        public void* iov_base;
+        public nuint iov_len;
+    }
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int posix_openpt(int flags);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int grantpt(int fd);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int unlockpt(int fd);
+
+    /// <remarks>Returns an error number rather than setting errno.</remarks>
+    [LibraryImport("libc")]
+    public static partial int ptsname_r(int fd, byte* buf, nuint buflen);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int open(byte* pathname, int flags);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int close(int fd);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial nint read(int fd, byte* buf, nuint count);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial nint readv(int fd, iovec* iov, int iovcnt);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial nint write(int fd, byte* buf, nuint count);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int poll(pollfd* fds, nuint nfds, int timeout);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int ioctl(int fd, nuint request, void* argp);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int tcgetattr(int fd, void* termios_p);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int tcsetattr(int fd, int optional_actions, void* termios_p);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int tcflush(int fd, int queue_selector);
+
+    [LibraryImport("libc")]
+    public static partial void cfmakeraw(void* termios_p);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int cfsetspeed(void* termios_p, uint speed);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int epoll_create1(int flags);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int epoll_ctl(int epfd, int op, int fd, void* @event);
+
+    [LibraryImport("libc", SetLastError = true)]
+    public static partial int epoll_wait(int epfd, void* events, int maxevents, int timeout);
+}
@@ -0,0 +1,350 @@
+﻿using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Runtime.Versioning;
+using System.Text;
+using static Harp.Protocol.Libc;
+
+namespace Harp.Protocol;
+
+/// <summary>A transport which drives a tty directly rather than going through <see cref="System.IO.Ports.SerialPort"/>.</summary>
+/// <remarks>
+/// The port is put in raw mode and the driver's low latency mode is enabled where possible, so data reaches us as soon as the USB frame containing it does.
+/// Incoming data is drained into a ring buffer a whole kernel buffer at a time, reads are served from it without a system call whenever it has data.
+/// <see cref="HarpConnection"/> parses straight out of the ring using <see cref="Peek"/>, so received data is never copied on its way to the parser.
+/// </remarks>
+[SupportedOSPlatform("linux")]
+public sealed unsafe class LinuxSerialTransport : IHarpBufferedTransport
+{
+    private int Fd = -1;
+    private int EpollFd = -1;
+
+    public string PortName { get; }
+    public int ReadTimeout { get; set; } = -1;
+    public int WriteTimeout { get; set; } = -1;
+
+    // Large enough to hold several full-speed USB frames worth of data, must be a power of two
+    private const int RingCapacity = 16 * 1024;
+    // The start of the ring is mirrored past its end when the buffered data wraps around so that Peek can return it contiguously
+    private const int RingMirrorLength = IHarpBufferedTransport.MaxMinimumLength;
+    private readonly byte[] Ring = new byte[RingCapacity + RingMirrorLength];
+    // These only ever increase, they're masked when indexing the ring
+    private int RingReadIndex;
+    private int RingWriteIndex;
+    private int RingLength => RingWriteIndex - RingReadIndex;
+
+    // The low latency settings we changed, they're restored when the port is closed
+    private string? LatencyTimerPath;
+    private string? OriginalLatencyTimer;
+    private bool ClearLowLatencyFlag;
+
+    public LinuxSerialTransport(string portName, int baudRate = HarpTransport.DefaultBaudRate)
+    {
+        PortName = portName;
+        uint speed = GetSpeed(baudRate);
+
+        try
+        {
+            byte[] path = Encoding.UTF8.GetBytes(portName + '\0');
+            fixed (byte* pathPointer = path)
+            {
+                // Non-blocking so that opening doesn't wait for carrier detect, and so reads never block outside of epoll_wait
+                Fd = open(pathPointer, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+            }
+            if (Fd < 0)
+            {
+                int error = Marshal.GetLastPInvokeError();
+                throw new IOException($"Failed to open '{portName}': {Marshal.GetPInvokeErrorMessage(error)}");
+            }
+
+            // SerialPort opens ports exclusively as well
+            if (ioctl(Fd, TIOCEXCL, null) != 0)
+                ThrowLastError(nameof(TIOCEXCL));
+
+            byte* termios = stackalloc byte[TermiosSize];
+            if (tcgetattr(Fd, termios) != 0)
+                ThrowLastError(nameof(tcgetattr));
+            cfmakeraw(termios);
+            uint* cflag = (uint*)(termios + TermiosCFlagOffset);
+            *cflag = (*cflag | CREAD | CLOCAL) & ~CRTSCTS;
+            // Return whatever is available immediately, waiting is done with epoll so the timeout isn't limited to VTIME's tenths of a second
+            termios[TermiosCcOffset + VMIN] = 0;
+            termios[TermiosCcOffset + VTIME] = 0;
+            if (cfsetspeed(termios, speed) != 0)
+                ThrowLastError(nameof(cfsetspeed));
+            if (tcsetattr(Fd, TCSANOW, termios) != 0)
+                ThrowLastError(nameof(tcsetattr));
+
+            // Anything received before the port was opened is a partial message we can't make sense of
+            if (tcflush(Fd, TCIOFLUSH) != 0)
+                ThrowLastError(nameof(tcflush));
+
+            EnableLowLatency();
+
+            EpollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (EpollFd < 0)
+                ThrowLastError(nameof(epoll_create1));
+
+            byte* epollEvent = stackalloc byte[EpollEventSize];
+            new Span<byte>(epollEvent, EpollEventSize).Clear();
+            *(uint*)epollEvent = EPOLLIN;
+            if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, Fd, epollEvent) != 0)
+                ThrowLastError(nameof(epoll_ctl));
+        }
+        catch
+        {
+            Dispose();
+            throw;
+        }
+    }
+
+    private static uint GetSpeed(int baudRate)
+        => baudRate switch
+        {
+            9600 => 0xD, // B9600
+            19200 => 0xE, // B19200
+            38400 => 0xF, // B38400
+            57600 => 0x1001, // B57600
+            115200 => 0x1002, // B115200
+            230400 => 0x1003, // B230400
+            460800 => 0x1004, // B460800
+            500000 => 0x1005, // B500000
+            576000 => 0x1006, // B576000
+            921600 => 0x1007, // B921600
+            1000000 => 0x1008, // B1000000
+            1152000 => 0x1009, // B1152000
+            1500000 => 0x100A, // B1500000
+            2000000 => 0x100B, // B2000000
+            2500000 => 0x100C, // B2500000
+            3000000 => 0x100D, // B3000000
+            _ => throw new ArgumentOutOfRangeException(nameof(baudRate), baudRate, "Only the standard termios baud rates are supported."),
+        };
+
+    private void ThrowLastError(string function)
+    {
+        int error = Marshal.GetLastPInvokeError();
+        throw new IOException($"{function} failed for '{PortName}': {Marshal.GetPInvokeErrorMessage(error)}");
+    }
+
+    /// <summary>Minimizes how long the driver holds on to received data before passing it along.</summary>
+    /// <remarks>This is best effort, the port works either way (pseudo-terminals and CDC ACM devices like the Pico support neither.)</remarks>
+    private void EnableLowLatency()
+    {
+        // FTDI adapters buffer data for up to 16ms by default, this is by far the largest source of latency with them
+        // The latency timer is usually only writable by root, so fall back to the driver's low latency flag (which ftdi_sio maps to the same thing) when it isn't
+        string latencyTimerPath = $"/sys/class/tty/{Path.GetFileName(PortName)}/device/latency_timer";
+        try
+        {
+            if (File.Exists(latencyTimerPath))
+            {
+                string originalLatencyTimer = File.ReadAllText(latencyTimerPath).Trim();
+                if (originalLatencyTimer == "1")
+                    return;
+
+                File.WriteAllText(latencyTimerPath, "1");
+                LatencyTimerPath = latencyTimerPath;
+                OriginalLatencyTimer = originalLatencyTimer;
+                return;
+            }
+        }
+        catch (Exception ex) when (ex is IOException or UnauthorizedAccessException)
+        { Trace.WriteLine($"Could not set the latency timer of '{PortName}', falling back to ASYNC_LOW_LATENCY: {ex.Message}"); }
+
+        byte* serial = stackalloc byte[SerialStructSize];
+        if (ioctl(Fd, TIOCGSERIAL, serial) != 0)
+            return;
+
+        int* flags = (int*)(serial + SerialStructFlagsOffset);
+        if ((*flags & ASYNC_LOW_LATENCY) != 0)
+            return;
+
+        *flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(Fd, TIOCSSERIAL, serial) == 0)
+        { ClearLowLatencyFlag = true; }
+        else
+        { Trace.WriteLine($"Could not enable low latency mode for '{PortName}', its latency will be higher than necessary: {Marshal.GetPInvokeErrorMessage(Marshal.GetLastPInvokeError())}"); }
+    }
+
+    private void RestoreLatency()
+    {
+        if (ClearLowLatencyFlag)
+        {
+            ClearLowLatencyFlag = false;
+            byte* serial = stackalloc byte[SerialStructSize];
+            if (ioctl(Fd, TIOCGSERIAL, serial) == 0)
+            {
+                *(int*)(serial + SerialStructFlagsOffset) &= ~ASYNC_LOW_LATENCY;
+                ioctl(Fd, TIOCSSERIAL, serial);
+            }
+        }
+
+        if (LatencyTimerPath is not null)
+        {
+            try
+            { File.WriteAllText(LatencyTimerPath, OriginalLatencyTimer); }
+            catch (Exception ex) when (ex is IOException or UnauthorizedAccessException)
+            { Trace.WriteLine($"Could not restore the latency timer of '{PortName}': {ex.Message}"); }
+            LatencyTimerPath = null;
+        }
+    }
+
+    /// <summary>Waits for data to arrive and moves everything the driver has into the ring.</summary>
+    /// <returns>False if nothing arrived within <paramref name="timeoutMilliseconds"/>.</returns>
+    private bool FillRing(int timeoutMilliseconds)
+    {
+        Debug.Assert(RingLength < RingCapacity);
+        long startTimestamp = Stopwatch.GetTimestamp();
+        byte* epollEvent = stackalloc byte[EpollEventSize];
+        while (true)
+        {
+            int remainingMilliseconds = timeoutMilliseconds;
+            if (timeoutMilliseconds >= 0)
+                remainingMilliseconds = Math.Max(0, timeoutMilliseconds - (int)Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds);
+
+            int eventCount = epoll_wait(EpollFd, epollEvent, 1, remainingMilliseconds);
+            if (eventCount < 0)
+            {
+                if (Marshal.GetLastPInvokeError() == EINTR)
+                    continue;
+                ThrowLastError(nameof(epoll_wait));
+            }
+
+            if (eventCount == 0)
+                return false;
+
+            // The free space in the ring is at most two segments, the one up to the end of the array and the one which wraps around to its start
+            fixed (byte* ring = Ring)
+            {
+                int writeOffset = RingWriteIndex & (RingCapacity - 1);
+                int free = RingCapacity - RingLength;
+                int firstLength = Math.Min(free, RingCapacity - writeOffset);
+                iovec* segments = stackalloc iovec[2];
+                segments[0] = new iovec() { iov_base = ring + writeOffset, iov_len = (nuint)firstLength };
+                segments[1] = new iovec() { iov_base = ring, iov_len = (nuint)(free - firstLength) };
+
+                nint bytesRead = readv(Fd, segments, free > firstLength ? 2 : 1);
+                if (bytesRead < 0)
+                {
+                    int error = Marshal.GetLastPInvokeError();
+                    if (error is EINTR or EAGAIN)
+                        continue;
+                    throw new IOException($"Failed to read from '{PortName}': {Marshal.GetPInvokeErrorMessage(error)}");
+                }
+
+                // Readable with nothing to read means the other end hung up (IE: the device was unplugged)
+                if (bytesRead == 0)
+                    throw new IOException($"'{PortName}' was disconnected.");
+
+                RingWriteIndex += (int)bytesRead;
+                return true;
+            }
+        }
+    }
+
+    public int Read(byte[] buffer, int offset, int count)
+    {
+        ObjectDisposedException.ThrowIf(Fd < 0, this);
+        Span<byte> destination = buffer.AsSpan(offset, count);
+        if (destination.IsEmpty)
+            return 0;
+
+        if (RingLength == 0 && !FillRing(ReadTimeout))
+            throw new TimeoutException();
+
+        int readOffset = RingReadIndex & (RingCapacity - 1);
+        int length = Math.Min(destination.Length, RingLength);
+        int firstLength = Math.Min(length, RingCapacity - readOffset);
+        Ring.AsSpan(readOffset, firstLength).CopyTo(destination);
+        Ring.AsSpan(0, length - firstLength).CopyTo(destination.Slice(firstLength));
+        RingReadIndex += length;
+        return length;
+    }
+
+    public ReadOnlySpan<byte> Peek(int minimumLength)
+    {
+        ObjectDisposedException.ThrowIf(Fd < 0, this);
+        ArgumentOutOfRangeException.ThrowIfNegative(minimumLength);
+        ArgumentOutOfRangeException.ThrowIfGreaterThan(minimumLength, IHarpBufferedTransport.MaxMinimumLength);
+
+        while (RingLength < minimumLength)
+        {
+            if (!FillRing(ReadTimeout))
+                throw new TimeoutException();
+        }
+
+        // Only a handful of bytes are copied when the data wraps around, which is enough to parse any field which straddles the end of the ring
+        int readOffset = RingReadIndex & (RingCapacity - 1);
+        int length = Math.Min(RingLength, RingCapacity - readOffset);
+        if (length < RingLength)
+        {
+            int mirrorLength = Math.Min(RingLength - length, RingMirrorLength);
+            Ring.AsSpan(0, mirrorLength).CopyTo(Ring.AsSpan(RingCapacity));
+            length += mirrorLength;
+        }
+
+        return Ring.AsSpan(readOffset, length);
+    }
+
+    public void Advance(int count)
+    {
+        ArgumentOutOfRangeException.ThrowIfNegative(count);
+        ArgumentOutOfRangeException.ThrowIfGreaterThan(count, RingLength);
+        RingReadIndex += count;
+    }
+
+    public void Write(byte[] buffer, int offset, int count)
+    {
+        ObjectDisposedException.ThrowIf(Fd < 0, this);
+        ReadOnlySpan<byte> data = buffer.AsSpan(offset, count);
+        long startTimestamp = Stopwatch.GetTimestamp();
+        fixed (byte* dataPointer = data)
+        {
+            int written = 0;
+            while (written < data.Length)
+            {
+                nint result = write(Fd, dataPointer + written, (nuint)(data.Length - written));
+                if (result >= 0)
+                {
+                    written += (int)result;
+                    continue;
+                }
+
+                int error = Marshal.GetLastPInvokeError();
+                if (error == EINTR)
+                    continue;
+                if (error != EAGAIN)
+                    throw new IOException($"Failed to write to '{PortName}': {Marshal.GetPInvokeErrorMessage(error)}");
+
+                // The driver's transmit buffer is full, wait for it to drain
+                int remainingMilliseconds = WriteTimeout;
+                if (WriteTimeout >= 0)
+                {
+                    remainingMilliseconds = WriteTimeout - (int)Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds;
+                    if (remainingMilliseconds <= 0)
+                        throw new TimeoutException();
+                }
+
+                pollfd pollFd = new() { fd = Fd, events = POLLOUT };
+                if (poll(&pollFd, 1, remainingMilliseconds) < 0 && Marshal.GetLastPInvokeError() != EINTR)
+                    ThrowLastError(nameof(poll));
+            }
+        }
+    }
+
+    public void Dispose()
+    {
+        if (EpollFd >= 0)
+        {
+            close(EpollFd);
+            EpollFd = -1;
+        }
+
+        if (Fd >= 0)
+        {
+            RestoreLatency();
+            close(Fd);
+            Fd = -1;
+        }
+    }
+}
@@ -8,17 +8,18 @@ public readonly struct PayloadType
 {
     public readonly byte RawValue;
 
-    public bool HasTimestamp => (RawValue & (1 << 4)) != 0;
+    internal const byte HasTimestampFlag = 1 << 4;
+    public bool HasTimestamp => (RawValue & HasTimestampFlag) != 0;
 
     public bool IsSigned => (RawValue & (1 << 7)) != 0;
-    public bool IsFloat => (RawValue & (1 << 7)) != 0;
+    public bool IsFloat => (RawValue & (1 << 6)) != 0;
     public int NumBits => (RawValue & 0b1111) * 8;
 
     public PayloadType(bool hasTimestamp, bool isSigned, bool isFloat, int numBits)
     {
         RawValue = 0;
         if (hasTimestamp)
-            RawValue |= 1 << 4;
+            RawValue |= HasTimestampFlag;
         if (isSigned)
             RawValue |= 1 << 7;
         if (isFloat)
@@ -59,9 +60,10 @@ public readonly struct PayloadType
             (false, false, 16) => typeof(ushort),
             (false, false, 32) => typeof(uint),
             (false, false, 64) => typeof(ulong),
-            (true, true, _) => throw new NotSupportedException($"{nameof(IsFloat)} and {nameof(IsSigned)} must not both be set."),
+            (true, true, _) => throwIfInvalid ? throw new NotSupportedException($"{nameof(IsFloat)} and {nameof(IsSigned)} must not both be set.") : null,
             (_, _, 0) => throwIfInvalid ? throw new NotSupportedException("0-bit type is not supported") : null,
-            (_, _, _) => throw new UnreachableException(),
+            // Only reachable with payload types received from the wire, the constructor doesn't allow other sizes
+            (_, _, _) => throwIfInvalid ? throw new NotSupportedException($"{NumBits}-bit types are not supported") : null,
         };
         return type is not null;
     }
@@ -0,0 +1,38 @@
+﻿using System.IO.Ports;
+
+namespace Harp.Protocol;
+
+/// <summary>A transport using <see cref="SerialPort"/>, which works on every platform.</summary>
+public sealed class SerialPortTransport : IHarpTransport
+{
+    private readonly SerialPort Port;
+
+    public SerialPortTransport(string portName, int baudRate = HarpTransport.DefaultBaudRate)
+    {
+        Port = new SerialPort(portName, baudRate);
+        Port.Open();
+    }
+
+    public string PortName => Port.PortName;
+
+    public int ReadTimeout
+    {
+        get => Port.ReadTimeout;
+        set => Port.ReadTimeout = value;
+    }
+
+    public int WriteTimeout
+    {
+        get => Port.WriteTimeout;
+        set => Port.WriteTimeout = value;
+    }
+
+    public int Read(byte[] buffer, int offset, int count)
+        => Port.Read(buffer, offset, count);
+
+    public void Write(byte[] buffer, int offset, int count)
+        => Port.Write(buffer, offset, count);
+
+    public void Dispose()
+        => Port.Dispose();
+}
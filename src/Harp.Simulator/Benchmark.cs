@@ -0,0 +1,139 @@
+﻿using Harp.Protocol;
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.Versioning;
+
+namespace Harp.Simulator;
+
+/// <summary>Measures the protocol path of <see cref="HarpConnection"/> against a <see cref="SimulatedHarpDevice"/>.</summary>
+[SupportedOSPlatform("linux")]
+internal static class Benchmark
+{
+    private const int WarmupCount = 100;
+
+    private static readonly (byte Register, PayloadType PayloadType)[] IdentityRegisters =
+    [
+        ((byte)CommonRegister.R_WHO_AM_I, PayloadType.GetType<ushort>()),
+        ((byte)CommonRegister.R_FW_VERSION_H, PayloadType.GetType<byte>()),
+        ((byte)CommonRegister.R_FW_VERSION_L, PayloadType.GetType<byte>()),
+        ((byte)CommonRegister.R_DEVICE_NAME, PayloadType.GetType<byte>()),
+        ((byte)CommonRegister.R_SERIAL_NUMBER, PayloadType.GetType<ushort>()),
+    ];
+
+    private readonly record struct Result(string Name, int Count, int Failures, TimeSpan Elapsed, long[] LatencyTicks)
+    {
+        private double GetPercentileMicroseconds(double percentile)
+            => LatencyTicks.Length == 0 ? double.NaN : LatencyTicks[(int)(percentile * (LatencyTicks.Length - 1))] * 1e6 / Stopwatch.Frequency;
+
+        public override string ToString()
+            => $"{Name}: {Count} in {Elapsed.TotalSeconds:0.000}s, {Count / Elapsed.TotalSeconds:0} per second, "
+            + $"p50 {GetPercentileMicroseconds(0.50):0.0}µs, p99 {GetPercentileMicroseconds(0.99):0.0}µs, max {GetPercentileMicroseconds(1.0):0.0}µs, {Failures} failure(s)";
+    }
+
+    private static Result Measure(string name, int count, Func<bool> operation)
+    {
+        // Injected faults surface as timeouts or mismatched responses, they count as failures rather than ending the benchmark
+        bool TryOperation()
+        {
+            try
+            { return operation(); }
+            catch (Exception ex) when (ex is TimeoutException or IOException or InvalidCastException)
+            { return false; }
+        }
+
+        for (int i = 0; i < Math.Min(WarmupCount, count); i++)
+            TryOperation();
+
+        long[] latencyTicks = new long[count];
+        int failures = 0;
+        long start = Stopwatch.GetTimestamp();
+        for (int i = 0; i < count; i++)
+        {
+            long operationStart = Stopwatch.GetTimestamp();
+            bool success = TryOperation();
+            latencyTicks[i] = Stopwatch.GetTimestamp() - operationStart;
+            if (!success)
+                failures++;
+        }
+
+        TimeSpan elapsed = Stopwatch.GetElapsedTime(start);
+        Array.Sort(latencyTicks);
+        return new Result(name, count, failures, elapsed, latencyTicks);
+    }
+
+    /// <param name="useSerialPort">Use <see cref="SerialPortTransport"/> rather than <see cref="LinuxSerialTransport"/>, for comparison.</param>
+    public static void Run(SimulatedHarpDeviceOptions options, int transactionCount, TimeSpan streamDuration, bool useSerialPort)
+    {
+        using SimulatedHarpDevice device = new(options);
+        device.Start();
+        Console.WriteLine($"Simulated device is on {device.PortName}");
+
+        IHarpTransport transport = useSerialPort ? new SerialPortTransport(device.PortName) : new LinuxSerialTransport(device.PortName);
+        Console.WriteLine($"Using {transport.GetType().Name}");
+        using HarpConnection harp = new(transport, timeoutMilliseconds: 500);
+        byte[] payloadBuffer = new byte[byte.MaxValue];
+
+        Console.WriteLine(Measure("Single reads", transactionCount, () =>
+        {
+            HarpMessageView<ushort> response = harp.Read<ushort>(CommonRegister.R_WHO_AM_I, payloadBuffer);
+            return response.IsValid && response.MessageType == MessageType.Read && response.Payload[0] == options.WhoAmI;
+        }));
+
+        Console.WriteLine(Measure("Batched identity reads", transactionCount / IdentityRegisters.Length, () =>
+        {
+            foreach (HarpMessage? response in harp.ReadMany(IdentityRegisters))
+            {
+                if (response is null || !response.IsValid || response.MessageType != MessageType.Read)
+                    return false;
+            }
+            return true;
+        }));
+
+        ushort[] table = new ushort[4096];
+        Console.WriteLine(Measure($"{table.Length * sizeof(ushort)} byte array writes", Math.Max(1, transactionCount / 100), () =>
+        {
+            HarpMessage response = harp.Write<ushort>(options.EventRegister, table);
+            return response.IsValid && response.MessageType == MessageType.Write;
+        }));
+
+        if (options.EventRate <= 0.0 || streamDuration <= TimeSpan.Zero)
+            return;
+
+        using HarpEventSubscription subscription = harp.Subscribe(options.EventRegister, capacity: 16384);
+        harp.StartStreaming();
+
+        long eventCount = 0;
+        long initialDeviceDroppedCount = device.DroppedEventCount;
+        long gapCount = 0;
+        ushort? expectedCounter = null;
+        long streamStart = Stopwatch.GetTimestamp();
+        while (Stopwatch.GetElapsedTime(streamStart) < streamDuration)
+        {
+            if (!subscription.WaitForEvent(100))
+                continue;
+
+            while (subscription.TryRead<ushort>(payloadBuffer, out HarpMessageView<ushort> message))
+            {
+                ushort counter = message.Payload[0];
+                if (expectedCounter is ushort expected && counter != expected)
+                    gapCount++;
+
+                expectedCounter = (ushort)(counter + 1);
+                eventCount++;
+            }
+        }
+
+        TimeSpan streamElapsed = Stopwatch.GetElapsedTime(streamStart);
+        Console.WriteLine($"Event stream: {eventCount} in {streamElapsed.TotalSeconds:0.000}s, {eventCount / streamElapsed.TotalSeconds:0} per second, {gapCount} gap(s), {subscription.DroppedCount} dropped by the connection, {device.DroppedEventCount - initialDeviceDroppedCount} dropped by the device");
+
+        // Transactions have to share the connection with the stream while streaming
+        Console.WriteLine(Measure("Single reads while streaming", transactionCount, () =>
+        {
+            HarpMessageView<ushort> response = harp.Read<ushort>(CommonRegister.R_WHO_AM_I, payloadBuffer);
+            return response.IsValid && response.MessageType == MessageType.Read && response.Payload[0] == options.WhoAmI;
+        }));
+
+        harp.StopStreaming();
+    }
+}
@@ -0,0 +1,178 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using PicobootConnection.LibUsb;
+using System;
+using System.Buffers.Binary;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using static PicobootConnection.Picoboot;
+
+namespace Harp.Simulator;
+
+/// <summary>Measures the PICOBOOT upload path of <see cref="PicobootDevice"/> against a <see cref="PicobootEmulator"/>.</summary>
+/// <remarks>Unlike <see cref="Benchmark"/> this doesn't need a pseudo-terminal, so it runs anywhere the native library does.</remarks>
+internal static class PicobootBenchmark
+{
+    private const string ProgramName = "picoboot-benchmark";
+
+    private static readonly (string Name, PBC_program_policy Policy)[] ProgramPolicies =
+    [
+        ("256 byte writes", new() { write_size = PAGE_SIZE, erase_size = 0, pipeline_depth = 0 }),
+        ("4 KiB writes", new() { write_size = FLASH_SECTOR_ERASE_SIZE, erase_size = 0, pipeline_depth = 0 }),
+        ("4 KiB writes, sector erases", new() { write_size = FLASH_SECTOR_ERASE_SIZE, erase_size = FLASH_SECTOR_ERASE_SIZE, pipeline_depth = 0 }),
+        ("4 KiB writes, 2 deep pipeline", new() { write_size = FLASH_SECTOR_ERASE_SIZE, erase_size = 0, pipeline_depth = 2 }),
+        ($"4 KiB writes, {PicobootWriteStream.DefaultDepth} deep pipeline", new() { write_size = FLASH_SECTOR_ERASE_SIZE, erase_size = 0, pipeline_depth = PicobootWriteStream.DefaultDepth }),
+        ("4 KiB writes, 8 deep pipeline", new() { write_size = FLASH_SECTOR_ERASE_SIZE, erase_size = 0, pipeline_depth = 8 }),
+    ];
+
+    private readonly record struct Result(string Name, int Count, int Failures, TimeSpan[] Elapsed, ulong BytesPerIteration)
+    {
+        public override string ToString()
+        {
+            TimeSpan[] successful = Elapsed.Where(e => e != TimeSpan.Zero).Order().ToArray();
+            if (successful.Length == 0)
+                return $"{Name}: all {Count} iteration(s) failed";
+
+            TimeSpan median = successful[successful.Length / 2];
+            string throughput = BytesPerIteration == 0 ? "" : $", {BytesPerIteration / 1024.0 / median.TotalSeconds:0.0} KiB/s";
+            return $"{Name}: median {median.TotalMilliseconds:0.0}ms, min {successful[0].TotalMilliseconds:0.0}ms, max {successful[^1].TotalMilliseconds:0.0}ms{throughput}, {Failures} failure(s)";
+        }
+    }
+
+    private static Result Measure(string name, int count, ulong bytesPerIteration, Action operation)
+    {
+        // Injected faults surface as failed commands, they count as failures rather than ending the benchmark
+        TimeSpan[] elapsed = new TimeSpan[count];
+        int failures = 0;
+        for (int i = 0; i < count; i++)
+        {
+            long start = Stopwatch.GetTimestamp();
+            try
+            {
+                operation();
+                elapsed[i] = Stopwatch.GetElapsedTime(start);
+            }
+            catch (Exception ex) when (ex is PicobootCommandFailureException or LibUsbException or InvalidOperationException)
+            {
+                Trace.WriteLine($"{name} iteration {i} failed: {ex.Message}");
+                failures++;
+            }
+        }
+
+        return new Result(name, count, failures, elapsed, bytesPerIteration);
+    }
+
+    /// <summary>Creates an image of random data with just enough of a binary info table for <see cref="PicoFirmwareInfo"/> to find.</summary>
+    private static byte[] CreateImage(model_t model, uint size, int seed)
+    {
+        byte[] image = new byte[size];
+        new Random(seed).NextBytes(image);
+
+        void WriteWord(uint offset, uint value)
+            => BinaryPrimitives.WriteUInt32LittleEndian(image.AsSpan((int)offset), value);
+
+        const uint tableOffset = 0x1000;
+        const uint entriesOffset = 0x1100;
+        const uint stringsOffset = 0x1200;
+        const uint entrySize = 12;
+        BinaryInfoId[] ids = [BinaryInfoId.RP_PROGRAM_NAME, BinaryInfoId.RP_PROGRAM_DESCRIPTION, BinaryInfoId.RP_PROGRAM_VERSION_STRING];
+        string[] values = [ProgramName, "Synthetic image for benchmarking PICOBOOT uploads", "1.0.0"];
+
+        // The marker is searched for after boot2 on RP2040
+        uint markerOffset = (model == model_t.rp2040 ? 0x100u : 0u) + 0x10;
+        WriteWord(markerOffset, 0x7188ebf2);
+        WriteWord(markerOffset + 4, PicoMemoryMap.FLASH_START + tableOffset);
+        WriteWord(markerOffset + 8, PicoMemoryMap.FLASH_START + tableOffset + (uint)ids.Length * sizeof(uint));
+        WriteWord(markerOffset + 12, 0);
+        WriteWord(markerOffset + 16, 0xe71aa390);
+
+        uint stringOffset = stringsOffset;
+        for (int i = 0; i < ids.Length; i++)
+        {
+            uint entryOffset = entriesOffset + (uint)i * entrySize;
+            WriteWord(tableOffset + (uint)i * sizeof(uint), PicoMemoryMap.FLASH_START + entryOffset);
+            WriteWord(entryOffset, (uint)BinaryInfoType.ID_AND_STRING | ((uint)BinaryInfoTag.RASPBERRY_PI << 16));
+            WriteWord(entryOffset + 4, (uint)ids[i]);
+            WriteWord(entryOffset + 8, PicoMemoryMap.FLASH_START + stringOffset);
+
+            int length = Encoding.UTF8.GetBytes(values[i], image.AsSpan((int)stringOffset));
+            image[stringOffset + length] = 0;
+            stringOffset += (uint)length + 1;
+        }
+
+        return image;
+    }
+
+    public static int Run(PicobootBenchmarkOptions options)
+    {
+        if (options.ImageSize < 2 * FLASH_SECTOR_ERASE_SIZE || options.ImageSize % FLASH_SECTOR_ERASE_SIZE != 0)
+        {
+            Console.Error.WriteLine($"The image size must be a multiple of {FLASH_SECTOR_ERASE_SIZE / 1024} KiB and at least {2 * FLASH_SECTOR_ERASE_SIZE / 1024} KiB.");
+            return 1;
+        }
+
+        picoboot_emulator_config config = options.GetEmulatorConfig();
+        if (options.ImageSize > config.flash_size)
+        {
+            Console.Error.WriteLine($"The image doesn't fit in the emulated device's {config.flash_size / 1024} KiB of flash.");
+            return 1;
+        }
+
+        using PicobootEmulator emulator = new(config);
+        byte[] image = CreateImage(options.Model, options.ImageSize, options.Seed);
+        AddressRange imageRange = new(PicoMemoryMap.FLASH_START, PicoMemoryMap.FLASH_START + options.ImageSize);
+        Console.WriteLine($"Emulating {options.Model} with {config.flash_size / 1024} KiB of flash, programming {options.ImageSize / 1024} KiB images");
+
+        PicobootDevice device = emulator.Open();
+        foreach ((string name, PBC_program_policy policy) in ProgramPolicies)
+        {
+            emulator.ResetStatistics();
+            Console.WriteLine(Measure(name, options.Iterations, options.ImageSize, () => device.ProgramRegion(imageRange.Start, image, policy: policy)));
+            Console.WriteLine($"    {Describe(emulator.GetStatistics())}");
+        }
+
+        // The device remembers the flash size once it has been detected, so each iteration gets a fresh one
+        Console.WriteLine(Measure("Flash size detection", options.Iterations, 0, () =>
+        {
+            device.Dispose();
+            device = emulator.Open();
+            uint flashSize = device.TryGetFlashSize();
+            if (flashSize != config.flash_size)
+                throw new InvalidOperationException($"Detected {flashSize} bytes of flash rather than {config.flash_size}.");
+        }));
+
+        Console.WriteLine(Measure("Firmware info", options.Iterations, 0, () =>
+        {
+            PicoFirmwareInfo info = PicoFirmwareInfo.GetInfo(device);
+            if (info.ProgramName != ProgramName)
+                throw new InvalidOperationException($"Read program name '{info.ProgramName}' rather than '{ProgramName}'.");
+        }));
+
+        if (device.CanComputeFlashCrc32)
+        {
+            uint expectedCrc = Crc32(image);
+            Console.WriteLine(Measure("On-device CRC32", options.Iterations, options.ImageSize, () =>
+            {
+                uint crc = device.GetFlashCrc32(imageRange);
+                if (crc != expectedCrc)
+                    throw new InvalidOperationException($"Device computed CRC 0x{crc:X8} rather than 0x{expectedCrc:X8}.");
+            }));
+        }
+
+        Console.WriteLine(Measure("Read back", options.Iterations, options.ImageSize, () =>
+        {
+            byte[] readBack = new byte[image.Length];
+            device.Read(imageRange.Start, readBack);
+            if (!readBack.AsSpan().SequenceEqual(image))
+                throw new InvalidOperationException("Read back data doesn't match the image.");
+        }));
+
+        device.Dispose();
+        return 0;
+    }
+
+    private static string Describe(in picoboot_emulator_stats stats)
+        => $"{stats.commands} command(s), {stats.pages_programmed} page(s) programmed, {stats.sectors_erased} sector(s) erased, device busy for {stats.busy_us / 1000.0:0.0}ms, "
+        + $"{stats.injected_stalls} injected stall(s), {stats.injected_timeouts} injected timeout(s)";
+}
@@ -0,0 +1,42 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+
+namespace Harp.Simulator;
+
+internal sealed record PicobootBenchmarkOptions
+{
+    public model_t Model { get; init; } = model_t.rp2040;
+    /// <summary>The size of the image programmed by each iteration, must be a multiple of the flash sector size.</summary>
+    public uint ImageSize { get; init; } = 256 * 1024;
+    public int Iterations { get; init; } = 5;
+
+    // Overrides for the emulator's default timing model, see picoboot_emulator_config
+    public uint? FlashSize { get; init; }
+    public TimeSpan? TransferLatency { get; init; }
+    public uint? BytesPerMillisecond { get; init; }
+    public TimeSpan? PageProgramTime { get; init; }
+    public TimeSpan? SectorEraseTime { get; init; }
+
+    // Fault injection, each is the probability that a given command is affected
+    /// <summary>The command fails and both endpoints are stalled.</summary>
+    public double StallProbability { get; init; } = 0.0;
+    /// <summary>The device hangs until the host gives up and resets the interface.</summary>
+    public double TimeoutProbability { get; init; } = 0.0;
+
+    public int Seed { get; init; } = 0;
+
+    public picoboot_emulator_config GetEmulatorConfig()
+    {
+        picoboot_emulator_config config = PicobootEmulator.GetDefaultConfig(Model);
+        config.flash_size = FlashSize ?? config.flash_size;
+        config.transfer_latency_us = TransferLatency is TimeSpan transferLatency ? checked((uint)transferLatency.TotalMicroseconds) : config.transfer_latency_us;
+        config.bytes_per_ms = BytesPerMillisecond ?? config.bytes_per_ms;
+        config.page_program_us = PageProgramTime is TimeSpan pageProgramTime ? checked((uint)pageProgramTime.TotalMicroseconds) : config.page_program_us;
+        config.sector_erase_us = SectorEraseTime is TimeSpan sectorEraseTime ? checked((uint)sectorEraseTime.TotalMicroseconds) : config.sector_erase_us;
+        config.stall_probability = StallProbability;
+        config.timeout_probability = TimeoutProbability;
+        config.seed = unchecked((uint)Seed);
+        return config;
+    }
+}
@@ -0,0 +1,246 @@
+﻿using Harp.Simulator;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.Threading;
+
+const string usage =
+    """
+    Usage:
+        Harp.Simulator serve [options]
+            Runs a simulated Harp device until Ctrl+C is pressed.
+        Harp.Simulator benchmark [options]
+            Measures transaction throughput and latency against a simulated Harp device.
+        Harp.Simulator picoboot [options]
+            Measures firmware upload performance against an emulated RP2040/RP2350 in BOOTSEL mode.
+
+    Device options:
+        --who-am-i <id>
+            The value of R_WHO_AM_I. Defaults to 1234.
+        --device-name <name>
+            The value of R_DEVICE_NAME.
+        --serial-number <number>
+            The value of R_SERIAL_NUMBER.
+        --no-firmware-update
+            Don't implement the firmware update registers.
+        --latency <microseconds>
+            How long the device takes to reply to each request. Defaults to 0.
+        --event-rate <hz>
+            How many events to emit per second. Defaults to 0 for serve and 1000 for benchmark.
+        --event-register <address>
+            The register events are emitted from. Defaults to 34.
+        --garbage <probability>
+            The probability of writing garbage before a reply.
+        --drop <probability>
+            The probability of not sending a reply.
+        --bad-checksum <probability>
+            The probability of sending a reply with a bad checksum.
+        --seed <seed>
+            Seed for fault injection.
+
+    Benchmark options:
+        --transactions <count>
+            How many transactions to measure. Defaults to 10000.
+        --duration <seconds>
+            How long to measure event streaming for. Defaults to 2.
+        --transport <termios|serialport>
+            How HarpConnection talks to the simulated device. Defaults to termios.
+
+    PICOBOOT options:
+        --model <rp2040|rp2350>
+            The chip to emulate. Defaults to rp2040.
+        --flash-size <KiB>
+            The size of the emulated flash chip, must be a power of two. Defaults to that of a Pico/Pico 2.
+        --image-size <KiB>
+            The size of the image to program. Defaults to 256.
+        --iterations <count>
+            How many times to repeat each measurement. Defaults to 5.
+        --usb-latency <microseconds>
+            How long each USB transfer takes to reach the device. Defaults to 250.
+        --usb-throughput <bytes per millisecond>
+            Bulk transfer throughput, 0 for unlimited. Defaults to 1000.
+        --page-program <microseconds>
+            How long programming each flash page takes. Defaults to 400.
+        --sector-erase <microseconds>
+            How long erasing each flash sector takes. Defaults to 45000.
+        --stall <probability>
+            The probability of a command failing and stalling the endpoints.
+        --timeout <probability>
+            The probability of the device hanging after receiving a command.
+        --seed <seed>
+            Seed for fault injection and the image contents.
+
+    Common options:
+        --verbose
+            Enables verbose logging.
+    """;
+
+Queue<string> arguments = new(args);
+if (arguments.Count == 0)
+{
+    Console.WriteLine(usage);
+    return 1;
+}
+
+string verb = arguments.Dequeue().ToLowerInvariant();
+if (verb is not ("serve" or "benchmark" or "picoboot"))
+{
+    Console.WriteLine(usage);
+    return 1;
+}
+
+SimulatedHarpDeviceOptions options = new() { EventRate = verb == "benchmark" ? 1000.0 : 0.0 };
+int transactionCount = 10_000;
+TimeSpan streamDuration = TimeSpan.FromSeconds(2);
+bool useSerialPort = false;
+PicobootBenchmarkOptions picobootOptions = new();
+
+try
+{
+    string NextArgument(string argument)
+        => arguments.TryDequeue(out string? value) ? value : throw new FormatException($"'{argument}' requires a value.");
+
+    double NextProbability(string argument)
+    {
+        double result = double.Parse(NextArgument(argument), CultureInfo.InvariantCulture);
+        return result is >= 0.0 and <= 1.0 ? result : throw new FormatException($"'{argument}' must be between 0 and 1.");
+    }
+
+    while (arguments.TryDequeue(out string? argument))
+    {
+        switch (argument.ToLowerInvariant())
+        {
+            case "--who-am-i":
+                options = options with { WhoAmI = ushort.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--device-name":
+                options = options with { DeviceName = NextArgument(argument) };
+                break;
+            case "--serial-number":
+                options = options with { SerialNumber = ushort.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--no-firmware-update":
+                options = options with { SupportsFirmwareUpdate = false };
+                break;
+            case "--latency":
+                options = options with { ResponseLatency = TimeSpan.FromMicroseconds(double.Parse(NextArgument(argument), CultureInfo.InvariantCulture)) };
+                break;
+            case "--event-rate":
+                options = options with { EventRate = double.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--event-register":
+                options = options with { EventRegister = byte.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--garbage":
+                options = options with { GarbageProbability = NextProbability(argument) };
+                break;
+            case "--drop":
+                options = options with { DropProbability = NextProbability(argument) };
+                break;
+            case "--bad-checksum":
+                options = options with { BadChecksumProbability = NextProbability(argument) };
+                break;
+            case "--seed":
+                options = options with { Seed = int.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                picobootOptions = picobootOptions with { Seed = options.Seed };
+                break;
+            case "--transactions" when verb == "benchmark":
+                transactionCount = int.Parse(NextArgument(argument), CultureInfo.InvariantCulture);
+                break;
+            case "--duration" when verb == "benchmark":
+                streamDuration = TimeSpan.FromSeconds(double.Parse(NextArgument(argument), CultureInfo.InvariantCulture));
+                break;
+            case "--transport" when verb == "benchmark":
+                useSerialPort = NextArgument(argument).ToLowerInvariant() switch
+                {
+                    "termios" => false,
+                    "serialport" => true,
+                    _ => throw new FormatException($"'{argument}' must be termios or serialport."),
+                };
+                break;
+            case "--model" when verb == "picoboot":
+                picobootOptions = picobootOptions with
+                {
+                    Model = NextArgument(argument).ToLowerInvariant() switch
+                    {
+                        "rp2040" => model_t.rp2040,
+                        "rp2350" => model_t.rp2350,
+                        _ => throw new FormatException($"'{argument}' must be rp2040 or rp2350."),
+                    }
+                };
+                break;
+            case "--flash-size" when verb == "picoboot":
+                picobootOptions = picobootOptions with { FlashSize = checked(uint.Parse(NextArgument(argument), CultureInfo.InvariantCulture) * 1024) };
+                break;
+            case "--image-size" when verb == "picoboot":
+                picobootOptions = picobootOptions with { ImageSize = checked(uint.Parse(NextArgument(argument), CultureInfo.InvariantCulture) * 1024) };
+                break;
+            case "--iterations" when verb == "picoboot":
+                picobootOptions = picobootOptions with { Iterations = int.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--usb-latency" when verb == "picoboot":
+                picobootOptions = picobootOptions with { TransferLatency = TimeSpan.FromMicroseconds(double.Parse(NextArgument(argument), CultureInfo.InvariantCulture)) };
+                break;
+            case "--usb-throughput" when verb == "picoboot":
+                picobootOptions = picobootOptions with { BytesPerMillisecond = uint.Parse(NextArgument(argument), CultureInfo.InvariantCulture) };
+                break;
+            case "--page-program" when verb == "picoboot":
+                picobootOptions = picobootOptions with { PageProgramTime = TimeSpan.FromMicroseconds(double.Parse(NextArgument(argument), CultureInfo.InvariantCulture)) };
+                break;
+            case "--sector-erase" when verb == "picoboot":
+                picobootOptions = picobootOptions with { SectorEraseTime = TimeSpan.FromMicroseconds(double.Parse(NextArgument(argument), CultureInfo.InvariantCulture)) };
+                break;
+            case "--stall" when verb == "picoboot":
+                picobootOptions = picobootOptions with { StallProbability = NextProbability(argument) };
+                break;
+            case "--timeout" when verb == "picoboot":
+                picobootOptions = picobootOptions with { TimeoutProbability = NextProbability(argument) };
+                break;
+            case "--verbose":
+                Trace.Listeners.Add(new ConsoleTraceListener(useErrorStream: true));
+                break;
+            default:
+                throw new FormatException($"Unrecognized argument '{argument}'.");
+        }
+    }
+}
+catch (Exception ex) when (ex is FormatException or OverflowException)
+{
+    Console.Error.WriteLine(ex.Message);
+    Console.WriteLine(usage);
+    return 1;
+}
+
+// The PICOBOOT emulator is part of the native library, so unlike the Harp device simulator it doesn't need Linux
+if (verb == "picoboot")
+    return PicobootBenchmark.Run(picobootOptions);
+
+if (!OperatingSystem.IsLinux())
+{
+    Console.Error.WriteLine("The Harp device simulator requires Linux.");
+    return 1;
+}
+
+if (verb == "benchmark")
+{
+    Benchmark.Run(options, transactionCount, streamDuration, useSerialPort);
+    return 0;
+}
+
+using SimulatedHarpDevice device = new(options);
+device.Start();
+Console.WriteLine($"Simulated Harp device {options.WhoAmI} is listening on {device.PortName}, press Ctrl+C to stop.");
+
+using ManualResetEventSlim stopRequested = new();
+Console.CancelKeyPress += (_, e) =>
+{
+    e.Cancel = true;
+    stopRequested.Set();
+};
+stopRequested.Wait();
+
+Console.WriteLine($"Handled {device.RequestCount} request(s) and emitted {device.EventCount} event(s), {device.DroppedEventCount} event(s) were dropped because they weren't read in time.");
+Console.WriteLine($"Injected faults: {device.DroppedReplyCount} dropped, {device.GarbageCount} garbage, {device.BadChecksumCount} bad checksum.");
+return 0;
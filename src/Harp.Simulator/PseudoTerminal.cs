@@ -0,0 +1,217 @@
+﻿using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Runtime.Versioning;
+using System.Text;
+using System.Threading;
+using static Harp.Protocol.Libc;
+
+namespace Harp.Simulator;
+
+/// <summary>A pseudo-terminal pair, the simulated device owns the master side and clients open <see cref="PortName"/> as if it were a serial port.</summary>
+[SupportedOSPlatform("linux")]
+internal sealed unsafe class PseudoTerminal : IDisposable
+{
+    private int MasterFd = -1;
+    // We keep the slave side open ourselves so that the master doesn't see a hangup whenever a client closes the port
+    private int SlaveFd = -1;
+
+    public string PortName { get; }
+
+    // Output which didn't fit in the terminal's buffer, a host's serial driver would normally buffer this for the device
+    // Queuing it rather than blocking means the device keeps reading requests even when the client is busy writing rather than reading
+    private readonly object PendingOutputLock = new();
+    private byte[] PendingOutput = new byte[4096];
+    private int PendingOutputStart;
+    private int PendingOutputEnd;
+    private bool HasPendingOutput => PendingOutputStart != PendingOutputEnd;
+
+    public PseudoTerminal()
+    {
+        try
+        {
+            // Non-blocking so that writing never stalls the device when the client stops reading
+            MasterFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+            if (MasterFd < 0)
+                ThrowLastError(nameof(posix_openpt));
+            if (grantpt(MasterFd) != 0)
+                ThrowLastError(nameof(grantpt));
+            if (unlockpt(MasterFd) != 0)
+                ThrowLastError(nameof(unlockpt));
+
+            byte* name = stackalloc byte[256];
+            int error = ptsname_r(MasterFd, name, 256);
+            if (error != 0)
+                ThrowError(nameof(ptsname_r), error);
+            PortName = Encoding.UTF8.GetString(MemoryMarshal.CreateReadOnlySpanFromNullTerminated(name));
+
+            SlaveFd = open(name, O_RDWR | O_NOCTTY);
+            if (SlaveFd < 0)
+                ThrowLastError(nameof(open));
+
+            // Clients are expected to configure the port themselves, but raw mode is a sensible default for anything which doesn't
+            byte* termios = stackalloc byte[TermiosSize];
+            if (tcgetattr(SlaveFd, termios) != 0)
+                ThrowLastError(nameof(tcgetattr));
+            cfmakeraw(termios);
+            if (tcsetattr(SlaveFd, TCSANOW, termios) != 0)
+                ThrowLastError(nameof(tcsetattr));
+        }
+        catch
+        {
+            Dispose();
+            throw;
+        }
+    }
+
+    private static void ThrowError(string function, int error)
+        => throw new IOException($"{function} failed: {Marshal.GetPInvokeErrorMessage(error)}");
+
+    private static void ThrowLastError(string function)
+        => ThrowError(function, Marshal.GetLastPInvokeError());
+
+    /// <summary>Reads whatever data the client has written, pending output is flushed while waiting.</summary>
+    /// <returns>The number of bytes read, or 0 if nothing arrived within <paramref name="timeoutMilliseconds"/>.</returns>
+    public int Read(Span<byte> buffer, int timeoutMilliseconds)
+    {
+        pollfd pollFd = new() { fd = MasterFd, events = POLLIN };
+        lock (PendingOutputLock)
+        {
+            if (HasPendingOutput)
+                pollFd.events |= POLLOUT;
+        }
+
+        int result = poll(&pollFd, 1, timeoutMilliseconds);
+        if (result < 0)
+        {
+            int error = Marshal.GetLastPInvokeError();
+            if (error == EINTR)
+                return 0;
+            ThrowError(nameof(poll), error);
+        }
+
+        if ((pollFd.revents & POLLOUT) != 0)
+        {
+            lock (PendingOutputLock)
+                FlushPendingOutput();
+        }
+
+        if ((pollFd.revents & POLLIN) == 0)
+            return 0;
+
+        fixed (byte* bufferPointer = buffer)
+        {
+            nint bytesRead = read(MasterFd, bufferPointer, (nuint)buffer.Length);
+            if (bytesRead < 0)
+            {
+                int error = Marshal.GetLastPInvokeError();
+                if (error is EINTR or EAGAIN)
+                    return 0;
+                ThrowError(nameof(read), error);
+            }
+
+            return (int)bytesRead;
+        }
+    }
+
+    /// <summary>Writes as much of <paramref name="data"/> as the terminal will currently accept.</summary>
+    /// <returns>The number of bytes written, which is 0 if the terminal's buffer is full.</returns>
+    private int WriteSome(ReadOnlySpan<byte> data)
+    {
+        fixed (byte* dataPointer = data)
+        {
+            nint bytesWritten = write(MasterFd, dataPointer, (nuint)data.Length);
+            if (bytesWritten < 0)
+            {
+                int error = Marshal.GetLastPInvokeError();
+                if (error is EINTR or EAGAIN)
+                    return 0;
+                ThrowError(nameof(write), error);
+            }
+
+            return (int)bytesWritten;
+        }
+    }
+
+    private void QueuePendingOutput(ReadOnlySpan<byte> data)
+    {
+        Debug.Assert(Monitor.IsEntered(PendingOutputLock));
+        if (PendingOutputEnd + data.Length > PendingOutput.Length)
+        {
+            int pendingLength = PendingOutputEnd - PendingOutputStart;
+            byte[] newPendingOutput = PendingOutput;
+            if (pendingLength + data.Length > PendingOutput.Length)
+                newPendingOutput = new byte[Math.Max(PendingOutput.Length * 2, pendingLength + data.Length)];
+
+            PendingOutput.AsSpan(PendingOutputStart, pendingLength).CopyTo(newPendingOutput);
+            PendingOutput = newPendingOutput;
+            PendingOutputStart = 0;
+            PendingOutputEnd = pendingLength;
+        }
+
+        data.CopyTo(PendingOutput.AsSpan(PendingOutputEnd));
+        PendingOutputEnd += data.Length;
+    }
+
+    private void FlushPendingOutput()
+    {
+        Debug.Assert(Monitor.IsEntered(PendingOutputLock));
+        PendingOutputStart += WriteSome(PendingOutput.AsSpan(PendingOutputStart, PendingOutputEnd - PendingOutputStart));
+        if (PendingOutputStart == PendingOutputEnd)
+        {
+            PendingOutputStart = 0;
+            PendingOutputEnd = 0;
+        }
+    }
+
+    /// <summary>Writes <paramref name="data"/> without waiting, anything which doesn't fit is queued and sent by <see cref="Read"/>.</summary>
+    public void Write(ReadOnlySpan<byte> data)
+    {
+        lock (PendingOutputLock)
+        {
+            // Pending output has to go first to keep everything in order
+            if (!HasPendingOutput)
+                data = data.Slice(WriteSome(data));
+
+            if (!data.IsEmpty)
+                QueuePendingOutput(data);
+        }
+    }
+
+    /// <summary>Writes <paramref name="data"/> unless the terminal's buffer is full or output is already pending.</summary>
+    /// <returns>False if nothing was written.</returns>
+    public bool TryWrite(ReadOnlySpan<byte> data)
+    {
+        lock (PendingOutputLock)
+        {
+            if (HasPendingOutput)
+                return false;
+
+            int bytesWritten = WriteSome(data);
+            if (bytesWritten == 0)
+                return false;
+
+            // Only part of it fit, the rest is queued regardless or the client would receive a truncated message
+            if (bytesWritten < data.Length)
+                QueuePendingOutput(data.Slice(bytesWritten));
+
+            return true;
+        }
+    }
+
+    public void Dispose()
+    {
+        if (SlaveFd >= 0)
+        {
+            close(SlaveFd);
+            SlaveFd = -1;
+        }
+
+        if (MasterFd >= 0)
+        {
+            close(MasterFd);
+            MasterFd = -1;
+        }
+    }
+}
@@ -0,0 +1,366 @@
+﻿using Harp.Protocol;
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using System.Runtime.Versioning;
+using System.Text;
+using System.Threading;
+
+namespace Harp.Simulator;
+
+/// <summary>A Harp device which implements the common registers on the far side of a pseudo-terminal.</summary>
+/// <remarks>
+/// Requests are handled one at a time in the order they arrive, the same as real devices.
+/// Replies and events are always timestamped, also the same as real devices.
+/// </remarks>
+[SupportedOSPlatform("linux")]
+internal sealed class SimulatedHarpDevice : IDisposable
+{
+    private sealed class Register
+    {
+        public required PayloadType PayloadType { get; init; }
+        public required byte[] Value { get; set; }
+        public bool IsWritable { get; init; }
+        /// <summary>Whether writes may change the number of elements in the register.</summary>
+        public bool IsVariableLength { get; init; }
+        public Action<Register>? OnRead { get; init; }
+        public Action<Register>? OnWrite { get; init; }
+    }
+
+    private const int DeviceNameLength = 25;
+
+    public SimulatedHarpDeviceOptions Options { get; }
+    private readonly PseudoTerminal Terminal;
+    private readonly Register?[] Registers = new Register?[byte.MaxValue + 1];
+
+    private readonly long StartTimestamp = Stopwatch.GetTimestamp();
+    private long TimestampOffsetSeconds;
+
+    private readonly object WriteLock = new();
+    private readonly byte[] TransmitBuffer = new byte[HarpMessageEncoder.GetEncodedLength(hasTimestamp: true, payloadLength: ushort.MaxValue - 10)];
+    private readonly Random RequestRandom;
+    private readonly Random EventRandom;
+
+    private Thread? RequestThread;
+    private Thread? EventThread;
+    private volatile bool StopRequested;
+
+    // Statistics
+    private long _RequestCount;
+    private long _DroppedReplyCount;
+    private long _GarbageCount;
+    private long _BadChecksumCount;
+    private long _EventCount;
+    private long _DroppedEventCount;
+    public long RequestCount => Interlocked.Read(ref _RequestCount);
+    public long DroppedReplyCount => Interlocked.Read(ref _DroppedReplyCount);
+    public long GarbageCount => Interlocked.Read(ref _GarbageCount);
+    public long BadChecksumCount => Interlocked.Read(ref _BadChecksumCount);
+    public long EventCount => Interlocked.Read(ref _EventCount);
+    /// <summary>Events which weren't sent because the client wasn't reading fast enough.</summary>
+    public long DroppedEventCount => Interlocked.Read(ref _DroppedEventCount);
+
+    /// <summary>Set once the host asks the device to reboot into its bootloader, after which the device stops responding.</summary>
+    public bool IsInBootloader { get; private set; }
+
+    /// <summary>The path clients should open to talk to the device.</summary>
+    public string PortName => Terminal.PortName;
+
+    public SimulatedHarpDevice(SimulatedHarpDeviceOptions options)
+    {
+        Options = options;
+        RequestRandom = new Random(options.Seed);
+        EventRandom = new Random(options.Seed + 1);
+        InitializeRegisters();
+        Terminal = new PseudoTerminal();
+    }
+
+    private void AddRegister<T>(CommonRegister register, T value, bool isWritable = false, Action<Register>? onRead = null, Action<Register>? onWrite = null)
+        where T : unmanaged
+        => AddRegister((byte)register, [value], isWritable, onRead, onWrite);
+
+    private void AddRegister<T>(byte register, T[] value, bool isWritable = false, Action<Register>? onRead = null, Action<Register>? onWrite = null, bool isVariableLength = false)
+        where T : unmanaged
+    {
+        Registers[register] = new Register()
+        {
+            PayloadType = PayloadType.GetType<T>(),
+            Value = MemoryMarshal.AsBytes(value.AsSpan()).ToArray(),
+            IsWritable = isWritable,
+            IsVariableLength = isVariableLength,
+            OnRead = onRead,
+            OnWrite = onWrite,
+        };
+    }
+
+    private void InitializeRegisters()
+    {
+        AddRegister(CommonRegister.R_WHO_AM_I, Options.WhoAmI);
+        AddRegister(CommonRegister.R_HW_VERSION_H, (byte)1);
+        AddRegister(CommonRegister.R_HW_VERSION_L, (byte)0);
+        AddRegister(CommonRegister.R_ASSEMBLY_VERSION, (byte)0);
+        AddRegister(CommonRegister.R_CORE_VERSION_H, (byte)1);
+        AddRegister(CommonRegister.R_CORE_VERSION_L, (byte)13);
+        AddRegister(CommonRegister.R_FW_VERSION_H, Options.FirmwareVersionMajor);
+        AddRegister(CommonRegister.R_FW_VERSION_L, Options.FirmwareVersionMinor);
+        AddRegister
+        (
+            CommonRegister.R_TIMESTAMP_SECOND,
+            0u,
+            isWritable: true,
+            onRead: r => r.Value = BitConverter.GetBytes(GetTimestamp().RawSeconds),
+            onWrite: r => Interlocked.Exchange(ref TimestampOffsetSeconds, BitConverter.ToUInt32(r.Value) - (long)Stopwatch.GetElapsedTime(StartTimestamp).TotalSeconds)
+        );
+        AddRegister(CommonRegister.R_TIMESTAMP_MICRO, (ushort)0, onRead: r => r.Value = BitConverter.GetBytes(GetTimestamp().RawMicroseconds));
+        AddRegister(CommonRegister.R_OPERATION_CTRL, (byte)0, isWritable: true);
+        AddRegister(CommonRegister.R_RESET_DEV, (byte)0, isWritable: true);
+
+        byte[] deviceName = new byte[DeviceNameLength];
+        // The last byte is reserved for the null terminator
+        if (!Encoding.UTF8.TryGetBytes(Options.DeviceName, deviceName.AsSpan(0, DeviceNameLength - 1), out _))
+            throw new ArgumentException($"The device name must be at most {DeviceNameLength - 1} bytes long.", nameof(Options));
+        AddRegister((byte)CommonRegister.R_DEVICE_NAME, deviceName, isWritable: true);
+
+        AddRegister(CommonRegister.R_SERIAL_NUMBER, Options.SerialNumber, isWritable: true);
+        AddRegister(CommonRegister.R_CLOCK_CONFIG, (byte)0, isWritable: true);
+        AddRegister(CommonRegister.R_TIMESTAMP_OFFSET, (byte)0, isWritable: true);
+
+        byte[] uid = new byte[16];
+        BitConverter.TryWriteBytes(uid, ((ulong)Options.WhoAmI << 16) | Options.SerialNumber);
+        AddRegister((byte)CommonRegister.R_UID, uid);
+        AddRegister((byte)CommonRegister.R_TAG, new byte[8], isWritable: true);
+
+        // Devices which don't support automated firmware updates simply don't implement these registers
+        if (Options.SupportsFirmwareUpdate)
+        {
+            AddRegister(CommonRegister.R_FIRMWARE_UPDATE_CAPABILITIES, (uint)FirmwareUpdateCapabilities.FIRMWARE_UPDATE_PICO_BOOTSEL);
+            AddRegister
+            (
+                CommonRegister.R_FIRMWARE_UPDATE_START_COMMAND,
+                0u,
+                isWritable: true,
+                onWrite: r =>
+                {
+                    Trace.WriteLine($"Host requested a firmware update (0x{BitConverter.ToUInt32(r.Value):X}), simulating a reboot into the bootloader.");
+                    IsInBootloader = true;
+                }
+            );
+        }
+
+        // The application register events are emitted from, it's also writable with any number of elements so that it can be used to exercise large writes
+        AddRegister(Options.EventRegister, [(ushort)0], isWritable: true, isVariableLength: true);
+    }
+
+    private HarpTimestamp GetTimestamp()
+    {
+        TimeSpan elapsed = Stopwatch.GetElapsedTime(StartTimestamp);
+        long seconds = (long)elapsed.TotalSeconds;
+        // Harp timestamps have a resolution of 32 microseconds
+        ushort microseconds = (ushort)((elapsed.Ticks - seconds * TimeSpan.TicksPerSecond) / TimeSpan.TicksPerMicrosecond / 32);
+        return new HarpTimestamp((uint)(seconds + Interlocked.Read(ref TimestampOffsetSeconds)), microseconds);
+    }
+
+    public void Start()
+    {
+        if (RequestThread is not null)
+            throw new InvalidOperationException("The device has already been started.");
+
+        RequestThread = new Thread(HandleRequests) { Name = "Simulated Harp device", IsBackground = true };
+        RequestThread.Start();
+
+        if (Options.EventRate > 0.0)
+        {
+            EventThread = new Thread(EmitEvents) { Name = "Simulated Harp device events", IsBackground = true };
+            EventThread.Start();
+        }
+    }
+
+    private void HandleRequests()
+    {
+        byte[] receiveBuffer = new byte[4096];
+        int readHead = 0;
+        int writeHead = 0;
+
+        Span<byte> payloadBuffer = new byte[ushort.MaxValue];
+        HarpMessageParser parser = new(payloadBuffer);
+
+        while (!StopRequested)
+        {
+            while (true)
+            {
+                bool isComplete = parser.TryConsume(receiveBuffer.AsSpan(readHead, writeHead - readHead), out int bytesConsumed);
+                readHead += bytesConsumed;
+                if (!isComplete)
+                    break;
+
+                HandleRequest(parser);
+                parser.Reset();
+            }
+
+            // Anything left over is the start of a field the parser can't handle yet
+            receiveBuffer.AsSpan(readHead, writeHead - readHead).CopyTo(receiveBuffer);
+            writeHead -= readHead;
+            readHead = 0;
+
+            writeHead += Terminal.Read(receiveBuffer.AsSpan(writeHead), timeoutMilliseconds: 50);
+        }
+    }
+
+    private void HandleRequest(scoped in HarpMessageParser request)
+    {
+        Interlocked.Increment(ref _RequestCount);
+
+        if (request.Checksum != request.CalculatedChecksum)
+        {
+            Trace.WriteLine($"Ignoring {request.MessageType} {(CommonRegister)request.Address} request with a bad checksum.");
+            return;
+        }
+
+        if (IsInBootloader)
+            return;
+
+        Register? register = Registers[request.Address];
+        // The timestamp flag doesn't affect the type of the payload
+        bool typeMatches = register is not null && register.PayloadType.RawValue == (request.PayloadType.RawValue & ~PayloadType.HasTimestampFlag);
+
+        switch (request.MessageType)
+        {
+            case MessageType.Read:
+                if (register is null || !typeMatches)
+                {
+                    Reply(MessageType.ReadError, request.Address, request.PayloadType, ReadOnlySpan<byte>.Empty);
+                    return;
+                }
+
+                register.OnRead?.Invoke(register);
+                Reply(MessageType.Read, request.Address, register.PayloadType, register.Value);
+                return;
+            case MessageType.Write:
+                if (register is null || !typeMatches || !register.IsWritable || request.PayloadSpan.Length == 0
+                    || (!register.IsVariableLength && request.PayloadSpan.Length != register.Value.Length))
+                {
+                    Reply(MessageType.WriteError, request.Address, request.PayloadType, ReadOnlySpan<byte>.Empty);
+                    return;
+                }
+
+                if (register.Value.Length == request.PayloadSpan.Length)
+                    request.PayloadSpan.CopyTo(register.Value);
+                else
+                    register.Value = request.PayloadSpan.ToArray();
+
+                register.OnWrite?.Invoke(register);
+                Reply(MessageType.Write, request.Address, register.PayloadType, register.Value);
+                return;
+            default:
+                Trace.WriteLine($"Ignoring unexpected {request.MessageType} {(CommonRegister)request.Address} message.");
+                return;
+        }
+    }
+
+    private static void Delay(TimeSpan duration)
+    {
+        if (duration <= TimeSpan.Zero)
+            return;
+
+        // Sleeping is only accurate to about a millisecond, so the remainder is spun
+        long start = Stopwatch.GetTimestamp();
+        if (duration > TimeSpan.FromMilliseconds(2))
+            Thread.Sleep(duration - TimeSpan.FromMilliseconds(1));
+
+        SpinWait spinWait = new();
+        while (Stopwatch.GetElapsedTime(start) < duration)
+            spinWait.SpinOnce(sleep1Threshold: -1);
+    }
+
+    private void Reply(MessageType messageType, byte address, PayloadType payloadType, ReadOnlySpan<byte> payload)
+    {
+        Delay(Options.ResponseLatency);
+
+        if (RequestRandom.NextDouble() < Options.DropProbability)
+        {
+            Interlocked.Increment(ref _DroppedReplyCount);
+            return;
+        }
+
+        bool injectGarbage = RequestRandom.NextDouble() < Options.GarbageProbability;
+        bool corruptChecksum = RequestRandom.NextDouble() < Options.BadChecksumProbability;
+        Send(RequestRandom, messageType, address, payloadType, payload, injectGarbage, corruptChecksum);
+    }
+
+    /// <param name="canDrop">Whether to drop the message rather than queue it when the client isn't keeping up.</param>
+    /// <returns>False if the message was dropped.</returns>
+    private bool Send(Random random, MessageType messageType, byte address, PayloadType payloadType, ReadOnlySpan<byte> payload, bool injectGarbage = false, bool corruptChecksum = false, bool canDrop = false)
+    {
+        PayloadType timestampedType = new(hasTimestamp: true, payloadType.IsSigned, payloadType.IsFloat, payloadType.NumBits);
+
+        lock (WriteLock)
+        {
+            if (injectGarbage)
+            {
+                Span<byte> garbage = stackalloc byte[random.Next(1, 9)];
+                random.NextBytes(garbage);
+                Terminal.Write(garbage);
+                Interlocked.Increment(ref _GarbageCount);
+            }
+
+            int length = HarpMessageEncoder.Encode(TransmitBuffer, messageType, address, timestampedType, GetTimestamp(), payload);
+            if (corruptChecksum)
+            {
+                TransmitBuffer[length - 1] ^= 0xFF;
+                Interlocked.Increment(ref _BadChecksumCount);
+            }
+
+            ReadOnlySpan<byte> message = TransmitBuffer.AsSpan(0, length);
+            if (canDrop)
+                return Terminal.TryWrite(message);
+
+            Terminal.Write(message);
+            return true;
+        }
+    }
+
+    private void EmitEvents()
+    {
+        long period = (long)(Stopwatch.Frequency / Options.EventRate);
+        long nextTimestamp = Stopwatch.GetTimestamp();
+        ushort counter = 0;
+        Span<byte> payload = stackalloc byte[sizeof(ushort)];
+
+        while (!StopRequested)
+        {
+            long now = Stopwatch.GetTimestamp();
+            if (now < nextTimestamp)
+            {
+                // Capped so that we notice being stopped even at low event rates
+                TimeSpan remaining = Stopwatch.GetElapsedTime(now, nextTimestamp);
+                Delay(remaining < TimeSpan.FromMilliseconds(50) ? remaining : TimeSpan.FromMilliseconds(50));
+                continue;
+            }
+
+            // If we've fallen far behind (IE: because the host stopped reading and the terminal filled up) we skip ahead rather than bursting
+            if (Stopwatch.GetElapsedTime(nextTimestamp, now) > TimeSpan.FromMilliseconds(100))
+                nextTimestamp = now;
+
+            if (!IsInBootloader)
+            {
+                BitConverter.TryWriteBytes(payload, counter);
+                // Like a real device whose USB buffer has filled up, events are lost rather than piling up while the client isn't keeping up
+                if (Send(EventRandom, MessageType.Event, Options.EventRegister, PayloadType.GetType<ushort>(), payload, canDrop: true))
+                    Interlocked.Increment(ref _EventCount);
+                else
+                    Interlocked.Increment(ref _DroppedEventCount);
+                counter++;
+            }
+
+            nextTimestamp += period;
+        }
+    }
+
+    public void Dispose()
+    {
+        StopRequested = true;
+        RequestThread?.Join();
+        EventThread?.Join();
+        Terminal.Dispose();
+    }
+}
@@ -0,0 +1,31 @@
+﻿using System;
+
+namespace Harp.Simulator;
+
+internal sealed record SimulatedHarpDeviceOptions
+{
+    public ushort WhoAmI { get; init; } = 1234;
+    public byte FirmwareVersionMajor { get; init; } = 1;
+    public byte FirmwareVersionMinor { get; init; } = 0;
+    public string DeviceName { get; init; } = "Simulated Harp Device";
+    public ushort SerialNumber { get; init; } = 0x5150;
+    /// <summary>Whether the device advertises support for rebooting into BOOTSEL mode via <c>R_FIRMWARE_UPDATE_CAPABILITIES</c>.</summary>
+    public bool SupportsFirmwareUpdate { get; init; } = true;
+
+    /// <summary>How long the device takes to process each request before replying.</summary>
+    public TimeSpan ResponseLatency { get; init; } = TimeSpan.Zero;
+
+    /// <summary>How many events are emitted per second, or 0 for none.</summary>
+    public double EventRate { get; init; } = 0.0;
+    public byte EventRegister { get; init; } = 34;
+
+    // Fault injection, each is the probability that a given reply is affected
+    /// <summary>Random bytes are written before the reply.</summary>
+    public double GarbageProbability { get; init; } = 0.0;
+    /// <summary>The reply is never sent.</summary>
+    public double DropProbability { get; init; } = 0.0;
+    /// <summary>The reply is sent with an incorrect checksum.</summary>
+    public double BadChecksumProbability { get; init; } = 0.0;
+
+    public int Seed { get; init; } = 0;
+}
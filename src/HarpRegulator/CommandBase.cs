@@ -82,6 +82,18 @@ internal abstract class CommandBase
         }
     }
 
+    protected static bool TryParseMaxConnections(Queue<string> arguments, out int maxParallelConnections)
+    {
+        if (!arguments.TryDequeue(out string? countString) || !int.TryParse(countString, out maxParallelConnections) || maxParallelConnections < 1)
+        {
+            Console.Error.WriteLine("A positive number of connections must be specified for `--max-connections`");
+            maxParallelConnections = 0;
+            return false;
+        }
+
+        return true;
+    }
+
     public static bool IsHelpArgument(string argument)
         => TryHandleCommonArgument(argument) == CommonArgumentResult.ShowHelp;
 
@@ -0,0 +1,118 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace HarpRegulator;
+
+/// <summary>Displays the progress of several concurrent operations, one line per operation.</summary>
+/// <remarks>
+/// When disabled (IE: output is redirected) only changes in status are printed since redrawing lines makes no sense in a log.
+/// The same happens when there are more lines than fit in the console's buffer.
+/// All members are thread-safe.
+/// </remarks>
+internal sealed class FleetProgress : IDisposable
+{
+    private readonly object Lock = new();
+    private readonly string[] Labels;
+    private readonly string[] Statuses;
+    private readonly int[] Percentages;
+    private readonly int LabelWidth;
+    private readonly int DisplayWidth;
+    private bool IsEnabled;
+    private readonly int Top;
+    private bool IsDisposed;
+
+    public FleetProgress(IReadOnlyList<string> labels, int displayWidth, bool isEnabled = true)
+    {
+        Labels = new string[labels.Count];
+        Statuses = new string[labels.Count];
+        Percentages = new int[labels.Count];
+        DisplayWidth = displayWidth;
+        IsEnabled = isEnabled;
+
+        for (int i = 0; i < Labels.Length; i++)
+        {
+            Labels[i] = labels[i];
+            Statuses[i] = "Waiting";
+            Percentages[i] = -1;
+            LabelWidth = Math.Max(LabelWidth, labels[i].Length);
+        }
+
+        // Each line is redrawn in place, which isn't possible if they don't all fit in the console's buffer
+        if (IsEnabled && Labels.Length >= Console.BufferHeight)
+            IsEnabled = false;
+
+        if (!IsEnabled)
+            return;
+
+        // Reserve the lines up front and then work out where they ended up, this accounts for the console scrolling
+        for (int i = 0; i < Labels.Length; i++)
+            Console.WriteLine();
+        Top = Math.Max(0, Console.CursorTop - Labels.Length);
+
+        for (int i = 0; i < Labels.Length && IsEnabled; i++)
+            Render(i);
+    }
+
+    /// <param name="fraction">The progress of the current step, or null if the step doesn't have measurable progress.</param>
+    public void Update(int index, string status, double? fraction = null)
+    {
+        int percentage = fraction is double value ? Math.Clamp((int)(value * 100.0), 0, 100) : -1;
+
+        lock (Lock)
+        {
+            if (IsDisposed)
+                return;
+
+            bool statusChanged = Statuses[index] != status;
+            if (!statusChanged && Percentages[index] == percentage)
+                return;
+
+            Statuses[index] = status;
+            Percentages[index] = percentage;
+
+            if (IsEnabled)
+                Render(index);
+            else if (statusChanged)
+                WriteStatusLine(index);
+        }
+    }
+
+    private void Render(int index)
+    {
+        const int barWidth = 20;
+        string line = $"  {Labels[index].PadRight(LabelWidth)} ";
+        int percentage = Percentages[index];
+        if (percentage >= 0)
+        {
+            int filledWidth = percentage * barWidth / 100;
+            line += $"[{new String('=', filledWidth)}{new String(' ', barWidth - filledWidth)}] {percentage,3}% ";
+        }
+        line += Statuses[index];
+
+        // Lines must not wrap or they'll clobber the line below them
+        int maxWidth = Math.Max(1, DisplayWidth - 1);
+        line = line.Length > maxWidth ? line.Substring(0, maxWidth) : line.PadRight(maxWidth);
+
+        try
+        {
+            Console.SetCursorPosition(0, Top + index);
+            Console.Write(line);
+            Console.SetCursorPosition(0, Top + Labels.Length);
+        }
+        catch (ArgumentOutOfRangeException)
+        {
+            // The console was resized out from under us, so fall back to printing changes in status
+            IsEnabled = false;
+            WriteStatusLine(index);
+        }
+    }
+
+    private void WriteStatusLine(int index)
+        => Console.WriteLine($"{Labels[index]}: {Statuses[index]}");
+
+    public void Dispose()
+    {
+        lock (Lock)
+            IsDisposed = true;
+    }
+}
@@ -126,14 +126,14 @@ internal sealed class InspectCommand : CommandBase
 
         if (Uf2File.IsUf2File(filePath))
         {
-            Uf2File uf2 = new(filePath);
+            using Uf2File uf2 = new(filePath);
             Dictionary<Uf2FamilyId, Uf2FamilyInfo>? jsonInfos = useJson ? new(uf2.FamilyIds.Count) : null;
             bool first = true;
 
             if ((uf2.FamilyIds.Count > 1 || VerboseMode) && !useJson)
             {
                 first = false;
-                Console.WriteLine($"'{filePath}' is a UF2 file containing {uf2.Blocks.Length} blocks for the following device families:");
+                Console.WriteLine($"'{filePath}' is a UF2 file containing {uf2.BlockCount} blocks for the following device families:");
                 foreach (Uf2FamilyId family in uf2.FamilyIds)
                     Console.WriteLine($"* {family.Description()}");
             }
@@ -13,10 +13,10 @@ internal sealed class ListDevicesCommand : CommandBase
 {
     public override string Verb => "list";
     public override string Description => "Displays information about Harp devices connected to this system.";
-    public override string UsageHelp => "list [--json] [--all[!]] [--allow-connect[!]]";
+    public override string UsageHelp => "list [--json] [--all[!]] [--allow-connect[!]] [--max-connections <count>] [--server|--socket <path>]";
 
     public override string ArgumentsHelp =>
-        """
+        $"""
         --json
             Formats the output using JSON.
 
@@ -30,6 +30,16 @@ internal sealed class ListDevicesCommand : CommandBase
         --allow-connect!
             Allow Harp Regulator to connect to the devices over the Harp protocol in ord to enumerate missing metadata.
             Adding a ! will attempt to connect to all serial ports, even ones that *really* don't seem like Harp devices.
+
+        --max-connections <count>
+            The maximum number of devices to connect to at once when --allow-connect is specified.
+            (Default is {Device.DefaultMaxParallelConnections}.)
+
+        --server
+        --socket <path>
+            Query a running `serve` instance rather than enumerating devices directly.
+            --server uses the default socket path, --socket uses the given one.
+            (Cannot be used with --allow-connect.)
         """;
 
     public override CommandResult Execute(Queue<string> arguments)
@@ -38,6 +48,8 @@ internal sealed class ListDevicesCommand : CommandBase
         DeviceConfidence deviceFilter = DeviceConfidence.High;
         bool allowConnect = false;
         DeviceConfidence connectionFilter = DeviceConfidence.High;
+        int maxParallelConnections = Device.DefaultMaxParallelConnections;
+        string? socketPath = null;
 
         // Parse arguments
         while (arguments.Count > 0)
@@ -62,6 +74,20 @@ internal sealed class ListDevicesCommand : CommandBase
                     connectionFilter = connectionFilter.DemoteTo(DeviceConfidence.Zero);
                     allowConnect = true;
                     break;
+                case "--max-connections":
+                    if (!TryParseMaxConnections(arguments, out maxParallelConnections))
+                        return CommandResult.Failure;
+                    break;
+                case "--server":
+                    socketPath ??= ServeCommand.DefaultSocketPath;
+                    break;
+                case "--socket":
+                    if (!arguments.TryDequeue(out socketPath))
+                    {
+                        Console.Error.WriteLine("A socket path must be specified for `--socket`");
+                        return CommandResult.Failure;
+                    }
+                    break;
                 default:
                     switch (TryHandleCommonArgument(argument))
                     {
@@ -83,20 +109,31 @@ internal sealed class ListDevicesCommand : CommandBase
         if (connectionFilter < deviceFilter)
             connectionFilter = deviceFilter;
 
+        // Let the server do the work if we have one
+        if (socketPath is not null)
+        {
+            if (allowConnect)
+            {
+                Console.Error.WriteLine("--allow-connect cannot be used when querying a server.");
+                return CommandResult.Failure;
+            }
+
+            return ServeCommand.Query(socketPath, useJson, deviceFilter);
+        }
+
         // List devices
-        ImmutableArray<Device> devices = Device.EnumerateDevices(allowConnect ? connectionFilter : null);
+        ImmutableArray<Device> devices = Device.EnumerateDevices(allowConnect ? connectionFilter : null, maxParallelConnections);
+        WriteDevices(Console.Out, devices, deviceFilter, useJson);
+        return CommandResult.Success;
+    }
 
+    /// <summary>Writes the output of the list command for the given devices.</summary>
+    internal static void WriteDevices(TextWriter output, ImmutableArray<Device> devices, DeviceConfidence deviceFilter, bool useJson)
+    {
         if (useJson)
-        {
-            string json = JsonSerializer.Serialize(devices.Where(d => d.Confidence >= deviceFilter), JsonOptions);
-            Console.WriteLine(json);
-            return CommandResult.Success;
-        }
+            output.WriteLine(JsonSerializer.Serialize(devices.Where(d => d.Confidence >= deviceFilter), JsonOptions));
         else
-        {
-            ListDevices(devices, deviceFilter);
-            return CommandResult.Success;
-        }
+            ListDevices(devices, deviceFilter, output);
     }
 
     public static void ListDevices(ImmutableArray<Device> devices, DeviceConfidence deviceFilter = DeviceConfidence.Zero, TextWriter? output = null)
@@ -130,22 +167,6 @@ internal sealed class ListDevicesCommand : CommandBase
         }
 
 
-
-        // Measure columns
-        int[] columnWidths = new int[rows[0].Length];
-        foreach (string[] row in rows)
-        {
-            if (row.Length != columnWidths.Length)
-                throw new InvalidOperationException("Table is malformed.");
-
-            for (int i = 0; i < row.Length; i++)
-            {
-                ref int columnWidth = ref columnWidths[i];
-                columnWidth = Math.Max(columnWidth, row[i].Length);
-            }
-        }
-
-
         // No devices to list
         if (rows.Count == 1)
         {
@@ -158,29 +179,6 @@ internal sealed class ListDevicesCommand : CommandBase
             return;
         }
 
-        // Print table
-        //TODO: Handle overflowing the width of the console
-        ReadOnlySpan<char> fullSpace = new String(' ', columnWidths.Max());
-        bool firstRow = true;
-        foreach (string[] row in rows)
-        {
-            output.Write("|");
-            int columnIndex = 0;
-            foreach (string column in row)
-            {
-                output.Write($" {column}{fullSpace.Slice(0, columnWidths[columnIndex] - column.Length)} |");
-                columnIndex++;
-            }
-            output.WriteLine();
-
-            if (firstRow)
-            {
-                firstRow = false;
-                output.Write("|");
-                foreach (int width in columnWidths)
-                    output.Write($"-{new String('-', width)}-|");
-                output.WriteLine();
-            }
-        }
+        Utilities.WriteTable(output, rows);
     }
 }
@@ -19,6 +19,7 @@ HelpCommand help = new()
         new UploadFirmwareCommand(),
         new InspectCommand(),
         new InstallDriversCommand(),
+        new ServeCommand(),
     ]
 };
 
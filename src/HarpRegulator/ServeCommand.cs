@@ -0,0 +1,299 @@
+﻿using Harp.Devices;
+using PicobootConnection.LibUsb;
+using System;
+using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Diagnostics;
+using System.IO;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+
+namespace HarpRegulator;
+
+internal sealed class ServeCommand : CommandBase
+{
+    public override string Verb => "serve";
+    public override string Description => "Keeps an up-to-date list of devices in memory and answers `list` queries over a local socket.";
+    public override string UsageHelp => "serve [--socket <path>]";
+
+    public override string ArgumentsHelp =>
+        $"""
+        --socket <path>
+            The path of the Unix domain socket to listen on.
+            (Default is "{DefaultSocketPath}".)
+
+        Query the server using `list --server` or `list --socket <path>`.
+        The device list is refreshed whenever a USB device arrives or leaves.
+        Harp devices are never connected to over the Harp protocol.
+        Devices in BOOTSEL mode are only opened once to learn their details, and not until a few seconds after they appear.
+        (This avoids racing `upload` in other processes for a device which was just rebooted into BOOTSEL mode.)
+        """;
+
+    public static string DefaultSocketPath => Path.Combine(Path.GetTempPath(), "harp-regulator.sock");
+
+    /// <summary>Delay used to coalesce bursts of USB changes (IE: a composite device arriving) into a single refresh.</summary>
+    private static readonly TimeSpan SettleTime = TimeSpan.FromMilliseconds(200);
+
+    /// <summary>How long a BOOTSEL device must be present before it's opened, by which point an upload which rebooted it will have already claimed it.</summary>
+    private static readonly TimeSpan BootselOpenDelay = TimeSpan.FromSeconds(5);
+
+    private readonly DeviceMetadataCache MetadataCache = new() { OpenDelay = BootselOpenDelay };
+    private readonly object RegistryLock = new();
+    private ImmutableArray<Device> Devices = ImmutableArray<Device>.Empty;
+    // Responses are rendered once per combination of query options and then served as-is until the registry changes
+    private readonly Dictionary<(bool UseJson, DeviceConfidence DeviceFilter), byte[]> Responses = new();
+
+    public override CommandResult Execute(Queue<string> arguments)
+    {
+        string socketPath = DefaultSocketPath;
+
+        // Parse arguments
+        while (arguments.Count > 0)
+        {
+            string argument = arguments.Dequeue();
+            switch (argument.ToLowerInvariant())
+            {
+                case "--socket":
+                    if (!arguments.TryDequeue(out string? socketPathArgument))
+                    {
+                        Console.Error.WriteLine("A socket path must be specified for `--socket`");
+                        return CommandResult.Failure;
+                    }
+                    socketPath = socketPathArgument;
+                    break;
+                default:
+                    switch (TryHandleCommonArgument(argument))
+                    {
+                        case CommonArgumentResult.Handled:
+                            break;
+                        case CommonArgumentResult.NotHandled:
+                            Console.Error.WriteLine($"Unknown argument '{argument}'");
+                            return CommandResult.ShowHelp;
+                        case CommonArgumentResult.ShowHelp:
+                            return CommandResult.ShowHelp;
+                        default:
+                            throw new UnreachableException();
+                    }
+                    break;
+            }
+        }
+
+        // A socket file left behind by a server which didn't shut down cleanly would otherwise prevent us from binding
+        if (File.Exists(socketPath))
+        {
+            try
+            {
+                using Socket probe = new(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+                probe.Connect(new UnixDomainSocketEndPoint(socketPath));
+                Console.Error.WriteLine($"Another server is already listening on '{socketPath}'.");
+                return CommandResult.Failure;
+            }
+            catch (SocketException)
+            { File.Delete(socketPath); }
+        }
+
+        using Socket listener = new(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+        listener.Bind(new UnixDomainSocketEndPoint(socketPath));
+        listener.Listen(backlog: 16);
+
+        bool stopping = false;
+        ConsoleCancelEventHandler cancelHandler = (_, e) =>
+        {
+            e.Cancel = true;
+            Volatile.Write(ref stopping, true);
+            listener.Close();
+        };
+        Console.CancelKeyPress += cancelHandler;
+
+        Thread listenerThread = new(() => ListenerThread(listener)) { IsBackground = true, Name = "Query listener" };
+        try
+        {
+            // The monitor is started before the first enumeration so that nothing which changes during it is missed
+            using UsbDeviceMonitor monitor = new();
+            Refresh();
+            listenerThread.Start();
+            Console.WriteLine($"Listening on '{socketPath}', press Ctrl+C to stop.");
+
+            while (!Volatile.Read(ref stopping))
+            {
+                if (monitor.Wait(TimeSpan.FromSeconds(1)) == 0)
+                {
+                    // Nothing changed, but a BOOTSEL device which was deferred might be ready to be opened now
+                    if (MetadataCache.HasDeferredDevicesReady)
+                        Refresh();
+                    continue;
+                }
+
+                while (monitor.Wait(SettleTime) > 0)
+                { }
+
+                Refresh();
+            }
+        }
+        finally
+        {
+            Console.CancelKeyPress -= cancelHandler;
+            listener.Close();
+            if (listenerThread.IsAlive)
+                listenerThread.Join();
+            File.Delete(socketPath);
+        }
+
+        return CommandResult.Success;
+    }
+
+    private void Refresh()
+    {
+        long startTimestamp = Stopwatch.GetTimestamp();
+        ImmutableArray<Device> devices = Device.EnumerateDevices(allowConnection: null, metadataCache: MetadataCache);
+        MetadataCache.Prune();
+
+        // We must not hold on to PICOBOOT devices since that'd prevent other instances from uploading to them
+        ImmutableArray<Device>.Builder builder = ImmutableArray.CreateBuilder<Device>(devices.Length);
+        foreach (Device device in devices)
+        {
+            device.PicobootDevice?.Dispose();
+            builder.Add(device with { PicobootDevice = null });
+        }
+
+        lock (RegistryLock)
+        {
+            Devices = builder.MoveToImmutable();
+            Responses.Clear();
+        }
+
+        Trace.WriteLine($"Device registry refreshed in {Stopwatch.GetElapsedTime(startTimestamp).TotalMilliseconds:N} ms, {devices.Length} device(s), {MetadataCache.Count} cached.");
+    }
+
+    private byte[] GetResponse(bool useJson, DeviceConfidence deviceFilter)
+    {
+        lock (RegistryLock)
+        {
+            if (!Responses.TryGetValue((useJson, deviceFilter), out byte[]? response))
+            {
+                StringWriter output = new();
+                output.Write($"{ResponseOk}\n");
+                ListDevicesCommand.WriteDevices(output, Devices, deviceFilter, useJson);
+                response = Encoding.UTF8.GetBytes(output.ToString());
+                Responses.Add((useJson, deviceFilter), response);
+            }
+
+            return response;
+        }
+    }
+
+    private void ListenerThread(Socket listener)
+    {
+        byte[] requestBuffer = new byte[256];
+        while (true)
+        {
+            Socket client;
+            try
+            { client = listener.Accept(); }
+            catch (Exception ex) when (ex is SocketException or ObjectDisposedException)
+            { return; } // The listener was closed
+
+            // Queries are answered from memory, so they're handled inline rather than on their own threads
+            using (client)
+            {
+                try
+                {
+                    client.ReceiveTimeout = 1000;
+                    int length = 0;
+                    while (length < requestBuffer.Length)
+                    {
+                        int received = client.Receive(requestBuffer, length, requestBuffer.Length - length, SocketFlags.None);
+                        if (received == 0)
+                            break;
+
+                        length += received;
+                        if (Array.IndexOf(requestBuffer, (byte)'\n', length - received, received) >= 0)
+                            break;
+                    }
+
+                    string request = Encoding.UTF8.GetString(requestBuffer, 0, length).Trim();
+                    client.Send(HandleRequest(request));
+                    client.Shutdown(SocketShutdown.Both);
+                }
+                catch (SocketException ex)
+                { Trace.WriteLine($"Error while handling query: {ex.Message}"); }
+            }
+        }
+    }
+
+    private const string ResponseOk = "OK";
+    private const string ResponseError = "ERROR";
+
+    /// <summary>Requests are a single line containing a subset of the arguments accepted by `list`.</summary>
+    private byte[] HandleRequest(string request)
+    {
+        bool useJson = false;
+        DeviceConfidence deviceFilter = DeviceConfidence.High;
+        foreach (string argument in request.Split(' ', StringSplitOptions.RemoveEmptyEntries | StringSplitOptions.TrimEntries))
+        {
+            switch (argument.ToLowerInvariant())
+            {
+                case "--json":
+                    useJson = true;
+                    break;
+                case "--all":
+                    deviceFilter = deviceFilter.DemoteTo(DeviceConfidence.Low);
+                    break;
+                case "--all!":
+                    deviceFilter = deviceFilter.DemoteTo(DeviceConfidence.Zero);
+                    break;
+                default:
+                    return Encoding.UTF8.GetBytes($"{ResponseError}\nUnsupported argument '{argument}'\n");
+            }
+        }
+
+        return GetResponse(useJson, deviceFilter);
+    }
+
+    /// <summary>Sends a list query to a running server and writes the response to the console.</summary>
+    public static CommandResult Query(string socketPath, bool useJson, DeviceConfidence deviceFilter)
+    {
+        string request = $"{(useJson ? "--json " : "")}{deviceFilter switch
+        {
+            DeviceConfidence.High => "",
+            DeviceConfidence.Low => "--all",
+            _ => "--all!",
+        }}\n";
+
+        string response;
+        try
+        {
+            using Socket socket = new(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+            socket.Connect(new UnixDomainSocketEndPoint(socketPath));
+            socket.Send(Encoding.UTF8.GetBytes(request));
+            socket.Shutdown(SocketShutdown.Send);
+
+            // The server closes the connection once the response has been sent
+            MemoryStream responseBytes = new();
+            byte[] buffer = new byte[4096];
+            int received;
+            while ((received = socket.Receive(buffer)) > 0)
+                responseBytes.Write(buffer, 0, received);
+            response = Encoding.UTF8.GetString(responseBytes.GetBuffer(), 0, (int)responseBytes.Length);
+        }
+        catch (SocketException ex)
+        {
+            Console.Error.WriteLine($"Could not query the server at '{socketPath}': {ex.Message}");
+            Console.Error.WriteLine("    Is `HarpRegulator serve` running?");
+            return CommandResult.Failure;
+        }
+
+        int statusEnd = response.IndexOf('\n');
+        string status = statusEnd < 0 ? response : response.Substring(0, statusEnd);
+        string body = statusEnd < 0 ? "" : response.Substring(statusEnd + 1);
+        if (status != ResponseOk)
+        {
+            Console.Error.Write(body.Length > 0 ? body : "The server sent a malformed response.\n");
+            return CommandResult.Failure;
+        }
+
+        Console.Write(body);
+        return CommandResult.Success;
+    }
+}
@@ -0,0 +1,90 @@
+﻿using Harp.Devices;
+using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    private enum SectorAction
+    {
+        Write,
+        EraseAndWrite,
+        EraseOnly,
+    }
+
+    /// <summary>Erases and writes only the flash sectors whose contents differ from what is already on the device.</summary>
+    private static void UploadFlashRangeDifferential(PicobootDevice device, AddressRange range, ReadOnlySpan<byte> data, UploadProgress progress)
+    {
+        const uint sectorSize = Picoboot.FLASH_SECTOR_ERASE_SIZE;
+        Debug.Assert(range.IsAligned(sectorSize));
+        Debug.Assert(range.Size == data.Length);
+
+        // Read everything back before writing anything so that reads don't stall the pipelined writes
+        List<(uint Address, SectorAction Action)> plan = new();
+        Span<byte> deviceSector = stackalloc byte[(int)sectorSize];
+        double sizeKibibytes = (double)range.Size / 1024.0;
+        progress.Log($"Comparing flash region {range} - {sizeKibibytes:N} KiB...");
+        progress.BeginStep("Comparing flash", range.Size);
+        try
+        {
+            for (uint address = range.Start; address < range.End; address += sectorSize)
+            {
+                ReadOnlySpan<byte> sector = data.Slice((int)(address - range.Start), (int)sectorSize);
+                device.ReadAligned(address, deviceSector);
+
+                if (!deviceSector.SequenceEqual(sector))
+                {
+                    // Programming can only clear bits, so a sector which is still erased can be written directly
+                    // Conversely a sector which should be erased doesn't need to be written at all
+                    if (!deviceSector.ContainsAnyExcept((byte)0xFF))
+                        plan.Add((address, SectorAction.Write));
+                    else if (!sector.ContainsAnyExcept((byte)0xFF))
+                        plan.Add((address, SectorAction.EraseOnly));
+                    else
+                        plan.Add((address, SectorAction.EraseAndWrite));
+                }
+
+                progress.ReportStepProgress(address + sectorSize - range.Start);
+            }
+        }
+        finally
+        { progress.EndStep(); }
+
+        uint sectorCount = range.Size / sectorSize;
+        if (plan.Count == 0)
+        {
+            progress.Log($"All {sectorCount} sectors already match, nothing to write.");
+            return;
+        }
+
+        ulong changedSize = (ulong)plan.Count * sectorSize;
+        progress.Log($"Writing {plan.Count} of {sectorCount} sectors - {(double)changedSize / 1024.0:N} KiB...");
+        progress.BeginStep("Writing flash", changedSize);
+        try
+        {
+            using PicobootWriteStream writeStream = device.OpenWriteStream(sectorSize);
+            ulong completed = 0;
+            foreach ((uint address, SectorAction action) in plan)
+            {
+                AddressRange sectorRange = new(address, address + sectorSize);
+
+                if (action is SectorAction.EraseAndWrite or SectorAction.EraseOnly)
+                    device.FlashErase(sectorRange);
+
+                if (action is SectorAction.Write or SectorAction.EraseAndWrite)
+                    writeStream.Write(address, data.Slice((int)(address - range.Start), (int)sectorSize));
+
+                completed += sectorSize;
+                progress.ReportStepProgress(completed);
+            }
+
+            writeStream.Flush();
+        }
+        finally
+        { progress.EndStep(); }
+    }
+}
@@ -0,0 +1,43 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System.Diagnostics;
+using static Harp.Devices.Pico.FlashStateCache;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    /// <summary>Loads what we last wrote to the device's flash and confirms that the device still contains it.</summary>
+    /// <returns>The confirmed state, or null if there isn't one (in which case every sector must be written.)</returns>
+    /// <remarks>
+    /// Confirmation costs one on-device CRC per cached region on RP2040 devices, other devices have to read the regions back.
+    /// Either way this is much cheaper than erasing and writing sectors which haven't changed.
+    /// </remarks>
+    private static FlashState? LoadConfirmedFlashState(PicobootDevice device, string cacheKey)
+    {
+        FlashState? state = FlashStateCache.Default.Load(cacheKey);
+        if (state is null)
+            return null;
+
+        if (state.Model != device.Model)
+        {
+            Trace.WriteLine($"Cached flash state for '{cacheKey}' is for a {state.Model.FriendlyName()} device, ignoring it.");
+            FlashStateCache.Default.Invalidate(cacheKey);
+            return null;
+        }
+
+        foreach (Region region in state.Regions)
+        {
+            uint actualCrc = GetDeviceCrc32(device, memory_type.flash, region.Range);
+            if (actualCrc != region.Crc32)
+            {
+                Trace.WriteLine($"Device flash region {region.Range} no longer matches the cached state (CRC32 {actualCrc:X8}, expected {region.Crc32:X8}), ignoring it.");
+                FlashStateCache.Default.Invalidate(cacheKey);
+                return null;
+            }
+        }
+
+        Trace.WriteLine($"Confirmed cached flash state for '{cacheKey}' ({state.Regions.Count} region(s).)");
+        return state;
+    }
+}
@@ -0,0 +1,296 @@
+﻿using Harp.Devices;
+using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Diagnostics;
+using System.Linq;
+using System.Threading;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    private const int DefaultMaxUploadsPerBus = 4;
+
+    private sealed class FleetTarget
+    {
+        public required string Label { get; init; }
+        public required Device Device { get; set; }
+        public bool StartedOnline { get; init; }
+        public string? FailureReason { get; set; }
+        public bool Succeeded { get; set; }
+        public TimeSpan Duration { get; set; }
+    }
+
+    /// <summary>Uploads the same firmware to every Pico device matching <paramref name="targetFilter"/>.</summary>
+    /// <remarks>
+    /// Devices are rebooted into BOOTSEL mode together and then uploaded to concurrently.
+    /// Devices on the same USB bus share the bandwidth of its root hub, so the number of concurrent uploads is limited per bus rather than globally.
+    /// This mode never prompts, problems with individual devices are reported in the summary instead.
+    /// Since every matching device is needed rather than just the first, <paramref name="allowHarpConnection"/> connects to all plausible Harp devices up front.
+    /// </remarks>
+    private CommandResult UploadFleet(Uf2View view, string firmwareFilePath, string targetFilter, bool allowHarpConnection, int maxParallelConnections, int maxUploadsPerBus, bool doFirmwareUpload, bool rebootAfterUpload, bool verify, bool useFlashStateCache, bool showProgress, bool force)
+    {
+        ImmutableArray<Device> allDevices = Device.EnumerateDevices(allowHarpConnection ? DeviceConfidence.Low : null, maxParallelConnections);
+        ImmutableArray<Device> matchingDevices = allDevices.Filter(targetFilter);
+        if (matchingDevices.Length == 0)
+        {
+            Console.Error.WriteLine($"None of the following devices matched the filter '{targetFilter}':");
+            ListDevicesCommand.ListDevices(allDevices, output: Console.Error);
+            return CommandResult.Failure;
+        }
+
+        Console.WriteLine($"Found {matchingDevices.Length} device(s) matching '{targetFilter}':");
+        ListDevicesCommand.ListDevices(matchingDevices);
+        Console.WriteLine();
+
+        List<FleetTarget> targets = new();
+        foreach (Device matchingDevice in matchingDevices)
+        {
+            FleetTarget target = new()
+            {
+                Label = matchingDevice.SerialNumber?.ToString("x") ?? matchingDevice.PortName ?? matchingDevice.Source,
+                Device = matchingDevice,
+                StartedOnline = matchingDevice.State is DeviceState.Online or DeviceState.Unknown,
+            };
+            targets.Add(target);
+
+            if (matchingDevice.Kind != DeviceKind.Pico)
+                target.FailureReason = "Harp Regulator currently only supports Pico devices.";
+        }
+
+        // Reboot everything into BOOTSEL mode at once so the devices re-enumerate in parallel
+        bool anyRebooted = false;
+        foreach (FleetTarget target in targets)
+        {
+            if (target.FailureReason is not null || !target.StartedOnline)
+                continue;
+
+            Device device = target.Device;
+            if (TryRebootUsingFirmwareUpdateCapabilitiesRegister(ref device) is string failReason)
+            {
+                target.FailureReason = $"Could not automatically place the device into bootloader mode: {failReason}";
+                continue;
+            }
+
+            target.Device = device;
+            anyRebooted = true;
+            if (device.SerialNumber is null)
+                target.FailureReason = "Device has no serial number, so it could not be identified after rebooting into BOOTSEL mode.";
+        }
+
+        if (anyRebooted)
+            FindFleetAfterReboot(allDevices, targets);
+
+        // Check compatibility up front so that the only output during the uploads is the progress display
+        foreach (FleetTarget target in targets)
+        {
+            if (target.FailureReason is not null)
+                continue;
+
+            if (target.Device.State == DeviceState.DriverError)
+                target.FailureReason = "Cannot communicate with the device, driver is in an erroneous state.";
+            else if (target.Device.PicobootDevice is null)
+                target.FailureReason = "Cannot communicate with the device, the PICOBOOT interface was not instantiated.";
+            else if (!VerifyFirmwareCompatibility(target.Device, view, interactive: false, force))
+            {
+                target.FailureReason = "Firmware is not compatible with the device.";
+                if (target.StartedOnline)
+                    target.Device.PicobootDevice.Reboot();
+            }
+        }
+
+        // Upload to everything which is still viable
+        FleetTarget[] uploadTargets = targets.Where(t => t.FailureReason is null).ToArray();
+
+        // Release anything we aren't going to upload to so it isn't held open for the duration of the upload
+        // (When devices were rebooted the initial enumeration has already been released, disposing it again is harmless.)
+        HashSet<PicobootDevice> uploadDevices = uploadTargets.Select(t => t.Device.PicobootDevice!).ToHashSet();
+        foreach (PicobootDevice? picobootDevice in allDevices.Select(d => d.PicobootDevice).Concat(targets.Select(t => t.Device.PicobootDevice)))
+        {
+            if (picobootDevice is not null && !uploadDevices.Contains(picobootDevice))
+                picobootDevice.Dispose();
+        }
+        if (uploadTargets.Length > 0)
+        {
+            Console.WriteLine($"Uploading '{firmwareFilePath}' to {uploadTargets.Length} device(s)...");
+            using FleetProgress progress = new(uploadTargets.Select(t => t.Label).ToArray(), DisplayWidth, isEnabled: showProgress && !Console.IsOutputRedirected);
+
+            // Every worker handles events on the shared libusb context, so any of them may complete another device's streamed writes
+            // The write stream's accounting is atomic for exactly this reason, see picoboot_write_stream_write
+            List<Thread> threads = new();
+            foreach (IGrouping<byte, int> bus in Enumerable.Range(0, uploadTargets.Length).GroupBy(i => uploadTargets[i].Device.PicobootDevice!.BusNumber))
+            {
+                int[] busTargets = bus.ToArray();
+                int nextTarget = -1;
+                for (int i = 0; i < Math.Min(maxUploadsPerBus, busTargets.Length); i++)
+                {
+                    Thread thread = new(() =>
+                    {
+                        int index;
+                        while ((index = Interlocked.Increment(ref nextTarget)) < busTargets.Length)
+                            UploadFleetTarget(uploadTargets[busTargets[index]], busTargets[index]);
+                    })
+                    {
+                        IsBackground = true,
+                        Name = $"Upload worker #{i} for bus {bus.Key}",
+                    };
+                    thread.Start();
+                    threads.Add(thread);
+                }
+            }
+
+            foreach (Thread thread in threads)
+                thread.Join();
+
+            void UploadFleetTarget(FleetTarget target, int progressIndex)
+            {
+                long startTimestamp = Stopwatch.GetTimestamp();
+                PicobootDevice device = target.Device.PicobootDevice!;
+                try
+                {
+                    if (doFirmwareUpload)
+                    {
+                        target.FailureReason = UploadFirmware(view, device, differential: false, verify, useFlashStateCache, new FleetUploadProgress(progress, progressIndex));
+                        if (target.FailureReason is not null)
+                        {
+                            // Leave the device in BOOTSEL mode, there's no point booting into a firmware we know is broken
+                            progress.Update(progressIndex, "Failed");
+                            return;
+                        }
+                    }
+
+                    if (rebootAfterUpload)
+                    {
+                        progress.Update(progressIndex, "Rebooting");
+                        device.Reboot(view, ignoreNonBootable: true);
+                    }
+
+                    target.Succeeded = true;
+                    progress.Update(progressIndex, doFirmwareUpload ? "Done" : "Upload skipped");
+                }
+                catch (Exception ex)
+                {
+                    target.FailureReason = ex.Message;
+                    progress.Update(progressIndex, "Failed");
+                }
+                finally
+                {
+                    target.Duration = Stopwatch.GetElapsedTime(startTimestamp);
+                    device.Dispose();
+                }
+            }
+        }
+
+        // Summarize
+        Console.WriteLine();
+        List<string[]> rows = [["Device", "Result", "Time", "Details"]];
+        foreach (FleetTarget target in targets)
+        {
+            rows.Add
+            ([
+                target.Label,
+                target.Succeeded ? "Pass" : "FAIL",
+                target.Duration == TimeSpan.Zero ? "" : $"{target.Duration.TotalSeconds:N} s",
+                target.FailureReason ?? "",
+            ]);
+        }
+        Utilities.WriteTable(Console.Out, rows);
+
+        int passCount = targets.Count(t => t.Succeeded);
+        Console.WriteLine();
+        Console.WriteLine($"{passCount} of {targets.Count} device(s) were uploaded to successfully.");
+        return passCount == targets.Count ? CommandResult.Success : CommandResult.Failure;
+    }
+
+    /// <summary>Finds each rebooted target again once it has appeared in BOOTSEL mode.</summary>
+    private static void FindFleetAfterReboot(ImmutableArray<Device> allDevices, List<FleetTarget> targets)
+    {
+        // Disconnect from existing Picoboot devices before reenumeration, devices which were already in BOOTSEL mode will be found again by serial number
+        foreach (PicobootDevice? picobootDevice in allDevices.Select(d => d.PicobootDevice))
+            picobootDevice?.Dispose();
+
+        Console.WriteLine("Finding devices again now that they're in BOOTSEL mode...");
+        PicobootDevice.WaitForBootselDevice(null, BootselWaitTimeout);
+
+        // The devices were all rebooted together, but there's no guarantee they show up together so keep enumerating until they all do
+        foreach (FleetTarget target in targets)
+        {
+            if (target.FailureReason is null && target.Device.SerialNumber is null)
+                target.FailureReason = "Device has no serial number, so it could not be identified after other devices were rebooted.";
+        }
+
+        FleetTarget[] pendingTargets = targets.Where(t => t.FailureReason is null).ToArray();
+        string[] pendingReasons = new string[pendingTargets.Length];
+        Device?[] foundDevices = new Device?[pendingTargets.Length];
+        long startTimestamp = Stopwatch.GetTimestamp();
+        while (true)
+        {
+            allDevices = Device.EnumerateDevices(allowConnection: null);
+            ImmutableArray<Device> bootselDevices = allDevices.Filter(d => d.Kind == DeviceKind.Pico && d.State is DeviceState.Bootloader);
+
+            bool allFound = true;
+            for (int i = 0; i < pendingTargets.Length; i++)
+            {
+                string serialNumberFilter = pendingTargets[i].Device.SerialNumber!.Value.ToString("x");
+                ImmutableArray<Device> snFiltered = bootselDevices.Filter(d => d.SerialNumberPartialMatch(serialNumberFilter));
+                foundDevices[i] = snFiltered.Length == 1 ? snFiltered[0] : null;
+                if (foundDevices[i] is null)
+                {
+                    allFound = false;
+                    pendingReasons[i] = snFiltered.Length == 0
+                        ? "Device did not appear in BOOTSEL mode after rebooting."
+                        : $"Serial number '{serialNumberFilter}' is ambiguous and matches multiple BOOTSEL devices.";
+                }
+            }
+
+            if (allFound || Stopwatch.GetElapsedTime(startTimestamp) > BootselWaitTimeout)
+                break;
+
+            foreach (PicobootDevice? picobootDevice in allDevices.Select(d => d.PicobootDevice))
+                picobootDevice?.Dispose();
+            Thread.Sleep(250);
+        }
+
+        for (int i = 0; i < pendingTargets.Length; i++)
+        {
+            if (foundDevices[i] is Device foundDevice)
+                pendingTargets[i].Device = foundDevice;
+            else
+                pendingTargets[i].FailureReason = pendingReasons[i];
+        }
+
+        // Release anything we aren't going to upload to so it isn't held open for the duration of the upload
+        foreach (Device device in allDevices)
+        {
+            if (device.PicobootDevice is not null && !foundDevices.Contains(device))
+                device.PicobootDevice.Dispose();
+        }
+    }
+
+    /// <summary>Reports upload progress on a single line of a <see cref="FleetProgress"/>.</summary>
+    /// <remarks>Log messages are only traced, failures are reported in the summary instead.</remarks>
+    private sealed class FleetUploadProgress(FleetProgress progress, int index) : UploadProgress
+    {
+        private string Status = "";
+        private ulong StepSize;
+
+        public override void Log(string message, bool isError = false)
+            => Trace.WriteLine(message);
+
+        public override void BeginStep(string status, ulong size = 0)
+        {
+            Status = status;
+            StepSize = size;
+            progress.Update(index, status, size == 0 ? null : 0.0);
+        }
+
+        public override void ReportStepProgress(ulong completed)
+            => progress.Update(index, Status, StepSize == 0 ? null : (double)completed / StepSize);
+
+        public override void EndStep()
+        { }
+    }
+}
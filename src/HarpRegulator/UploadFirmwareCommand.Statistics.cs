@@ -0,0 +1,106 @@
+﻿using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Text.Json;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    private enum StatisticsFormat
+    {
+        None,
+        Table,
+        Json,
+    }
+
+    private static void PrintStatistics(PicobootDevice device, StatisticsFormat format)
+    {
+        if (format == StatisticsFormat.None)
+            return;
+
+        ImmutableArray<PicobootCommandStatistics> statistics = device.GetStatistics();
+
+        if (format == StatisticsFormat.Json)
+        {
+            Console.WriteLine(JsonSerializer.Serialize(statistics, JsonOptions));
+            return;
+        }
+
+        List<string[]> rows = new(statistics.Length + 1);
+        rows.Add(["Command", "Calls", "Failures", "Timeouts", "Halts", "Bytes", "Total", "Mean", "Max", "P50", "P99"]);
+        foreach (PicobootCommandStatistics command in statistics)
+        {
+            rows.Add
+            (
+                [
+                    command.Command.ToString(),
+                    command.Calls.ToString(),
+                    command.Failures.ToString(),
+                    command.Timeouts.ToString(),
+                    command.Halts.ToString(),
+                    Utilities.FriendlyByteCount(command.Bytes),
+                    FormatMicroseconds(command.TotalMicroseconds),
+                    FormatMicroseconds(command.MeanMicroseconds),
+                    FormatMicroseconds(command.MaxMicroseconds),
+                    FormatPercentile(command, 0.50),
+                    FormatPercentile(command, 0.99),
+                ]
+            );
+        }
+
+        Console.WriteLine();
+        Console.WriteLine("PICOBOOT command statistics:");
+        Utilities.WriteTable(Console.Out, rows);
+
+        static string FormatMicroseconds(double microseconds)
+            => microseconds < 1000.0 ? $"{microseconds:N0} us" : $"{microseconds / 1000.0:N1} ms";
+
+        // The histogram only tells us which power of two bucket the percentile falls in, so we report the bucket's upper bound
+        static string FormatPercentile(PicobootCommandStatistics command, double percentile)
+        {
+            ulong target = (ulong)Math.Ceiling(command.Calls * percentile);
+            ulong seen = 0;
+            for (int i = 0; i < command.LatencyHistogram.Length; i++)
+            {
+                seen += command.LatencyHistogram[i];
+                if (seen >= target)
+                {
+                    ulong limit = PicobootCommandStatistics.GetHistogramBucketLimitMicroseconds(i);
+                    return limit == ulong.MaxValue ? $">{FormatMicroseconds(PicobootCommandStatistics.GetHistogramBucketLimitMicroseconds(i - 1))}" : $"<{FormatMicroseconds(limit)}";
+                }
+            }
+
+            return "N/A";
+        }
+    }
+
+    private static void PrintEmulatorStatistics(PicobootEmulator emulator, StatisticsFormat format)
+    {
+        // The JSON output is a single array of command statistics, so this is only included in the table output
+        if (format != StatisticsFormat.Table)
+            return;
+
+        picoboot_emulator_stats statistics = emulator.GetStatistics();
+        Console.WriteLine();
+        Console.WriteLine("Emulated device statistics:");
+        Utilities.WriteTable
+        (
+            Console.Out,
+            [
+                ["Commands", "Rejected", "Written", "Read", "Pages programmed", "Sectors erased", "Busy"],
+                [
+                    statistics.commands.ToString(),
+                    statistics.rejected_commands.ToString(),
+                    Utilities.FriendlyByteCount(statistics.bytes_written),
+                    Utilities.FriendlyByteCount(statistics.bytes_read),
+                    statistics.pages_programmed.ToString(),
+                    statistics.sectors_erased.ToString(),
+                    $"{statistics.busy_us / 1000.0:N1} ms",
+                ],
+            ]
+        );
+    }
+}
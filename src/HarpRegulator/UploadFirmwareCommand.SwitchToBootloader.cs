@@ -6,12 +6,13 @@ using System.Collections.Immutable;
 using System.Diagnostics;
 using System.Diagnostics.CodeAnalysis;
 using System.Linq;
-using System.Threading;
 
 namespace HarpRegulator;
 
 partial class UploadFirmwareCommand
 {
+    private static readonly TimeSpan BootselWaitTimeout = TimeSpan.FromSeconds(10);
+
     private bool SwitchToBootloader(ref ImmutableArray<Device> allDevices, [DisallowNull, NotNullWhen(true)] ref Device? device, bool interactive, bool force)
     {
         switch (device.State)
@@ -49,9 +50,10 @@ partial class UploadFirmwareCommand
 
         // Find our device again now that it's in picoboot mode
         Console.WriteLine("Finding device again now that it's in BOOTSEL mode...");
-        Thread.Sleep(1000); // Wait for bootloader to become available
-
         string? serialNumberFilter = device.SerialNumber?.ToString("x");
+        if (!PicobootDevice.WaitForBootselDevice(serialNumberFilter, BootselWaitTimeout))
+            Console.Error.WriteLine($"Warning: No BOOTSEL device appeared within {BootselWaitTimeout.TotalSeconds:0} seconds, the device might not have rebooted.");
+
         allDevices = Device.EnumerateDevices(allowConnection: null);
         ImmutableArray<Device> bootselDevices = allDevices.Filter(d => d.Kind == DeviceKind.Pico && d.State is DeviceState.Bootloader);
         device = null;
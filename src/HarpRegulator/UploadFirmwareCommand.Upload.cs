@@ -0,0 +1,149 @@
+﻿using Harp.Devices;
+using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    /// <summary>Receives progress from <see cref="UploadFirmware"/>, which lets single device and fleet uploads share the same upload logic.</summary>
+    private abstract class UploadProgress
+    {
+        /// <summary>Reports a complete sentence describing what the upload is doing or has done.</summary>
+        public abstract void Log(string message, bool isError = false);
+
+        /// <summary>Starts a step of the upload which processes <paramref name="size"/> bytes, or has no measurable progress if it's 0.</summary>
+        /// <param name="status">A short description of the step, suitable for a status display.</param>
+        public abstract void BeginStep(string status, ulong size = 0);
+
+        /// <summary>Reports the number of bytes processed by the current step so far.</summary>
+        public abstract void ReportStepProgress(ulong completed);
+
+        public abstract void EndStep();
+    }
+
+    /// <summary>Writes upload progress to the console, with a progress bar for each step which has measurable progress.</summary>
+    private sealed class ConsoleUploadProgress(bool showProgress) : UploadProgress
+    {
+        private ProgressBar<double> ProgressBar;
+        private bool HasProgressBar;
+
+        public override void Log(string message, bool isError = false)
+            => (isError ? Console.Error : Console.Out).WriteLine(message);
+
+        public override void BeginStep(string status, ulong size = 0)
+        {
+            EndStep();
+            if (size == 0)
+                return;
+
+            ProgressBar = new((double)size / 1024.0, "KiB", isEnabled: showProgress);
+            HasProgressBar = true;
+        }
+
+        public override void ReportStepProgress(ulong completed)
+        {
+            if (HasProgressBar)
+                ProgressBar.SetProgress((double)completed / 1024.0);
+        }
+
+        public override void EndStep()
+        {
+            if (HasProgressBar)
+                ProgressBar.Dispose();
+            HasProgressBar = false;
+        }
+    }
+
+    // The logic here is based on (but not identical to) picotool
+    // https://github.com/raspberrypi/picotool/blob/de8ae5ac334e1126993f72a5c67949712fd1e1a4/main.cpp#L4591
+    /// <summary>Uploads <paramref name="view"/> to a device which is already in BOOTSEL mode.</summary>
+    /// <param name="differential">Read back the device's flash and only write the sectors which differ.</param>
+    /// <param name="verify">Verify each range after writing it.</param>
+    /// <param name="useFlashStateCache">Skip flash sectors which the flash state cache confirms the device already contains.</param>
+    /// <returns>Null if successful, otherwise the reason the upload failed (which has also been logged.)</returns>
+    private static string? UploadFirmware(Uf2View view, PicobootDevice device, bool differential, bool verify, bool useFlashStateCache, UploadProgress progress)
+    {
+        long startTimestamp = Stopwatch.GetTimestamp();
+        progress.Log("Uploading firmware...");
+        Uf2UploadPlan plan = Uf2UploadPlan.Compile(view, device.Model);
+
+        // The differential upload already compares against the device itself, so there's no need to consult the cache
+        string? cacheKey = FlashStateCache.GetKey(device);
+        FlashStateCache.FlashState? confirmedState = null;
+        if (useFlashStateCache && !differential && cacheKey is not null)
+        {
+            progress.BeginStep("Checking flash state");
+            confirmedState = LoadConfirmedFlashState(device, cacheKey);
+            progress.EndStep();
+        }
+        List<FlashStateCache.Region> newFlashState = new();
+
+        foreach (Uf2UploadPlan.Region region in plan.Regions)
+        {
+            memory_type memoryType = region.MemoryType;
+            AddressRange targetRange = region.Range;
+
+            // The whole range is handed to the native library at once so that the erase and all of the writes happen without returning to us
+            byte[] buffer = region.ToArray();
+
+            if (differential && memoryType == memory_type.flash)
+            {
+                UploadFlashRangeDifferential(device, targetRange, buffer, progress);
+                newFlashState.Add(FlashStateCache.CreateRegion(targetRange, buffer));
+            }
+            else if (memoryType == memory_type.flash)
+            {
+                List<AddressRange> changedRanges = FlashStateCache.GetChangedRanges(confirmedState, targetRange, buffer, out FlashStateCache.Region newRegion);
+                newFlashState.Add(newRegion);
+
+                if (changedRanges.Count == 0)
+                    progress.Log($"Flash region {targetRange} already matches the firmware, nothing to write.");
+
+                foreach (AddressRange changedRange in changedRanges)
+                    WriteRange(changedRange, buffer.AsSpan((int)(changedRange.Start - targetRange.Start), (int)changedRange.Size));
+            }
+            else
+            {
+                WriteRange(targetRange, buffer);
+            }
+
+            void WriteRange(AddressRange range, ReadOnlySpan<byte> data)
+            {
+                double sizeKibibytes = (double)range.Size / 1024.0;
+                progress.Log($"Writing {memoryType.FriendlyName()} region {range} - {sizeKibibytes:N} KiB...");
+                progress.BeginStep($"Writing {memoryType.FriendlyName()}", range.Size);
+                try
+                { device.ProgramRegion(range.Start, data, bytesWritten => progress.ReportStepProgress(bytesWritten)); }
+                finally
+                { progress.EndStep(); }
+            }
+
+            // Ranges are verified as soon as they're written since the on-device CRC clobbers SRAM, which a later range might target
+            // (The upload plan always places flash regions first.)
+            if (verify)
+            {
+                progress.BeginStep($"Verifying {memoryType.FriendlyName()}");
+                bool verified = VerifyRange(device, memoryType, targetRange, buffer, out string message);
+                progress.EndStep();
+                progress.Log(message, isError: !verified);
+                if (!verified)
+                {
+                    if (cacheKey is not null)
+                        FlashStateCache.Default.Invalidate(cacheKey);
+                    return message;
+                }
+            }
+        }
+
+        // This is recorded even without verification since the state is always confirmed before it is trusted
+        if (cacheKey is not null)
+            FlashStateCache.Default.Save(cacheKey, new FlashStateCache.FlashState() { Model = device.Model, Regions = newFlashState });
+
+        progress.Log($"Upload completed in {Stopwatch.GetElapsedTime(startTimestamp).TotalSeconds:N} seconds");
+        return null;
+    }
+}
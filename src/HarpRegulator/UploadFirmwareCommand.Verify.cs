@@ -0,0 +1,45 @@
+﻿using Harp.Devices;
+using Harp.Devices.Pico;
+using PicobootConnection;
+using System;
+
+namespace HarpRegulator;
+
+partial class UploadFirmwareCommand
+{
+    /// <param name="message">Describes the outcome of the verification, for the caller to print.</param>
+    /// <returns>True if the device contents match <paramref name="expected"/>, false otherwise.</returns>
+    private static bool VerifyRange(PicobootDevice device, memory_type memoryType, AddressRange range, ReadOnlySpan<byte> expected, out string message)
+    {
+        uint expectedCrc = Picoboot.Crc32(expected);
+        uint actualCrc = GetDeviceCrc32(device, memoryType, range);
+
+        if (actualCrc != expectedCrc)
+        {
+            message = $"Verification of {memoryType.FriendlyName()} region {range} failed! Expected CRC32 {expectedCrc:X8}, device has {actualCrc:X8}.";
+            return false;
+        }
+
+        message = $"Verified {memoryType.FriendlyName()} region {range} (CRC32 {actualCrc:X8})";
+        return true;
+    }
+
+    /// <summary>Gets the CRC32 of a range of the device's memory, as computed by <see cref="Picoboot.Crc32"/>.</summary>
+    private static uint GetDeviceCrc32(PicobootDevice device, memory_type memoryType, AddressRange range)
+    {
+        if (memoryType == memory_type.flash && device.CanComputeFlashCrc32)
+            return device.GetFlashCrc32(range);
+
+        // Fall back to reading everything back and checksumming it ourselves
+        Span<byte> buffer = stackalloc byte[(int)Picoboot.FLASH_SECTOR_ERASE_SIZE];
+        uint crc = 0xFFFFFFFF;
+        for (uint address = range.Start; address < range.End; address += (uint)buffer.Length)
+        {
+            Span<byte> chunk = buffer.Slice(0, (int)Math.Min((uint)buffer.Length, range.End - address));
+            device.Read(address, chunk);
+            crc = Picoboot.Crc32(chunk, crc);
+        }
+
+        return crc;
+    }
+}
@@ -13,7 +13,7 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
 {
     public override string Verb => "upload";
     public override string Description => "Uploads firmware to a specific device.";
-    public override string? UsageHelp => "upload <firmware-file-path> --target <device> [--[no-]interactive] [--allow-connect|--no-connect] [--[no-]progress] [--no-reboot] [--no-upload] [--force]";
+    public override string? UsageHelp => "upload <firmware-file-path> --target <device> [--[no-]interactive] [--allow-connect|--no-connect] [--max-connections <count>] [--[no-]progress] [--no-reboot] [--no-upload] [--diff] [--verify] [--no-cache] [--stats|--stats-json] [--all-matching [--max-per-bus <count>]] [--force]";
 
     public override string? ArgumentsHelp =>
         $"""
@@ -26,6 +26,7 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
                 {(OperatingSystem.IsWindows() ? "A COM port (EG: \"COM3\"" : "A path to a serial port TTY device (EG: \"/dev/ttyUSB0\")")}
                 A device serial number in hex. Partial serial numbers accepted using prefix or suffix match.
                 "PICOBOOT" - The first available PICOBOOT device (IE: an Pico-based Harp device already in BOOTSEL mode.)
+                "WhoAmI=<number>" - Devices with the given WhoAmI. (Mostly useful with --all-matching.)
 
         --interactive
         --no-interactive
@@ -38,6 +39,11 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
             Connection will only be peformed if necessary, connecting to high confidence before low confidence, etc.
             (Default is to prompt the user if running interactively, disabled otherwise.)
             (Note that the target device may be connected to irrespective of this switch.)
+            (With --all-matching, --allow-connect connects to every plausible Harp device up front rather than only when nothing matches.)
+
+        --max-connections <count>
+            The maximum number of devices to connect to at once when searching for the target device.
+            (Default is {Device.DefaultMaxParallelConnections}.)
 
         --progress
         --no-progress
@@ -50,6 +56,33 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
         --no-upload
             Do not actually upload the firmware to the device.
 
+        --diff
+            Read back the device's flash and only erase and write the sectors which differ from the firmware.
+            (Faster when the device already has a similar firmware installed.)
+
+        --verify
+            Verify the contents of the device's memory after uploading.
+            (On RP2040 devices the checksum of the flash is computed on the device itself.)
+
+        --no-cache
+            Write every flash sector, even ones which the device is known to already contain.
+            Normally a record of what was last written to each device is kept, and sectors which haven't changed since are skipped.
+            The device is always checked against the record before it is trusted.
+
+        --stats
+        --stats-json
+            Print statistics about the PICOBOOT commands sent during the upload as a table or as JSON.
+
+        --all-matching
+            Upload to every device matching the target filter rather than requiring it to match exactly one device.
+            All devices are rebooted into BOOTSEL mode together and uploaded to concurrently, a summary is printed at the end.
+            Never prompts, devices with problems are skipped and reported in the summary.
+            (Not compatible with --diff or --stats.)
+
+        --max-per-bus <count>
+            The maximum number of devices to upload to at once on each USB bus when --all-matching is specified.
+            (Default is {DefaultMaxUploadsPerBus}.)
+
         --force
             Whether to force firmware upload even if things seem incorrect.
             (IE: WhoAmI mismatch, attempting to flash device which doesn't appear to be a Harp device.)
@@ -63,9 +96,17 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
         bool force = false;
         bool doFirmwareUpload = true;
         bool rebootAfterUpload = true;
+        bool differential = false;
+        bool verify = false;
+        bool useFlashStateCache = true;
+        StatisticsFormat statisticsFormat = StatisticsFormat.None;
         string? targetFilter = null;
         string? firmwareFilePath = null;
         bool? allowHarpConnection = null;
+        int maxParallelConnections = Device.DefaultMaxParallelConnections;
+        bool allMatching = false;
+        int maxUploadsPerBus = DefaultMaxUploadsPerBus;
+        bool emulate = false;
 
         while (arguments.Count > 0)
         {
@@ -79,6 +120,10 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
                         return CommandResult.Failure;
                     }
                     break;
+                // Deliberately left out of the help, this is a development aid for exercising uploads without hardware (see the README)
+                case "--emulate":
+                    emulate = true;
+                    break;
                 case "--interactive":
                     interactive = true;
                     break;
@@ -91,6 +136,10 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
                 case "--no-connect":
                     allowHarpConnection = false;
                     break;
+                case "--max-connections":
+                    if (!TryParseMaxConnections(arguments, out maxParallelConnections))
+                        return CommandResult.Failure;
+                    break;
                 case "--progress":
                     showProgress = true;
                     break;
@@ -103,9 +152,34 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
                 case "--no-upload":
                     doFirmwareUpload = false;
                     break;
+                case "--diff":
+                    differential = true;
+                    break;
+                case "--verify":
+                    verify = true;
+                    break;
+                case "--no-cache":
+                    useFlashStateCache = false;
+                    break;
+                case "--stats":
+                    statisticsFormat = StatisticsFormat.Table;
+                    break;
+                case "--stats-json":
+                    statisticsFormat = StatisticsFormat.Json;
+                    break;
                 case "--force":
                     force = true;
                     break;
+                case "--all-matching":
+                    allMatching = true;
+                    break;
+                case "--max-per-bus":
+                    if (!arguments.TryDequeue(out string? maxUploadsString) || !int.TryParse(maxUploadsString, out maxUploadsPerBus) || maxUploadsPerBus < 1)
+                    {
+                        Console.Error.WriteLine("A positive number of devices must be specified for `--max-per-bus`");
+                        return CommandResult.Failure;
+                    }
+                    break;
                 default:
                 {
                     switch (TryHandleCommonArgument(argument))
@@ -137,6 +211,17 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
             return CommandResult.ShowHelp;
         }
 
+        if (emulate)
+        {
+            if (targetFilter is not null || allMatching)
+            {
+                Console.Error.WriteLine("--emulate cannot be used with --target or --all-matching.");
+                return CommandResult.Failure;
+            }
+
+            return UploadEmulated(firmwareFilePath);
+        }
+
         if (targetFilter is null)
         {
             Console.Error.WriteLine("A target device must be spcified.");
@@ -148,7 +233,21 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
             allowHarpConnection = false;
 
         // Load the UF2
-        Uf2File file = new(firmwareFilePath);
+        using Uf2File file = new(firmwareFilePath);
+
+        if (allMatching)
+        {
+            if (differential || statisticsFormat != StatisticsFormat.None)
+            {
+                Console.Error.WriteLine("--diff and --stats cannot be used with --all-matching.");
+                return CommandResult.Failure;
+            }
+
+            if (GetPicoView(file, firmwareFilePath) is not Uf2View fleetView)
+                return CommandResult.Failure;
+
+            return UploadFleet(fleetView, firmwareFilePath, targetFilter, allowHarpConnection == true, maxParallelConnections, maxUploadsPerBus, doFirmwareUpload, rebootAfterUpload, verify, useFlashStateCache, showProgress, force);
+        }
 
         // Find target device
         ImmutableArray<Device> allDevices = Device.EnumerateDevices(allowConnection: null);
@@ -167,60 +266,8 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
         }
 
         // Find the appropriate UF2 view for the device
-        Uf2View? view = null;
-        {
-            bool ambiguousFamily = false;
-            foreach (Uf2FamilyId family in file.FamilyIds)
-            {
-                //TODO: It would be more correct to ensure that the model matches the target device
-                if (family.ToPicoModel() != model_t.unknown)
-                {
-                    if (view is not null)
-                    {
-                        if (!ambiguousFamily)
-                        {
-                            Console.Error.WriteLine($"'{firmwareFilePath}' contains multiple family IDs which could be applicable to this device:");
-                            Console.Error.WriteLine($"* {view.FamilyId.Description()}");
-                            ambiguousFamily = true;
-                        }
-
-                        Console.Error.WriteLine($"* {family.Description()}");
-                    }
-
-                    view = new(file, family);
-                }
-            }
-
-            if (view is null)
-            {
-                Console.Error.WriteLine("The UF2 file doesn't contain firmware applicable to the device.");
-                return CommandResult.Failure;
-            }
-
-            if (ambiguousFamily)
-            {
-                Console.Error.WriteLine();
-                Console.Error.WriteLine("Could not determine which family to use. UF2 is malformed.");
-                return CommandResult.Failure;
-            }
-
-            // Validate the UF2 view
-            // This is roughly requivalent to the validation logic found in picotool's load_guts function
-            {
-                model_t model = view.FamilyId.ToPicoModel();
-                foreach (ref readonly Uf2Block block in view)
-                {
-                    memory_type type1 = Picoboot.PBC_get_memory_type(block.AddressRange.Start, model);
-                    memory_type type2 = Picoboot.PBC_get_memory_type(block.AddressRange.End, model);
-
-                    if (type1 != type2 || type1 is memory_type.invalid or memory_type.rom or memory_type.sram_unstriped)
-                    {
-                        Console.Error.WriteLine($"{view} has contains data for {block.AddressRange}, which is not valid. (Memory type = {type1}{(type1 != type2 ? $"..{type2}" : "")})");
-                        return CommandResult.Failure;
-                    }
-                }
-            }
-        }
+        if (GetPicoView(file, firmwareFilePath) is not Uf2View view)
+            return CommandResult.Failure;
 
         // Reboot the device if necessary
         bool deviceStartedOnline = false;
@@ -261,10 +308,24 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
         }
 
         // Upload firmware
-        if (doFirmwareUpload)
-            UploadFirmware(view, device.PicobootDevice);
-        else
+        if (!doFirmwareUpload)
+        {
             Console.WriteLine("Firmware upload skipped!");
+        }
+        else
+        {
+            // Only the upload itself is interesting, not everything we did to discover the device
+            device.PicobootDevice.ResetStatistics();
+            bool uploadSucceeded = UploadFirmware(view, device.PicobootDevice, differential, verify, useFlashStateCache, new ConsoleUploadProgress(showProgress)) is null;
+            PrintStatistics(device.PicobootDevice, statisticsFormat);
+
+            if (!uploadSucceeded)
+            {
+                // Leave the device in BOOTSEL mode, there's no point booting into a firmware we know is broken
+                device.PicobootDevice.Dispose();
+                return CommandResult.Failure;
+            }
+        }
 
         // Reboot into firmware
         if (rebootAfterUpload)
@@ -277,6 +338,45 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
         Console.WriteLine($"Finished uploading '{firmwareFilePath}' to device matching '{targetFilter}'");
         return CommandResult.Success;
 
+        // Same as the real thing, minus everything to do with finding the device and checking that the firmware belongs on it
+        CommandResult UploadEmulated(string firmwareFilePath)
+        {
+            using Uf2File file = new(firmwareFilePath);
+            if (GetPicoView(file, firmwareFilePath) is not Uf2View view)
+                return CommandResult.Failure;
+
+            using PicobootEmulator emulator = new(view.FamilyId.ToPicoModel());
+            PicobootDevice device = emulator.Open();
+            Console.WriteLine($"Uploading to {device}.");
+
+            bool uploadSucceeded = true;
+            if (!doFirmwareUpload)
+            {
+                Console.WriteLine("Firmware upload skipped!");
+            }
+            else
+            {
+                // The emulator's statistics cover the whole upload, so they have to be reset at the same point as the device's
+                device.ResetStatistics();
+                emulator.ResetStatistics();
+                uploadSucceeded = UploadFirmware(view, device, differential, verify, useFlashStateCache, new ConsoleUploadProgress(showProgress)) is null;
+                PrintStatistics(device, statisticsFormat);
+                PrintEmulatorStatistics(emulator, statisticsFormat);
+            }
+
+            if (!uploadSucceeded)
+                return CommandResult.Failure;
+
+            if (rebootAfterUpload)
+            {
+                Console.WriteLine("Rebooting device...");
+                device.Reboot(view, ignoreNonBootable: true);
+            }
+
+            Console.WriteLine($"Finished uploading '{firmwareFilePath}' to emulated device");
+            return CommandResult.Success;
+        }
+
         Device? FindTargetDevice(ImmutableArray<Device> allDevices, DeviceConfidence? connectionLevel)
         {
             ImmutableArray<Device> filteredDevices = allDevices.Filter(targetFilter);
@@ -339,19 +439,7 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
 
                         connectionLevel = connectionLevel is null ? DeviceConfidence.High : connectionLevel - 1;
                         Trace.WriteLine($"Didn't find any devices, trying to connect to devices with {connectionLevel} Confidence for more information...");
-                        for (int i = 0; i < builder.Count; i++)
-                        {
-                            Device device = builder[i];
-                            if (device.PortName is not null && device.Confidence == connectionLevel)
-                            {
-                                Device newDevice = device.WithMetadataFromHarpProtocol();
-                                if (device == newDevice)
-                                    continue;
-
-                                builder[i] = newDevice;
-                                numDevicesUpdated++;
-                            }
-                        }
+                        numDevicesUpdated += Device.PopulateMetadataFromHarpProtocol(builder, d => d.Confidence == connectionLevel, maxParallelConnections);
                         Trace.WriteLine($"{numDevicesUpdated} device(s) were updated.");
                     } while (numDevicesUpdated == 0);
 
@@ -361,47 +449,65 @@ internal sealed partial class UploadFirmwareCommand : CommandBase
                     throw new UnreachableException();
             }
         }
+    }
 
-        // The logic here is based on (but not identical to) picotool
-        // https://github.com/raspberrypi/picotool/blob/de8ae5ac334e1126993f72a5c67949712fd1e1a4/main.cpp#L4591
-        void UploadFirmware(Uf2View view, PicobootDevice device)
+    /// <summary>Finds the view of the UF2 applicable to Pico devices and validates it.</summary>
+    /// <returns>The view, or null if there isn't exactly one valid view (in which case an error has been printed.)</returns>
+    private static Uf2View? GetPicoView(Uf2File file, string firmwareFilePath)
+    {
+        Uf2View? view = null;
+        bool ambiguousFamily = false;
+        foreach (Uf2FamilyId family in file.FamilyIds)
         {
-            long startTimestamp = Stopwatch.GetTimestamp();
-            Console.WriteLine("Uploading firmware...");
-            Uf2FlashReader uf2Reader = new(view);
-
-            // This can be any multiple of FLASH_SECTOR_ERASE_SIZE
-            Span<byte> _buffer = stackalloc byte[(int)Picoboot.FLASH_SECTOR_ERASE_SIZE];
-            Debug.Assert(_buffer.Length % Picoboot.FLASH_SECTOR_ERASE_SIZE == 0);
-
-            foreach (AddressRange coalescedRange in view.CoalescedRanges)
+            //TODO: It would be more correct to ensure that the model matches the target device
+            if (family.ToPicoModel() != model_t.unknown)
             {
-                memory_type memoryType = Picoboot.PBC_get_memory_type(coalescedRange.Start, device.Model);
-                Debug.Assert(Picoboot.PBC_get_memory_type(coalescedRange.End, device.Model) == memoryType);
-                AddressRange targetRange = coalescedRange;
-
-                if (memoryType == memory_type.flash)
+                if (view is not null)
                 {
-                    targetRange = targetRange.GetAligned(Picoboot.FLASH_SECTOR_ERASE_SIZE);
-                    device.ExitXip();
-                    device.FlashErase(targetRange);
+                    if (!ambiguousFamily)
+                    {
+                        Console.Error.WriteLine($"'{firmwareFilePath}' contains multiple family IDs which could be applicable to this device:");
+                        Console.Error.WriteLine($"* {view.FamilyId.Description()}");
+                        ambiguousFamily = true;
+                    }
+
+                    Console.Error.WriteLine($"* {family.Description()}");
                 }
 
-                double sizeKibibytes = (double)targetRange.Size / 1024.0;
-                Console.WriteLine($"Writing {memoryType.FriendlyName()} region {targetRange} - {sizeKibibytes:N} KiB...");
-                using ProgressBar<double> progress = new(sizeKibibytes, "KiB", isEnabled: showProgress);
-                while (targetRange.Size > 0)
+                view = new(file, family);
+            }
+        }
+
+        if (view is null)
+        {
+            Console.Error.WriteLine("The UF2 file doesn't contain firmware applicable to the device.");
+            return null;
+        }
+
+        if (ambiguousFamily)
+        {
+            Console.Error.WriteLine();
+            Console.Error.WriteLine("Could not determine which family to use. UF2 is malformed.");
+            return null;
+        }
+
+        // Validate the UF2 view
+        // This is roughly requivalent to the validation logic found in picotool's load_guts function
+        {
+            model_t model = view.FamilyId.ToPicoModel();
+            foreach (ref readonly Uf2Block block in view)
+            {
+                memory_type type1 = Picoboot.PBC_get_memory_type(block.AddressRange.Start, model);
+                memory_type type2 = Picoboot.PBC_get_memory_type(block.AddressRange.End, model);
+
+                if (type1 != type2 || type1 is memory_type.invalid or memory_type.rom or memory_type.sram_unstriped)
                 {
-                    uint chunkSize = Math.Min((uint)_buffer.Length, targetRange.Size);
-                    Span<byte> buffer = _buffer.Slice(0, (int)chunkSize);
-                    uf2Reader.Read(targetRange.Start, buffer, fillHolesWithZero: true);
-                    device.Write(targetRange.Start, buffer);
-                    progress.ReportProgress((double)buffer.Length / 1024.0);
-                    targetRange = new AddressRange(targetRange.Start + chunkSize, targetRange.End);
+                    Console.Error.WriteLine($"{view} has contains data for {block.AddressRange}, which is not valid. (Memory type = {type1}{(type1 != type2 ? $"..{type2}" : "")})");
+                    return null;
                 }
             }
-
-            Console.WriteLine($"Upload completed in {Stopwatch.GetElapsedTime(startTimestamp).TotalSeconds:N} seconds");
         }
+
+        return view;
     }
 }
@@ -1,8 +1,13 @@
-﻿namespace HarpRegulator;
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+
+namespace HarpRegulator;
 
 internal static class Utilities
 {
-    public static string FriendlyByteCount(uint byteCount, string format = "N")
+    public static string FriendlyByteCount(ulong byteCount, string format = "N")
     {
         if (byteCount == 1)
             return $"{byteCount.ToString(format)} byte";
@@ -24,4 +29,50 @@ internal static class Utilities
         value /= 1024.0;
         return $"{value.ToString(format)} TiB";
     }
+
+    /// <summary>Writes a simple table, the first row is treated as the header.</summary>
+    public static void WriteTable(TextWriter output, IReadOnlyList<string[]> rows)
+    {
+        if (rows.Count == 0)
+            return;
+
+        // Measure columns
+        int[] columnWidths = new int[rows[0].Length];
+        foreach (string[] row in rows)
+        {
+            if (row.Length != columnWidths.Length)
+                throw new InvalidOperationException("Table is malformed.");
+
+            for (int i = 0; i < row.Length; i++)
+            {
+                ref int columnWidth = ref columnWidths[i];
+                columnWidth = Math.Max(columnWidth, row[i].Length);
+            }
+        }
+
+        // Print table
+        //TODO: Handle overflowing the width of the console
+        ReadOnlySpan<char> fullSpace = new String(' ', columnWidths.Max());
+        bool firstRow = true;
+        foreach (string[] row in rows)
+        {
+            output.Write("|");
+            int columnIndex = 0;
+            foreach (string column in row)
+            {
+                output.Write($" {column}{fullSpace.Slice(0, columnWidths[columnIndex] - column.Length)} |");
+                columnIndex++;
+            }
+            output.WriteLine();
+
+            if (firstRow)
+            {
+                firstRow = false;
+                output.Write("|");
+                foreach (int width in columnWidths)
+                    output.Write($"-{new String('-', width)}-|");
+                output.WriteLine();
+            }
+        }
+    }
 }
@@ -8,8 +8,20 @@ public unsafe sealed class LibusbManager : IDisposable
 {
     private readonly libusb_context _Context;
     private static LibusbManager? Instance;
+    private static readonly object InstanceLock = new();
 
-    public static libusb_context Context => (Instance ??= new())._Context;
+    public static libusb_context Context
+    {
+        get
+        {
+            if (Volatile.Read(ref Instance) is LibusbManager instance)
+                return instance._Context;
+
+            // libusb contexts are thread-safe, but we must not race to create more than one
+            lock (InstanceLock)
+                return (Instance ??= new())._Context;
+        }
+    }
 
     private LibusbManager()
     {
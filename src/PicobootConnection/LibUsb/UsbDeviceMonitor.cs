@@ -0,0 +1,52 @@
+﻿using System;
+using static PicobootConnection.Picoboot;
+
+namespace PicobootConnection.LibUsb;
+
+/// <summary>Watches for USB devices arriving or leaving the system.</summary>
+/// <remarks>
+/// Uses libusb hotplug events where supported (on Linux libusb sources them from udev or netlink), otherwise the device list is polled.
+/// Changes are accumulated between calls to <see cref="Wait"/> so none are missed while the caller is busy handling a previous change.
+/// </remarks>
+public unsafe sealed class UsbDeviceMonitor : IDisposable
+{
+    private void* Monitor;
+
+    public UsbDeviceMonitor(libusb_context context)
+    {
+        void* monitor;
+        ((libusb_error)PBC_usb_monitor_open(context, &monitor)).ThrowIfError("Failed to start monitoring USB devices");
+        Monitor = monitor;
+    }
+
+    public UsbDeviceMonitor()
+        : this(LibusbManager.Context)
+    { }
+
+    /// <summary>Waits for USB devices to arrive or leave.</summary>
+    /// <returns>The number of devices which arrived or left since the previous call, or 0 if the timeout elapsed without any changes.</returns>
+    public int Wait(TimeSpan timeout)
+    {
+        ObjectDisposedException.ThrowIf(Monitor is null, this);
+
+        int result = PBC_usb_monitor_wait(Monitor, (uint)Math.Clamp(timeout.TotalMilliseconds, 0, uint.MaxValue));
+        if (result < 0)
+            ((libusb_error)result).Throw();
+
+        return result;
+    }
+
+    public void Dispose()
+    {
+        GC.SuppressFinalize(this);
+
+        if (Monitor is not null)
+        {
+            PBC_usb_monitor_close(Monitor);
+            Monitor = null;
+        }
+    }
+
+    ~UsbDeviceMonitor()
+        => Dispose();
+}
@@ -1,5 +1,11 @@
 ﻿#include <assert.h>
 #include "picoboot_connection.h"
+#include "crc32.h"
+#include <chrono>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
 
 #ifdef _WIN32
 #include "libusb_windows_common_minimal.h"
@@ -8,7 +14,7 @@
 #ifdef _WIN32
 #define DLL_EXPORT extern "C" __declspec(dllexport)
 #else
-#define DLL_EXPORT
+#define DLL_EXPORT extern "C" __attribute__((visibility("default")))
 #endif
 
 DLL_EXPORT enum memory_type PBC_get_memory_type(uint32_t addr, model_t model)
@@ -45,9 +51,470 @@ DLL_EXPORT const char* PBC_GetUsbInstanceId(libusb_device* device)
 #endif
 }
 
+DLL_EXPORT uint32_t PBC_crc32(const uint8_t* buffer, uint32_t count, uint32_t crc)
+{
+    return crc32_sw(buffer, count, crc);
+}
+
+DLL_EXPORT unsigned int PBC_get_stats(picoboot_connection* connection, picoboot_cmd_stats* stats, unsigned int count)
+{
+    return picoboot_get_stats(connection, stats, count);
+}
+
+DLL_EXPORT void PBC_reset_stats(picoboot_connection* connection)
+{
+    picoboot_reset_stats(connection);
+}
+
+struct PBC_program_policy
+{
+    // Size of each write command, must be a multiple of PAGE_SIZE for flash
+    uint32_t write_size;
+    // Size of each erase command, must be a multiple of FLASH_SECTOR_ERASE_SIZE
+    // 0 erases the entire range with a single command
+    uint32_t erase_size;
+    // Number of writes to keep in flight, 0 to write synchronously
+    uint32_t pipeline_depth;
+};
+
+typedef void (*PBC_progress_callback)(uint32_t bytes_written, uint32_t total_bytes, void* user_data);
+
+// Programs a contiguous region of memory in one call (exiting XIP and erasing first for flash) so that callers don't pay for a
+// managed/native transition per page.
+// For flash the target must be sector-aligned, the caller is responsible for padding the buffer accordingly.
+// context is only used when pipeline_depth is non-zero and must be the context the device was opened from.
+DLL_EXPORT int PBC_program_region(picoboot_connection* connection, libusb_context* context, model_t model, uint32_t addr, const uint8_t* buffer, uint32_t len,
+    const PBC_program_policy* policy, PBC_progress_callback progress, void* user_data)
+{
+    bool is_flash = get_memory_type(addr, model) == flash;
+    uint32_t write_size = policy->write_size;
+    uint32_t erase_size = policy->erase_size == 0 ? len : policy->erase_size;
+
+    if (len == 0)
+        return 0;
+
+    if (write_size == 0 || (is_flash && write_size % PAGE_SIZE != 0))
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    if (is_flash && (addr % FLASH_SECTOR_ERASE_SIZE != 0 || len % FLASH_SECTOR_ERASE_SIZE != 0 || erase_size % FLASH_SECTOR_ERASE_SIZE != 0))
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    int ret;
+    bool pipelined = policy->pipeline_depth != 0;
+    if (pipelined)
+    {
+        ret = picoboot_write_stream_open(connection, context, policy->pipeline_depth, write_size);
+        if (ret)
+            return ret;
+    }
+
+    if (is_flash)
+        ret = picoboot_exit_xip(connection);
+    else
+        ret = 0;
+
+    // Erasing as we go rather than up front means progress is reported evenly across the whole operation
+    uint32_t offset = 0;
+    uint32_t erased_end = is_flash ? 0 : len;
+    while (ret == 0 && offset < len)
+    {
+        if (offset >= erased_end)
+        {
+            uint32_t erase_len = len - offset < erase_size ? len - offset : erase_size;
+            ret = picoboot_flash_erase(connection, addr + offset, erase_len);
+            if (ret)
+                break;
+            erased_end = offset + erase_len;
+        }
+
+        uint32_t chunk = erased_end - offset < write_size ? erased_end - offset : write_size;
+        if (pipelined)
+            ret = picoboot_write_stream_write(connection, addr + offset, buffer + offset, chunk);
+        else
+            ret = picoboot_write(connection, addr + offset, const_cast<uint8_t*>(buffer + offset), chunk);
+
+        if (ret)
+            break;
+
+        offset += chunk;
+        if (progress)
+            progress(offset, len, user_data);
+    }
+
+    if (pipelined)
+    {
+        if (ret == 0)
+            ret = picoboot_write_stream_flush(connection);
+        picoboot_write_stream_close(connection);
+    }
+
+    return ret;
+}
+
+struct PBC_wait_state
+{
+    const char* serial;
+    bool enumerating;
+    int found;
+    // Devices which were already present when we started waiting, their serial numbers are checked once registration completes
+    libusb_device* existing[16];
+    int existing_count;
+    // Devices which arrived while waiting but whose serial number hasn't been read yet
+    libusb_device* arrived[16];
+    int arrived_count;
+};
+
+static bool PBC_is_bootsel_device(libusb_device* device)
+{
+    libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(device, &descriptor))
+        return false;
+
+    return descriptor.idVendor == VENDOR_ID_RASPBERRY_PI
+        && (descriptor.idProduct == PRODUCT_ID_RP2040_USBBOOT || descriptor.idProduct == PRODUCT_ID_RP2350_USBBOOT);
+}
+
+// Matches the same way as SerialNumberPartialMatch on the managed side: the serial is compared without leading zeros and may match either end
+// Returns 1 on a match, 0 on a mismatch, or -1 if the serial number couldn't be read (IE: a device which just arrived and isn't accessible yet)
+static int PBC_serial_matches(libusb_device* device, const char* serial)
+{
+    libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(device, &descriptor))
+        return -1;
+    if (descriptor.iSerialNumber == 0)
+        return 0;
+
+    libusb_device_handle* handle;
+    if (libusb_open(device, &handle))
+        return -1;
+
+    char buffer[64];
+    int length = libusb_get_string_descriptor_ascii(handle, descriptor.iSerialNumber, (unsigned char*)buffer, sizeof(buffer) - 1);
+    libusb_close(handle);
+    if (length <= 0)
+        return -1;
+
+    const char* device_serial = buffer;
+    while (length > 1 && *device_serial == '0')
+    {
+        device_serial++;
+        length--;
+    }
+
+    int serial_length = (int)strlen(serial);
+    if (serial_length == 0 || serial_length > length)
+        return 0;
+
+    auto equal_ignore_case = [](const char* a, const char* b, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+                return false;
+        }
+        return true;
+    };
+
+    return equal_ignore_case(device_serial, serial, serial_length) || equal_ignore_case(device_serial + length - serial_length, serial, serial_length) ? 1 : 0;
+}
+
+static int LIBUSB_CALL PBC_wait_hotplug_callback(libusb_context*, libusb_device* device, libusb_hotplug_event, void* user_data)
+{
+    PBC_wait_state* state = (PBC_wait_state*)user_data;
+
+    // Hotplug callbacks must not perform synchronous I/O, so devices which were already present are checked after registration returns
+    if (state->enumerating)
+    {
+        if (state->existing_count < (int)(sizeof(state->existing) / sizeof(state->existing[0])))
+            state->existing[state->existing_count++] = libusb_ref_device(device);
+        return 0;
+    }
+
+    // Anything arriving after we started waiting is presumably the device which was just rebooted
+    if (!state->serial)
+    {
+        state->found = 1;
+        return 1;
+    }
+
+    // When several devices reboot at once the arrival might not be the one we're waiting for, its serial number is checked outside of the callback
+    if (state->arrived_count < (int)(sizeof(state->arrived) / sizeof(state->arrived[0])))
+        state->arrived[state->arrived_count++] = libusb_ref_device(device);
+    return 0;
+}
+
+static int PBC_wait_for_bootsel_device_polling(libusb_context* context, const char* serial, std::chrono::steady_clock::time_point deadline)
+{
+    // libusb_device instances are only reused once they're released, so holding on to the initial list lets us identify new arrivals by pointer
+    libusb_device** initial_devices;
+    ssize_t initial_count = libusb_get_device_list(context, &initial_devices);
+    if (initial_count < 0)
+        return (int)initial_count;
+
+    int ret = 0;
+    for (ssize_t i = 0; i < initial_count && ret == 0; i++)
+    {
+        if (serial && PBC_is_bootsel_device(initial_devices[i]) && PBC_serial_matches(initial_devices[i], serial) == 1)
+            ret = 1;
+    }
+
+    while (ret == 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        libusb_device** devices;
+        ssize_t count = libusb_get_device_list(context, &devices);
+        if (count < 0)
+        {
+            ret = (int)count;
+            break;
+        }
+
+        for (ssize_t i = 0; i < count && ret == 0; i++)
+        {
+            if (!PBC_is_bootsel_device(devices[i]))
+                continue;
+
+            bool is_new = true;
+            for (ssize_t j = 0; j < initial_count && is_new; j++)
+                is_new = devices[i] != initial_devices[j];
+
+            // New arrivals which can't be read yet are checked again on the next poll
+            if (is_new && (!serial || PBC_serial_matches(devices[i], serial) == 1))
+                ret = 1;
+        }
+
+        libusb_free_device_list(devices, 1);
+    }
+
+    libusb_free_device_list(initial_devices, 1);
+    return ret;
+}
+
+// Waits for a device in BOOTSEL mode to appear, intended to be used right after asking a device to reboot into BOOTSEL mode.
+// Returns 1 as soon as a BOOTSEL device arrives (or one matching serial is already present), 0 on timeout, or a libusb error.
+// serial is optional and uses the same partial matching as the managed side, both existing devices and new arrivals must match it.
+// Hotplug events are used where libusb supports them (on Linux libusb sources them from udev or netlink), otherwise the device list is polled.
+DLL_EXPORT int PBC_wait_for_bootsel_device(libusb_context* context, const char* serial, uint32_t timeout_ms)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+        return PBC_wait_for_bootsel_device_polling(context, serial, deadline);
+
+    PBC_wait_state state = {};
+    state.serial = serial;
+    state.enumerating = true;
+
+    // Registration is done per product ID since libusb only allows filtering on a single one
+    libusb_hotplug_callback_handle handles[2];
+    const int product_ids[2] = { PRODUCT_ID_RP2040_USBBOOT, PRODUCT_ID_RP2350_USBBOOT };
+    int registered = 0;
+    int ret = 0;
+    for (; registered < 2; registered++)
+    {
+        ret = libusb_hotplug_register_callback(context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_ENUMERATE, VENDOR_ID_RASPBERRY_PI,
+            product_ids[registered], LIBUSB_HOTPLUG_MATCH_ANY, PBC_wait_hotplug_callback, &state, &handles[registered]);
+        if (ret)
+            break;
+    }
+    state.enumerating = false;
+
+    for (int i = 0; i < state.existing_count; i++)
+    {
+        if (ret == 0 && serial && !state.found && PBC_serial_matches(state.existing[i], serial) == 1)
+            state.found = 1;
+        libusb_unref_device(state.existing[i]);
+    }
+
+    while (ret == 0 && !state.found)
+    {
+        // Arrivals whose serial number couldn't be read yet stay queued and are retried after a short delay
+        int unreadable_count = 0;
+        for (int i = 0; i < state.arrived_count; i++)
+        {
+            int match = state.found ? 0 : PBC_serial_matches(state.arrived[i], serial);
+            if (match == 1)
+                state.found = 1;
+
+            if (match < 0)
+                state.arrived[unreadable_count++] = state.arrived[i];
+            else
+                libusb_unref_device(state.arrived[i]);
+        }
+        state.arrived_count = unreadable_count;
+
+        if (state.found)
+            break;
+
+        std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero())
+            break;
+
+        if (state.arrived_count > 0 && remaining > std::chrono::milliseconds(50))
+            remaining = std::chrono::milliseconds(50);
+
+        long long remaining_us = std::chrono::duration_cast<std::chrono::microseconds>(remaining).count();
+        timeval tv;
+        tv.tv_sec = (long)(remaining_us / 1000000);
+        tv.tv_usec = (long)(remaining_us % 1000000);
+        ret = libusb_handle_events_timeout_completed(context, &tv, &state.found);
+        if (ret == LIBUSB_ERROR_INTERRUPTED)
+            ret = 0;
+    }
+
+    // Callbacks which returned 1 have already been deregistered by libusb, but deregistering them again is harmless
+    for (int i = 0; i < registered; i++)
+        libusb_hotplug_deregister_callback(context, handles[i]);
+
+    for (int i = 0; i < state.arrived_count; i++)
+        libusb_unref_device(state.arrived[i]);
+
+    return ret < 0 ? ret : state.found;
+}
+
+// Watches for any USB device arriving or leaving, intended for long-running processes which need to keep a device list up to date.
+// Unlike PBC_wait_for_bootsel_device the monitor stays registered between waits so that changes which happen while the caller is busy aren't missed.
+struct PBC_usb_monitor
+{
+    libusb_context* context;
+    bool hotplug;
+    libusb_hotplug_callback_handle handle;
+    int changes;
+    // Used when hotplug is not supported, the previous list is held on to so that its devices can be identified by pointer
+    libusb_device** devices;
+    ssize_t device_count;
+};
+
+static int LIBUSB_CALL PBC_usb_monitor_callback(libusb_context*, libusb_device*, libusb_hotplug_event, void* user_data)
+{
+    ((PBC_usb_monitor*)user_data)->changes++;
+    return 0;
+}
+
+DLL_EXPORT int PBC_usb_monitor_open(libusb_context* context, PBC_usb_monitor** monitor_out)
+{
+    PBC_usb_monitor* monitor = (PBC_usb_monitor*)calloc(1, sizeof(PBC_usb_monitor));
+    if (!monitor)
+        return LIBUSB_ERROR_NO_MEM;
+
+    monitor->context = context;
+    monitor->hotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0;
+
+    int ret;
+    if (monitor->hotplug)
+    {
+        ret = libusb_hotplug_register_callback(context, (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+            LIBUSB_HOTPLUG_NO_FLAGS, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, PBC_usb_monitor_callback, monitor, &monitor->handle);
+    }
+    else
+    {
+        monitor->device_count = libusb_get_device_list(context, &monitor->devices);
+        ret = monitor->device_count < 0 ? (int)monitor->device_count : 0;
+    }
+
+    if (ret)
+    {
+        free(monitor);
+        return ret;
+    }
+
+    *monitor_out = monitor;
+    return 0;
+}
+
+static int PBC_usb_monitor_poll(PBC_usb_monitor* monitor)
+{
+    libusb_device** devices;
+    ssize_t count = libusb_get_device_list(monitor->context, &devices);
+    if (count < 0)
+        return (int)count;
+
+    // Both lists come from the same context, so any difference in membership is a device which arrived or left
+    int changes = 0;
+    for (ssize_t i = 0; i < count; i++)
+    {
+        bool found = false;
+        for (ssize_t j = 0; j < monitor->device_count && !found; j++)
+            found = devices[i] == monitor->devices[j];
+
+        if (!found)
+            changes++;
+    }
+
+    // Whatever wasn't retained from the previous list has left
+    changes += (int)(monitor->device_count - (count - changes));
+
+    libusb_free_device_list(monitor->devices, 1);
+    monitor->devices = devices;
+    monitor->device_count = count;
+    return changes;
+}
+
+// Returns the number of devices which arrived or left since the previous wait (or since the monitor was opened), 0 on timeout, or a libusb error.
+DLL_EXPORT int PBC_usb_monitor_wait(PBC_usb_monitor* monitor, uint32_t timeout_ms)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    int ret = 0;
+    while (true)
+    {
+        if (monitor->hotplug)
+        {
+            if (monitor->changes)
+                break;
+        }
+        else
+        {
+            ret = PBC_usb_monitor_poll(monitor);
+            if (ret)
+                return ret;
+        }
+
+        std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero())
+            break;
+
+        if (monitor->hotplug)
+        {
+            long long remaining_us = std::chrono::duration_cast<std::chrono::microseconds>(remaining).count();
+            timeval tv;
+            tv.tv_sec = (long)(remaining_us / 1000000);
+            tv.tv_usec = (long)(remaining_us % 1000000);
+            ret = libusb_handle_events_timeout_completed(monitor->context, &tv, &monitor->changes);
+            if (ret && ret != LIBUSB_ERROR_INTERRUPTED)
+                return ret;
+        }
+        else
+        {
+            std::chrono::steady_clock::duration interval = std::chrono::milliseconds(250);
+            std::this_thread::sleep_for(remaining < interval ? remaining : interval);
+        }
+    }
+
+    ret = monitor->changes;
+    monitor->changes = 0;
+    return ret;
+}
+
+DLL_EXPORT void PBC_usb_monitor_close(PBC_usb_monitor* monitor)
+{
+    if (!monitor)
+        return;
+
+    if (monitor->hotplug)
+        libusb_hotplug_deregister_callback(monitor->context, monitor->handle);
+    else if (monitor->devices)
+        libusb_free_device_list(monitor->devices, 1);
+
+    free(monitor);
+}
+
 // Export picoboot functions
 #ifdef _WIN32
 #pragma comment(linker, "/export:picoboot_open_device")
+#pragma comment(linker, "/export:picoboot_close_device")
+#pragma comment(linker, "/export:picoboot_open_emulated_device")
 #pragma comment(linker, "/export:picoboot_reset")
 #pragma comment(linker, "/export:picoboot_cmd_status_verbose")
 #pragma comment(linker, "/export:picoboot_cmd_status")
@@ -67,4 +534,16 @@ DLL_EXPORT const char* PBC_GetUsbInstanceId(libusb_device* device)
 #pragma comment(linker, "/export:picoboot_poke")
 #pragma comment(linker, "/export:picoboot_peek")
 #pragma comment(linker, "/export:picoboot_flash_id")
+#pragma comment(linker, "/export:picoboot_flash_crc32")
+#pragma comment(linker, "/export:picoboot_write_stream_open")
+#pragma comment(linker, "/export:picoboot_write_stream_write")
+#pragma comment(linker, "/export:picoboot_write_stream_flush")
+#pragma comment(linker, "/export:picoboot_write_stream_close")
+#pragma comment(linker, "/export:picoboot_emulator_default_config")
+#pragma comment(linker, "/export:picoboot_emulator_create")
+#pragma comment(linker, "/export:picoboot_emulator_destroy")
+#pragma comment(linker, "/export:picoboot_emulator_read_memory")
+#pragma comment(linker, "/export:picoboot_emulator_write_memory")
+#pragma comment(linker, "/export:picoboot_emulator_get_stats")
+#pragma comment(linker, "/export:picoboot_emulator_reset_stats")
 #endif
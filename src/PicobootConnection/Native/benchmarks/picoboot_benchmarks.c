@@ -0,0 +1,239 @@
+﻿// Microbenchmarks for the host side of picoboot_connection.c, results are written to stdout as JSON
+// PICOBOOT commands are issued against an emulator with its timing model disabled, so they measure the overhead of the connection itself.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "../picoboot_connection.h"
+#include "../picoboot_emulator.h"
+#include "../picoboot_time.h"
+#include "../crc32.h"
+
+// Each measurement runs batches of at least this long and reports the fastest, which is the least disturbed by the rest of the system
+#define MIN_BATCH_US 100000u
+#define BATCH_COUNT 5
+
+typedef bool (*benchmark_fn)(void *context, uint32_t iterations);
+
+static bool first_result = true;
+
+static void write_result(const char *name, uint64_t best_ns, uint64_t bytes_per_op) {
+    double ns_per_op = (double) best_ns;
+    printf("%s\n    {\"name\": \"%s\", \"ns_per_op\": %.1f", first_result ? "" : ",", name, ns_per_op);
+    if (bytes_per_op) {
+        printf(", \"bytes_per_op\": %" PRIu64 ", \"mib_per_s\": %.1f", bytes_per_op, (double) bytes_per_op * 1e9 / ns_per_op / (1024.0 * 1024.0));
+    }
+    printf("}");
+    first_result = false;
+}
+
+// Returns false if the benchmark itself failed, in which case nothing is reported
+static bool run(const char *name, benchmark_fn fn, void *context, uint64_t bytes_per_op) {
+    // Find an iteration count which takes long enough to time with microsecond resolution
+    uint32_t iterations = 1;
+    uint64_t elapsed_us;
+    for (;;) {
+        uint64_t start_us = picoboot_time_us();
+        if (!fn(context, iterations)) {
+            fprintf(stderr, "%s failed\n", name);
+            return false;
+        }
+        elapsed_us = picoboot_time_us() - start_us;
+        if (elapsed_us >= MIN_BATCH_US || iterations >= (1u << 30)) {
+            break;
+        }
+        iterations *= elapsed_us == 0 ? 16 : 2;
+    }
+
+    uint64_t best_ns = elapsed_us * 1000u / iterations;
+    for (int i = 1; i < BATCH_COUNT; i++) {
+        uint64_t start_us = picoboot_time_us();
+        if (!fn(context, iterations)) {
+            fprintf(stderr, "%s failed\n", name);
+            return false;
+        }
+        uint64_t batch_ns = (picoboot_time_us() - start_us) * 1000u / iterations;
+        if (batch_ns < best_ns) {
+            best_ns = batch_ns;
+        }
+    }
+
+    write_result(name, best_ns, bytes_per_op);
+    return true;
+}
+
+typedef struct crc32_context {
+    uint8_t *buffer;
+    uint32_t size;
+    // Keeps the compiler from discarding the CRCs
+    uint32_t crc;
+} crc32_context;
+
+static bool crc32_benchmark(void *context, uint32_t iterations) {
+    crc32_context *c = (crc32_context *) context;
+    for (uint32_t i = 0; i < iterations; i++) {
+        c->crc ^= crc32_sw(c->buffer, c->size, 0xffffffff);
+    }
+    return true;
+}
+
+typedef struct memory_type_context {
+    model_t model;
+    uint32_t addresses[1024];
+    uint32_t count;
+} memory_type_context;
+
+static bool memory_type_benchmark(void *context, uint32_t iterations) {
+    memory_type_context *c = (memory_type_context *) context;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint32_t j = 0; j < 1024; j++) {
+            c->count += get_memory_type(c->addresses[j], c->model) == flash;
+        }
+    }
+    return true;
+}
+
+typedef struct transfer_context {
+    picoboot_connection *connection;
+    uint32_t addr;
+    uint8_t *buffer;
+    uint32_t size;
+} transfer_context;
+
+static bool write_benchmark(void *context, uint32_t iterations) {
+    transfer_context *c = (transfer_context *) context;
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (picoboot_write(c->connection, c->addr, c->buffer, c->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_benchmark(void *context, uint32_t iterations) {
+    transfer_context *c = (transfer_context *) context;
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (picoboot_read(c->connection, c->addr, c->buffer, c->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool write_stream_benchmark(void *context, uint32_t iterations) {
+    transfer_context *c = (transfer_context *) context;
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (picoboot_write_stream_write(c->connection, c->addr, c->buffer, c->size)) {
+            return false;
+        }
+    }
+    return !picoboot_write_stream_flush(c->connection);
+}
+
+static bool run_transfer_benchmarks(model_t model, uint8_t *buffer) {
+    const char *model_name = model == rp2040 ? "rp2040" : "rp2350";
+    picoboot_emulator_config config;
+    picoboot_emulator_default_config(model, &config);
+    config.transfer_latency_us = 0;
+    config.bytes_per_ms = 0;
+    config.command_us = 0;
+    config.page_program_us = 0;
+    config.sector_erase_us = 0;
+    config.xip_read_bytes_per_ms = 0;
+
+    picoboot_emulator *emulator;
+    if (picoboot_emulator_create(&config, &emulator)) {
+        fprintf(stderr, "Failed to create the %s emulator\n", model_name);
+        return false;
+    }
+
+    picoboot_connection *connection;
+    model_t connected_model;
+    bool ok = picoboot_open_emulated_device(emulator, &connection, &connected_model) == dr_vidpid_bootrom_ok;
+    if (!ok) {
+        fprintf(stderr, "Failed to open the %s emulator\n", model_name);
+        picoboot_emulator_destroy(emulator);
+        return false;
+    }
+
+    ok = !picoboot_exclusive_access(connection, 1) && !picoboot_exit_xip(connection) && !picoboot_flash_erase(connection, FLASH_START, 64u * 1024u);
+
+    static const uint32_t sizes[] = { PAGE_SIZE, FLASH_SECTOR_ERASE_SIZE, 64u * 1024u };
+    char name[64];
+    for (unsigned int i = 0; ok && i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        transfer_context context = { connection, FLASH_START, buffer, sizes[i] };
+        snprintf(name, sizeof(name), "picoboot_write/%s/flash/%u", model_name, sizes[i]);
+        ok = run(name, write_benchmark, &context, sizes[i]);
+
+        snprintf(name, sizeof(name), "picoboot_read/%s/flash/%u", model_name, sizes[i]);
+        ok = ok && run(name, read_benchmark, &context, sizes[i]);
+
+        context.addr = SRAM_START;
+        snprintf(name, sizeof(name), "picoboot_write/%s/sram/%u", model_name, sizes[i]);
+        ok = ok && run(name, write_benchmark, &context, sizes[i]);
+    }
+
+    // The write stream needs a libusb context for real devices, emulated ones complete transfers themselves
+    if (ok && !picoboot_write_stream_open(connection, NULL, 4, FLASH_SECTOR_ERASE_SIZE)) {
+        transfer_context context = { connection, FLASH_START, buffer, FLASH_SECTOR_ERASE_SIZE };
+        snprintf(name, sizeof(name), "picoboot_write_stream/%s/depth4/%u", model_name, FLASH_SECTOR_ERASE_SIZE);
+        ok = run(name, write_stream_benchmark, &context, FLASH_SECTOR_ERASE_SIZE);
+        picoboot_write_stream_close(connection);
+    }
+
+    picoboot_close_device(connection);
+    picoboot_emulator_destroy(emulator);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    (void) argc;
+    (void) argv;
+
+    // The same pseudo-random data every run so results are comparable between runs and machines
+    const uint32_t max_size = 16u * 1024u * 1024u;
+    uint8_t *buffer = (uint8_t *) malloc(max_size);
+    if (!buffer) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    uint32_t state = 0x12345678;
+    for (uint32_t i = 0; i < max_size; i++) {
+        state = state * 1664525u + 1013904223u;
+        buffer[i] = (uint8_t) (state >> 24);
+    }
+
+    bool ok = true;
+    printf("{\n  \"benchmarks\": [");
+
+    static const uint32_t crc_sizes[] = { 64, 4096, 256u * 1024u, 16u * 1024u * 1024u };
+    char name[64];
+    for (unsigned int i = 0; ok && i < sizeof(crc_sizes) / sizeof(crc_sizes[0]); i++) {
+        crc32_context context = { buffer, crc_sizes[i], 0 };
+        snprintf(name, sizeof(name), "crc32_sw/%u", crc_sizes[i]);
+        ok = run(name, crc32_benchmark, &context, crc_sizes[i]);
+
+        // Unaligned buffers take the slower head/tail paths
+        context.buffer = buffer + 1;
+        context.size = crc_sizes[i] - 1;
+        snprintf(name, sizeof(name), "crc32_sw/%u/unaligned", crc_sizes[i] - 1);
+        ok = ok && run(name, crc32_benchmark, &context, crc_sizes[i] - 1);
+    }
+
+    // Addresses spread across every region of the memory map, as seen when classifying UF2 blocks
+    memory_type_context memory_types = { rp2350, { 0 }, 0 };
+    for (uint32_t i = 0; i < 1024; i++) {
+        memory_types.addresses[i] = ((uint32_t) buffer[i] << 24) | ((uint32_t) buffer[i + 1024] << 12);
+    }
+    ok = ok && run("get_memory_type/1024", memory_type_benchmark, &memory_types, 0);
+
+    ok = ok && run_transfer_benchmarks(rp2040, buffer);
+    ok = ok && run_transfer_benchmarks(rp2350, buffer);
+
+    printf("\n  ]\n}\n");
+    free(buffer);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+﻿#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "crc32_table.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CRC32_HAVE_CLMUL 1
+#include <immintrin.h>
+#include <wmmintrin.h>
+#if defined(__GNUC__)
+#include <cpuid.h>
+#define CRC32_TARGET_CLMUL __attribute__((target("pclmul,ssse3")))
+#else
+#define CRC32_TARGET_CLMUL
+#endif
+#elif defined(__aarch64__) && defined(__GNUC__)
+// (MSVC on ARM64 uses the table implementation since it lacks the ACLE bit reversal intrinsics.)
+#define CRC32_HAVE_ARMV8 1
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define CRC32_TARGET_ARMV8 __attribute__((target("+crc")))
+#endif
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static uint32_t crc32_slice8(const uint8_t *buf, size_t count, uint32_t crc) {
+    while (count >= 8) {
+        uint32_t w = crc ^ load_be32(buf);
+        crc = crc32_table[7][w >> 24] ^ crc32_table[6][(w >> 16) & 0xff] ^ crc32_table[5][(w >> 8) & 0xff] ^ crc32_table[4][w & 0xff]
+            ^ crc32_table[3][buf[4]] ^ crc32_table[2][buf[5]] ^ crc32_table[1][buf[6]] ^ crc32_table[0][buf[7]];
+        buf += 8;
+        count -= 8;
+    }
+    while (count--) {
+        crc = (crc << 8) ^ crc32_table[0][(crc >> 24) ^ *buf++];
+    }
+    return crc;
+}
+
+#if CRC32_HAVE_CLMUL
+// Folding as described in Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+// Blocks are byte swapped so that the first byte of the message is the most significant, which makes the non-reflected
+// polynomial arithmetic straightforward. Rather than doing a Barrett reduction at the end, the folded 128 bit remainder
+// (which is congruent to the message modulo the polynomial) is stored back out and run through the table.
+#define CRC32_FOLD_128_HI 0xc5b9cd4cu // x^192 mod P
+#define CRC32_FOLD_128_LO 0xe8a45605u // x^128 mod P
+#define CRC32_FOLD_512_HI 0x8833794cu // x^576 mod P
+#define CRC32_FOLD_512_LO 0xe6228b11u // x^512 mod P
+
+CRC32_TARGET_CLMUL static inline __m128i crc32_fold(__m128i x, __m128i k, __m128i next) {
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+CRC32_TARGET_CLMUL static uint32_t crc32_clmul(const uint8_t *buf, size_t count, uint32_t crc) {
+    if (count < 64) {
+        return crc32_slice8(buf, count, crc);
+    }
+
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k128 = _mm_set_epi64x(CRC32_FOLD_128_HI, CRC32_FOLD_128_LO);
+    const __m128i k512 = _mm_set_epi64x(CRC32_FOLD_512_HI, CRC32_FOLD_512_LO);
+
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 0)), swap);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 16)), swap);
+    __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 32)), swap);
+    __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 48)), swap);
+    // The initial CRC is equivalent to XORing it into the first four bytes of the message
+    x0 = _mm_xor_si128(x0, _mm_set_epi32((int) crc, 0, 0, 0));
+    buf += 64;
+    count -= 64;
+
+    while (count >= 64) {
+        x0 = crc32_fold(x0, k512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 0)), swap));
+        x1 = crc32_fold(x1, k512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 16)), swap));
+        x2 = crc32_fold(x2, k512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 32)), swap));
+        x3 = crc32_fold(x3, k512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 48)), swap));
+        buf += 64;
+        count -= 64;
+    }
+
+    x1 = crc32_fold(x0, k128, x1);
+    x2 = crc32_fold(x1, k128, x2);
+    x3 = crc32_fold(x2, k128, x3);
+
+    while (count >= 16) {
+        x3 = crc32_fold(x3, k128, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) buf), swap));
+        buf += 16;
+        count -= 16;
+    }
+
+    uint8_t remainder[16];
+    _mm_storeu_si128((__m128i *) remainder, _mm_shuffle_epi8(x3, swap));
+    crc = crc32_slice8(remainder, sizeof(remainder), 0);
+    return crc32_slice8(buf, count, crc);
+}
+
+static int crc32_cpu_has_clmul(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) && (info[2] & (1 << 9)); // PCLMULQDQ and SSSE3
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+#endif
+}
+#endif
+
+#if CRC32_HAVE_ARMV8
+// The ARMv8 CRC32 instructions only implement the reflected (LSB first) form of the polynomial. Reversing the bits of each
+// input byte and of the CRC register turns our MSB first CRC into exactly that, and rbit/rev are single cycle instructions.
+CRC32_TARGET_ARMV8 static uint32_t crc32_armv8(const uint8_t *buf, size_t count, uint32_t crc) {
+    crc = __rbit(crc);
+
+    while (count >= 8) {
+        uint64_t w;
+        memcpy(&w, buf, sizeof(w));
+        // rbit reverses the whole word, rev undoes the byte order part of that, leaving each byte bit reversed in place
+        crc = __crc32d(crc, __rbitll(__revll(w)));
+        buf += 8;
+        count -= 8;
+    }
+    while (count--) {
+        crc = __crc32b(crc, (uint8_t) (__rbit(*buf++) >> 24));
+    }
+
+    return __rbit(crc);
+}
+
+static int crc32_cpu_has_armv8(void) {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+    return 1; // Every Apple Silicon chip has the CRC extension
+#else
+    return 0;
+#endif
+}
+#endif
+
+typedef uint32_t (*crc32_impl_t)(const uint8_t *buf, size_t count, uint32_t crc);
+
+// Selection is idempotent, so racing threads at worst all perform it and store the same pointer
+static volatile crc32_impl_t crc32_impl = NULL;
+
+static crc32_impl_t crc32_select_impl(void) {
+#if CRC32_HAVE_CLMUL
+    if (crc32_cpu_has_clmul()) {
+        return crc32_clmul;
+    }
+#endif
+#if CRC32_HAVE_ARMV8
+    if (crc32_cpu_has_armv8()) {
+        return crc32_armv8;
+    }
+#endif
+    return crc32_slice8;
+}
+
+uint32_t crc32_sw(const uint8_t *buf, unsigned int count, uint32_t crc) {
+    crc32_impl_t impl = crc32_impl;
+    if (!impl) {
+        impl = crc32_select_impl();
+        crc32_impl = impl;
+    }
+    return impl(buf, count, crc);
+}
@@ -0,0 +1,21 @@
+﻿#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slice-by-8 tables, crc32_table[0] is the classic byte-at-a-time table
+extern const uint32_t crc32_table[8][256];
+
+// CRC-32 with polynomial 0x04c11db7, MSB first and no final XOR (start with 0xffffffff for the usual CRC-32/MPEG-2)
+// This is the same CRC as picotool's crc32_sw (and the RP2040's DMA sniffer in CRC32 mode.)
+// Safe to call from multiple threads, the fastest implementation supported by the CPU is selected on first use.
+uint32_t crc32_sw(const uint8_t *buf, unsigned int count, uint32_t crc);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,8 +8,12 @@
 #include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "picoboot_connection.h"
+#include "picoboot_emulator.h"
+#include "picoboot_time.h"
+#include "crc32.h"
 #include "boot/bootrom_constants.h"
 #include "pico/stdio_usb/reset_interface.h"
 
@@ -21,50 +25,104 @@
 #endif
 
 static bool verbose = 1;
-static bool definitely_exclusive;
-static enum {
+
+enum picoboot_xip_state {
     XIP_UNKOWN,
     XIP_ACTIVE,
     XIP_INACTIVE,
-} xip_state;
+};
 
-// todo test sparse binary (well actually two range is this)
+// All per-device state lives here rather than in globals so that multiple devices can be driven concurrently from separate threads
+struct picoboot_connection {
+    libusb_device_handle *usb_device;
+    unsigned int interface;
+    unsigned int out_ep;
+    unsigned int in_ep;
+    int token;
+    bool definitely_exclusive;
+    enum picoboot_xip_state xip_state;
+    int one_time_bulk_timeout;
+    struct picoboot_write_stream *write_stream;
+    uint8_t last_cmd_id;
+    picoboot_cmd_stats stats[PICOBOOT_STATS_COMMAND_COUNT];
+    // Non-NULL for connections opened with picoboot_open_emulated_device, in which case usb_device is NULL
+    picoboot_emulator *emulator;
+};
+
+// All USB traffic goes through these so that emulated connections can be routed to their emulator instead of libusb
+static int picoboot_bulk_transfer(picoboot_connection *connection, unsigned char endpoint, uint8_t *data, int length, int *transferred, unsigned int timeout) {
+    if (connection->emulator) {
+        return picoboot_emulator_bulk_transfer(connection->emulator, endpoint, data, length, transferred, timeout);
+    }
+    return libusb_bulk_transfer(connection->usb_device, endpoint, data, length, transferred, timeout);
+}
+
+static int picoboot_control_transfer(picoboot_connection *connection, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                                     uint8_t *data, uint16_t length, unsigned int timeout) {
+    if (connection->emulator) {
+        return picoboot_emulator_control_transfer(connection->emulator, request_type, request, value, index, data, length, timeout);
+    }
+    return libusb_control_transfer(connection->usb_device, request_type, request, value, index, data, length, timeout);
+}
 
-uint32_t crc32_for_byte(uint32_t remainder) {
-    const uint32_t POLYNOMIAL = 0x4C11DB7;
-    remainder <<= 24u;
-    for (unsigned int bit = 8; bit > 0; bit--) {
-        if (remainder & 0x80000000)
-            remainder = (remainder << 1) ^ POLYNOMIAL;
-        else
-            remainder = (remainder << 1);
+static int picoboot_clear_halt(picoboot_connection *connection, unsigned char endpoint) {
+    if (connection->emulator) {
+        return picoboot_emulator_clear_halt(connection->emulator, endpoint);
     }
-    return remainder;
+    return libusb_clear_halt(connection->usb_device, endpoint);
 }
 
-uint32_t crc32_sw(const uint8_t *buf, unsigned int count, uint32_t crc) {
-    static uint32_t table[0x100];
-    if (!table[1]) {
-        for (unsigned int i = 0; i < count_of(table); i++) {
-            table[i] = crc32_for_byte(i);
+static void picoboot_record_stats(picoboot_connection *connection, uint8_t cmd_id, uint32_t bytes, uint64_t start_us, int ret) {
+    unsigned int index = cmd_id & 0x7fu;
+    if (index >= PICOBOOT_STATS_COMMAND_COUNT) {
+        return;
+    }
+
+    picoboot_cmd_stats *stats = &connection->stats[index];
+    uint64_t elapsed_us = picoboot_time_us() - start_us;
+    stats->calls++;
+    stats->total_us += elapsed_us;
+    if (elapsed_us > stats->max_us) {
+        stats->max_us = elapsed_us;
+    }
+
+    unsigned int bucket = 0;
+    while (bucket < PICOBOOT_STATS_HISTOGRAM_BUCKETS - 1 && elapsed_us >= ((uint64_t) PICOBOOT_STATS_HISTOGRAM_BASE_US << bucket)) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+
+    if (ret) {
+        stats->failures++;
+        if (ret == LIBUSB_ERROR_TIMEOUT) {
+            stats->timeouts++;
         }
+    } else {
+        stats->bytes += bytes;
     }
-    for (unsigned int i = 0; i < count; ++i) {
-        crc = (crc << 8u) ^ table[(uint8_t) ((crc >> 24u) ^ buf[i])];
+}
+
+unsigned int picoboot_get_stats(picoboot_connection *connection, picoboot_cmd_stats *stats, unsigned int count) {
+    if (count > PICOBOOT_STATS_COMMAND_COUNT) {
+        count = PICOBOOT_STATS_COMMAND_COUNT;
     }
-    return crc;
+    memcpy(stats, connection->stats, count * sizeof(picoboot_cmd_stats));
+    return PICOBOOT_STATS_COMMAND_COUNT;
+}
+
+void picoboot_reset_stats(picoboot_connection *connection) {
+    memset(connection->stats, 0, sizeof(connection->stats));
 }
 
-unsigned int interface;
-unsigned int out_ep;
-unsigned int in_ep;
+// todo test sparse binary (well actually two range is this)
 
-enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_device_handle **dev_handle, model_t *model, int vid, int pid, const char* ser) {
+enum picoboot_device_result picoboot_open_device(libusb_device *device, picoboot_connection **connection, model_t *model, int vid, int pid, const char* ser) {
     struct libusb_device_descriptor desc;
     struct libusb_config_descriptor *config;
+    libusb_device_handle *dev_handle = NULL;
+    picoboot_connection *conn = NULL;
 
-    definitely_exclusive = false;
-    *dev_handle = NULL;
+    *connection = NULL;
     *model = unknown;
     int ret = libusb_get_device_descriptor(device, &desc);
     enum picoboot_device_result res = dr_vidpid_unknown;
@@ -112,10 +170,22 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
     }
 
     if (!ret) {
-        ret  = libusb_open(device, dev_handle);
+        ret  = libusb_open(device, &dev_handle);
         if (ret && verbose) {
             output("Failed to open device %d\n", ret);
         }
+        if (!ret) {
+            // The caller owns the connection from here on, even if we end up rejecting the device below
+            conn = calloc(1, sizeof(picoboot_connection));
+            if (!conn) {
+                libusb_close(dev_handle);
+                return dr_error;
+            }
+            conn->usb_device = dev_handle;
+            conn->token = 1;
+            conn->xip_state = XIP_UNKOWN;
+            *connection = conn;
+        }
         if (ret) {
             if (vid == 0 || strlen(ser) != 0) {
                 // didn't check vid or ser, so treat as unknown
@@ -132,7 +202,7 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
         if (strlen(ser) != 0) {
             // Check USB serial number
             char ser_str[128];
-            libusb_get_string_descriptor_ascii(*dev_handle, desc.iSerialNumber, (unsigned char*)ser_str, sizeof(ser_str));
+            libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, (unsigned char*)ser_str, sizeof(ser_str));
             if (strcmp(ser, ser_str)) {
                 return dr_vidpid_unknown;
             } else {
@@ -156,18 +226,18 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
 
     if (!ret) {
         if (config->bNumInterfaces == 1) {
-            interface = 0;
+            conn->interface = 0;
         } else {
-            interface = 1;
+            conn->interface = 1;
         }
-        if (config->interface[interface].altsetting[0].bInterfaceClass == 0xff &&
-            config->interface[interface].altsetting[0].bNumEndpoints == 2) {
-            out_ep = config->interface[interface].altsetting[0].endpoint[0].bEndpointAddress;
-            in_ep = config->interface[interface].altsetting[0].endpoint[1].bEndpointAddress;
+        if (config->interface[conn->interface].altsetting[0].bInterfaceClass == 0xff &&
+            config->interface[conn->interface].altsetting[0].bNumEndpoints == 2) {
+            conn->out_ep = config->interface[conn->interface].altsetting[0].endpoint[0].bEndpointAddress;
+            conn->in_ep = config->interface[conn->interface].altsetting[0].endpoint[1].bEndpointAddress;
         }
-        if (out_ep && in_ep && !(out_ep & 0x80u) && (in_ep & 0x80u)) {
+        if (conn->out_ep && conn->in_ep && !(conn->out_ep & 0x80u) && (conn->in_ep & 0x80u)) {
             if (verbose) output("Found PICOBOOT interface\n");
-            ret = libusb_claim_interface(*dev_handle, interface);
+            ret = libusb_claim_interface(dev_handle, conn->interface);
             if (ret) {
                 if (verbose) output("Failed to claim interface\n");
                 return dr_vidpid_bootrom_no_interface;
@@ -185,7 +255,7 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
             info_cmd.dParams[0] = (uint32_t) (SYS_INFO_CHIP_INFO);
             uint32_t word_buf[64];
             // RP2040 doesn't have this function, so returns non-zero
-            int info_ret = picoboot_get_info(*dev_handle, &info_cmd, (uint8_t*)word_buf, sizeof(word_buf));
+            int info_ret = picoboot_get_info(conn, &info_cmd, (uint8_t*)word_buf, sizeof(word_buf));
             if (info_ret) {
                 *model = rp2040;
             } else {
@@ -197,7 +267,7 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
                 // Check flash ID, as USB serial number is not unique
                 uint64_t ser_num = strtoull(ser, NULL, 16);
                 uint64_t id = 0;
-                int id_ret = picoboot_flash_id(*dev_handle, &id);
+                int id_ret = picoboot_flash_id(conn, &id);
                 if (verbose) output("Flash ID %"PRIX64"\n", id);
                 if (id_ret || (ser_num != id)) {
                     return dr_vidpid_unknown;
@@ -205,7 +275,7 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
             } else {
                 // Check USB serial number
                 char ser_str[128];
-                libusb_get_string_descriptor_ascii(*dev_handle, desc.iSerialNumber, (unsigned char*)ser_str, sizeof(ser_str));
+                libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, (unsigned char*)ser_str, sizeof(ser_str));
                 if (strcmp(ser, ser_str)) {
                     return dr_vidpid_unknown;
                 }
@@ -216,19 +286,58 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
 
     assert(ret);
 
-    if (*dev_handle) {
-        libusb_close(*dev_handle);
-        *dev_handle = NULL;
+    if (*connection) {
+        picoboot_close_device(*connection);
+        *connection = NULL;
     }
 
     return dr_error;
 }
 
-static bool is_halted(libusb_device_handle *usb_device, int ep) {
+enum picoboot_device_result picoboot_open_emulated_device(picoboot_emulator *emulator, picoboot_connection **connection, model_t *model) {
+    *connection = NULL;
+    int ret = picoboot_emulator_attach(emulator, model);
+    if (ret) {
+        if (verbose) output("Emulated device is already in use\n");
+        return dr_vidpid_bootrom_cant_connect;
+    }
+
+    picoboot_connection *conn = (picoboot_connection *) calloc(1, sizeof(*conn));
+    if (!conn) {
+        picoboot_emulator_detach(emulator);
+        return dr_error;
+    }
+
+    conn->emulator = emulator;
+    conn->interface = PICOBOOT_EMULATOR_INTERFACE;
+    conn->out_ep = PICOBOOT_EMULATOR_OUT_EP;
+    conn->in_ep = PICOBOOT_EMULATOR_IN_EP;
+    conn->token = 1;
+    conn->xip_state = XIP_UNKOWN;
+    *connection = conn;
+    if (verbose) output("Found emulated PICOBOOT interface\n");
+    return dr_vidpid_bootrom_ok;
+}
+
+void picoboot_close_device(picoboot_connection *connection) {
+    if (!connection) {
+        return;
+    }
+    picoboot_write_stream_close(connection);
+    if (connection->usb_device) {
+        libusb_close(connection->usb_device);
+    }
+    if (connection->emulator) {
+        picoboot_emulator_detach(connection->emulator);
+    }
+    free(connection);
+}
+
+static bool is_halted(picoboot_connection *connection, int ep) {
     uint8_t data[2];
 
-    int transferred = libusb_control_transfer(
-            usb_device,
+    int transferred = picoboot_control_transfer(
+            connection,
             /*LIBUSB_REQUEST_TYPE_STANDARD | */LIBUSB_RECIPIENT_ENDPOINT | LIBUSB_ENDPOINT_IN,
             LIBUSB_REQUEST_GET_STATUS,
             0, ep,
@@ -246,34 +355,40 @@ static bool is_halted(libusb_device_handle *usb_device, int ep) {
     return false;
 }
 
-int picoboot_reset(libusb_device_handle *usb_device) {
+int picoboot_reset(picoboot_connection *connection) {
     if (verbose) output("RESET\n");
-    if (is_halted(usb_device, in_ep))
-        libusb_clear_halt(usb_device, in_ep);
-    if (is_halted(usb_device, out_ep))
-        libusb_clear_halt(usb_device, out_ep);
+    // Halts are attributed to the last command sent, which is almost certainly the one which failed
+    picoboot_cmd_stats *stats = (connection->last_cmd_id & 0x7fu) < PICOBOOT_STATS_COMMAND_COUNT ? &connection->stats[connection->last_cmd_id & 0x7fu] : NULL;
+    if (is_halted(connection, connection->in_ep)) {
+        if (stats) stats->halts++;
+        picoboot_clear_halt(connection, connection->in_ep);
+    }
+    if (is_halted(connection, connection->out_ep)) {
+        if (stats) stats->halts++;
+        picoboot_clear_halt(connection, connection->out_ep);
+    }
     int ret =
-            libusb_control_transfer(usb_device, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE,
-                                    PICOBOOT_IF_RESET, 0, interface, NULL, 0, 1000);
+            picoboot_control_transfer(connection, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE,
+                                      PICOBOOT_IF_RESET, 0, connection->interface, NULL, 0, 1000);
 
     if (ret != 0) {
         output("  ...failed\n");
         return ret;
     }
     if (verbose) output("  ...ok\n");
-    definitely_exclusive = false;
+    connection->definitely_exclusive = false;
     return 0;
 }
 
-int picoboot_cmd_status_verbose(libusb_device_handle *usb_device, struct picoboot_cmd_status *status, bool local_verbose) {
+int picoboot_cmd_status_verbose(picoboot_connection *connection, struct picoboot_cmd_status *status, bool local_verbose) {
     struct picoboot_cmd_status s;
     if (!status) status = &s;
 
     if (local_verbose) output("CMD_STATUS\n");
     int ret =
-            libusb_control_transfer(usb_device,
-                                    LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN,
-                                    PICOBOOT_IF_CMD_STATUS, 0, interface, (uint8_t *) status, sizeof(*status), 1000);
+            picoboot_control_transfer(connection,
+                                      LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN,
+                                      PICOBOOT_IF_CMD_STATUS, 0, connection->interface, (uint8_t *) status, sizeof(*status), 1000);
 
     if (ret != sizeof(*status)) {
         output("  ...failed\n");
@@ -285,41 +400,58 @@ int picoboot_cmd_status_verbose(libusb_device_handle *usb_device, struct picoboo
     return 0;
 }
 
-int picoboot_cmd_status(libusb_device_handle *usb_device, struct picoboot_cmd_status *status) {
-    return picoboot_cmd_status_verbose(usb_device, status, verbose);
+int picoboot_cmd_status(picoboot_connection *connection, struct picoboot_cmd_status *status) {
+    return picoboot_cmd_status_verbose(connection, status, verbose);
 }
 
-int one_time_bulk_timeout;
+static int picoboot_cmd_transfer(picoboot_connection *connection, struct picoboot_cmd *cmd, uint8_t *buffer, unsigned int buf_size);
+
+int picoboot_cmd(picoboot_connection *connection, struct picoboot_cmd *cmd, uint8_t *buffer, unsigned int buf_size) {
+    int ret;
+
+    // Streamed writes must be fully acknowledged before anything else goes over the wire
+    if (connection->write_stream) {
+        ret = picoboot_write_stream_flush(connection);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    connection->last_cmd_id = cmd->bCmdId;
+    uint64_t start_us = picoboot_time_us();
+    ret = picoboot_cmd_transfer(connection, cmd, buffer, buf_size);
+    picoboot_record_stats(connection, cmd->bCmdId, cmd->dTransferLength, start_us, ret);
+    return ret;
+}
 
-int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uint8_t *buffer, unsigned int buf_size) {
+static int picoboot_cmd_transfer(picoboot_connection *connection, struct picoboot_cmd *cmd, uint8_t *buffer, unsigned int buf_size) {
     int sent = 0;
     int ret;
 
-    static int token = 1;
     cmd->dMagic = PICOBOOT_MAGIC;
-    cmd->dToken = token++;
-    ret = libusb_bulk_transfer(usb_device, out_ep, (uint8_t *) cmd, sizeof(struct picoboot_cmd), &sent, 3000);
+    cmd->dToken = connection->token++;
+    ret = picoboot_bulk_transfer(connection, connection->out_ep, (uint8_t *) cmd, sizeof(struct picoboot_cmd), &sent, 3000);
 
     if (ret != 0 || sent != sizeof(struct picoboot_cmd)) {
         output("   ...failed to send command %d\n", ret);
         return ret;
     }
 
-    int saved_xip_state = xip_state;
-    bool saved_exclusive = definitely_exclusive;
-    xip_state = XIP_UNKOWN;
-    definitely_exclusive = false;
+    int saved_xip_state = connection->xip_state;
+    bool saved_exclusive = connection->definitely_exclusive;
+    connection->xip_state = XIP_UNKOWN;
+    connection->definitely_exclusive = false;
     int timeout = 10000;
-    if (one_time_bulk_timeout) {
-        timeout = one_time_bulk_timeout;
-        one_time_bulk_timeout = 0;
+    if (connection->one_time_bulk_timeout) {
+        timeout = connection->one_time_bulk_timeout;
+        connection->one_time_bulk_timeout = 0;
     }
     if (cmd->dTransferLength != 0) {
         assert(buf_size >= cmd->dTransferLength);
         if (cmd->bCmdId & 0x80u) {
             if (verbose) output("  receive %d...\n", cmd->dTransferLength);
             int received = 0;
-            ret = libusb_bulk_transfer(usb_device, in_ep, buffer, cmd->dTransferLength, &received, timeout);
+            ret = picoboot_bulk_transfer(connection, connection->in_ep, buffer, cmd->dTransferLength, &received, timeout);
             if (ret != 0 || received != (int) cmd->dTransferLength) {
                 output("  ...failed to receive data %d %d/%d\n", ret, received, cmd->dTransferLength);
                 if (!ret) ret = 1;
@@ -327,11 +459,11 @@ int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uin
             }
         } else {
             if (verbose) output("  send %d...\n", cmd->dTransferLength);
-            ret = libusb_bulk_transfer(usb_device, out_ep, buffer, cmd->dTransferLength, &sent, timeout);
+            ret = picoboot_bulk_transfer(connection, connection->out_ep, buffer, cmd->dTransferLength, &sent, timeout);
             if (ret != 0 || sent != (int) cmd->dTransferLength) {
                 output("  ...failed to send data %d %d/%d\n", ret, sent, cmd->dTransferLength);
                 if (!ret) ret = 1;
-                picoboot_cmd_status_verbose(usb_device, NULL, true);
+                picoboot_cmd_status_verbose(connection, NULL, true);
                 return ret;
             }
         }
@@ -342,43 +474,46 @@ int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uin
     uint8_t spoon[64];
     if (cmd->bCmdId & 0x80u) {
         if (verbose) output("zero length out\n");
-        ret = libusb_bulk_transfer(usb_device, out_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
+        ret = picoboot_bulk_transfer(connection, connection->out_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
     } else {
         if (verbose) output("zero length in\n");
-        ret = libusb_bulk_transfer(usb_device, in_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
+        ret = picoboot_bulk_transfer(connection, connection->in_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
     }
     if (!ret) {
         // do our defensive best to keep the xip_state up to date
         switch (cmd->bCmdId) {
             case PC_EXIT_XIP:
-                xip_state = XIP_INACTIVE;
+                connection->xip_state = XIP_INACTIVE;
                 break;
             case PC_ENTER_CMD_XIP:
-                xip_state = XIP_ACTIVE;
+                connection->xip_state = XIP_ACTIVE;
                 break;
             case PC_READ:
             case PC_WRITE:
                 // whitelist PC_READ and PC_WRITE as not affecting xip state
-                xip_state = saved_xip_state;
+                connection->xip_state = saved_xip_state;
                 break;
             default:
-                xip_state = XIP_UNKOWN;
+                connection->xip_state = XIP_UNKOWN;
                 break;
         }
         // do our defensive best to keep the exclusive var up to date
         switch (cmd->bCmdId) {
             case PC_EXCLUSIVE_ACCESS:
-                definitely_exclusive = cmd->exclusive_cmd.bExclusive;
+                connection->definitely_exclusive = cmd->exclusive_cmd.bExclusive;
                 break;
             case PC_ENTER_CMD_XIP:
             case PC_EXIT_XIP:
             case PC_READ:
             case PC_WRITE:
-                // whitelist PC_READ and PC_WRITE as not affecting xip state
-                definitely_exclusive = saved_exclusive;
+            case PC_FLASH_ERASE:
+            case PC_EXEC:
+                // whitelist commands which don't touch the bootrom's exclusivity state
+                // (PC_EXEC is only ever used with our own stubs, none of which touch it)
+                connection->definitely_exclusive = saved_exclusive;
                 break;
             default:
-                definitely_exclusive = false;
+                connection->definitely_exclusive = false;
                 break;
         }
     }
@@ -386,18 +521,18 @@ int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uin
     return ret;
 }
 
-int picoboot_exclusive_access(libusb_device_handle *usb_device, uint8_t exclusive) {
+int picoboot_exclusive_access(picoboot_connection *connection, uint8_t exclusive) {
     if (verbose) output("EXCLUSIVE ACCESS %d\n", exclusive);
     struct picoboot_cmd cmd;
     cmd.bCmdId = PC_EXCLUSIVE_ACCESS;
     cmd.exclusive_cmd.bExclusive = exclusive;
     cmd.bCmdSize = sizeof(struct picoboot_exclusive_cmd);
     cmd.dTransferLength = 0;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_exit_xip(libusb_device_handle *usb_device) {
-    if (definitely_exclusive && xip_state == XIP_INACTIVE) {
+int picoboot_exit_xip(picoboot_connection *connection) {
+    if (connection->definitely_exclusive && connection->xip_state == XIP_INACTIVE) {
         if (verbose) output("Skipping EXIT_XIP");
         return 0;
     }
@@ -406,21 +541,21 @@ int picoboot_exit_xip(libusb_device_handle *usb_device) {
     cmd.bCmdId = PC_EXIT_XIP;
     cmd.bCmdSize = 0;
     cmd.dTransferLength = 0;
-    xip_state = XIP_INACTIVE;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    connection->xip_state = XIP_INACTIVE;
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_enter_cmd_xip(libusb_device_handle *usb_device) {
+int picoboot_enter_cmd_xip(picoboot_connection *connection) {
     struct picoboot_cmd cmd;
     if (verbose) output("ENTER_CMD_XIP\n");
     cmd.bCmdId = PC_ENTER_CMD_XIP;
     cmd.bCmdSize = 0;
     cmd.dTransferLength = 0;
-    xip_state = XIP_ACTIVE;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    connection->xip_state = XIP_ACTIVE;
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_reboot(libusb_device_handle *usb_device, uint32_t pc, uint32_t sp, uint32_t delay_ms) {
+int picoboot_reboot(picoboot_connection *connection, uint32_t pc, uint32_t sp, uint32_t delay_ms) {
     struct picoboot_cmd cmd;
     if (verbose) output("REBOOT %08x %08x %u\n", (unsigned int) pc, (unsigned int) sp, (unsigned int) delay_ms);
     cmd.bCmdId = PC_REBOOT;
@@ -429,20 +564,20 @@ int picoboot_reboot(libusb_device_handle *usb_device, uint32_t pc, uint32_t sp,
     cmd.reboot_cmd.dPC = pc;
     cmd.reboot_cmd.dSP = sp;
     cmd.reboot_cmd.dDelayMS = delay_ms;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_reboot2(libusb_device_handle *usb_device, struct picoboot_reboot2_cmd *reboot_cmd) {
+int picoboot_reboot2(picoboot_connection *connection, struct picoboot_reboot2_cmd *reboot_cmd) {
     struct picoboot_cmd cmd;
     if (verbose) output("REBOOT %08x %08x %08x %u\n", (unsigned int)reboot_cmd->dFlags, (unsigned int) reboot_cmd->dParam0, (unsigned int) reboot_cmd->dParam1, (unsigned int) reboot_cmd->dDelayMS);
     cmd.bCmdId = PC_REBOOT2;
     cmd.bCmdSize = sizeof(cmd.reboot2_cmd);
     cmd.reboot2_cmd = *reboot_cmd;
     cmd.dTransferLength = 0;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_exec(libusb_device_handle *usb_device, uint32_t addr) {
+int picoboot_exec(picoboot_connection *connection, uint32_t addr) {
     struct picoboot_cmd cmd;
     // shouldn't be necessary any more
     // addr |= 1u; // Thumb bit
@@ -451,10 +586,10 @@ int picoboot_exec(libusb_device_handle *usb_device, uint32_t addr) {
     cmd.bCmdSize = sizeof(cmd.address_only_cmd);
     cmd.dTransferLength = 0;
     cmd.address_only_cmd.dAddr = addr;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-// int picoboot_exec2(libusb_device_handle *usb_device, struct picoboot_exec2_cmd *exec2_cmd) {
+// int picoboot_exec2(picoboot_connection *connection, struct picoboot_exec2_cmd *exec2_cmd) {
 //     struct picoboot_cmd cmd;
 //     // shouldn't be necessary any more
 //     // addr |= 1u; // Thumb bit
@@ -463,11 +598,11 @@ int picoboot_exec(libusb_device_handle *usb_device, uint32_t addr) {
 //     cmd.bCmdSize = sizeof(cmd.exec2_cmd);
 //     cmd.dTransferLength = 0;
 //     cmd.exec2_cmd = *exec2_cmd;
-//     return picoboot_cmd(usb_device, &cmd, NULL, 0);
+//     return picoboot_cmd(connection, &cmd, NULL, 0);
 // } // currently unused
 
 
-int picoboot_flash_erase(libusb_device_handle *usb_device, uint32_t addr, uint32_t len) {
+int picoboot_flash_erase(picoboot_connection *connection, uint32_t addr, uint32_t len) {
     struct picoboot_cmd cmd;
     if (verbose) output("FLASH_ERASE %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
     cmd.bCmdId = PC_FLASH_ERASE;
@@ -475,30 +610,341 @@ int picoboot_flash_erase(libusb_device_handle *usb_device, uint32_t addr, uint32
     cmd.range_cmd.dAddr = addr;
     cmd.range_cmd.dSize = len;
     cmd.dTransferLength = 0;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_vector(libusb_device_handle *usb_device, uint32_t addr) {
+int picoboot_vector(picoboot_connection *connection, uint32_t addr) {
     struct picoboot_cmd cmd;
     if (verbose) output("VECTOR %08x\n", (unsigned int) addr);
     cmd.bCmdId = PC_VECTORIZE_FLASH;
     cmd.bCmdSize = sizeof(cmd.address_only_cmd);
     cmd.range_cmd.dAddr = addr;
     cmd.dTransferLength = 0;
-    return picoboot_cmd(usb_device, &cmd, NULL, 0);
+    return picoboot_cmd(connection, &cmd, NULL, 0);
 }
 
-int picoboot_write(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len) {
+int picoboot_write(picoboot_connection *connection, uint32_t addr, uint8_t *buffer, uint32_t len) {
     struct picoboot_cmd cmd;
     if (verbose) output("WRITE %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
     cmd.bCmdId = PC_WRITE;
     cmd.bCmdSize = sizeof(cmd.range_cmd);
     cmd.range_cmd.dAddr = addr;
     cmd.range_cmd.dSize = cmd.dTransferLength = len;
-    return picoboot_cmd(usb_device, &cmd, buffer, len);
+    return picoboot_cmd(connection, &cmd, buffer, len);
+}
+
+// Pipelined writes
+//
+// A synchronous PC_WRITE is three back-to-back transfers (command, data, zero length ack) and the host sits idle for a full
+// round trip after each one. Here we submit all three transfers for up to `depth` writes at once so that the next command
+// and its data are already queued on the OUT endpoint while the device is still programming the previous page.
+// The host controller completes transfers on each endpoint in submission order, so the device sees exactly the same
+// sequence of packets as it would from picoboot_write.
+#define PICOBOOT_WRITE_STREAM_MAX_DEPTH 8
+
+enum picoboot_write_stream_transfer {
+    WST_COMMAND,
+    WST_DATA,
+    WST_ACK,
+    WST_COUNT,
+};
+
+struct picoboot_write_stream_slot {
+    struct picoboot_write_stream *stream;
+    struct picoboot_cmd cmd;
+    uint64_t submit_us;
+    uint8_t *data;
+    uint8_t ack[64];
+    struct libusb_transfer *transfers[WST_COUNT];
+    // Completion callbacks may run on any thread handling events for the context, so everything they touch is atomic
+    atomic_int status;
+    // Set to WST_COUNT before anything is submitted, whoever brings it to zero retires the slot
+    atomic_int in_flight;
+    // Used as the completion flag for libusb_handle_events_timeout_completed, non-zero when nothing is in flight
+    atomic_int idle;
+};
+
+// libusb (and the emulator) are handed a plain int pointer to idle
+_Static_assert(sizeof(atomic_int) == sizeof(int) && ATOMIC_INT_LOCK_FREE == 2, "atomic_int must be a lock-free int");
+
+struct picoboot_write_stream {
+    picoboot_connection *connection;
+    libusb_context *context;
+    unsigned int depth;
+    uint32_t max_transfer_size;
+    unsigned int next_slot;
+    atomic_int error;
+    struct picoboot_write_stream_slot slots[PICOBOOT_WRITE_STREAM_MAX_DEPTH];
+};
+
+static int picoboot_transfer_status_to_error(enum libusb_transfer_status status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_CANCELLED:
+        case LIBUSB_TRANSFER_ERROR:
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+// Only the first failure is kept, anything after it is most likely fallout from our cancellations
+static void picoboot_write_stream_set_error(atomic_int *error, int ret) {
+    int expected = 0;
+    atomic_compare_exchange_strong(error, &expected, ret);
 }
 
-int picoboot_read(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len) {
+// Called for transfers which completed or were never submitted, the last of a slot's transfers retires it
+static void picoboot_write_stream_release(struct picoboot_write_stream_slot *slot, int count) {
+    if (atomic_fetch_sub(&slot->in_flight, count) == count) {
+        // Latency is measured from submission, so it includes time spent queued behind earlier writes
+        picoboot_record_stats(slot->stream->connection, slot->cmd.bCmdId, slot->cmd.dTransferLength, slot->submit_us, atomic_load(&slot->status));
+        atomic_store(&slot->idle, 1);
+    }
+}
+
+static void LIBUSB_CALL picoboot_write_stream_callback(struct libusb_transfer *transfer) {
+    struct picoboot_write_stream_slot *slot = (struct picoboot_write_stream_slot *) transfer->user_data;
+    struct picoboot_write_stream *stream = slot->stream;
+
+    int ret = picoboot_transfer_status_to_error(transfer->status);
+    // Short command/data packets are failures just like in picoboot_cmd (the ack is expected to be short)
+    if (!ret && transfer != slot->transfers[WST_ACK] && transfer->actual_length != transfer->length) {
+        ret = LIBUSB_ERROR_IO;
+    }
+
+    if (ret) {
+        output("  ...streamed write to %08x failed %d\n", (unsigned int) slot->cmd.range_cmd.dAddr, ret);
+        picoboot_write_stream_set_error(&stream->error, ret);
+        picoboot_write_stream_set_error(&slot->status, ret);
+    }
+
+    picoboot_write_stream_release(slot, 1);
+}
+
+static int picoboot_write_stream_wait_slot(struct picoboot_write_stream *stream, struct picoboot_write_stream_slot *slot) {
+    while (!atomic_load(&slot->idle)) {
+        // Transfers have their own timeouts so this will always terminate, the timeout here only bounds how long we wait
+        // on another thread which happens to be handling events for the same context
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        int ret = stream->connection->emulator
+                ? picoboot_emulator_handle_events(stream->connection->emulator, &tv, (int *) &slot->idle)
+                : libusb_handle_events_timeout_completed(stream->context, &tv, (int *) &slot->idle);
+        if (ret && ret != LIBUSB_ERROR_INTERRUPTED) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// Cancels everything still in flight and waits for the cancellations to land
+static void picoboot_write_stream_abort(struct picoboot_write_stream *stream) {
+    for (unsigned int i = 0; i < stream->depth; i++) {
+        struct picoboot_write_stream_slot *slot = &stream->slots[i];
+        if (atomic_load(&slot->idle)) {
+            continue;
+        }
+        for (int j = 0; j < WST_COUNT; j++) {
+            // Fails harmlessly with LIBUSB_ERROR_NOT_FOUND for transfers which already completed or were never submitted
+            if (stream->connection->emulator) {
+                picoboot_emulator_cancel_transfer(stream->connection->emulator, slot->transfers[j]);
+            } else {
+                libusb_cancel_transfer(slot->transfers[j]);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < stream->depth; i++) {
+        if (picoboot_write_stream_wait_slot(stream, &stream->slots[i])) {
+            // Event handling itself is broken, there's nothing sensible left to do but to leak the slot
+            output("  ...failed to wait for cancelled streamed write\n");
+        }
+    }
+}
+
+int picoboot_write_stream_open(picoboot_connection *connection, libusb_context *context, unsigned int depth, uint32_t max_transfer_size) {
+    if (connection->write_stream) {
+        return LIBUSB_ERROR_BUSY;
+    }
+    if (depth == 0 || depth > PICOBOOT_WRITE_STREAM_MAX_DEPTH || max_transfer_size == 0) {
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    struct picoboot_write_stream *stream = (struct picoboot_write_stream *) calloc(1, sizeof(*stream));
+    if (!stream) {
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    stream->connection = connection;
+    stream->context = context;
+    stream->depth = depth;
+    stream->max_transfer_size = max_transfer_size;
+    atomic_init(&stream->error, 0);
+
+    for (unsigned int i = 0; i < depth; i++) {
+        stream->slots[i].stream = stream;
+        atomic_init(&stream->slots[i].status, 0);
+        atomic_init(&stream->slots[i].in_flight, 0);
+        atomic_init(&stream->slots[i].idle, 1);
+    }
+
+    for (unsigned int i = 0; i < depth; i++) {
+        struct picoboot_write_stream_slot *slot = &stream->slots[i];
+        slot->data = (uint8_t *) malloc(max_transfer_size);
+        for (int j = 0; j < WST_COUNT; j++) {
+            slot->transfers[j] = libusb_alloc_transfer(0);
+        }
+
+        if (!slot->data || !slot->transfers[WST_COMMAND] || !slot->transfers[WST_DATA] || !slot->transfers[WST_ACK]) {
+            // Nothing has been submitted yet so close can clean up whatever was allocated
+            connection->write_stream = stream;
+            picoboot_write_stream_close(connection);
+            return LIBUSB_ERROR_NO_MEM;
+        }
+
+        libusb_fill_bulk_transfer(slot->transfers[WST_COMMAND], connection->usb_device, connection->out_ep,
+                                  (uint8_t *) &slot->cmd, sizeof(struct picoboot_cmd), picoboot_write_stream_callback, slot, 3000);
+        libusb_fill_bulk_transfer(slot->transfers[WST_DATA], connection->usb_device, connection->out_ep,
+                                  slot->data, 0, picoboot_write_stream_callback, slot, 10000);
+        // ack is in the opposite direction, see picoboot_cmd
+        libusb_fill_bulk_transfer(slot->transfers[WST_ACK], connection->usb_device, connection->in_ep,
+                                  slot->ack, 1, picoboot_write_stream_callback, slot, 3000);
+    }
+
+    connection->write_stream = stream;
+    return 0;
+}
+
+int picoboot_write_stream_write(picoboot_connection *connection, uint32_t addr, const uint8_t *buffer, uint32_t len) {
+    struct picoboot_write_stream *stream = connection->write_stream;
+    if (!stream) {
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+    if (len == 0 || len > stream->max_transfer_size) {
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    // Report failures of earlier writes as soon as we know about them rather than piling more writes on a stalled endpoint
+    if (atomic_load(&stream->error)) {
+        return picoboot_write_stream_flush(connection);
+    }
+
+    // Slots are used round-robin, so the next slot is always the oldest write
+    struct picoboot_write_stream_slot *slot = &stream->slots[stream->next_slot];
+    int ret = picoboot_write_stream_wait_slot(stream, slot);
+    if (ret) {
+        picoboot_write_stream_set_error(&stream->error, ret);
+    }
+    if (atomic_load(&stream->error)) {
+        return picoboot_write_stream_flush(connection);
+    }
+    stream->next_slot = (stream->next_slot + 1) % stream->depth;
+
+    if (verbose) output("WRITE (streamed) %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
+    memset(&slot->cmd, 0, sizeof(slot->cmd));
+    slot->cmd.dMagic = PICOBOOT_MAGIC;
+    slot->cmd.dToken = connection->token++;
+    slot->cmd.bCmdId = PC_WRITE;
+    slot->cmd.bCmdSize = sizeof(slot->cmd.range_cmd);
+    slot->cmd.range_cmd.dAddr = addr;
+    slot->cmd.range_cmd.dSize = slot->cmd.dTransferLength = len;
+    // The caller's buffer is only borrowed for the duration of the call
+    memcpy(slot->data, buffer, len);
+    slot->transfers[WST_DATA]->length = (int) len;
+
+    slot->submit_us = picoboot_time_us();
+    atomic_store(&slot->status, 0);
+    atomic_store(&slot->idle, 0);
+    // Accounted for up front since another thread handling events may complete the first transfer before the last is submitted
+    atomic_store(&slot->in_flight, WST_COUNT);
+    connection->last_cmd_id = PC_WRITE;
+    for (int i = 0; i < WST_COUNT; i++) {
+        if (connection->emulator) {
+            ret = picoboot_emulator_submit_transfer(connection->emulator, slot->transfers[i]);
+        } else {
+            ret = libusb_submit_transfer(slot->transfers[i]);
+        }
+        if (ret) {
+            picoboot_write_stream_set_error(&stream->error, ret);
+            picoboot_write_stream_set_error(&slot->status, ret);
+            picoboot_write_stream_release(slot, WST_COUNT - i);
+            break;
+        }
+    }
+
+    if (atomic_load(&stream->error)) {
+        return picoboot_write_stream_flush(connection);
+    }
+
+    return 0;
+}
+
+int picoboot_write_stream_flush(picoboot_connection *connection) {
+    struct picoboot_write_stream *stream = connection->write_stream;
+    if (!stream) {
+        return 0;
+    }
+
+    // Waiting on slots oldest to newest retires them in the same order the device acknowledges them
+    for (unsigned int i = 0; i < stream->depth && !atomic_load(&stream->error); i++) {
+        struct picoboot_write_stream_slot *slot = &stream->slots[(stream->next_slot + i) % stream->depth];
+        int ret = picoboot_write_stream_wait_slot(stream, slot);
+        if (ret) {
+            picoboot_write_stream_set_error(&stream->error, ret);
+        }
+    }
+
+    int ret = atomic_load(&stream->error);
+    if (ret) {
+        picoboot_write_stream_abort(stream);
+        atomic_store(&stream->error, 0);
+        // Same as a failed picoboot_cmd, we no longer know what state the device is in
+        connection->xip_state = XIP_UNKOWN;
+        connection->definitely_exclusive = false;
+    }
+
+    return ret;
+}
+
+void picoboot_write_stream_close(picoboot_connection *connection) {
+    struct picoboot_write_stream *stream = connection->write_stream;
+    if (!stream) {
+        return;
+    }
+
+    picoboot_write_stream_abort(stream);
+    connection->write_stream = NULL;
+
+    for (unsigned int i = 0; i < stream->depth; i++) {
+        struct picoboot_write_stream_slot *slot = &stream->slots[i];
+        if (!atomic_load(&slot->idle)) {
+            // See picoboot_write_stream_abort, libusb still owns this slot so it has to be leaked
+            continue;
+        }
+        for (int j = 0; j < WST_COUNT; j++) {
+            libusb_free_transfer(slot->transfers[j]);
+        }
+        free(slot->data);
+    }
+
+    // If any slot is still in flight the stream has to stay allocated since the callback references it
+    for (unsigned int i = 0; i < stream->depth; i++) {
+        if (!atomic_load(&stream->slots[i].idle)) {
+            return;
+        }
+    }
+    free(stream);
+}
+
+int picoboot_read(picoboot_connection *connection, uint32_t addr, uint8_t *buffer, uint32_t len) {
     memset(buffer, 0xaa, len);
     if (verbose) output("READ %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
     struct picoboot_cmd cmd;
@@ -506,7 +952,7 @@ int picoboot_read(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buff
     cmd.bCmdSize = sizeof(cmd.range_cmd);
     cmd.range_cmd.dAddr = addr;
     cmd.range_cmd.dSize = cmd.dTransferLength = len;
-    int ret = picoboot_cmd(usb_device, &cmd, buffer, len);
+    int ret = picoboot_cmd(connection, &cmd, buffer, len);
     if (!ret && len < 256 && verbose) {
         for (uint32_t i = 0; i < len; i += 32) {
             output("\t");
@@ -519,7 +965,7 @@ int picoboot_read(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buff
     return ret;
 }
 
-int picoboot_otp_write(libusb_device_handle *usb_device, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len) {
+int picoboot_otp_write(picoboot_connection *connection, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len) {
     struct picoboot_cmd cmd;
     if (verbose) output("OTP WRITE %04x+%08x ecc=%d\n", (unsigned int) otp_cmd->wRow, otp_cmd->wRowCount, otp_cmd->bEcc);
     cmd.bCmdId = PC_OTP_WRITE;
@@ -530,11 +976,11 @@ int picoboot_otp_write(libusb_device_handle *usb_device, struct picoboot_otp_cmd
 #endif
     cmd.otp_cmd = *otp_cmd;
     cmd.dTransferLength = len;
-    one_time_bulk_timeout = 5000 + len * 5;
-    return picoboot_cmd(usb_device, &cmd, buffer, len);
+    connection->one_time_bulk_timeout = 5000 + len * 5;
+    return picoboot_cmd(connection, &cmd, buffer, len);
 }
 
-int picoboot_otp_read(libusb_device_handle *usb_device, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len) {
+int picoboot_otp_read(picoboot_connection *connection, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len) {
     struct picoboot_cmd cmd;
     if (verbose) output("OTP READ %04x+%08x ecc=%d\n", (unsigned int) otp_cmd->wRow, otp_cmd->wRowCount, otp_cmd->bEcc);
     cmd.bCmdId = PC_OTP_READ;
@@ -545,17 +991,17 @@ int picoboot_otp_read(libusb_device_handle *usb_device, struct picoboot_otp_cmd
 #endif
     cmd.otp_cmd = *otp_cmd;
     cmd.dTransferLength = len;
-    return picoboot_cmd(usb_device, &cmd, buffer, len);
+    return picoboot_cmd(connection, &cmd, buffer, len);
 }
 
-int picoboot_get_info(libusb_device_handle *usb_device, struct picoboot_get_info_cmd *get_info_cmd, uint8_t *buffer, uint32_t len) {
+int picoboot_get_info(picoboot_connection *connection, struct picoboot_get_info_cmd *get_info_cmd, uint8_t *buffer, uint32_t len) {
     if (verbose) output("GET_INFO\n");
     struct picoboot_cmd cmd;
     cmd.bCmdId = PC_GET_INFO;
     cmd.bCmdSize = sizeof(cmd.get_info_cmd);
     cmd.get_info_cmd = *get_info_cmd;
     cmd.dTransferLength = len;
-    int ret = picoboot_cmd(usb_device, &cmd, buffer, len);
+    int ret = picoboot_cmd(connection, &cmd, buffer, len);
     return ret;
 }
 
@@ -667,37 +1113,110 @@ static const uint8_t picoboot_peek_cmd[] = {
 #define FLASH_ID_CODE_LOC 0x15000000 // XIP_SRAM_BASE on RP2040, as we're not using XIP so probably fine
 #define FLASH_ID_UID_ADDR (FLASH_ID_CODE_LOC + 28 + 1 + 4)
 
-int picoboot_poke(libusb_device_handle *usb_device, uint32_t addr, uint32_t data) {
+int picoboot_poke(picoboot_connection *connection, uint32_t addr, uint32_t data) {
     uint8_t prog[PICOBOOT_POKE_CMD_PROG_SIZE];
     output("POKE (D)%08x -> (A)%08x\n", data, addr);
     memcpy(prog, picoboot_poke_cmd, picoboot_poke_cmd_len);
     *(uint32_t *) (prog + picoboot_poke_cmd_len) = data;
     *(uint32_t *) (prog + picoboot_poke_cmd_len + 4) = addr;
 
-    int ret = picoboot_write(usb_device, PEEK_POKE_CODE_LOC, prog, PICOBOOT_POKE_CMD_PROG_SIZE);
+    int ret = picoboot_write(connection, PEEK_POKE_CODE_LOC, prog, PICOBOOT_POKE_CMD_PROG_SIZE);
     if (ret)
         return ret;
-    return picoboot_exec(usb_device, PEEK_POKE_CODE_LOC);
+    return picoboot_exec(connection, PEEK_POKE_CODE_LOC);
 }
 
 // TODO haven't checked the store goes to the right address :)
-int picoboot_peek(libusb_device_handle *usb_device, uint32_t addr, uint32_t *data) {
+int picoboot_peek(picoboot_connection *connection, uint32_t addr, uint32_t *data) {
     uint8_t prog[PICOBOOT_PEEK_CMD_PROG_SIZE];
     output("PEEK %08x\n", addr);
     memcpy(prog, picoboot_peek_cmd, picoboot_peek_cmd_len);
     *(uint32_t *) (prog + picoboot_peek_cmd_len) = addr;
 
-    int ret = picoboot_write(usb_device, PEEK_POKE_CODE_LOC, prog, PICOBOOT_PEEK_CMD_PROG_SIZE);
+    int ret = picoboot_write(connection, PEEK_POKE_CODE_LOC, prog, PICOBOOT_PEEK_CMD_PROG_SIZE);
     if (ret)
         return ret;
-    ret = picoboot_exec(usb_device, PEEK_POKE_CODE_LOC);
+    ret = picoboot_exec(connection, PEEK_POKE_CODE_LOC);
     if (ret)
         return ret;
-    return picoboot_read(usb_device, PEEK_POKE_CODE_LOC + picoboot_peek_cmd_len, (uint8_t *) data, sizeof(uint32_t));
+    return picoboot_read(connection, PEEK_POKE_CODE_LOC + picoboot_peek_cmd_len, (uint8_t *) data, sizeof(uint32_t));
 }
 
-int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data) {
-    picoboot_exclusive_access(usb_device, 1);
+// 00000000 <crc32_stub>:
+//    0:   b570        push    {r4, r5, r6, lr}
+//    2:   a309        adr     r3, 28 <params>
+//    4:   6818        ldr     r0, [r3, #0]
+//    6:   6859        ldr     r1, [r3, #4]
+//    8:   689a        ldr     r2, [r3, #8]
+//    a:   a40a        adr     r4, 34 <table>
+//    c:   2900        cmp     r1, #0
+//    e:   d009        beq.n   24 <done>
+// 00000010 <loop>:
+//   10:   7805        ldrb    r5, [r0, #0]
+//   12:   3001        adds    r0, #1
+//   14:   0e16        lsrs    r6, r2, #24
+//   16:   406e        eors    r6, r5
+//   18:   00b6        lsls    r6, r6, #2
+//   1a:   59a6        ldr     r6, [r4, r6]
+//   1c:   0212        lsls    r2, r2, #8
+//   1e:   4072        eors    r2, r6
+//   20:   3901        subs    r1, #1
+//   22:   d1f5        bne.n   10 <loop>
+// 00000024 <done>:
+//   24:   609a        str     r2, [r3, #8]
+//   26:   bd70        pop     {r4, r5, r6, pc}
+// 00000028 <params>:
+//   28:   .word   addr
+//   2c:   .word   len
+//   30:   .word   crc (in/out)
+// 00000034 <table>:
+//   34:   .word   crc32_table[0][0..255]
+
+static const size_t picoboot_crc32_cmd_len = 0x28;
+static const uint8_t picoboot_crc32_cmd[] = {
+        0x70, 0xb5, 0x09, 0xa3, 0x18, 0x68, 0x59, 0x68, 0x9a, 0x68, 0x0a, 0xa4, 0x00, 0x29, 0x09, 0xd0,
+        0x05, 0x78, 0x01, 0x30, 0x16, 0x0e, 0x6e, 0x40, 0xb6, 0x00, 0xa6, 0x59, 0x12, 0x02, 0x72, 0x40,
+        0x01, 0x39, 0xf5, 0xd1, 0x9a, 0x60, 0x70, 0xbd,
+};
+#define PICOBOOT_CRC32_CMD_PARAMS_OFFSET 0x28
+#define PICOBOOT_CRC32_CMD_TABLE_OFFSET 0x34
+#define PICOBOOT_CRC32_CMD_PROG_SIZE (size_t)(PICOBOOT_CRC32_CMD_TABLE_OFFSET + 256 * 4)
+
+// The stub reads flash through XIP, so unlike the flash ID stub it can't live in the XIP SRAM (which is acting as the cache)
+#define CRC32_CODE_LOC 0x20000000u
+
+// The bootrom is running from the USB PLL and reading flash with plain 03h reads, assume at least 256 KiB/s
+#define CRC32_TIMEOUT_MS(len) (3000 + (int) ((len) / 256))
+
+int picoboot_flash_crc32(picoboot_connection *connection, uint32_t addr, uint32_t len, uint32_t *crc) {
+    uint8_t prog[PICOBOOT_CRC32_CMD_PROG_SIZE];
+    output("FLASH CRC32 %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
+    memcpy(prog, picoboot_crc32_cmd, picoboot_crc32_cmd_len);
+    uint32_t params[3] = { addr, len, 0xffffffffu };
+    memcpy(prog + PICOBOOT_CRC32_CMD_PARAMS_OFFSET, params, sizeof(params));
+    for (uint32_t i = 0; i < 256; i++) {
+        memcpy(prog + PICOBOOT_CRC32_CMD_TABLE_OFFSET + i * 4, &crc32_table[0][i], sizeof(uint32_t));
+    }
+
+    // flash must be memory mapped for the stub to read it
+    int ret = picoboot_enter_cmd_xip(connection);
+    if (ret)
+        return ret;
+    ret = picoboot_write(connection, CRC32_CODE_LOC, prog, PICOBOOT_CRC32_CMD_PROG_SIZE);
+    if (ret)
+        return ret;
+    connection->one_time_bulk_timeout = CRC32_TIMEOUT_MS(len);
+    ret = picoboot_exec(connection, CRC32_CODE_LOC);
+    if (ret)
+        return ret;
+    return picoboot_read(connection, CRC32_CODE_LOC + PICOBOOT_CRC32_CMD_PARAMS_OFFSET + 8, (uint8_t *) crc, sizeof(uint32_t));
+}
+
+int picoboot_flash_id(picoboot_connection *connection, uint64_t *data) {
+    // Only take (and later release) exclusive access if we don't already have it, otherwise we'd drop the caller's lock
+    bool was_exclusive = connection->definitely_exclusive;
+    if (!was_exclusive)
+        picoboot_exclusive_access(connection, 1);
     assert(PICOBOOT_FLASH_ID_CMD_PROG_SIZE == flash_id_bin_SIZE);
     uint8_t prog[PICOBOOT_FLASH_ID_CMD_PROG_SIZE];
     uint64_t id;
@@ -705,16 +1224,16 @@ int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data) {
     memcpy(prog, flash_id_bin, flash_id_bin_SIZE);
 
     // ensure XIP is exited before executing
-    int ret = picoboot_exit_xip(usb_device);
+    int ret = picoboot_exit_xip(connection);
     if (ret)
         goto flash_id_return;
-    ret = picoboot_write(usb_device, FLASH_ID_CODE_LOC, prog, PICOBOOT_FLASH_ID_CMD_PROG_SIZE);
+    ret = picoboot_write(connection, FLASH_ID_CODE_LOC, prog, PICOBOOT_FLASH_ID_CMD_PROG_SIZE);
     if (ret)
         goto flash_id_return;
-    ret = picoboot_exec(usb_device, FLASH_ID_CODE_LOC);
+    ret = picoboot_exec(connection, FLASH_ID_CODE_LOC);
     if (ret)
         goto flash_id_return;
-    ret = picoboot_read(usb_device, FLASH_ID_UID_ADDR, (uint8_t *) &id, sizeof(uint64_t));
+    ret = picoboot_read(connection, FLASH_ID_UID_ADDR, (uint8_t *) &id, sizeof(uint64_t));
     *data = (((id & 0x00000000000000FF) << 56) |
             ((id & 0x000000000000FF00) << 40) |
             ((id & 0x0000000000FF0000) << 24) |
@@ -725,7 +1244,25 @@ int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data) {
             ((id & 0xFF00000000000000) >> 56));
 
 flash_id_return:
-    picoboot_exclusive_access(usb_device, 0);
+    if (!was_exclusive)
+        picoboot_exclusive_access(connection, 0);
     return ret;
 }
+
+enum picoboot_stub picoboot_identify_stub(const uint8_t *code, uint32_t len) {
+    if (len >= PICOBOOT_POKE_CMD_PROG_SIZE && !memcmp(code, picoboot_poke_cmd, picoboot_poke_cmd_len)) {
+        return picoboot_stub_poke;
+    }
+    if (len >= PICOBOOT_PEEK_CMD_PROG_SIZE && !memcmp(code, picoboot_peek_cmd, picoboot_peek_cmd_len)) {
+        return picoboot_stub_peek;
+    }
+    if (len >= PICOBOOT_FLASH_ID_CMD_PROG_SIZE && !memcmp(code, flash_id_bin, flash_id_bin_SIZE)) {
+        return picoboot_stub_flash_id;
+    }
+    // The table is derived from crc32_table so only the code itself needs to match
+    if (len >= PICOBOOT_CRC32_CMD_PROG_SIZE && !memcmp(code, picoboot_crc32_cmd, picoboot_crc32_cmd_len)) {
+        return picoboot_stub_crc32;
+    }
+    return picoboot_stub_unknown;
+}
 #endif
@@ -52,31 +52,74 @@ typedef enum {
     rp2350_unknown
 } rp2350_version_t;
 
+// Per-command statistics, indexed by bCmdId & 0x7f
+#define PICOBOOT_STATS_COMMAND_COUNT 16u
+// Bucket i counts commands which took less than (PICOBOOT_STATS_HISTOGRAM_BASE_US << i) microseconds, the last bucket counts everything else
+#define PICOBOOT_STATS_HISTOGRAM_BUCKETS 20u
+#define PICOBOOT_STATS_HISTOGRAM_BASE_US 32u
+
+typedef struct picoboot_cmd_stats {
+    uint64_t bytes;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint32_t calls;
+    uint32_t failures;
+    uint32_t timeouts;
+    uint32_t halts;
+    uint32_t histogram[PICOBOOT_STATS_HISTOGRAM_BUCKETS];
+} picoboot_cmd_stats;
+
 #if HAS_LIBUSB
-// note that vid and pid are filters, unless both are specified in which case a device with that VID and PID is allowed for RP2350
-enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_device_handle **dev_handle, model_t *model, int vid, int pid, const char* ser);
+// Opaque per-device connection state (endpoints, command token, XIP/exclusive tracking)
+// Each connection may be used from a single thread at a time, but separate connections may be used concurrently.
+typedef struct picoboot_connection picoboot_connection;
 
-int picoboot_reset(libusb_device_handle *usb_device);
-int picoboot_cmd_status_verbose(libusb_device_handle *usb_device, struct picoboot_cmd_status *status,
+// note that vid and pid are filters, unless both are specified in which case a device with that VID and PID is allowed for RP2350
+// if *connection is non-NULL on return it is owned by the caller and must be released with picoboot_close_device, even if the device was rejected
+enum picoboot_device_result picoboot_open_device(libusb_device *device, picoboot_connection **connection, model_t *model, int vid, int pid, const char* ser);
+// Opens a connection to a software emulated device instead of a real one, see picoboot_emulator.h
+// Only one connection may have the emulator open at a time, otherwise this fails with dr_vidpid_bootrom_cant_connect
+typedef struct picoboot_emulator picoboot_emulator;
+enum picoboot_device_result picoboot_open_emulated_device(picoboot_emulator *emulator, picoboot_connection **connection, model_t *model);
+void picoboot_close_device(picoboot_connection *connection);
+
+int picoboot_reset(picoboot_connection *connection);
+int picoboot_cmd_status_verbose(picoboot_connection *connection, struct picoboot_cmd_status *status,
                                 bool local_verbose);
-int picoboot_cmd_status(libusb_device_handle *usb_device, struct picoboot_cmd_status *status);
-int picoboot_exclusive_access(libusb_device_handle *usb_device, uint8_t exclusive);
-int picoboot_enter_cmd_xip(libusb_device_handle *usb_device);
-int picoboot_exit_xip(libusb_device_handle *usb_device);
-int picoboot_reboot(libusb_device_handle *usb_device, uint32_t pc, uint32_t sp, uint32_t delay_ms);
-int picoboot_reboot2(libusb_device_handle *usb_device, struct picoboot_reboot2_cmd *reboot_cmd);
-int picoboot_get_info(libusb_device_handle *usb_device, struct picoboot_get_info_cmd *cmd, uint8_t *buffer, uint32_t len);
-int picoboot_exec(libusb_device_handle *usb_device, uint32_t addr);
-// int picoboot_exec2(libusb_device_handle *usb_device, struct picoboot_exec2_cmd *exec2_cmd); // currently unused
-int picoboot_flash_erase(libusb_device_handle *usb_device, uint32_t addr, uint32_t len);
-int picoboot_vector(libusb_device_handle *usb_device, uint32_t addr);
-int picoboot_write(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len);
-int picoboot_read(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len);
-int picoboot_otp_write(libusb_device_handle *usb_device, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
-int picoboot_otp_read(libusb_device_handle *usb_device, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
-int picoboot_poke(libusb_device_handle *usb_device, uint32_t addr, uint32_t data);
-int picoboot_peek(libusb_device_handle *usb_device, uint32_t addr, uint32_t *data);
-int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data);
+int picoboot_cmd_status(picoboot_connection *connection, struct picoboot_cmd_status *status);
+int picoboot_exclusive_access(picoboot_connection *connection, uint8_t exclusive);
+int picoboot_enter_cmd_xip(picoboot_connection *connection);
+int picoboot_exit_xip(picoboot_connection *connection);
+int picoboot_reboot(picoboot_connection *connection, uint32_t pc, uint32_t sp, uint32_t delay_ms);
+int picoboot_reboot2(picoboot_connection *connection, struct picoboot_reboot2_cmd *reboot_cmd);
+int picoboot_get_info(picoboot_connection *connection, struct picoboot_get_info_cmd *cmd, uint8_t *buffer, uint32_t len);
+int picoboot_exec(picoboot_connection *connection, uint32_t addr);
+// int picoboot_exec2(picoboot_connection *connection, struct picoboot_exec2_cmd *exec2_cmd); // currently unused
+int picoboot_flash_erase(picoboot_connection *connection, uint32_t addr, uint32_t len);
+int picoboot_vector(picoboot_connection *connection, uint32_t addr);
+int picoboot_write(picoboot_connection *connection, uint32_t addr, uint8_t *buffer, uint32_t len);
+int picoboot_read(picoboot_connection *connection, uint32_t addr, uint8_t *buffer, uint32_t len);
+int picoboot_otp_write(picoboot_connection *connection, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
+int picoboot_otp_read(picoboot_connection *connection, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
+int picoboot_poke(picoboot_connection *connection, uint32_t addr, uint32_t data);
+int picoboot_peek(picoboot_connection *connection, uint32_t addr, uint32_t *data);
+int picoboot_flash_id(picoboot_connection *connection, uint64_t *data);
+// RP2040 only, computes crc32_sw(0xffffffff) of the given flash range on the device itself by uploading and executing a small stub
+// Note that this clobbers the start of SRAM and leaves XIP enabled
+int picoboot_flash_crc32(picoboot_connection *connection, uint32_t addr, uint32_t len, uint32_t *crc);
+
+// Copies up to count entries of the connection's command statistics, returns the number of entries available (PICOBOOT_STATS_COMMAND_COUNT)
+unsigned int picoboot_get_stats(picoboot_connection *connection, picoboot_cmd_stats *stats, unsigned int count);
+void picoboot_reset_stats(picoboot_connection *connection);
+
+// Pipelined PC_WRITE, up to depth writes are kept in flight using libusb's asynchronous API
+// context must be the libusb context the device was opened from, as it is used to drive event handling
+// Errors from earlier writes are reported by the next write or flush, after which all outstanding writes have been cancelled
+// Any other command implicitly flushes the stream first
+int picoboot_write_stream_open(picoboot_connection *connection, libusb_context *context, unsigned int depth, uint32_t max_transfer_size);
+int picoboot_write_stream_write(picoboot_connection *connection, uint32_t addr, const uint8_t *buffer, uint32_t len);
+int picoboot_write_stream_flush(picoboot_connection *connection);
+void picoboot_write_stream_close(picoboot_connection *connection);
 #endif
 
 // we require 256 (as this is the page size supported by the device)
@@ -0,0 +1,914 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include "picoboot_emulator.h"
+#include "picoboot_time.h"
+#include "crc32.h"
+#include "boot/bootrom_constants.h"
+
+#if ENABLE_DEBUG_LOG
+#include <stdio.h>
+#define output(...) printf(__VA_ARGS__)
+#else
+#define output(format,...) ((void)0)
+#endif
+
+// Enough for every transfer of the deepest write stream
+#define EMULATOR_MAX_PENDING 32u
+// The largest data phase the emulator will buffer, more than any of the emulated flash sizes
+#define EMULATOR_MAX_TRANSFER_LENGTH (32u * 1024u * 1024u)
+// libusb treats a timeout of 0 as infinite, but the emulator needs a time at which to complete the transfer
+#define EMULATOR_INFINITE_TIMEOUT_MS (60u * 60u * 1000u)
+
+enum emulator_phase {
+    // Waiting for a command on the OUT endpoint
+    PHASE_COMMAND,
+    // Receiving the data of a host to device command
+    PHASE_DATA_OUT,
+    // Sending the data of a device to host command
+    PHASE_DATA_IN,
+    // Waiting for the host's ack of a device to host command
+    PHASE_ACK_OUT,
+    // Waiting for the host to collect our ack of a host to device command
+    PHASE_ACK_IN,
+    // An injected timeout, nothing happens until the interface is reset
+    PHASE_HUNG,
+};
+
+enum emulator_access {
+    ACCESS_CHECK,
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_PROGRAM,
+};
+
+struct emulator_pending {
+    struct libusb_transfer *transfer;
+    uint64_t complete_us;
+    enum libusb_transfer_status status;
+    int actual_length;
+};
+
+struct emulator_result {
+    int ret;
+    int transferred;
+    uint64_t complete_us;
+};
+
+struct picoboot_emulator {
+    picoboot_emulator_config config;
+    picoboot_emulator_stats stats;
+    uint64_t random_state;
+
+    uint8_t *flash;
+    uint8_t *sram;
+    uint32_t sram_size;
+    uint8_t *xip_sram;
+    uint32_t xip_sram_start;
+    uint32_t xip_sram_size;
+    uint8_t *rom;
+    uint32_t rom_size;
+
+    bool attached;
+    bool connected;
+    uint32_t commands_since_attach;
+
+    // Interface state
+    enum emulator_phase phase;
+    struct picoboot_cmd cmd;
+    struct picoboot_cmd_status status;
+    bool halted_out;
+    bool halted_in;
+    uint8_t *buffer;
+    uint32_t buffer_capacity;
+    uint32_t data_offset;
+
+    // Bootrom state
+    bool xip_active;
+    uint8_t exclusive;
+    bool reboot_pending;
+    uint32_t reboot_delay_ms;
+    // When the device drops off the bus following a reboot command, 0 if it isn't rebooting
+    uint64_t reboot_us;
+
+    // When the device will be done with everything it has been given so far, see emulator_bus
+    uint64_t device_time_us;
+
+    // Asynchronous transfers waiting for their modelled completion time, in submission order
+    struct emulator_pending pending[EMULATOR_MAX_PENDING];
+    unsigned int pending_count;
+};
+
+static void emulator_sleep_until(uint64_t time_us) {
+    uint64_t now = picoboot_time_us();
+    if (time_us <= now) {
+        return;
+    }
+
+    uint64_t remaining_us = time_us - now;
+#ifdef _WIN32
+    Sleep((DWORD) ((remaining_us + 999u) / 1000u));
+#else
+    struct timespec duration;
+    duration.tv_sec = (time_t) (remaining_us / 1000000u);
+    duration.tv_nsec = (long) (remaining_us % 1000000u) * 1000;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+// xorshift64*, plenty for deciding which commands to fail
+static double emulator_random(picoboot_emulator *emulator) {
+    uint64_t x = emulator->random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    emulator->random_state = x;
+    return (double) ((x * 0x2545f4914f6cdd1dull) >> 11) / 9007199254740992.0;
+}
+
+static uint32_t emulator_load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static void emulator_store32(uint8_t *p, uint32_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+// Transfers are serialized on the device: each one starts once it has made it across the bus and the device has finished with everything before it
+// This is what makes pipelining pay off, the bus latency of a queued transfer overlaps with the device programming the previous page
+static uint64_t emulator_bus(picoboot_emulator *emulator, uint64_t submit_us, uint32_t bytes) {
+    uint64_t start_us = submit_us + emulator->config.transfer_latency_us;
+    if (start_us < emulator->device_time_us) {
+        start_us = emulator->device_time_us;
+    }
+    uint64_t duration_us = emulator->config.bytes_per_ms ? (uint64_t) bytes * 1000u / emulator->config.bytes_per_ms : 0;
+    emulator->device_time_us = start_us + duration_us;
+    return emulator->device_time_us;
+}
+
+static void emulator_busy(picoboot_emulator *emulator, uint64_t duration_us) {
+    emulator->device_time_us += duration_us;
+    emulator->stats.busy_us += duration_us;
+}
+
+// Returns the storage backing addr and how many bytes of it are contiguous, or NULL if nothing is emulated there
+static uint8_t *emulator_map(picoboot_emulator *emulator, uint32_t addr, uint32_t *contiguous) {
+    uint32_t offset;
+    switch (get_memory_type(addr, emulator->config.model)) {
+        case flash:
+            // The flash chip ignores address bits beyond its size, so it appears mirrored throughout the XIP window
+            offset = (addr - FLASH_START) & (emulator->config.flash_size - 1);
+            *contiguous = emulator->config.flash_size - offset;
+            return emulator->flash + offset;
+        case sram:
+            offset = addr - SRAM_START;
+            if (offset >= emulator->sram_size) {
+                return NULL;
+            }
+            *contiguous = emulator->sram_size - offset;
+            return emulator->sram + offset;
+        case xip_sram:
+            offset = addr - emulator->xip_sram_start;
+            if (offset >= emulator->xip_sram_size) {
+                return NULL;
+            }
+            *contiguous = emulator->xip_sram_size - offset;
+            return emulator->xip_sram + offset;
+        case rom:
+            offset = addr - ROM_START;
+            if (offset >= emulator->rom_size) {
+                return NULL;
+            }
+            *contiguous = emulator->rom_size - offset;
+            return emulator->rom + offset;
+        default:
+            // Unstriped SRAM isn't emulated
+            return NULL;
+    }
+}
+
+// Fails without touching anything if any part of the range isn't emulated
+static bool emulator_access(picoboot_emulator *emulator, uint32_t addr, uint8_t *buffer, uint32_t len, enum emulator_access access) {
+    if ((uint64_t) addr + len > 0x100000000ull) {
+        return false;
+    }
+
+    if (access != ACCESS_CHECK && !emulator_access(emulator, addr, NULL, len, ACCESS_CHECK)) {
+        return false;
+    }
+
+    while (len) {
+        uint32_t contiguous;
+        uint8_t *memory = emulator_map(emulator, addr, &contiguous);
+        if (!memory) {
+            return false;
+        }
+
+        uint32_t count = MIN(len, contiguous);
+        switch (access) {
+            case ACCESS_READ:
+                memcpy(buffer, memory, count);
+                break;
+            case ACCESS_WRITE:
+                memcpy(memory, buffer, count);
+                break;
+            case ACCESS_PROGRAM:
+                if (get_memory_type(addr, emulator->config.model) == flash) {
+                    // Programming can only clear bits, which is why flash has to be erased first
+                    for (uint32_t i = 0; i < count; i++) {
+                        memory[i] &= buffer[i];
+                    }
+                } else {
+                    memcpy(memory, buffer, count);
+                }
+                break;
+            case ACCESS_CHECK:
+                break;
+        }
+
+        if (buffer) {
+            buffer += count;
+        }
+        addr += count;
+        len -= count;
+    }
+    return true;
+}
+
+void picoboot_emulator_default_config(model_t model, picoboot_emulator_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->model = model;
+    // The Pico has a 2 MiB W25Q16JV, the Pico 2 has a 4 MiB W25Q32RV
+    config->flash_size = model == rp2350 ? 4u * 1024u * 1024u : 2u * 1024u * 1024u;
+    config->unique_id = model == rp2350 ? 0x5a3c91e0d7b2f468ull : 0xe6614103e7452d2full;
+    // A full speed bulk endpoint with the usual host controller overhead, and the typical figures from the W25Q datasheets
+    config->transfer_latency_us = 250;
+    config->bytes_per_ms = 1000;
+    config->command_us = 20;
+    config->page_program_us = 400;
+    config->sector_erase_us = 45000;
+    config->xip_read_bytes_per_ms = 2000;
+}
+
+int picoboot_emulator_create(const picoboot_emulator_config *config, picoboot_emulator **emulator_out) {
+    *emulator_out = NULL;
+    if (config->model != rp2040 && config->model != rp2350) {
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    uint32_t flash_window = (config->model == rp2040 ? FLASH_END_RP2040 : FLASH_END_RP2350) - FLASH_START;
+    if (config->flash_size < FLASH_SECTOR_ERASE_SIZE || config->flash_size > flash_window || (config->flash_size & (config->flash_size - 1))) {
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+    picoboot_emulator *emulator = (picoboot_emulator *) calloc(1, sizeof(*emulator));
+    if (!emulator) {
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    emulator->config = *config;
+    emulator->random_state = (uint64_t) config->seed + 0x9e3779b97f4a7c15ull;
+    if (config->model == rp2040) {
+        emulator->sram_size = SRAM_END_RP2040 - SRAM_START;
+        emulator->xip_sram_start = XIP_SRAM_START_RP2040;
+        emulator->xip_sram_size = XIP_SRAM_END_RP2040 - XIP_SRAM_START_RP2040;
+        emulator->rom_size = ROM_END_RP2040 - ROM_START;
+    } else {
+        emulator->sram_size = SRAM_END_RP2350 - SRAM_START;
+        emulator->xip_sram_start = XIP_SRAM_START_RP2350;
+        emulator->xip_sram_size = XIP_SRAM_END_RP2350 - XIP_SRAM_START_RP2350;
+        emulator->rom_size = ROM_END_RP2350 - ROM_START;
+    }
+
+    emulator->flash = (uint8_t *) malloc(config->flash_size);
+    emulator->sram = (uint8_t *) calloc(1, emulator->sram_size);
+    emulator->xip_sram = (uint8_t *) calloc(1, emulator->xip_sram_size);
+    emulator->rom = (uint8_t *) calloc(1, emulator->rom_size);
+    if (!emulator->flash || !emulator->sram || !emulator->xip_sram || !emulator->rom) {
+        picoboot_emulator_destroy(emulator);
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    // Blank flash, and just enough of the bootrom for the host to tell which chip it's talking to ('M', 'u', chip, version)
+    memset(emulator->flash, 0xff, config->flash_size);
+    const uint8_t rom_magic[4] = { 'M', 'u', config->model == rp2040 ? 0x01 : 0x02, config->model == rp2040 ? 0x03 : 0x02 };
+    memcpy(emulator->rom + 0x10, rom_magic, sizeof(rom_magic));
+
+    *emulator_out = emulator;
+    return 0;
+}
+
+void picoboot_emulator_destroy(picoboot_emulator *emulator) {
+    if (!emulator) {
+        return;
+    }
+    free(emulator->flash);
+    free(emulator->sram);
+    free(emulator->xip_sram);
+    free(emulator->rom);
+    free(emulator->buffer);
+    free(emulator);
+}
+
+int picoboot_emulator_read_memory(picoboot_emulator *emulator, uint32_t addr, uint8_t *buffer, uint32_t len) {
+    return emulator_access(emulator, addr, buffer, len, ACCESS_READ) ? 0 : LIBUSB_ERROR_INVALID_PARAM;
+}
+
+int picoboot_emulator_write_memory(picoboot_emulator *emulator, uint32_t addr, const uint8_t *buffer, uint32_t len) {
+    return emulator_access(emulator, addr, (uint8_t *) buffer, len, ACCESS_WRITE) ? 0 : LIBUSB_ERROR_INVALID_PARAM;
+}
+
+void picoboot_emulator_get_stats(picoboot_emulator *emulator, picoboot_emulator_stats *stats) {
+    *stats = emulator->stats;
+}
+
+void picoboot_emulator_reset_stats(picoboot_emulator *emulator) {
+    memset(&emulator->stats, 0, sizeof(emulator->stats));
+}
+
+static bool emulator_is_connected(picoboot_emulator *emulator) {
+    if (emulator->connected && emulator->reboot_us && picoboot_time_us() >= emulator->reboot_us) {
+        emulator->connected = false;
+        emulator->reboot_us = 0;
+        emulator->stats.reboots++;
+    }
+    return emulator->connected;
+}
+
+static void emulator_reset_interface(picoboot_emulator *emulator) {
+    emulator->phase = PHASE_COMMAND;
+    emulator->halted_out = false;
+    emulator->halted_in = false;
+    emulator->status.bInProgress = 0;
+    emulator->status.dStatusCode = PICOBOOT_OK;
+    emulator->exclusive = 0;
+}
+
+int picoboot_emulator_attach(picoboot_emulator *emulator, model_t *model) {
+    if (emulator->attached) {
+        return LIBUSB_ERROR_BUSY;
+    }
+
+    if (!emulator_is_connected(emulator)) {
+        // Plugged in for the first time or coming back after a reboot/disconnect, either way the bootrom starts from scratch
+        emulator->connected = true;
+        emulator->commands_since_attach = 0;
+        emulator->xip_active = false;
+        emulator->reboot_pending = false;
+        emulator->reboot_us = 0;
+        memset(&emulator->status, 0, sizeof(emulator->status));
+    }
+
+    emulator_reset_interface(emulator);
+    emulator->attached = true;
+    *model = emulator->config.model;
+    return 0;
+}
+
+void picoboot_emulator_detach(picoboot_emulator *emulator) {
+    emulator->attached = false;
+    emulator->pending_count = 0;
+}
+
+// The command fails, the host finds out when the next transfer of the command is stalled
+static void emulator_stall(picoboot_emulator *emulator, enum picoboot_status status) {
+    emulator->status.dStatusCode = status;
+    emulator->status.bInProgress = 0;
+    emulator->halted_out = true;
+    emulator->halted_in = true;
+    emulator->phase = PHASE_COMMAND;
+}
+
+static void emulator_complete_command(picoboot_emulator *emulator) {
+    emulator->status.bInProgress = 0;
+    emulator->phase = PHASE_COMMAND;
+    if (emulator->reboot_pending) {
+        // Like the bootrom the reboot is only scheduled once the command is acknowledged, see emulator_is_connected
+        emulator->reboot_pending = false;
+        emulator->reboot_us = picoboot_time_us() + (uint64_t) emulator->reboot_delay_ms * 1000u;
+    }
+}
+
+static enum picoboot_status emulator_exec(picoboot_emulator *emulator, uint32_t addr) {
+    uint32_t contiguous;
+    uint8_t *code = emulator_map(emulator, addr, &contiguous);
+    if (!code) {
+        return PICOBOOT_INVALID_ADDRESS;
+    }
+
+    // The offsets here are those of the stubs in picoboot_connection.c
+    switch (picoboot_identify_stub(code, contiguous)) {
+        case picoboot_stub_poke: {
+            uint8_t data[4];
+            memcpy(data, code + 8, sizeof(data));
+            if (!emulator_access(emulator, emulator_load32(code + 12), data, sizeof(data), ACCESS_WRITE)) {
+                return PICOBOOT_UNKNOWN_ERROR;
+            }
+            break;
+        }
+        case picoboot_stub_peek: {
+            uint8_t data[4];
+            if (!emulator_access(emulator, emulator_load32(code + 12), data, sizeof(data), ACCESS_READ)) {
+                return PICOBOOT_UNKNOWN_ERROR;
+            }
+            memcpy(code + 12, data, sizeof(data));
+            break;
+        }
+        case picoboot_stub_flash_id:
+            // Stored most significant byte first, just as it comes out of the flash chip
+            for (int i = 0; i < 8; i++) {
+                code[33 + i] = (uint8_t) (emulator->config.unique_id >> (56 - 8 * i));
+            }
+            break;
+        case picoboot_stub_crc32: {
+            uint32_t crc_addr = emulator_load32(code + 0x28);
+            uint32_t crc_len = emulator_load32(code + 0x2c);
+            uint32_t crc = emulator_load32(code + 0x30);
+            // The stub reads flash through XIP, on real hardware it'd fault or read garbage if the host hadn't set that up
+            if (!emulator->xip_active || get_memory_type(crc_addr, emulator->config.model) != flash
+                || !emulator_access(emulator, crc_addr, NULL, crc_len, ACCESS_CHECK)) {
+                return PICOBOOT_UNKNOWN_ERROR;
+            }
+            while (crc_len) {
+                uint32_t count;
+                const uint8_t *memory = emulator_map(emulator, crc_addr, &count);
+                count = MIN(count, crc_len);
+                crc = crc32_sw(memory, count, crc);
+                crc_addr += count;
+                crc_len -= count;
+            }
+            emulator_store32(code + 0x30, crc);
+            if (emulator->config.xip_read_bytes_per_ms) {
+                emulator_busy(emulator, (uint64_t) emulator_load32(code + 0x2c) * 1000u / emulator->config.xip_read_bytes_per_ms);
+            }
+            break;
+        }
+        default:
+            // Real hardware would run whatever is there, we can only stand in for the programs we know about
+            output("Emulated device can't execute unknown code at %08x\n", (unsigned int) addr);
+            return PICOBOOT_UNKNOWN_ERROR;
+    }
+    return PICOBOOT_OK;
+}
+
+static void emulator_get_info(picoboot_emulator *emulator, uint8_t *buffer, uint32_t len) {
+    // The response is the number of words which follow, the flags which were included, and then the data for each of them
+    uint32_t words[5] = { 0 };
+    uint32_t included = emulator->cmd.get_info_cmd.dParams[0] & SYS_INFO_CHIP_INFO;
+    uint32_t count = 1;
+    words[1] = included;
+    if (included & SYS_INFO_CHIP_INFO) {
+        words[count + 1] = 0; // package_sel
+        words[count + 2] = (uint32_t) emulator->config.unique_id;
+        words[count + 3] = (uint32_t) (emulator->config.unique_id >> 32);
+        count += 3;
+    }
+    words[0] = count;
+
+    memset(buffer, 0, len);
+    memcpy(buffer, words, MIN(len, (count + 1) * sizeof(uint32_t)));
+}
+
+// Does whatever the command does, for host to device commands this happens once all of the data has arrived
+static enum picoboot_status emulator_execute(picoboot_emulator *emulator) {
+    struct picoboot_cmd *cmd = &emulator->cmd;
+    uint32_t addr = cmd->range_cmd.dAddr;
+    uint32_t size = cmd->range_cmd.dSize;
+    emulator_busy(emulator, emulator->config.command_us);
+
+    switch (cmd->bCmdId) {
+        case PC_EXCLUSIVE_ACCESS:
+            emulator->exclusive = cmd->exclusive_cmd.bExclusive;
+            break;
+        case PC_REBOOT:
+        case PC_REBOOT2:
+            emulator->reboot_pending = true;
+            emulator->reboot_delay_ms = cmd->bCmdId == PC_REBOOT ? cmd->reboot_cmd.dDelayMS : cmd->reboot2_cmd.dDelayMS;
+            break;
+        case PC_FLASH_ERASE:
+            for (uint32_t offset = 0; offset < size; offset += FLASH_SECTOR_ERASE_SIZE) {
+                uint32_t contiguous;
+                memset(emulator_map(emulator, addr + offset, &contiguous), 0xff, FLASH_SECTOR_ERASE_SIZE);
+            }
+            emulator->stats.sectors_erased += size / FLASH_SECTOR_ERASE_SIZE;
+            emulator_busy(emulator, (uint64_t) (size / FLASH_SECTOR_ERASE_SIZE) * emulator->config.sector_erase_us);
+            emulator->xip_active = false;
+            break;
+        case PC_WRITE:
+            emulator_access(emulator, addr, emulator->buffer, size, ACCESS_PROGRAM);
+            if (get_memory_type(addr, emulator->config.model) == flash) {
+                emulator->stats.pages_programmed += size / PAGE_SIZE;
+                emulator_busy(emulator, (uint64_t) (size / PAGE_SIZE) * emulator->config.page_program_us);
+                emulator->xip_active = false;
+            }
+            emulator->stats.bytes_written += size;
+            break;
+        case PC_READ:
+            emulator_access(emulator, addr, emulator->buffer, size, ACCESS_READ);
+            emulator->stats.bytes_read += size;
+            break;
+        case PC_GET_INFO:
+            emulator_get_info(emulator, emulator->buffer, cmd->dTransferLength);
+            break;
+        case PC_EXIT_XIP:
+            emulator->xip_active = false;
+            break;
+        case PC_ENTER_CMD_XIP:
+            emulator->xip_active = true;
+            break;
+        case PC_EXEC:
+            return emulator_exec(emulator, cmd->address_only_cmd.dAddr);
+        case PC_VECTORIZE_FLASH:
+            break;
+        default:
+            return PICOBOOT_UNKNOWN_CMD;
+    }
+    return PICOBOOT_OK;
+}
+
+// Validates a newly received command the same way the bootrom does before it starts the data phase
+static enum picoboot_status emulator_validate(picoboot_emulator *emulator) {
+    struct picoboot_cmd *cmd = &emulator->cmd;
+    bool is_rp2040 = emulator->config.model == rp2040;
+    uint32_t addr = cmd->range_cmd.dAddr;
+    uint32_t size = cmd->range_cmd.dSize;
+    enum memory_type type = get_memory_type(addr, emulator->config.model);
+
+    unsigned int expected_size;
+    switch (cmd->bCmdId) {
+        case PC_EXCLUSIVE_ACCESS:
+            expected_size = sizeof(cmd->exclusive_cmd);
+            break;
+        case PC_FLASH_ERASE:
+        case PC_READ:
+        case PC_WRITE:
+            expected_size = sizeof(cmd->range_cmd);
+            break;
+        case PC_EXIT_XIP:
+        case PC_ENTER_CMD_XIP:
+            expected_size = 0;
+            break;
+        case PC_REBOOT:
+            expected_size = is_rp2040 ? sizeof(cmd->reboot_cmd) : ~0u;
+            break;
+        case PC_EXEC:
+        case PC_VECTORIZE_FLASH:
+            expected_size = is_rp2040 ? sizeof(cmd->address_only_cmd) : ~0u;
+            break;
+        case PC_REBOOT2:
+            expected_size = is_rp2040 ? ~0u : sizeof(cmd->reboot2_cmd);
+            break;
+        case PC_GET_INFO:
+            expected_size = is_rp2040 ? ~0u : sizeof(cmd->get_info_cmd);
+            break;
+        default:
+            // Includes the OTP commands, which aren't emulated
+            expected_size = ~0u;
+            break;
+    }
+
+    if (expected_size == ~0u) {
+        return PICOBOOT_UNKNOWN_CMD;
+    }
+    if (cmd->bCmdSize != expected_size) {
+        return PICOBOOT_INVALID_CMD_LENGTH;
+    }
+
+    bool has_data = cmd->bCmdId == PC_READ || cmd->bCmdId == PC_WRITE || cmd->bCmdId == PC_GET_INFO;
+    if ((!has_data && cmd->dTransferLength) || cmd->dTransferLength > EMULATOR_MAX_TRANSFER_LENGTH) {
+        return PICOBOOT_INVALID_TRANSFER_LENGTH;
+    }
+
+    switch (cmd->bCmdId) {
+        case PC_FLASH_ERASE:
+            if (type != flash) {
+                return PICOBOOT_INVALID_ADDRESS;
+            }
+            if ((addr | size) & (FLASH_SECTOR_ERASE_SIZE - 1)) {
+                return PICOBOOT_BAD_ALIGNMENT;
+            }
+            break;
+        case PC_WRITE:
+            if (type != flash && type != sram && type != xip_sram) {
+                return PICOBOOT_INVALID_ADDRESS;
+            }
+            if (type == flash && ((addr | size) & (PAGE_SIZE - 1))) {
+                return PICOBOOT_BAD_ALIGNMENT;
+            }
+            // fall through
+        case PC_READ:
+            if (cmd->dTransferLength != size) {
+                return PICOBOOT_INVALID_TRANSFER_LENGTH;
+            }
+            break;
+        case PC_EXEC:
+            if (type != sram && type != xip_sram) {
+                return PICOBOOT_INVALID_ADDRESS;
+            }
+            break;
+        case PC_GET_INFO:
+            if (cmd->get_info_cmd.bType != PICOBOOT_GET_INFO_SYS) {
+                return PICOBOOT_INVALID_ARG;
+            }
+            break;
+    }
+
+    if ((cmd->bCmdId == PC_FLASH_ERASE || cmd->bCmdId == PC_READ || cmd->bCmdId == PC_WRITE) && !emulator_access(emulator, addr, NULL, size, ACCESS_CHECK)) {
+        return PICOBOOT_INVALID_ADDRESS;
+    }
+
+    if (cmd->dTransferLength > emulator->buffer_capacity) {
+        uint8_t *buffer = (uint8_t *) realloc(emulator->buffer, cmd->dTransferLength);
+        if (!buffer) {
+            return PICOBOOT_UNKNOWN_ERROR;
+        }
+        emulator->buffer = buffer;
+        emulator->buffer_capacity = cmd->dTransferLength;
+    }
+    return PICOBOOT_OK;
+}
+
+static struct emulator_result emulator_receive_command(picoboot_emulator *emulator, const uint8_t *data, int length, uint64_t submit_us) {
+    struct emulator_result result = { 0, length, emulator_bus(emulator, submit_us, (uint32_t) length) };
+
+    if (emulator->config.disconnect_after_commands && emulator->commands_since_attach >= emulator->config.disconnect_after_commands) {
+        emulator->connected = false;
+        emulator->stats.disconnects++;
+        result.ret = LIBUSB_ERROR_NO_DEVICE;
+        result.transferred = 0;
+        return result;
+    }
+
+    emulator->stats.commands++;
+    emulator->commands_since_attach++;
+
+    if (length != sizeof(struct picoboot_cmd)) {
+        emulator->stats.rejected_commands++;
+        emulator_stall(emulator, PICOBOOT_INVALID_CMD_LENGTH);
+        return result;
+    }
+
+    memcpy(&emulator->cmd, data, sizeof(emulator->cmd));
+    emulator->status.dToken = emulator->cmd.dToken;
+    emulator->status.bCmdId = emulator->cmd.bCmdId;
+    emulator->status.dStatusCode = PICOBOOT_OK;
+    emulator->status.bInProgress = 1;
+    emulator->data_offset = 0;
+
+    // Both are always drawn so that the sequence of faults for a given seed doesn't depend on the probabilities
+    bool inject_timeout = emulator_random(emulator) < emulator->config.timeout_probability;
+    bool inject_stall = emulator_random(emulator) < emulator->config.stall_probability;
+    if (inject_timeout) {
+        emulator->stats.injected_timeouts++;
+        emulator->phase = PHASE_HUNG;
+        return result;
+    }
+    if (inject_stall) {
+        emulator->stats.injected_stalls++;
+        emulator_stall(emulator, PICOBOOT_UNKNOWN_ERROR);
+        return result;
+    }
+
+    enum picoboot_status status = emulator_validate(emulator);
+    if (status) {
+        emulator->stats.rejected_commands++;
+        emulator_stall(emulator, status);
+        return result;
+    }
+
+    if (emulator->cmd.dTransferLength && !(emulator->cmd.bCmdId & 0x80u)) {
+        emulator->phase = PHASE_DATA_OUT;
+        return result;
+    }
+
+    status = emulator_execute(emulator);
+    if (status) {
+        emulator_stall(emulator, status);
+    } else if (emulator->cmd.dTransferLength) {
+        emulator->phase = PHASE_DATA_IN;
+    } else {
+        // ack is in the opposite direction
+        emulator->phase = emulator->cmd.bCmdId & 0x80u ? PHASE_ACK_OUT : PHASE_ACK_IN;
+    }
+    return result;
+}
+
+static struct emulator_result emulator_transfer(picoboot_emulator *emulator, unsigned char endpoint, uint8_t *data, int length, unsigned int timeout, uint64_t submit_us) {
+    struct emulator_result result = { 0, 0, submit_us + emulator->config.transfer_latency_us };
+    bool is_in = endpoint == PICOBOOT_EMULATOR_IN_EP;
+
+    if (!emulator_is_connected(emulator)) {
+        result.ret = LIBUSB_ERROR_NO_DEVICE;
+        return result;
+    }
+    if (endpoint != PICOBOOT_EMULATOR_OUT_EP && endpoint != PICOBOOT_EMULATOR_IN_EP) {
+        result.ret = LIBUSB_ERROR_INVALID_PARAM;
+        return result;
+    }
+    if (is_in ? emulator->halted_in : emulator->halted_out) {
+        result.ret = LIBUSB_ERROR_PIPE;
+        return result;
+    }
+
+    uint32_t remaining = emulator->cmd.dTransferLength - emulator->data_offset;
+    uint32_t count = MIN((uint32_t) length, remaining);
+    if (is_in && emulator->phase == PHASE_DATA_IN) {
+        memcpy(data, emulator->buffer + emulator->data_offset, count);
+        emulator->data_offset += count;
+        if (emulator->data_offset == emulator->cmd.dTransferLength) {
+            emulator->phase = PHASE_ACK_OUT;
+        }
+        result.transferred = (int) count;
+        result.complete_us = emulator_bus(emulator, submit_us, count);
+        return result;
+    }
+    if (is_in && emulator->phase == PHASE_ACK_IN) {
+        emulator_complete_command(emulator);
+        result.complete_us = emulator_bus(emulator, submit_us, 0);
+        return result;
+    }
+    if (!is_in && emulator->phase == PHASE_COMMAND) {
+        return emulator_receive_command(emulator, data, length, submit_us);
+    }
+    if (!is_in && emulator->phase == PHASE_DATA_OUT) {
+        memcpy(emulator->buffer + emulator->data_offset, data, count);
+        emulator->data_offset += count;
+        result.transferred = (int) count;
+        result.complete_us = emulator_bus(emulator, submit_us, count);
+        if (emulator->data_offset == emulator->cmd.dTransferLength) {
+            enum picoboot_status status = emulator_execute(emulator);
+            if (status) {
+                emulator_stall(emulator, status);
+            } else {
+                emulator->phase = PHASE_ACK_IN;
+            }
+        }
+        return result;
+    }
+    if (!is_in && emulator->phase == PHASE_ACK_OUT) {
+        emulator_complete_command(emulator);
+        result.transferred = length;
+        result.complete_us = emulator_bus(emulator, submit_us, 0);
+        return result;
+    }
+
+    // The device isn't expecting anything on this endpoint (or is hung), so it NAKs until the host gives up
+    result.ret = LIBUSB_ERROR_TIMEOUT;
+    result.complete_us = submit_us + (uint64_t) (timeout ? timeout : EMULATOR_INFINITE_TIMEOUT_MS) * 1000u;
+    return result;
+}
+
+int picoboot_emulator_bulk_transfer(picoboot_emulator *emulator, unsigned char endpoint, uint8_t *data, int length, int *transferred, unsigned int timeout) {
+    struct emulator_result result = emulator_transfer(emulator, endpoint, data, length, timeout, picoboot_time_us());
+    emulator_sleep_until(result.complete_us);
+    if (transferred) {
+        *transferred = result.transferred;
+    }
+    return result.ret;
+}
+
+int picoboot_emulator_control_transfer(picoboot_emulator *emulator, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                                       uint8_t *data, uint16_t length, unsigned int timeout) {
+    (void) value;
+    (void) timeout;
+    if (!emulator_is_connected(emulator)) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    // Control requests are answered straight away, even while a command is in progress
+    emulator_sleep_until(picoboot_time_us() + emulator->config.transfer_latency_us);
+
+    uint8_t type = request_type & (0x03u << 5);
+    uint8_t recipient = request_type & 0x1fu;
+    bool is_in = request_type & LIBUSB_ENDPOINT_IN;
+    if (type == LIBUSB_REQUEST_TYPE_VENDOR && recipient == LIBUSB_RECIPIENT_INTERFACE && index == PICOBOOT_EMULATOR_INTERFACE) {
+        if (request == PICOBOOT_IF_RESET && !is_in) {
+            emulator_reset_interface(emulator);
+            return 0;
+        }
+        if (request == PICOBOOT_IF_CMD_STATUS && is_in) {
+            uint16_t count = MIN(length, (uint16_t) sizeof(emulator->status));
+            memcpy(data, &emulator->status, count);
+            return count;
+        }
+    } else if (type == LIBUSB_REQUEST_TYPE_STANDARD && recipient == LIBUSB_RECIPIENT_ENDPOINT && request == LIBUSB_REQUEST_GET_STATUS && is_in
+               && (index == PICOBOOT_EMULATOR_OUT_EP || index == PICOBOOT_EMULATOR_IN_EP)) {
+        if (length < 2) {
+            return LIBUSB_ERROR_OVERFLOW;
+        }
+        data[0] = (index == PICOBOOT_EMULATOR_IN_EP ? emulator->halted_in : emulator->halted_out) ? 1 : 0;
+        data[1] = 0;
+        return 2;
+    }
+
+    // Just like real hardware, requests which aren't understood are stalled
+    return LIBUSB_ERROR_PIPE;
+}
+
+int picoboot_emulator_clear_halt(picoboot_emulator *emulator, unsigned char endpoint) {
+    if (!emulator_is_connected(emulator)) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    if (endpoint == PICOBOOT_EMULATOR_OUT_EP) {
+        emulator->halted_out = false;
+    } else if (endpoint == PICOBOOT_EMULATOR_IN_EP) {
+        emulator->halted_in = false;
+    } else {
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    return 0;
+}
+
+static enum libusb_transfer_status emulator_transfer_status(int ret) {
+    switch (ret) {
+        case LIBUSB_SUCCESS:
+            return LIBUSB_TRANSFER_COMPLETED;
+        case LIBUSB_ERROR_TIMEOUT:
+            return LIBUSB_TRANSFER_TIMED_OUT;
+        case LIBUSB_ERROR_PIPE:
+            return LIBUSB_TRANSFER_STALL;
+        case LIBUSB_ERROR_NO_DEVICE:
+            return LIBUSB_TRANSFER_NO_DEVICE;
+        default:
+            return LIBUSB_TRANSFER_ERROR;
+    }
+}
+
+int picoboot_emulator_submit_transfer(picoboot_emulator *emulator, struct libusb_transfer *transfer) {
+    if (!emulator_is_connected(emulator)) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    if (emulator->pending_count == EMULATOR_MAX_PENDING) {
+        return LIBUSB_ERROR_BUSY;
+    }
+
+    // The device sees transfers in the order they're submitted, so everything but the completion can be decided right away
+    struct emulator_result result = emulator_transfer(emulator, transfer->endpoint, transfer->buffer, transfer->length, transfer->timeout, picoboot_time_us());
+    struct emulator_pending *pending = &emulator->pending[emulator->pending_count++];
+    pending->transfer = transfer;
+    pending->complete_us = result.complete_us;
+    pending->status = emulator_transfer_status(result.ret);
+    pending->actual_length = result.transferred;
+    return 0;
+}
+
+int picoboot_emulator_cancel_transfer(picoboot_emulator *emulator, struct libusb_transfer *transfer) {
+    for (unsigned int i = 0; i < emulator->pending_count; i++) {
+        struct emulator_pending *pending = &emulator->pending[i];
+        if (pending->transfer == transfer && pending->status != LIBUSB_TRANSFER_CANCELLED) {
+            // Whatever the transfer did to the device has already happened, same as a real cancellation which loses the race
+            pending->status = LIBUSB_TRANSFER_CANCELLED;
+            pending->actual_length = 0;
+            pending->complete_us = picoboot_time_us();
+            return 0;
+        }
+    }
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int picoboot_emulator_handle_events(picoboot_emulator *emulator, struct timeval *tv, int *completed) {
+    uint64_t deadline_us = picoboot_time_us() + (uint64_t) tv->tv_sec * 1000000u + (uint64_t) tv->tv_usec;
+
+    while (!completed || !*completed) {
+        // Completions are delivered earliest first, ties go to whichever was submitted first
+        unsigned int next = emulator->pending_count;
+        for (unsigned int i = 0; i < emulator->pending_count; i++) {
+            if (next == emulator->pending_count || emulator->pending[i].complete_us < emulator->pending[next].complete_us) {
+                next = i;
+            }
+        }
+
+        uint64_t now_us = picoboot_time_us();
+        if (next < emulator->pending_count && emulator->pending[next].complete_us <= now_us) {
+            struct emulator_pending pending = emulator->pending[next];
+            emulator->pending_count--;
+            memmove(&emulator->pending[next], &emulator->pending[next + 1], (emulator->pending_count - next) * sizeof(pending));
+
+            pending.transfer->status = pending.status;
+            pending.transfer->actual_length = pending.actual_length;
+            pending.transfer->callback(pending.transfer);
+
+            if (!completed) {
+                break;
+            }
+            continue;
+        }
+
+        if (now_us >= deadline_us) {
+            break;
+        }
+
+        uint64_t wake_us = deadline_us;
+        if (next < emulator->pending_count && emulator->pending[next].complete_us < wake_us) {
+            wake_us = emulator->pending[next].complete_us;
+        }
+        emulator_sleep_until(wake_us);
+    }
+    return 0;
+}
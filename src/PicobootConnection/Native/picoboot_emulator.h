@@ -0,0 +1,106 @@
+﻿#ifndef _PICOBOOT_EMULATOR_H
+#define _PICOBOOT_EMULATOR_H
+
+#include "picoboot_connection.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if HAS_LIBUSB
+// A software PICOBOOT device which stands in for a real RP2040/RP2350 at the USB transfer level
+// Connections opened with picoboot_open_emulated_device send every bulk/control transfer here instead of to libusb, so the command layer,
+// the write stream and the statistics all run exactly as they would against real hardware.
+// The device is modelled with in-memory flash/SRAM and a simple timing model, transfers complete when the modelled device would have completed them.
+// Like a connection, an emulator may only be used from a single thread at a time and it must outlive any connection opened from it.
+typedef struct picoboot_emulator picoboot_emulator;
+
+typedef struct picoboot_emulator_config {
+    model_t model;
+    // Must be a power of two, reads and writes beyond it wrap around like they do on a real flash chip
+    uint32_t flash_size;
+    // The flash unique ID on RP2040, the chip ID on RP2350
+    uint64_t unique_id;
+    // Time from a transfer being submitted to the device seeing it (host controller scheduling, frame alignment, etc.)
+    uint32_t transfer_latency_us;
+    // Bulk throughput once a transfer is underway, 0 for unlimited
+    uint32_t bytes_per_ms;
+    // Fixed cost of processing each command
+    uint32_t command_us;
+    uint32_t page_program_us;
+    uint32_t sector_erase_us;
+    // Rate at which on-device code (IE: the CRC32 stub) can read flash through XIP, 0 for unlimited
+    uint32_t xip_read_bytes_per_ms;
+    // Seed for fault injection
+    uint32_t seed;
+    // The device disappears once this many commands have been received since it was last plugged in, 0 for never
+    uint32_t disconnect_after_commands;
+    // Probability that a command fails with PICOBOOT_UNKNOWN_ERROR and stalls both endpoints
+    double stall_probability;
+    // Probability that the device hangs after receiving a command, the host sees a timeout and must reset the interface
+    double timeout_probability;
+} picoboot_emulator_config;
+
+typedef struct picoboot_emulator_stats {
+    // Modelled time spent executing commands (programming, erasing, etc.), excludes time spent on the bus
+    uint64_t busy_us;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint32_t commands;
+    uint32_t pages_programmed;
+    uint32_t sectors_erased;
+    // Commands rejected by the device itself (bad alignment, invalid address, etc.)
+    uint32_t rejected_commands;
+    uint32_t injected_stalls;
+    uint32_t injected_timeouts;
+    uint32_t disconnects;
+    uint32_t reboots;
+} picoboot_emulator_stats;
+
+// Fills config with the defaults for model, which are based on a Pico/Pico 2 with its stock flash chip
+void picoboot_emulator_default_config(model_t model, picoboot_emulator_config *config);
+int picoboot_emulator_create(const picoboot_emulator_config *config, picoboot_emulator **emulator);
+void picoboot_emulator_destroy(picoboot_emulator *emulator);
+
+// Direct access to the emulated memory which bypasses PICOBOOT entirely, writes to flash replace its contents rather than programming it
+int picoboot_emulator_read_memory(picoboot_emulator *emulator, uint32_t addr, uint8_t *buffer, uint32_t len);
+int picoboot_emulator_write_memory(picoboot_emulator *emulator, uint32_t addr, const uint8_t *buffer, uint32_t len);
+
+void picoboot_emulator_get_stats(picoboot_emulator *emulator, picoboot_emulator_stats *stats);
+void picoboot_emulator_reset_stats(picoboot_emulator *emulator);
+
+// Everything below is used by picoboot_connection.c to route a connection's transfers to the emulator
+
+#define PICOBOOT_EMULATOR_INTERFACE 1u
+#define PICOBOOT_EMULATOR_OUT_EP 0x03u
+#define PICOBOOT_EMULATOR_IN_EP 0x84u
+
+// Plugs the device in (again, if it rebooted or was disconnected), fails with LIBUSB_ERROR_BUSY if a connection already has it open
+int picoboot_emulator_attach(picoboot_emulator *emulator, model_t *model);
+void picoboot_emulator_detach(picoboot_emulator *emulator);
+
+// Same semantics as their libusb counterparts
+int picoboot_emulator_bulk_transfer(picoboot_emulator *emulator, unsigned char endpoint, uint8_t *data, int length, int *transferred, unsigned int timeout);
+int picoboot_emulator_control_transfer(picoboot_emulator *emulator, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                                       uint8_t *data, uint16_t length, unsigned int timeout);
+int picoboot_emulator_clear_halt(picoboot_emulator *emulator, unsigned char endpoint);
+int picoboot_emulator_submit_transfer(picoboot_emulator *emulator, struct libusb_transfer *transfer);
+int picoboot_emulator_cancel_transfer(picoboot_emulator *emulator, struct libusb_transfer *transfer);
+int picoboot_emulator_handle_events(picoboot_emulator *emulator, struct timeval *tv, int *completed);
+
+// The programs picoboot_connection.c runs with PC_EXEC, the emulator recognizes them and does what they would have done instead of executing Thumb code
+enum picoboot_stub {
+    picoboot_stub_unknown,
+    picoboot_stub_poke,
+    picoboot_stub_peek,
+    picoboot_stub_flash_id,
+    picoboot_stub_crc32,
+};
+
+enum picoboot_stub picoboot_identify_stub(const uint8_t *code, uint32_t len);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,27 @@
+﻿#ifndef _PICOBOOT_TIME_H
+#define _PICOBOOT_TIME_H
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// A monotonic clock in microseconds, shared by the connection statistics and the emulator's timing model
+// This is static so that every file which needs it gets its own copy rather than it being exported from the library
+static inline uint64_t picoboot_time_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart / frequency.QuadPart) * 1000000u
+        + (uint64_t) (now.QuadPart % frequency.QuadPart) * 1000000u / (uint64_t) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000u + (uint64_t) now.tv_nsec / 1000u;
+#endif
+}
+
+#endif
@@ -0,0 +1,11 @@
+﻿namespace PicobootConnection;
+
+public struct PBC_program_policy
+{
+    /// <summary>Size of each write command, must be a multiple of <see cref="Picoboot.PAGE_SIZE"/> for flash.</summary>
+    public uint write_size;
+    /// <summary>Size of each erase command, must be a multiple of <see cref="Picoboot.FLASH_SECTOR_ERASE_SIZE"/>. 0 erases the entire range with a single command.</summary>
+    public uint erase_size;
+    /// <summary>Number of writes to keep in flight, 0 to write synchronously.</summary>
+    public uint pipeline_depth;
+}
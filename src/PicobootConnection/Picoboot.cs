@@ -20,34 +20,57 @@ public unsafe static class Picoboot
     public const uint PAGE_SIZE = (1u << LOG2_PAGE_SIZE);
     public const uint FLASH_SECTOR_ERASE_SIZE = 4096u;
 
+    public const uint PICOBOOT_STATS_COMMAND_COUNT = 16u;
+    public const uint PICOBOOT_STATS_HISTOGRAM_BUCKETS = 20u;
+    public const uint PICOBOOT_STATS_HISTOGRAM_BASE_US = 32u;
+
     static Picoboot()
     {
         Debug.Assert(sizeof(picoboot_cmd_status) == 16);
+        Debug.Assert(sizeof(picoboot_cmd_stats) == 120);
+        Debug.Assert(sizeof(picoboot_emulator_config) == 64);
+        Debug.Assert(sizeof(picoboot_emulator_stats) == 56);
     }
 
-    [DllImport("PicobootConnection.Native")] public static extern picoboot_device_result picoboot_open_device(libusb_device device, libusb_device_handle* dev_handle, model_t* model, int vid, int pid, byte* ser);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_reset(libusb_device_handle usb_device);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_cmd_status_verbose(libusb_device_handle usb_device, picoboot_cmd_status* status, byte local_verbose);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_cmd_status(libusb_device_handle usb_device, picoboot_cmd_status* status);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exclusive_access(libusb_device_handle usb_device, picoboot_exclusive_type exclusive);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_enter_cmd_xip(libusb_device_handle usb_device);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exit_xip(libusb_device_handle usb_device);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_reboot(libusb_device_handle usb_device, uint pc, uint sp, uint delay_ms);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exec(libusb_device_handle usb_device, uint addr);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_flash_erase(libusb_device_handle usb_device, uint addr, uint len);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_vector(libusb_device_handle usb_device, uint addr);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_write(libusb_device_handle usb_device, uint addr, byte* buffer, uint len);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_read(libusb_device_handle usb_device, uint addr, byte* buffer, uint len);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_poke(libusb_device_handle usb_device, uint addr, uint data);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_peek(libusb_device_handle usb_device, uint addr, uint* data);
-    [DllImport("PicobootConnection.Native")] public static extern int picoboot_flash_id(libusb_device_handle usb_device, ulong* data);
+    [DllImport("PicobootConnection.Native")] public static extern picoboot_device_result picoboot_open_device(libusb_device device, picoboot_connection* connection, model_t* model, int vid, int pid, byte* ser);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_close_device(picoboot_connection connection);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_reset(picoboot_connection connection);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_cmd_status_verbose(picoboot_connection connection, picoboot_cmd_status* status, byte local_verbose);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_cmd_status(picoboot_connection connection, picoboot_cmd_status* status);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exclusive_access(picoboot_connection connection, picoboot_exclusive_type exclusive);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_enter_cmd_xip(picoboot_connection connection);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exit_xip(picoboot_connection connection);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_reboot(picoboot_connection connection, uint pc, uint sp, uint delay_ms);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_exec(picoboot_connection connection, uint addr);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_flash_erase(picoboot_connection connection, uint addr, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_vector(picoboot_connection connection, uint addr);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_write(picoboot_connection connection, uint addr, byte* buffer, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_read(picoboot_connection connection, uint addr, byte* buffer, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_poke(picoboot_connection connection, uint addr, uint data);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_peek(picoboot_connection connection, uint addr, uint* data);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_flash_id(picoboot_connection connection, ulong* data);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_flash_crc32(picoboot_connection connection, uint addr, uint len, uint* crc);
+
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_write_stream_open(picoboot_connection connection, libusb_context context, uint depth, uint max_transfer_size);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_write_stream_write(picoboot_connection connection, uint addr, byte* buffer, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_write_stream_flush(picoboot_connection connection);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_write_stream_close(picoboot_connection connection);
+
+    [DllImport("PicobootConnection.Native")] public static extern picoboot_device_result picoboot_open_emulated_device(picoboot_emulator emulator, picoboot_connection* connection, model_t* model);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_emulator_default_config(model_t model, picoboot_emulator_config* config);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_emulator_create(picoboot_emulator_config* config, picoboot_emulator* emulator);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_emulator_destroy(picoboot_emulator emulator);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_emulator_read_memory(picoboot_emulator emulator, uint addr, byte* buffer, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern int picoboot_emulator_write_memory(picoboot_emulator emulator, uint addr, byte* buffer, uint len);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_emulator_get_stats(picoboot_emulator emulator, picoboot_emulator_stats* stats);
+    [DllImport("PicobootConnection.Native")] public static extern void picoboot_emulator_reset_stats(picoboot_emulator emulator);
 
     public static class Rp2350
     {
-        [DllImport("PicobootConnection.Native")] public static extern int picoboot_reboot2(libusb_device_handle usb_device, picoboot_reboot2_cmd* reboot_cmd);
-        [DllImport("PicobootConnection.Native")] public static extern int picoboot_get_info(libusb_device_handle usb_device, picoboot_get_info_cmd* cmd, byte* buffer, uint len);
-        [DllImport("PicobootConnection.Native")] public static extern int picoboot_otp_write(libusb_device_handle usb_device, picoboot_otp_cmd* otp_cmd, byte* buffer, uint len);
-        [DllImport("PicobootConnection.Native")] public static extern int picoboot_otp_read(libusb_device_handle usb_device, picoboot_otp_cmd* otp_cmd, byte* buffer, uint len);
+        [DllImport("PicobootConnection.Native")] public static extern int picoboot_reboot2(picoboot_connection connection, picoboot_reboot2_cmd* reboot_cmd);
+        [DllImport("PicobootConnection.Native")] public static extern int picoboot_get_info(picoboot_connection connection, picoboot_get_info_cmd* cmd, byte* buffer, uint len);
+        [DllImport("PicobootConnection.Native")] public static extern int picoboot_otp_write(picoboot_connection connection, picoboot_otp_cmd* otp_cmd, byte* buffer, uint len);
+        [DllImport("PicobootConnection.Native")] public static extern int picoboot_otp_read(picoboot_connection connection, picoboot_otp_cmd* otp_cmd, byte* buffer, uint len);
     }
 
     [DllImport("PicobootConnection.Native")] public static extern memory_type PBC_get_memory_type(uint addr, model_t model);
@@ -57,4 +80,23 @@ public unsafe static class Picoboot
     [SupportedOSPlatform("windows")]
     [DllImport("PicobootConnection.Native")]
     public static extern byte* PBC_GetUsbInstanceId(libusb_device device);
+
+    [DllImport("PicobootConnection.Native")] public static extern uint PBC_get_stats(picoboot_connection connection, picoboot_cmd_stats* stats, uint count);
+    [DllImport("PicobootConnection.Native")] public static extern void PBC_reset_stats(picoboot_connection connection);
+
+    [DllImport("PicobootConnection.Native")] public static extern uint PBC_crc32(byte* buffer, uint count, uint crc);
+
+    /// <summary>Computes the same CRC32 as <see cref="picoboot_flash_crc32"/>.</summary>
+    /// <param name="crc">The running CRC from a previous call, or the default to start a new one.</param>
+    public static uint Crc32(ReadOnlySpan<byte> data, uint crc = 0xFFFFFFFF)
+    {
+        fixed (byte* dataP = data)
+            return PBC_crc32(dataP, (uint)data.Length, crc);
+    }
+
+    [DllImport("PicobootConnection.Native")] public static extern int PBC_program_region(picoboot_connection connection, libusb_context context, model_t model, uint addr, byte* buffer, uint len, PBC_program_policy* policy, delegate* unmanaged[Cdecl]<uint, uint, void*, void> progress, void* user_data);
+    [DllImport("PicobootConnection.Native")] public static extern int PBC_wait_for_bootsel_device(libusb_context context, byte* serial, uint timeout_ms);
+    [DllImport("PicobootConnection.Native")] public static extern int PBC_usb_monitor_open(libusb_context context, void** monitor);
+    [DllImport("PicobootConnection.Native")] public static extern int PBC_usb_monitor_wait(void* monitor, uint timeout_ms);
+    [DllImport("PicobootConnection.Native")] public static extern void PBC_usb_monitor_close(void* monitor);
 }
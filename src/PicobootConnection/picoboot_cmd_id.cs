@@ -0,0 +1,18 @@
+﻿namespace PicobootConnection;
+
+public enum picoboot_cmd_id : byte
+{
+    PC_EXCLUSIVE_ACCESS = 0x1,
+    PC_REBOOT = 0x2,
+    PC_FLASH_ERASE = 0x3,
+    PC_READ = 0x84,
+    PC_WRITE = 0x5,
+    PC_EXIT_XIP = 0x6,
+    PC_ENTER_CMD_XIP = 0x7,
+    PC_EXEC = 0x8,
+    PC_VECTORIZE_FLASH = 0x9,
+    PC_REBOOT2 = 0xa,
+    PC_GET_INFO = 0x8b,
+    PC_OTP_READ = 0x8c,
+    PC_OTP_WRITE = 0xd,
+}
@@ -0,0 +1,16 @@
+﻿using System.Runtime.InteropServices;
+
+namespace PicobootConnection;
+
+[StructLayout(LayoutKind.Sequential)]
+public unsafe struct picoboot_cmd_stats
+{
+    public ulong bytes;
+    public ulong total_us;
+    public ulong max_us;
+    public uint calls;
+    public uint failures;
+    public uint timeouts;
+    public uint halts;
+    public fixed uint histogram[(int)Picoboot.PICOBOOT_STATS_HISTOGRAM_BUCKETS];
+}
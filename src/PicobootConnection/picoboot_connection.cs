@@ -0,0 +1,12 @@
+﻿using System.Runtime.InteropServices;
+
+namespace PicobootConnection;
+
+/// <summary>Opaque handle to the native per-device PICOBOOT connection state.</summary>
+/// <remarks>A single connection must not be used from multiple threads at once, but separate connections may be used concurrently.</remarks>
+[StructLayout(LayoutKind.Sequential)]
+public readonly struct picoboot_connection
+{
+    private readonly nint __opaqueHandle;
+    public bool IsNull => __opaqueHandle == nint.Zero;
+}
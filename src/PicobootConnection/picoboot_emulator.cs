@@ -0,0 +1,12 @@
+﻿using System.Runtime.InteropServices;
+
+namespace PicobootConnection;
+
+/// <summary>Opaque handle to a native software emulated PICOBOOT device.</summary>
+/// <remarks>An emulator must not be used from multiple threads at once, and it must outlive any connection opened from it.</remarks>
+[StructLayout(LayoutKind.Sequential)]
+public readonly struct picoboot_emulator
+{
+    private readonly nint __opaqueHandle;
+    public bool IsNull => __opaqueHandle == nint.Zero;
+}
@@ -0,0 +1,26 @@
+﻿using System.Runtime.InteropServices;
+
+namespace PicobootConnection;
+
+[StructLayout(LayoutKind.Sequential)]
+public struct picoboot_emulator_config
+{
+    public model_t model;
+    /// <summary>Must be a power of two, accesses beyond it wrap around like they do on a real flash chip.</summary>
+    public uint flash_size;
+    /// <summary>The flash unique ID on RP2040, the chip ID on RP2350.</summary>
+    public ulong unique_id;
+    public uint transfer_latency_us;
+    /// <summary>Bulk throughput once a transfer is underway, 0 for unlimited.</summary>
+    public uint bytes_per_ms;
+    public uint command_us;
+    public uint page_program_us;
+    public uint sector_erase_us;
+    /// <summary>Rate at which on-device code can read flash through XIP, 0 for unlimited.</summary>
+    public uint xip_read_bytes_per_ms;
+    public uint seed;
+    /// <summary>The device disappears once this many commands have been received since it was last plugged in, 0 for never.</summary>
+    public uint disconnect_after_commands;
+    public double stall_probability;
+    public double timeout_probability;
+}
@@ -0,0 +1,20 @@
+﻿using System.Runtime.InteropServices;
+
+namespace PicobootConnection;
+
+[StructLayout(LayoutKind.Sequential)]
+public struct picoboot_emulator_stats
+{
+    /// <summary>Modelled time spent executing commands, excludes time spent on the bus.</summary>
+    public ulong busy_us;
+    public ulong bytes_written;
+    public ulong bytes_read;
+    public uint commands;
+    public uint pages_programmed;
+    public uint sectors_erased;
+    public uint rejected_commands;
+    public uint injected_stalls;
+    public uint injected_timeouts;
+    public uint disconnects;
+    public uint reboots;
+}